@@ -110,6 +110,26 @@ if [ $have_pthread -eq 0 ] && [ "$uname" != "Darwin" ]; then
    fi
 fi
 
+# the io_uring engine of the server, enabled when liburing can be linked
+IO_URING_CFLAGS=''
+IO_URING_LIBS=''
+if [ "$uname" = "Linux" ]; then
+  tmp_src=/tmp/fs_check_liburing_$$.c
+  cat > $tmp_src <<EOF
+#include <liburing.h>
+int main()
+{
+    struct io_uring ring;
+    return io_uring_queue_init(1, &ring, 0);
+}
+EOF
+  if $CC -o ${tmp_src%.c} $tmp_src $LIBS -luring > /dev/null 2>&1; then
+    IO_URING_CFLAGS='-DOS_HAVE_IO_URING'
+    IO_URING_LIBS='-luring'
+  fi
+  rm -f $tmp_src ${tmp_src%.c}
+fi
+
 sed_replace()
 {
     sed_cmd=$1
@@ -121,11 +141,12 @@ sed_replace()
     fi
 }
 
+# params: [extra cflags] [extra libs]
 replace_makefile()
 {
     cp Makefile.in Makefile
-    sed_replace "s#\\\$(CFLAGS)#$CFLAGS#g" Makefile
-    sed_replace "s#\\\$(LIBS)#$LIBS#g" Makefile
+    sed_replace "s#\\\$(CFLAGS)#$CFLAGS $1#g" Makefile
+    sed_replace "s#\\\$(LIBS)#$LIBS $2#g" Makefile
     sed_replace "s#\\\$(TARGET_PREFIX)#$TARGET_PREFIX#g" Makefile
     sed_replace "s#\\\$(LIB_VERSION)#$LIB_VERSION#g" Makefile
     sed_replace "s#\\\$(TARGET_CONF_PATH)#$TARGET_CONF_PATH#g" Makefile
@@ -134,8 +155,13 @@ replace_makefile()
 }
 
 cd src/server
+replace_makefile "$IO_URING_CFLAGS" "$IO_URING_LIBS"
+make $1 $2
+
+cd tools
 replace_makefile
 make $1 $2
+cd ..
 
 cd ../client
 replace_makefile
@@ -0,0 +1,1260 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "fastcommon/shared_func.h"
+#include "fastcommon/pthread_func.h"
+#include "fastcommon/sockopt.h"
+#include "fastcommon/logger.h"
+#include "sf/idempotency/client/client_channel.h"
+#include "fs_proto.h"
+#include "client_func.h"
+#include "async_client.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define ASYNC_RECV_STAGE_HEADER  0
+#define ASYNC_RECV_STAGE_BODY    1  //the response body of the update
+#define ASYNC_RECV_STAGE_DATA    2  //the slice data of the read
+#define ASYNC_RECV_STAGE_ERROR   3  //the error info of the response
+
+#define ASYNC_ERROR_INFO_SIZE    512
+#define ASYNC_MAX_POLL_TIMEOUT   1000
+
+typedef struct fs_async_message {
+    FSAsyncRequest *req;
+    FSBlockSliceKeyInfo bs_key;  //the part of the request slice
+    int buff_offset;             //the offset of the request buffer
+    int data_group_index;
+    int retry_count;
+    int64_t retry_time_ms;       //the time to dispatch again
+    uint64_t idempotency_id;     //the req_id of the channel, 0 for none
+    IdempotencyClientChannel *channel;  //the channel of the idempotency_id
+    struct {
+        int data_group_id;
+        int64_t version;
+    } route;                     //the routing table of the read server
+    SFNetRetryIntervalContext net_retry_ctx;
+    struct fs_async_message *next;
+} FSAsyncMessage;
+
+typedef struct fs_async_message_chain {
+    FSAsyncMessage *head;
+    FSAsyncMessage *tail;
+} FSAsyncMessageChain;
+
+typedef struct fs_async_connection {
+    ConnectionInfo *conn;
+    IdempotencyClientChannel *channel;
+    int buffer_size;
+    int64_t last_io_time_ms;
+    FSAsyncMessageChain to_send;   //the head is being sent
+    FSAsyncMessageChain inflight;  //sent and waiting for the response
+
+    struct {
+        char buff[sizeof(FSProtoHeader) +
+            sizeof(SFProtoIdempotencyAdditionalHeader) +
+            sizeof(FSProtoBlockSlice)];
+        int length;  //the length of the packed front, 0 for NOT packed
+        int offset;  //the sent bytes of the front and the data
+    } send;
+
+    struct {
+        int stage;
+        int status;
+        int body_len;
+        int offset;  //the received bytes of the current stage
+        FSProtoHeader header;
+        FSProtoSliceUpdateResp resp;
+        char error[ASYNC_ERROR_INFO_SIZE];
+    } recv;
+
+    struct fs_async_connection *next;
+} FSAsyncConnection;
+
+typedef struct fs_async_loop {
+    FSAsyncClient *client;
+    struct fc_queue queue;     //the submitted requests
+    int pipe_fds[2];           //for the notify of the submit and cancel
+    volatile bool cancel_flag;
+    int64_t current_time_ms;
+    FSAsyncConnection *conns;
+    int conn_count;
+    FSAsyncMessageChain retry; //the messages waiting to dispatch again
+
+    struct {
+        struct pollfd *fds;
+        FSAsyncConnection **conns;
+        int alloc;
+    } poll;
+
+    struct fast_mblock_man msg_allocator;
+} FSAsyncLoop;
+
+#define ASYNC_CHAIN_APPEND(chain, msg) \
+    do { \
+        (msg)->next = NULL;  \
+        if ((chain).tail == NULL) { \
+            (chain).head = (msg);   \
+        } else { \
+            (chain).tail->next = (msg); \
+        } \
+        (chain).tail = (msg);  \
+    } while (0)
+
+#define ASYNC_CHAIN_POP_HEAD(chain, msg) \
+    do { \
+        (msg) = (chain).head;  \
+        (chain).head = (msg)->next;  \
+        if ((chain).head == NULL) {  \
+            (chain).tail = NULL;     \
+        } \
+    } while (0)
+
+static void loop_notify(FSAsyncLoop *loop)
+{
+    if (write(loop->pipe_fds[1], "n", 1) < 0 && errno != EAGAIN) {
+        logError("file: "__FILE__", line: %d, "
+                "write to pipe fail, errno: %d, error info: %s",
+                __LINE__, errno, STRERROR(errno));
+    }
+}
+
+static void request_done(FSAsyncClient *client, FSAsyncRequest *req)
+{
+    bool notify;
+
+    if (req->result == 0 && req->op_type == FS_ASYNC_OP_SLICE_READ &&
+            req->done_bytes == 0)
+    {
+        req->result = ENODATA;
+    }
+
+    if (req->complete != NULL) {
+        __sync_sub_and_fetch(&client->pending_count, 1);
+        req->complete(req);
+        return;
+    }
+
+    fc_queue_push_ex(&client->completion.queue, req, &notify);
+    if (notify) {
+        if (write(client->completion.pipe_fds[1], "c", 1) < 0 &&
+                errno != EAGAIN)
+        {
+            logError("file: "__FILE__", line: %d, "
+                    "write to pipe fail, errno: %d, error info: %s",
+                    __LINE__, errno, STRERROR(errno));
+        }
+    }
+}
+
+static void message_done(FSAsyncLoop *loop, FSAsyncMessage *msg,
+        const int result)
+{
+    FSAsyncRequest *req;
+
+    req = msg->req;
+    if (result != 0 && req->result == 0) {
+        req->result = result;
+    }
+    if (msg->idempotency_id > 0) {
+        idempotency_client_channel_push(msg->channel, msg->idempotency_id);
+    }
+
+    fast_mblock_free_object(&loop->msg_allocator, msg);
+    if (--req->waiting_count == 0) {
+        request_done(loop->client, req);
+    }
+}
+
+static void expire_message_cache(FSClientContext *client_ctx,
+        FSAsyncMessage *msg)
+{
+    if (msg->req->op_type == FS_ASYNC_OP_SLICE_READ) {
+        fs_client_expire_route_cache_ex(client_ctx,
+                msg->route.data_group_id, msg->route.version);
+    } else {
+        fs_client_expire_master_cache(client_ctx,
+                msg->data_group_index + 1);
+    }
+}
+
+/* retry the message after the retry interval when the error is retriable,
+   otherwise complete the message with the error */
+static void message_retry(FSAsyncLoop *loop, FSAsyncMessage *msg,
+        const int result, const bool expire_cache)
+{
+    FSClientContext *client_ctx;
+    int times;
+
+    client_ctx = loop->client->client_ctx;
+    if (expire_cache) {
+        expire_message_cache(client_ctx, msg);
+    }
+    if (result == SF_RETRIABLE_ERROR_CHANNEL_INVALID && msg->channel != NULL) {
+        idempotency_client_channel_check_reconnect(msg->channel);
+    }
+
+    times = client_ctx->net_retry_cfg.network.times;
+    if (!SF_IS_RETRIABLE_ERROR(result) || (times >= 0 &&
+                ++msg->retry_count > times))
+    {
+        message_done(loop, msg, SF_UNIX_ERRNO(result, EIO));
+        return;
+    }
+    if (msg->req->canceled) {
+        message_done(loop, msg, ECANCELED);
+        return;
+    }
+
+    msg->retry_time_ms = loop->current_time_ms +
+        msg->net_retry_ctx.interval_ms;
+    sf_calc_next_retry_interval(&msg->net_retry_ctx);
+    ASYNC_CHAIN_APPEND(loop->retry, msg);
+}
+
+static FSAsyncConnection *get_async_connection(FSAsyncLoop *loop,
+        FSAsyncMessage *msg, int *err_no)
+{
+    FSClientContext *client_ctx;
+    FSConnectionManager *cm;
+    FSConnectionParameters *params;
+    FSAsyncConnection *aconn;
+    ConnectionInfo *conn;
+
+    client_ctx = loop->client->client_ctx;
+    cm = &client_ctx->conn_manager;
+    if (msg->req->op_type == FS_ASYNC_OP_SLICE_READ) {
+        conn = cm->get_readable_connection(client_ctx,
+                msg->data_group_index, err_no);
+    } else {
+        conn = cm->get_master_connection(client_ctx,
+                msg->data_group_index, err_no);
+    }
+    if (conn == NULL) {
+        return NULL;
+    }
+
+    params = (FSConnectionParameters *)cm->get_connection_params(
+            client_ctx, conn);
+    if (msg->req->op_type == FS_ASYNC_OP_SLICE_READ) {
+        msg->route.data_group_id = params->route.data_group_id;
+        msg->route.version = params->route.version;
+    }
+
+    for (aconn=loop->conns; aconn!=NULL; aconn=aconn->next) {
+        if (aconn->conn->port == conn->port &&
+                strcmp(aconn->conn->ip_addr, conn->ip_addr) == 0)
+        {
+            cm->release_connection(client_ctx, conn);
+            return aconn;
+        }
+    }
+
+    //keep the connection for the loop until it broken
+    aconn = (FSAsyncConnection *)fc_malloc(sizeof(FSAsyncConnection));
+    if (aconn == NULL) {
+        cm->release_connection(client_ctx, conn);
+        *err_no = ENOMEM;
+        return NULL;
+    }
+    if ((*err_no=fd_add_flags(conn->sock, O_NONBLOCK)) != 0) {
+        free(aconn);
+        cm->close_connection(client_ctx, conn);
+        return NULL;
+    }
+
+    //the caches are expired by the messages of the loop
+    params->data_group_id = 0;
+    params->route.data_group_id = 0;
+
+    memset(aconn, 0, sizeof(FSAsyncConnection));
+    aconn->conn = conn;
+    aconn->channel = params->channel;
+    aconn->buffer_size = params->buffer_size;
+    aconn->next = loop->conns;
+    loop->conns = aconn;
+    loop->conn_count++;
+    return aconn;
+}
+
+static void close_async_connection(FSAsyncLoop *loop,
+        FSAsyncConnection *aconn, const int result)
+{
+    FSClientContext *client_ctx;
+    FSAsyncConnection **pp;
+    FSAsyncMessage *msg;
+
+    client_ctx = loop->client->client_ctx;
+    logWarning("file: "__FILE__", line: %d, "
+            "close the connection to server %s:%u, in flight count: %s, "
+            "errno: %d, error info: %s", __LINE__, aconn->conn->ip_addr,
+            aconn->conn->port, aconn->inflight.head != NULL ? ">= 1" : "0",
+            result, STRERROR(result));
+
+    for (pp=&loop->conns; *pp!=NULL; pp=&(*pp)->next) {
+        if (*pp == aconn) {
+            *pp = aconn->next;
+            loop->conn_count--;
+            break;
+        }
+    }
+
+    while (aconn->inflight.head != NULL) {
+        ASYNC_CHAIN_POP_HEAD(aconn->inflight, msg);
+        message_retry(loop, msg, result, true);
+    }
+
+    //the message being sent is in flight for the server
+    if (aconn->send.offset > 0) {
+        ASYNC_CHAIN_POP_HEAD(aconn->to_send, msg);
+        message_retry(loop, msg, result, true);
+    }
+
+    //the messages NOT sent are dispatched again without delay
+    while (aconn->to_send.head != NULL) {
+        ASYNC_CHAIN_POP_HEAD(aconn->to_send, msg);
+        msg->retry_time_ms = loop->current_time_ms;
+        ASYNC_CHAIN_APPEND(loop->retry, msg);
+    }
+
+    client_ctx->conn_manager.close_connection(client_ctx, aconn->conn);
+    free(aconn);
+}
+
+static inline void pack_block_key(const FSBlockKey *bkey,
+        FSProtoBlockKey *proto_bkey)
+{
+    long2buff(bkey->oid, proto_bkey->oid);
+    long2buff(bkey->offset, proto_bkey->offset);
+}
+
+static inline void pack_block_slice(const FSBlockSliceKeyInfo *bs_key,
+        FSProtoBlockSlice *bs)
+{
+    pack_block_key(&bs_key->block, &bs->bkey);
+    int2buff(bs_key->slice.offset, bs->slice_size.offset);
+    int2buff(bs_key->slice.length, bs->slice_size.length);
+}
+
+static inline int get_message_data_length(FSAsyncMessage *msg)
+{
+    return msg->req->op_type == FS_ASYNC_OP_SLICE_WRITE ?
+        msg->bs_key.slice.length : 0;
+}
+
+//pack the header and the body front of the message
+static void pack_message(FSAsyncConnection *aconn, FSAsyncMessage *msg)
+{
+    FSProtoHeader *proto_header;
+    char *p;
+    int req_cmd;
+
+    proto_header = (FSProtoHeader *)aconn->send.buff;
+    p = (char *)(proto_header + 1);
+    if (msg->idempotency_id > 0) {
+        long2buff(msg->idempotency_id, ((SFProtoIdempotencyAdditionalHeader *)
+                    p)->req_id);
+        p += sizeof(SFProtoIdempotencyAdditionalHeader);
+    }
+
+    switch (msg->req->op_type) {
+        case FS_ASYNC_OP_SLICE_WRITE:
+            req_cmd = FS_SERVICE_PROTO_SLICE_WRITE_REQ;
+            pack_block_slice(&msg->bs_key, &((FSProtoSliceWriteReqHeader *)
+                        p)->bs);
+            p += sizeof(FSProtoSliceWriteReqHeader);
+            break;
+        case FS_ASYNC_OP_SLICE_READ:
+            req_cmd = FS_SERVICE_PROTO_SLICE_READ_REQ;
+            pack_block_slice(&msg->bs_key, &((FSProtoSliceReadReqHeader *)
+                        p)->bs);
+            p += sizeof(FSProtoSliceReadReqHeader);
+            break;
+        default:
+            req_cmd = msg->req->bs_op.req_cmd;
+            if (req_cmd == FS_SERVICE_PROTO_BLOCK_DELETE_REQ) {
+                pack_block_key(&msg->bs_key.block,
+                        &((FSProtoBlockDeleteReq *)p)->bkey);
+                p += sizeof(FSProtoBlockDeleteReq);
+            } else {
+                pack_block_slice(&msg->bs_key,
+                        &((FSProtoSliceAllocateReq *)p)->bs);
+                p += sizeof(FSProtoSliceAllocateReq);
+            }
+            break;
+    }
+
+    aconn->send.length = p - aconn->send.buff;
+    aconn->send.offset = 0;
+    SF_PROTO_SET_HEADER(proto_header, req_cmd, (aconn->send.length -
+                sizeof(FSProtoHeader)) + get_message_data_length(msg));
+}
+
+//send the messages until the socket buffer full
+static int async_conn_send(FSAsyncLoop *loop, FSAsyncConnection *aconn)
+{
+    FSAsyncMessage *msg;
+    struct iovec iov[2];
+    struct msghdr msghdr;
+    int data_len;
+    int data_offset;
+    int bytes;
+
+    memset(&msghdr, 0, sizeof(msghdr));
+    msghdr.msg_iov = iov;
+    while ((msg=aconn->to_send.head) != NULL) {
+        if (aconn->send.length == 0) {
+            pack_message(aconn, msg);
+        }
+
+        data_len = get_message_data_length(msg);
+        msghdr.msg_iovlen = 0;
+        if (aconn->send.offset < aconn->send.length) {
+            iov[0].iov_base = aconn->send.buff + aconn->send.offset;
+            iov[0].iov_len = aconn->send.length - aconn->send.offset;
+            msghdr.msg_iovlen++;
+            data_offset = 0;
+        } else {
+            data_offset = aconn->send.offset - aconn->send.length;
+        }
+        if (data_offset < data_len) {
+            iov[msghdr.msg_iovlen].iov_base = msg->req->buff +
+                msg->buff_offset + data_offset;
+            iov[msghdr.msg_iovlen].iov_len = data_len - data_offset;
+            msghdr.msg_iovlen++;
+        }
+
+        bytes = sendmsg(aconn->conn->sock, &msghdr, MSG_NOSIGNAL);
+        if (bytes < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            } else if (errno == EINTR) {
+                continue;
+            }
+            return errno != 0 ? errno : EIO;
+        }
+
+        aconn->last_io_time_ms = loop->current_time_ms;
+        aconn->send.offset += bytes;
+        if (aconn->send.offset == aconn->send.length + data_len) {
+            ASYNC_CHAIN_POP_HEAD(aconn->to_send, msg);
+            ASYNC_CHAIN_APPEND(aconn->inflight, msg);
+            aconn->send.length = aconn->send.offset = 0;
+        }
+    }
+
+    return 0;
+}
+
+static int parse_response_header(FSAsyncConnection *aconn,
+        FSAsyncMessage *msg)
+{
+    int resp_cmd;
+
+    aconn->recv.status = buff2short(aconn->recv.header.status);
+    aconn->recv.body_len = buff2int(aconn->recv.header.body_len);
+    aconn->recv.offset = 0;
+    if (aconn->recv.status != 0) {
+        if (aconn->recv.body_len >= ASYNC_ERROR_INFO_SIZE) {
+            logError("file: "__FILE__", line: %d, "
+                    "server %s:%u, response body length: %d is too "
+                    "large for the error info", __LINE__, aconn->conn->
+                    ip_addr, aconn->conn->port, aconn->recv.body_len);
+            return EOVERFLOW;
+        }
+        aconn->recv.stage = ASYNC_RECV_STAGE_ERROR;
+        return 0;
+    }
+
+    switch (msg->req->op_type) {
+        case FS_ASYNC_OP_SLICE_WRITE:
+            resp_cmd = FS_SERVICE_PROTO_SLICE_WRITE_RESP;
+            break;
+        case FS_ASYNC_OP_SLICE_READ:
+            resp_cmd = FS_SERVICE_PROTO_SLICE_READ_RESP;
+            break;
+        default:
+            resp_cmd = msg->req->bs_op.resp_cmd;
+            break;
+    }
+    if (aconn->recv.header.cmd != resp_cmd) {
+        logError("file: "__FILE__", line: %d, "
+                "server %s:%u, response cmd: %d != expect: %d",
+                __LINE__, aconn->conn->ip_addr, aconn->conn->port,
+                aconn->recv.header.cmd, resp_cmd);
+        return EINVAL;
+    }
+
+    if (msg->req->op_type == FS_ASYNC_OP_SLICE_READ) {
+        if (aconn->recv.body_len > msg->bs_key.slice.length) {
+            logError("file: "__FILE__", line: %d, "
+                    "server %s:%u, response body length: %d > "
+                    "slice length: %d", __LINE__, aconn->conn->ip_addr,
+                    aconn->conn->port, aconn->recv.body_len,
+                    msg->bs_key.slice.length);
+            return EINVAL;
+        }
+        aconn->recv.stage = ASYNC_RECV_STAGE_DATA;
+    } else {
+        if (aconn->recv.body_len != sizeof(FSProtoSliceUpdateResp)) {
+            logError("file: "__FILE__", line: %d, "
+                    "server %s:%u, response body length: %d != %d",
+                    __LINE__, aconn->conn->ip_addr, aconn->conn->port,
+                    aconn->recv.body_len, (int)sizeof(FSProtoSliceUpdateResp));
+            return EINVAL;
+        }
+        aconn->recv.stage = ASYNC_RECV_STAGE_BODY;
+    }
+
+    return 0;
+}
+
+static void deal_response(FSAsyncLoop *loop, FSAsyncConnection *aconn,
+        FSAsyncMessage *msg)
+{
+    FSAsyncRequest *req;
+    int status;
+    int bytes;
+    int log_level;
+
+    req = msg->req;
+    status = aconn->recv.status;
+    if (status == ENOENT && req->op_type == FS_ASYNC_OP_SLICE_READ) {
+        status = 0;  //ignore errno ENOENT for the hole
+        aconn->recv.body_len = 0;
+    }
+
+    if (status == 0) {
+        switch (req->op_type) {
+            case FS_ASYNC_OP_SLICE_WRITE:
+                req->done_bytes += msg->bs_key.slice.length;
+                req->inc_alloc += buff2int(aconn->recv.resp.inc_alloc);
+                break;
+            case FS_ASYNC_OP_SLICE_READ:
+                bytes = aconn->recv.body_len;
+                if (bytes < msg->bs_key.slice.length) {
+                    memset(req->buff + msg->buff_offset + bytes, 0,
+                            msg->bs_key.slice.length - bytes);
+                }
+                if (bytes > 0 && msg->buff_offset + bytes >
+                        req->done_bytes)
+                {
+                    req->done_bytes = msg->buff_offset + bytes;
+                }
+                break;
+            default:
+                req->inc_alloc = buff2int(aconn->recv.resp.inc_alloc);
+                break;
+        }
+        message_done(loop, msg, 0);
+        return;
+    }
+
+    aconn->recv.error[aconn->recv.body_len] = '\0';
+    if (status == ENOENT && req->op_type == FS_ASYNC_OP_BS_OPERATE) {
+        log_level = req->bs_op.enoent_log_level;
+    } else {
+        log_level = LOG_ERR;
+    }
+    log_it_ex(&g_log_context, log_level, "file: "__FILE__", line: %d, "
+            "server %s:%u, request id: %"PRId64", response status: %d, "
+            "error info: %s", __LINE__, aconn->conn->ip_addr,
+            aconn->conn->port, req->req_id, status, aconn->recv.error);
+
+    message_retry(loop, msg, status, (status ==
+                SF_RETRIABLE_ERROR_NOT_ACTIVE ||
+                status == SF_RETRIABLE_ERROR_NOT_MASTER));
+}
+
+//recv the responses and match them with the in-flight messages in order
+static int async_conn_recv(FSAsyncLoop *loop, FSAsyncConnection *aconn)
+{
+    FSAsyncMessage *msg;
+    char *buff;
+    char ch;
+    int length;
+    int bytes;
+    int result;
+
+    while (1) {
+        if ((msg=aconn->inflight.head) == NULL) {
+            bytes = recv(aconn->conn->sock, &ch, 1, 0);
+            if (bytes == 0) {
+                return ECONNRESET;
+            } else if (bytes < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return 0;
+                } else if (errno == EINTR) {
+                    continue;
+                }
+                return errno != 0 ? errno : EIO;
+            }
+
+            logError("file: "__FILE__", line: %d, "
+                    "server %s:%u, unexpected response without request",
+                    __LINE__, aconn->conn->ip_addr, aconn->conn->port);
+            return EPROTO;
+        }
+
+        switch (aconn->recv.stage) {
+            case ASYNC_RECV_STAGE_HEADER:
+                buff = (char *)&aconn->recv.header;
+                length = sizeof(FSProtoHeader);
+                break;
+            case ASYNC_RECV_STAGE_BODY:
+                buff = (char *)&aconn->recv.resp;
+                length = aconn->recv.body_len;
+                break;
+            case ASYNC_RECV_STAGE_DATA:
+                buff = msg->req->buff + msg->buff_offset;
+                length = aconn->recv.body_len;
+                break;
+            default:
+                buff = aconn->recv.error;
+                length = aconn->recv.body_len;
+                break;
+        }
+
+        if (aconn->recv.offset < length) {
+            bytes = recv(aconn->conn->sock, buff + aconn->recv.offset,
+                    length - aconn->recv.offset, 0);
+            if (bytes == 0) {
+                return ECONNRESET;
+            } else if (bytes < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return 0;
+                } else if (errno == EINTR) {
+                    continue;
+                }
+                return errno != 0 ? errno : EIO;
+            }
+
+            aconn->last_io_time_ms = loop->current_time_ms;
+            aconn->recv.offset += bytes;
+            if (aconn->recv.offset < length) {
+                continue;
+            }
+        }
+
+        if (aconn->recv.stage == ASYNC_RECV_STAGE_HEADER) {
+            if ((result=parse_response_header(aconn, msg)) != 0) {
+                return result;
+            }
+            if (aconn->recv.body_len > 0) {
+                continue;
+            }
+        }
+
+        ASYNC_CHAIN_POP_HEAD(aconn->inflight, msg);
+        aconn->recv.stage = ASYNC_RECV_STAGE_HEADER;
+        aconn->recv.offset = 0;
+        deal_response(loop, aconn, msg);
+    }
+}
+
+static void enqueue_message(FSAsyncLoop *loop, FSAsyncConnection *aconn,
+        FSAsyncMessage *msg)
+{
+    FSClientContext *client_ctx;
+    int result;
+
+    client_ctx = loop->client->client_ctx;
+    if (msg->req->op_type != FS_ASYNC_OP_SLICE_READ &&
+            client_ctx->idempotency_enabled)
+    {
+        if (msg->channel != aconn->channel) {  //new message or master changed
+            msg->channel = aconn->channel;
+            msg->idempotency_id = idempotency_client_channel_next_seq_id(
+                    msg->channel);
+            msg->retry_count = 0;
+            sf_reset_net_retry_interval(&msg->net_retry_ctx);
+        }
+
+        if ((result=idempotency_client_channel_check_wait(
+                        msg->channel)) != 0)
+        {
+            message_retry(loop, msg, result, false);
+            return;
+        }
+    }
+
+    if (aconn->to_send.head == NULL && aconn->inflight.head == NULL) {
+        aconn->last_io_time_ms = loop->current_time_ms;
+    }
+    ASYNC_CHAIN_APPEND(aconn->to_send, msg);
+}
+
+//split the front part of the message with the size
+static FSAsyncMessage *split_message(FSAsyncLoop *loop,
+        FSAsyncMessage *msg, const int size)
+{
+    FSAsyncMessage *part;
+
+    part = (FSAsyncMessage *)fast_mblock_alloc_object(&loop->msg_allocator);
+    if (part == NULL) {
+        return NULL;
+    }
+
+    *part = *msg;
+    part->bs_key.slice.length = size;
+    part->next = NULL;
+    msg->bs_key.slice.offset += size;
+    msg->bs_key.slice.length -= size;
+    msg->buff_offset += size;
+    msg->req->waiting_count++;
+
+    //the parts are the new requests for the idempotency
+    part->channel = msg->channel = NULL;
+    part->idempotency_id = msg->idempotency_id = 0;
+    return part;
+}
+
+static void dispatch_message(FSAsyncLoop *loop, FSAsyncMessage *msg)
+{
+    FSAsyncConnection *aconn;
+    FSAsyncMessage *part;
+    int result;
+
+    if (msg->req->canceled) {
+        message_done(loop, msg, ECANCELED);
+        return;
+    }
+
+    if ((aconn=get_async_connection(loop, msg, &result)) == NULL) {
+        message_retry(loop, msg, result, false);
+        return;
+    }
+
+    if (msg->req->op_type != FS_ASYNC_OP_BS_OPERATE) {
+        while (msg->bs_key.slice.length > aconn->buffer_size) {
+            if ((part=split_message(loop, msg,
+                            aconn->buffer_size)) == NULL)
+            {
+                message_done(loop, msg, ENOMEM);
+                return;
+            }
+            enqueue_message(loop, aconn, part);
+        }
+    }
+
+    enqueue_message(loop, aconn, msg);
+}
+
+static void deal_submitted_requests(FSAsyncLoop *loop)
+{
+    FSClientContext *client_ctx;
+    FSAsyncRequest *head;
+    FSAsyncRequest *req;
+    FSAsyncMessage *msg;
+
+    head = (FSAsyncRequest *)fc_queue_try_pop_all(&loop->queue);
+    client_ctx = loop->client->client_ctx;
+    while (head != NULL) {
+        req = head;
+        head = head->next;
+
+        if (req->op_type != FS_ASYNC_OP_BS_OPERATE &&
+                req->bs_key.slice.length <= 0)
+        {
+            request_done(loop->client, req);
+            continue;
+        }
+        msg = (FSAsyncMessage *)fast_mblock_alloc_object(
+                &loop->msg_allocator);
+        if (msg == NULL) {
+            req->result = ENOMEM;
+            request_done(loop->client, req);
+            continue;
+        }
+
+        memset(msg, 0, sizeof(FSAsyncMessage));
+        msg->req = req;
+        msg->bs_key = req->bs_key;
+        msg->data_group_index = FS_CLIENT_DATA_GROUP_INDEX(
+                client_ctx, req->bs_key.block.hash_code);
+        sf_init_net_retry_interval_context(&msg->net_retry_ctx,
+                &client_ctx->net_retry_cfg.interval_mm,
+                &client_ctx->net_retry_cfg.network);
+        req->waiting_count = 1;
+        dispatch_message(loop, msg);
+    }
+}
+
+static void deal_retry_messages(FSAsyncLoop *loop)
+{
+    FSAsyncMessageChain chain;
+    FSAsyncMessage *msg;
+
+    if (loop->retry.head == NULL) {
+        return;
+    }
+
+    //the messages failed again are appended to the retry chain of the loop
+    chain = loop->retry;
+    loop->retry.head = loop->retry.tail = NULL;
+    while (chain.head != NULL) {
+        ASYNC_CHAIN_POP_HEAD(chain, msg);
+        if (msg->req->canceled) {
+            message_done(loop, msg, ECANCELED);
+        } else if (msg->retry_time_ms <= loop->current_time_ms) {
+            dispatch_message(loop, msg);
+        } else {
+            ASYNC_CHAIN_APPEND(loop->retry, msg);
+        }
+    }
+}
+
+//drop the canceled messages NOT sent
+static void deal_canceled_messages(FSAsyncLoop *loop)
+{
+    FSAsyncConnection *aconn;
+    FSAsyncMessageChain chain;
+    FSAsyncMessage *msg;
+
+    for (aconn=loop->conns; aconn!=NULL; aconn=aconn->next) {
+        chain = aconn->to_send;
+        aconn->to_send.head = aconn->to_send.tail = NULL;
+        if (aconn->send.offset > 0) {  //being sent
+            ASYNC_CHAIN_POP_HEAD(chain, msg);
+            ASYNC_CHAIN_APPEND(aconn->to_send, msg);
+        } else {
+            aconn->send.length = 0;
+        }
+
+        while (chain.head != NULL) {
+            ASYNC_CHAIN_POP_HEAD(chain, msg);
+            if (msg->req->canceled) {
+                message_done(loop, msg, ECANCELED);
+            } else {
+                ASYNC_CHAIN_APPEND(aconn->to_send, msg);
+            }
+        }
+    }
+}
+
+static int build_poll_fds(FSAsyncLoop *loop)
+{
+    FSAsyncConnection *aconn;
+    struct pollfd *fds;
+    FSAsyncConnection **conns;
+    int alloc;
+    int count;
+
+    if (loop->poll.alloc < loop->conn_count + 1) {
+        alloc = loop->poll.alloc * 2;
+        while (alloc < loop->conn_count + 1) {
+            alloc *= 2;
+        }
+        fds = (struct pollfd *)fc_malloc(sizeof(struct pollfd) * alloc);
+        conns = (FSAsyncConnection **)fc_malloc(
+                sizeof(FSAsyncConnection *) * alloc);
+        if (fds == NULL || conns == NULL) {
+            free(fds);
+            free(conns);
+            return -1;
+        }
+
+        free(loop->poll.fds);
+        free(loop->poll.conns);
+        loop->poll.fds = fds;
+        loop->poll.conns = conns;
+        loop->poll.alloc = alloc;
+    }
+
+    loop->poll.fds[0].fd = loop->pipe_fds[0];
+    loop->poll.fds[0].events = POLLIN;
+    loop->poll.fds[0].revents = 0;
+    count = 1;
+    for (aconn=loop->conns; aconn!=NULL; aconn=aconn->next) {
+        loop->poll.fds[count].fd = aconn->conn->sock;
+        loop->poll.fds[count].events = POLLIN;
+        if (aconn->to_send.head != NULL) {
+            loop->poll.fds[count].events |= POLLOUT;
+        }
+        loop->poll.fds[count].revents = 0;
+        loop->poll.conns[count] = aconn;
+        count++;
+    }
+
+    return count;
+}
+
+static int get_poll_timeout(FSAsyncLoop *loop)
+{
+    FSAsyncMessage *msg;
+    int64_t timeout;
+
+    timeout = ASYNC_MAX_POLL_TIMEOUT;
+    for (msg=loop->retry.head; msg!=NULL; msg=msg->next) {
+        if (msg->retry_time_ms - loop->current_time_ms < timeout) {
+            timeout = msg->retry_time_ms - loop->current_time_ms;
+            if (timeout <= 0) {
+                return 0;
+            }
+        }
+    }
+
+    return timeout;
+}
+
+static void check_connection_timeout(FSAsyncLoop *loop)
+{
+    FSAsyncConnection *aconn;
+    FSAsyncConnection *next;
+    int64_t timeout_ms;
+
+    timeout_ms = loop->client->client_ctx->network_timeout * 1000;
+    aconn = loop->conns;
+    while (aconn != NULL) {
+        next = aconn->next;
+        if ((aconn->to_send.head != NULL || aconn->inflight.head != NULL) &&
+                loop->current_time_ms - aconn->last_io_time_ms > timeout_ms)
+        {
+            close_async_connection(loop, aconn, ETIMEDOUT);
+        }
+        aconn = next;
+    }
+}
+
+static void deal_io_events(FSAsyncLoop *loop, const int count)
+{
+    FSAsyncConnection *aconn;
+    struct pollfd *pfd;
+    int result;
+    int i;
+
+    for (i=1; i<count; i++) {
+        pfd = loop->poll.fds + i;
+        if (pfd->revents == 0) {
+            continue;
+        }
+
+        aconn = loop->poll.conns[i];
+        result = 0;
+        if ((pfd->revents & POLLOUT) != 0) {
+            result = async_conn_send(loop, aconn);
+        }
+        if (result == 0 && (pfd->revents & (POLLIN | POLLERR | POLLHUP)) != 0) {
+            result = async_conn_recv(loop, aconn);
+        }
+        if (result != 0) {
+            close_async_connection(loop, aconn, result);
+        }
+    }
+}
+
+static void async_loop_terminate(FSAsyncLoop *loop)
+{
+    FSAsyncRequest *req;
+    FSAsyncRequest *current;
+    FSAsyncMessage *msg;
+
+    while (loop->conns != NULL) {
+        close_async_connection(loop, loop->conns, EINTR);
+    }
+    while (loop->retry.head != NULL) {
+        ASYNC_CHAIN_POP_HEAD(loop->retry, msg);
+        message_done(loop, msg, EINTR);
+    }
+
+    req = (FSAsyncRequest *)fc_queue_try_pop_all(&loop->queue);
+    while (req != NULL) {
+        current = req;
+        req = req->next;
+        current->result = EINTR;
+        request_done(loop->client, current);
+    }
+}
+
+static void *async_loop_thread_func(void *arg)
+{
+    FSAsyncLoop *loop;
+    char buff[256];
+    int count;
+
+    loop = (FSAsyncLoop *)arg;
+    __sync_add_and_fetch(&loop->client->running_count, 1);
+    loop->current_time_ms = get_current_time_ms();
+    while (loop->client->continue_flag) {
+        if ((count=build_poll_fds(loop)) < 0) {
+            fc_sleep_ms(10);
+            continue;
+        }
+
+        if (poll(loop->poll.fds, count, get_poll_timeout(loop)) < 0) {
+            if (errno != EINTR) {
+                logError("file: "__FILE__", line: %d, "
+                        "poll fail, errno: %d, error info: %s",
+                        __LINE__, errno, STRERROR(errno));
+                fc_sleep_ms(10);
+            }
+            count = 0;
+        }
+        loop->current_time_ms = get_current_time_ms();
+
+        if (count > 0 && loop->poll.fds[0].revents != 0) {
+            //drain the notify pipe before the pop, so no request is missed
+            while (read(loop->pipe_fds[0], buff, sizeof(buff)) > 0) {
+            }
+        }
+
+        if (loop->cancel_flag) {
+            loop->cancel_flag = false;
+            deal_canceled_messages(loop);
+        }
+        deal_submitted_requests(loop);
+        deal_io_events(loop, count);
+        check_connection_timeout(loop);
+        deal_retry_messages(loop);
+    }
+
+    //the messages are completed with EINTR, the retry NOT dispatched
+    async_loop_terminate(loop);
+    __sync_sub_and_fetch(&loop->client->running_count, 1);
+    return NULL;
+}
+
+static int init_pipe(int pipe_fds[2])
+{
+    int result;
+    int i;
+
+    if (pipe(pipe_fds) != 0) {
+        result = errno != 0 ? errno : EMFILE;
+        logError("file: "__FILE__", line: %d, "
+                "create pipe fail, errno: %d, error info: %s",
+                __LINE__, result, STRERROR(result));
+        return result;
+    }
+
+    for (i=0; i<2; i++) {
+        if ((result=fd_add_flags(pipe_fds[i], O_NONBLOCK)) != 0) {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+static int init_loop(FSAsyncClient *client, FSAsyncLoop *loop)
+{
+    int result;
+
+    loop->client = client;
+    loop->pipe_fds[0] = loop->pipe_fds[1] = -1;
+    if ((result=fc_queue_init(&loop->queue, (long)
+                    (&((FSAsyncRequest *)NULL)->next))) != 0)
+    {
+        return result;
+    }
+    if ((result=init_pipe(loop->pipe_fds)) != 0) {
+        return result;
+    }
+    if ((result=fast_mblock_init_ex1(&loop->msg_allocator,
+                    "async_message", sizeof(FSAsyncMessage),
+                    1024, 0, NULL, NULL, false)) != 0)
+    {
+        return result;
+    }
+
+    loop->poll.alloc = 64;
+    loop->poll.fds = (struct pollfd *)fc_malloc(
+            sizeof(struct pollfd) * loop->poll.alloc);
+    loop->poll.conns = (FSAsyncConnection **)fc_malloc(
+            sizeof(FSAsyncConnection *) * loop->poll.alloc);
+    if (loop->poll.fds == NULL || loop->poll.conns == NULL) {
+        return ENOMEM;
+    }
+
+    return 0;
+}
+
+static void destroy_loop(FSAsyncLoop *loop)
+{
+    fc_queue_destroy(&loop->queue);
+    fast_mblock_destroy(&loop->msg_allocator);
+    if (loop->pipe_fds[0] >= 0) {
+        close(loop->pipe_fds[0]);
+        close(loop->pipe_fds[1]);
+        loop->pipe_fds[0] = loop->pipe_fds[1] = -1;
+    }
+    free(loop->poll.fds);
+    free(loop->poll.conns);
+    loop->poll.fds = NULL;
+    loop->poll.conns = NULL;
+}
+
+int fs_async_client_init(FSAsyncClient *client,
+        FSClientContext *client_ctx, const int threads)
+{
+    const int stack_size = 256 * 1024;
+    pthread_t tid;
+    int result;
+    int bytes;
+    int i;
+
+    memset(client, 0, sizeof(FSAsyncClient));
+    client->client_ctx = client_ctx;
+    client->completion.pipe_fds[0] = client->completion.pipe_fds[1] = -1;
+    if (threads <= 0 || threads > FS_ASYNC_CLIENT_MAX_THREADS) {
+        logError("file: "__FILE__", line: %d, "
+                "invalid thread count: %d, which <= 0 or > %d",
+                __LINE__, threads, FS_ASYNC_CLIENT_MAX_THREADS);
+        return EINVAL;
+    }
+
+    if ((result=fc_queue_init(&client->completion.queue, (long)
+                    (&((FSAsyncRequest *)NULL)->next))) != 0)
+    {
+        return result;
+    }
+    if ((result=init_pipe(client->completion.pipe_fds)) != 0) {
+        return result;
+    }
+
+    bytes = sizeof(FSAsyncLoop) * threads;
+    if ((client->loops=(FSAsyncLoop *)fc_malloc(bytes)) == NULL) {
+        return ENOMEM;
+    }
+    memset(client->loops, 0, bytes);
+    for (i=0; i<threads; i++) {
+        if ((result=init_loop(client, client->loops + i)) != 0) {
+            return result;
+        }
+    }
+
+    client->loop_count = threads;
+    client->continue_flag = true;
+    for (i=0; i<threads; i++) {
+        if ((result=fc_create_thread(&tid, async_loop_thread_func,
+                        client->loops + i, stack_size)) != 0)
+        {
+            client->continue_flag = false;
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+void fs_async_client_destroy(FSAsyncClient *client)
+{
+    int i;
+    int k;
+
+    if (client->loop_count == 0) {
+        return;
+    }
+
+    client->continue_flag = false;
+    for (i=0; i<300 && __sync_add_and_fetch(&client->
+                running_count, 0) > 0; i++)
+    {
+        for (k=0; k<client->loop_count; k++) {
+            loop_notify(client->loops + k);
+        }
+        fc_sleep_ms(10);
+    }
+
+    if (client->running_count == 0) {
+        for (i=0; i<client->loop_count; i++) {
+            destroy_loop(client->loops + i);
+        }
+        free(client->loops);
+        client->loops = NULL;
+        client->loop_count = 0;
+
+        fc_queue_destroy(&client->completion.queue);
+        close(client->completion.pipe_fds[0]);
+        close(client->completion.pipe_fds[1]);
+        client->completion.pipe_fds[0] = client->completion.pipe_fds[1] = -1;
+    }
+}
+
+int fs_async_client_submit(FSAsyncClient *client, FSAsyncRequest *req)
+{
+    bool notify;
+
+    if (!client->continue_flag) {
+        return EINTR;
+    }
+
+    switch (req->op_type) {
+        case FS_ASYNC_OP_SLICE_WRITE:
+        case FS_ASYNC_OP_SLICE_READ:
+            if (req->buff == NULL) {
+                return EINVAL;
+            }
+            break;
+        case FS_ASYNC_OP_BS_OPERATE:
+            break;
+        default:
+            logError("file: "__FILE__", line: %d, "
+                    "invalid op type: %d", __LINE__, req->op_type);
+            return EINVAL;
+    }
+
+    req->client = client;
+    req->result = 0;
+    req->done_bytes = req->inc_alloc = 0;
+    req->canceled = false;
+    req->waiting_count = 0;
+
+    //the requests of the same data group are dispatched by the same loop
+    req->loop = client->loops + FS_CLIENT_DATA_GROUP_INDEX(client->
+            client_ctx, req->bs_key.block.hash_code) % client->loop_count;
+    req->req_id = __sync_add_and_fetch(&client->current_req_id, 1);
+    __sync_add_and_fetch(&client->pending_count, 1);
+    fc_queue_push_ex(&req->loop->queue, req, &notify);
+    if (notify) {
+        loop_notify(req->loop);
+    }
+    return 0;
+}
+
+void fs_async_client_cancel(FSAsyncRequest *req)
+{
+    req->canceled = true;
+    req->loop->cancel_flag = true;
+    loop_notify(req->loop);
+}
+
+FSAsyncRequest *fs_async_client_reap_ex(FSAsyncClient *client,
+        const bool blocked)
+{
+    FSAsyncRequest *head;
+    FSAsyncRequest *req;
+    char buff[64];
+
+    //drain the notify pipe before the pop, so no completion is missed
+    while (read(client->completion.pipe_fds[0], buff, sizeof(buff)) > 0) {
+    }
+
+    head = (FSAsyncRequest *)fc_queue_pop_all_ex(
+            &client->completion.queue, blocked);
+    for (req=head; req!=NULL; req=req->next) {
+        __sync_sub_and_fetch(&client->pending_count, 1);
+    }
+
+    return head;
+}
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//async_client.h
+
+/* the asynchronous client for the slice operations:
+ *   1. the caller submits the requests without blocking, each request is
+ *      tagged by an unique request id
+ *   2. the requests are executed by a few event loop threads, each loop
+ *      polls its own non-blocking connections, one per server. the
+ *      requests are split by the buffer size of the server and pipelined
+ *      on the connection: the loop sends the next request before the
+ *      former responses arrived, so the outstanding requests are NOT
+ *      limited by the thread count
+ *   3. the server processes the requests of a connection in order, so the
+ *      responses are matched with the in-flight requests in FIFO order
+ *   4. the requests of the same data group go to the same loop, and keep
+ *      the idempotency and the retry of the synchronous API: the messages
+ *      of a broken connection are resent after the retry interval without
+ *      blocking the other connections of the loop
+ *   5. the request is completed by the callback in the loop thread, or
+ *      pushed to the completion queue when no callback, the notify fd is
+ *      readable when the completion queue is not empty for poll / epoll
+ *
+ * NOTE: getting the master or readable server (and connecting to it)
+ *   calls the connection manager, which may block the loop thread on
+ *   the routing query and the connect with its retries
+ */
+
+#ifndef _FS_ASYNC_CLIENT_H
+#define _FS_ASYNC_CLIENT_H
+
+#include "fastcommon/fc_queue.h"
+#include "fastcommon/fast_mblock.h"
+#include "fs_client.h"
+
+#define FS_ASYNC_CLIENT_DEFAULT_THREADS  4
+#define FS_ASYNC_CLIENT_MAX_THREADS      64
+
+#define FS_ASYNC_OP_SLICE_WRITE  'w'
+#define FS_ASYNC_OP_SLICE_READ   'r'
+#define FS_ASYNC_OP_BS_OPERATE   'o'
+
+struct fs_async_request;
+struct fs_async_loop;
+struct fs_async_client;
+
+typedef void (*fs_async_complete_func)(struct fs_async_request *req);
+
+typedef struct fs_async_request {
+    int64_t req_id;    //set by the engine when submit
+    int op_type;
+
+    FSBlockSliceKeyInfo bs_key;  //the block key only for block delete
+    char *buff;                  //the data to write or the buffer to read
+
+    /* for FS_ASYNC_OP_BS_OPERATE */
+    struct {
+        int req_cmd;
+        int resp_cmd;
+        int enoent_log_level;
+    } bs_op;
+
+    /* the output */
+    int result;        //ECANCELED when canceled
+    int done_bytes;    //write bytes or read bytes
+    int inc_alloc;     //inc_alloc for write, dec_alloc for delete
+
+    fs_async_complete_func complete;  //NULL for the completion queue
+    void *arg;         //the extra argument of the caller
+
+    /* the internal fields of the engine */
+    volatile bool canceled;
+    int waiting_count;  //the messages NOT completed
+    struct fs_async_loop *loop;
+    struct fs_async_client *client;
+    struct fs_async_request *next;
+} FSAsyncRequest;
+
+typedef struct fs_async_client {
+    FSClientContext *client_ctx;
+    struct fs_async_loop *loops;
+    int loop_count;
+    volatile int running_count;
+    volatile int64_t current_req_id;
+    volatile int64_t pending_count;  //the requests submitted but NOT reaped
+    volatile bool continue_flag;
+
+    struct {
+        struct fc_queue queue;
+        int pipe_fds[2];
+    } completion;
+} FSAsyncClient;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /* init the client and start the event loop threads
+       params:
+            client: the async client
+            client_ctx: the client context
+            threads: the event loop thread count
+       return 0 for success, != 0 fail */
+    int fs_async_client_init(FSAsyncClient *client,
+            FSClientContext *client_ctx, const int threads);
+
+    void fs_async_client_destroy(FSAsyncClient *client);
+
+    /* submit the request without blocking, the request should NOT be
+       modified or freed until it completed
+       return 0 for success, != 0 fail */
+    int fs_async_client_submit(FSAsyncClient *client, FSAsyncRequest *req);
+
+    /* cancel the submitted request, the request is still completed once:
+       the parts NOT sent are dropped and the request completes with
+       ECANCELED, but the parts in flight are waited for their responses,
+       so the written data may be partial (done_bytes) or complete
+       (the result is 0 when all parts had been sent) */
+    void fs_async_client_cancel(FSAsyncRequest *req);
+
+    /* pop all the completed requests from the completion queue
+       return the request chain linked by next, NULL for none */
+    FSAsyncRequest *fs_async_client_reap_ex(FSAsyncClient *client,
+            const bool blocked);
+
+#define fs_async_client_reap(client) \
+    fs_async_client_reap_ex(client, true)
+
+#define fs_async_client_try_reap(client) \
+    fs_async_client_reap_ex(client, false)
+
+    //the fd readable when the completion queue NOT empty
+    static inline int fs_async_client_get_notify_fd(FSAsyncClient *client)
+    {
+        return client->completion.pipe_fds[0];
+    }
+
+    static inline void fs_async_slice_write_init(FSAsyncRequest *req,
+            const FSBlockSliceKeyInfo *bs_key, const char *data,
+            fs_async_complete_func complete, void *arg)
+    {
+        req->op_type = FS_ASYNC_OP_SLICE_WRITE;
+        req->bs_key = *bs_key;
+        req->buff = (char *)data;
+        req->complete = complete;
+        req->arg = arg;
+    }
+
+    static inline void fs_async_slice_read_init(FSAsyncRequest *req,
+            const FSBlockSliceKeyInfo *bs_key, char *buff,
+            fs_async_complete_func complete, void *arg)
+    {
+        req->op_type = FS_ASYNC_OP_SLICE_READ;
+        req->bs_key = *bs_key;
+        req->buff = buff;
+        req->complete = complete;
+        req->arg = arg;
+    }
+
+    static inline void fs_async_bs_operate_init(FSAsyncRequest *req,
+            const FSBlockSliceKeyInfo *bs_key, const int req_cmd,
+            const int resp_cmd, const int enoent_log_level,
+            fs_async_complete_func complete, void *arg)
+    {
+        req->op_type = FS_ASYNC_OP_BS_OPERATE;
+        req->bs_key = *bs_key;
+        req->buff = NULL;
+        req->bs_op.req_cmd = req_cmd;
+        req->bs_op.resp_cmd = resp_cmd;
+        req->bs_op.enoent_log_level = enoent_log_level;
+        req->complete = complete;
+        req->arg = arg;
+    }
+
+#define fs_async_slice_allocate_init(req, bs_key, complete, arg) \
+    fs_async_bs_operate_init(req, bs_key,          \
+            FS_SERVICE_PROTO_SLICE_ALLOCATE_REQ,   \
+            FS_SERVICE_PROTO_SLICE_ALLOCATE_RESP,  \
+            LOG_DEBUG, complete, arg)
+
+#define fs_async_slice_delete_init(req, bs_key, complete, arg) \
+    fs_async_bs_operate_init(req, bs_key,          \
+            FS_SERVICE_PROTO_SLICE_DELETE_REQ,     \
+            FS_SERVICE_PROTO_SLICE_DELETE_RESP,    \
+            LOG_DEBUG, complete, arg)
+
+#define fs_async_block_delete_init(req, bs_key, complete, arg) \
+    fs_async_bs_operate_init(req, bs_key,          \
+            FS_SERVICE_PROTO_BLOCK_DELETE_REQ,     \
+            FS_SERVICE_PROTO_BLOCK_DELETE_RESP,    \
+            LOG_DEBUG, complete, arg)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -70,6 +70,13 @@ static int fs_client_do_init_ex(FSClientContext *client_ctx,
 
     sf_load_read_rule_config(&client_ctx->read_rule, ini_ctx);
 
+    client_ctx->route_cache_ttl = iniGetIntValueEx(
+            ini_ctx->section_name, "route_cache_ttl",
+            ini_ctx->context, FS_CLIENT_DEFAULT_ROUTE_CACHE_TTL, true);
+    if (client_ctx->route_cache_ttl < 0) {
+        client_ctx->route_cache_ttl = 0;
+    }
+
     if ((result=fs_cluster_cfg_load_from_ini_ex1(client_ctx->
                     cluster_cfg.ptr, ini_ctx)) != 0)
     {
@@ -89,7 +96,7 @@ static int fs_client_do_init_ex(FSClientContext *client_ctx,
             "base_path: %s, "
             "connect_timeout: %d, "
             "network_timeout: %d, "
-            "read_rule: %s, %s, "
+            "read_rule: %s, route_cache_ttl: %d s, %s, "
             "server group count: %d, "
             "data group count: %d",
             g_fs_global_vars.version.major,
@@ -98,6 +105,7 @@ static int fs_client_do_init_ex(FSClientContext *client_ctx,
             client_ctx->connect_timeout,
             client_ctx->network_timeout,
             sf_get_read_rule_caption(client_ctx->read_rule),
+            client_ctx->route_cache_ttl,
             net_retry_output,
             FS_SERVER_GROUP_COUNT(*client_ctx->cluster_cfg.ptr),
             FS_DATA_GROUP_COUNT(*client_ctx->cluster_cfg.ptr));
@@ -17,6 +17,8 @@
 #ifndef _FS_CLIENT_FUNC_H
 #define _FS_CLIENT_FUNC_H
 
+#include <sys/uio.h>
+#include "fastcommon/pthread_func.h"
 #include "fs_global.h"
 #include "client_types.h"
 
@@ -76,6 +78,101 @@ static inline int fs_client_init_ex(FSClientContext *client_ctx,
 **/
 void fs_client_destroy_ex(FSClientContext *client_ctx);
 
+//fill zero to the range [offset, offset + length) of the iovec array
+static inline void fs_client_iovec_fill_zero(const struct iovec *iov,
+        const int iovcnt, int64_t offset, int64_t length)
+{
+    const struct iovec *vec;
+    const struct iovec *end;
+    int64_t bytes;
+
+    end = iov + iovcnt;
+    for (vec=iov; vec<end && length > 0; vec++) {
+        if (offset >= (int64_t)vec->iov_len) {
+            offset -= vec->iov_len;
+            continue;
+        }
+
+        bytes = FC_MIN((int64_t)vec->iov_len - offset, length);
+        memset((char *)vec->iov_base + offset, 0, bytes);
+        length -= bytes;
+        offset = 0;
+    }
+}
+
+/**
+* expire the routing table cache of the data group when its version matched
+* params:
+*       client_ctx: the client context
+*       data_group_id: the data group id, base 1
+*       version: the routing table version which the server selected from
+* return: none
+**/
+static inline void fs_client_expire_route_cache_ex(
+        FSClientContext *client_ctx, const int data_group_id,
+        const int64_t version)
+{
+    FSClientDataGroupEntry *entry;
+
+    if (data_group_id <= 0 || data_group_id >
+            client_ctx->conn_manager.data_group_array.count)
+    {
+        return;
+    }
+
+    entry = client_ctx->conn_manager.data_group_array.entries +
+        (data_group_id - 1);
+    PTHREAD_MUTEX_LOCK(&entry->route_cache.lock);
+    if (entry->route_cache.version == version) {
+        entry->route_cache.expire_time = 0;
+    }
+    PTHREAD_MUTEX_UNLOCK(&entry->route_cache.lock);
+}
+
+/**
+* expire the routing table cache which the connection selected from,
+* called when the server rejects the read request because its status or
+* role changed, or the connection broken
+* params:
+*       client_ctx: the client context
+*       conn: the connection got by get_readable_connection
+* return: none
+**/
+static inline void fs_client_expire_route_cache(
+        FSClientContext *client_ctx, ConnectionInfo *conn)
+{
+    FSConnectionParameters *params;
+
+    params = (FSConnectionParameters *)conn->args;
+    fs_client_expire_route_cache_ex(client_ctx,
+            params->route.data_group_id, params->route.version);
+}
+
+/**
+* expire the master connection cache of the data group, called when
+* the master rejects the update request or the connection broken
+* params:
+*       client_ctx: the client context
+*       data_group_id: the data group id, base 1
+* return: none
+**/
+static inline void fs_client_expire_master_cache(
+        FSClientContext *client_ctx, const int data_group_id)
+{
+    FSClientDataGroupEntry *entry;
+
+    if (data_group_id <= 0 || data_group_id >
+            client_ctx->conn_manager.data_group_array.count)
+    {
+        return;
+    }
+
+    entry = client_ctx->conn_manager.data_group_array.entries +
+        (data_group_id - 1);
+    PTHREAD_MUTEX_LOCK(&entry->master_cache.lock);
+    entry->master_cache.conn->port = 0;
+    PTHREAD_MUTEX_UNLOCK(&entry->master_cache.lock);
+}
 
 int fs_alloc_group_servers(FSServerGroup *server_group,
         const int alloc_size);
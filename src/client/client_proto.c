@@ -31,10 +31,68 @@ static inline void proto_pack_block_key(const FSBlockKey *
     long2buff(bkey->offset, proto_bkey->offset);
 }
 
-int fs_client_proto_slice_write(FSClientContext *client_ctx,
+//send the data of the range [offset, offset + length) of the iovec array
+static int send_iovec_data(FSClientContext *client_ctx, ConnectionInfo *conn,
+        const struct iovec *iov, const int iovcnt, int offset, int length)
+{
+    const struct iovec *vec;
+    const struct iovec *end;
+    int bytes;
+    int result;
+
+    end = iov + iovcnt;
+    for (vec=iov; vec<end && length > 0; vec++) {
+        if (offset >= (int)vec->iov_len) {
+            offset -= vec->iov_len;
+            continue;
+        }
+
+        bytes = FC_MIN((int)vec->iov_len - offset, length);
+        if ((result=tcpsenddata_nb(conn->sock, (char *)vec->iov_base +
+                        offset, bytes, client_ctx->network_timeout)) != 0)
+        {
+            return result;
+        }
+        length -= bytes;
+        offset = 0;
+    }
+
+    return length > 0 ? EOVERFLOW : 0;
+}
+
+//recv the data to the range [offset, offset + length) of the iovec array
+static int recv_iovec_data(FSClientContext *client_ctx, ConnectionInfo *conn,
+        const struct iovec *iov, const int iovcnt, int offset, int length)
+{
+    const struct iovec *vec;
+    const struct iovec *end;
+    int bytes;
+    int result;
+
+    end = iov + iovcnt;
+    for (vec=iov; vec<end && length > 0; vec++) {
+        if (offset >= (int)vec->iov_len) {
+            offset -= vec->iov_len;
+            continue;
+        }
+
+        bytes = FC_MIN((int)vec->iov_len - offset, length);
+        if ((result=tcprecvdata_nb(conn->sock, (char *)vec->iov_base +
+                        offset, bytes, client_ctx->network_timeout)) != 0)
+        {
+            return result;
+        }
+        length -= bytes;
+        offset = 0;
+    }
+
+    return length > 0 ? EOVERFLOW : 0;
+}
+
+int fs_client_proto_slice_writev(FSClientContext *client_ctx,
         ConnectionInfo *conn, const uint64_t req_id,
-        const FSBlockSliceKeyInfo *bs_key, const char *data,
-        int *inc_alloc)
+        const FSBlockSliceKeyInfo *bs_key, const struct iovec *iov,
+        const int iovcnt, const int iov_offset, int *inc_alloc)
 {
     char out_buff[sizeof(FSProtoHeader) +
         sizeof(SFProtoIdempotencyAdditionalHeader) +
@@ -73,8 +131,8 @@ int fs_client_proto_slice_write(FSClientContext *client_ctx,
             break;
         }
 
-        if ((result=tcpsenddata_nb(conn->sock, (char *)data, bs_key->
-                        slice.length, client_ctx->network_timeout)) != 0)
+        if ((result=send_iovec_data(client_ctx, conn, iov, iovcnt,
+                        iov_offset, bs_key->slice.length)) != 0)
         {
             break;
         }
@@ -97,9 +155,10 @@ int fs_client_proto_slice_write(FSClientContext *client_ctx,
     return result;
 }
 
-int fs_client_proto_slice_read(FSClientContext *client_ctx,
+int fs_client_proto_slice_readv(FSClientContext *client_ctx,
         ConnectionInfo *conn, const FSBlockSliceKeyInfo *bs_key,
-        char *buff, int *read_bytes)
+        const struct iovec *iov, const int iovcnt, const int iov_offset,
+        int *read_bytes)
 {
     const FSConnectionParameters *connection_params;
     char out_buff[sizeof(FSProtoHeader) + sizeof(FSProtoSliceReadReqHeader)];
@@ -164,9 +223,9 @@ int fs_client_proto_slice_read(FSClientContext *client_ctx,
                 break;
             }
 
-            if ((result=tcprecvdata_nb_ex(conn->sock, buff + buff_offet,
-                            response.header.body_len, client_ctx->
-                            network_timeout, &bytes)) != 0)
+            bytes = response.header.body_len;
+            if ((result=recv_iovec_data(client_ctx, conn, iov, iovcnt,
+                            iov_offset + buff_offet, bytes)) != 0)
             {
                 response.error.length = snprintf(response.error.message,
                         sizeof(response.error.message),
@@ -177,7 +236,8 @@ int fs_client_proto_slice_read(FSClientContext *client_ctx,
 
             hole_len = buff_offet - hole_start;
             if (hole_len > 0) {
-                memset(buff + hole_start, 0, hole_len);
+                fs_client_iovec_fill_zero(iov, iovcnt,
+                        iov_offset + hole_start, hole_len);
             }
             hole_start = buff_offet + bytes;
         }
@@ -205,6 +265,153 @@ int fs_client_proto_slice_read(FSClientContext *client_ctx,
     }
 }
 
+int fs_client_proto_batch_slice_read(FSClientContext *client_ctx,
+        ConnectionInfo *conn, FSClientBatchSlice **slices,
+        const int count)
+{
+    char out_buff[sizeof(FSProtoHeader) +
+        sizeof(FSProtoBatchSliceReadReqHeader) +
+        sizeof(FSProtoBlockSlice) * FS_PROTO_MAX_BATCH_SLICES];
+    char in_buff[sizeof(FSProtoBatchSliceReadRespBodyHeader) +
+        sizeof(FSProtoBatchSliceReadRespBodyPart) *
+        FS_PROTO_MAX_BATCH_SLICES];
+    FSProtoHeader *proto_header;
+    FSProtoBatchSliceReadReqHeader *req_header;
+    FSProtoBatchSliceReadRespBodyHeader *body_header;
+    FSProtoBatchSliceReadRespBodyPart *body_part;
+    FSProtoBlockSlice *bs;
+    FSClientBatchSlice **slice;
+    FSClientBatchSlice **end;
+    SFResponseInfo response;
+    int out_bytes;
+    int front_len;
+    int data_len;
+    int resp_count;
+    int result;
+
+    if (count <= 0 || count > FS_PROTO_MAX_BATCH_SLICES) {
+        logError("file: "__FILE__", line: %d, "
+                "invalid slice count: %d, which <= 0 or > %d",
+                __LINE__, count, FS_PROTO_MAX_BATCH_SLICES);
+        return EINVAL;
+    }
+
+    proto_header = (FSProtoHeader *)out_buff;
+    req_header = (FSProtoBatchSliceReadReqHeader *)(proto_header + 1);
+    int2buff(count, req_header->count);
+    end = slices + count;
+    for (slice=slices, bs=req_header->slices; slice<end; slice++, bs++) {
+        proto_pack_block_key(&(*slice)->bs_key.block, &bs->bkey);
+        int2buff((*slice)->bs_key.slice.offset, bs->slice_size.offset);
+        int2buff((*slice)->bs_key.slice.length, bs->slice_size.length);
+    }
+    out_bytes = (char *)bs - out_buff;
+    SF_PROTO_SET_HEADER(proto_header, FS_SERVICE_PROTO_BATCH_SLICE_READ_REQ,
+            out_bytes - sizeof(FSProtoHeader));
+
+    front_len = sizeof(FSProtoBatchSliceReadRespBodyHeader) +
+        sizeof(FSProtoBatchSliceReadRespBodyPart) * count;
+    response.error.length = 0;
+    do {
+        if ((result=sf_send_and_recv_response_header(conn, out_buff,
+                        out_bytes, &response, client_ctx->
+                        network_timeout)) != 0)
+        {
+            break;
+        }
+
+        if ((result=sf_check_response(conn, &response,
+                        client_ctx->network_timeout,
+                        FS_SERVICE_PROTO_BATCH_SLICE_READ_RESP)) != 0)
+        {
+            break;
+        }
+
+        if (response.header.body_len < front_len) {
+            response.error.length = sprintf(response.error.message,
+                    "response body length: %d < expect: %d",
+                    response.header.body_len, front_len);
+            result = EINVAL;
+            break;
+        }
+
+        if ((result=tcprecvdata_nb(conn->sock, in_buff, front_len,
+                        client_ctx->network_timeout)) != 0)
+        {
+            response.error.length = snprintf(response.error.message,
+                    sizeof(response.error.message),
+                    "recv data fail, errno: %d, error info: %s",
+                    result, STRERROR(result));
+            break;
+        }
+
+        body_header = (FSProtoBatchSliceReadRespBodyHeader *)in_buff;
+        resp_count = buff2int(body_header->count);
+        if (resp_count != count) {
+            response.error.length = sprintf(response.error.message,
+                    "response slice count: %d != request count: %d",
+                    resp_count, count);
+            result = EINVAL;
+            break;
+        }
+
+        data_len = 0;
+        body_part = (FSProtoBatchSliceReadRespBodyPart *)(body_header + 1);
+        for (slice=slices; slice<end; slice++, body_part++) {
+            (*slice)->result = buff2int(body_part->result);
+            (*slice)->read_bytes = buff2int(body_part->read_bytes);
+            if ((*slice)->read_bytes < 0 || (*slice)->read_bytes >
+                    (*slice)->bs_key.slice.length)
+            {
+                response.error.length = sprintf(response.error.message,
+                        "slice index: %d, read bytes: %d is invalid, "
+                        "slice length: %d", (int)(slice - slices),
+                        (*slice)->read_bytes, (*slice)->bs_key.slice.length);
+                result = EINVAL;
+                break;
+            }
+            data_len += (*slice)->read_bytes;
+        }
+        if (result != 0) {
+            break;
+        }
+
+        if (front_len + data_len != response.header.body_len) {
+            response.error.length = sprintf(response.error.message,
+                    "response body length: %d != expect: %d",
+                    response.header.body_len, front_len + data_len);
+            result = EINVAL;
+            break;
+        }
+
+        for (slice=slices; slice<end; slice++) {
+            if ((*slice)->read_bytes == 0) {
+                if ((*slice)->result == 0 || (*slice)->result == ENOENT) {
+                    (*slice)->result = ENODATA;
+                }
+                continue;
+            }
+
+            if ((result=tcprecvdata_nb(conn->sock, (*slice)->buff,
+                            (*slice)->read_bytes, client_ctx->
+                            network_timeout)) != 0)
+            {
+                response.error.length = snprintf(response.error.message,
+                        sizeof(response.error.message),
+                        "recv data fail, errno: %d, error info: %s",
+                        result, STRERROR(result));
+                break;
+            }
+        }
+    } while (0);
+
+    if (result != 0) {
+        sf_log_network_error(&response, conn, result);
+    }
+
+    return result;
+}
+
 int fs_client_proto_bs_operate(FSClientContext *client_ctx,
         ConnectionInfo *conn, const uint64_t req_id, const void *key,
         const int req_cmd, const int resp_cmd,
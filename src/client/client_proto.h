@@ -17,23 +17,61 @@
 #ifndef _FS_CLIENT_PROTO_H
 #define _FS_CLIENT_PROTO_H
 
+#include <sys/uio.h>
 #include "fastcommon/fast_mpool.h"
 #include "fs_types.h"
 #include "fs_proto.h"
 #include "client_types.h"
+#include "client_func.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-    int fs_client_proto_slice_write(FSClientContext *client_ctx,
+    /* write the slice data from the iovec array without copying,
+       the data starts at iov_offset of the iovec array */
+    int fs_client_proto_slice_writev(FSClientContext *client_ctx,
+            ConnectionInfo *conn, const uint64_t req_id,
+            const FSBlockSliceKeyInfo *bs_key, const struct iovec *iov,
+            const int iovcnt, const int iov_offset, int *inc_alloc);
+
+    /* read the slice data to the iovec array without copying,
+       the data is stored from iov_offset of the iovec array */
+    int fs_client_proto_slice_readv(FSClientContext *client_ctx,
+            ConnectionInfo *conn, const FSBlockSliceKeyInfo *bs_key,
+            const struct iovec *iov, const int iovcnt, const int iov_offset,
+            int *read_bytes);
+
+    static inline int fs_client_proto_slice_write(FSClientContext *client_ctx,
             ConnectionInfo *conn, const uint64_t req_id,
             const FSBlockSliceKeyInfo *bs_key, const char *data,
-            int *inc_alloc);
+            int *inc_alloc)
+    {
+        struct iovec iov;
+
+        iov.iov_base = (char *)data;
+        iov.iov_len = bs_key->slice.length;
+        return fs_client_proto_slice_writev(client_ctx, conn,
+                req_id, bs_key, &iov, 1, 0, inc_alloc);
+    }
 
-    int fs_client_proto_slice_read(FSClientContext *client_ctx,
+    static inline int fs_client_proto_slice_read(FSClientContext *client_ctx,
             ConnectionInfo *conn, const FSBlockSliceKeyInfo *bs_key,
-            char *buff, int *read_bytes);
+            char *buff, int *read_bytes)
+    {
+        struct iovec iov;
+
+        iov.iov_base = buff;
+        iov.iov_len = bs_key->slice.length;
+        return fs_client_proto_slice_readv(client_ctx, conn,
+                bs_key, &iov, 1, 0, read_bytes);
+    }
+
+    /* read the slices of the same data group in one request,
+       the result of each slice is set in the slice */
+    int fs_client_proto_batch_slice_read(FSClientContext *client_ctx,
+            ConnectionInfo *conn, FSClientBatchSlice **slices,
+            const int count);
 
     int fs_client_proto_bs_operate(FSClientContext *client_ctx,
             ConnectionInfo *conn, const uint64_t req_id, const void *key,
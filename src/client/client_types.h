@@ -23,6 +23,12 @@
 #include "fs_types.h"
 #include "fs_cluster_cfg.h"
 
+//the default TTL of the routing table cache in seconds
+#define FS_CLIENT_DEFAULT_ROUTE_CACHE_TTL  60
+
+//the interval in seconds to reload the routing table after the load fail
+#define FS_CLIENT_ROUTE_CACHE_RETRY_INTERVAL  1
+
 struct idempotency_client_channel;
 struct fs_connection_parameters;
 struct fs_client_context;
@@ -50,6 +56,10 @@ typedef const struct fs_connection_parameters * (*fs_get_connection_parameters)(
 typedef struct fs_connection_parameters {
     int buffer_size;
     int data_group_id;  //for master cache
+    struct {
+        int data_group_id;
+        int64_t version;
+    } route;            //for routing table cache
     struct idempotency_client_channel *channel;
 } FSConnectionParameters;
 
@@ -59,6 +69,13 @@ typedef struct fs_client_server_entry {
     char status;
 } FSClientServerEntry;
 
+typedef struct fs_client_route_server {
+    int server_id;
+    bool is_master;
+    char status;
+    ConnectionInfo conn;
+} FSClientRouteServer;
+
 typedef struct fs_client_data_group_entry {
     /* master connection cache */
     struct {
@@ -66,6 +83,17 @@ typedef struct fs_client_data_group_entry {
         ConnectionInfo holder;
         pthread_mutex_t lock;
     } master_cache;
+
+    /* routing table cache for reading, loaded from the cluster stat */
+    struct {
+        FSClientRouteServer *servers;
+        int alloc;
+        int count;
+        int64_t version;     //increased when the table reloaded
+        time_t expire_time;  //0 for expired
+        bool refreshing;
+        pthread_mutex_t lock;
+    } route_cache;
 } FSClientDataGroupEntry;
 
 typedef struct fs_client_data_group_array {
@@ -84,6 +112,13 @@ typedef struct fs_client_cluster_stat_entry {
     int64_t data_version;
 } FSClientClusterStatEntry;
 
+typedef struct fs_client_batch_slice {
+    FSBlockSliceKeyInfo bs_key;
+    char *buff;      //the buffer to read, the size >= slice length
+    int read_bytes;  //output
+    int result;      //output, ENODATA for no data
+} FSClientBatchSlice;
+
 typedef struct fs_client_server_space_stat {
     int server_id;
     FSClusterSpaceStat stat;
@@ -131,6 +166,7 @@ typedef struct fs_client_context {
     bool is_simple_conn_mananger;
     bool idempotency_enabled;
     SFDataReadRule read_rule;  //the rule for read
+    int route_cache_ttl;       //0 for disable the routing table cache
     int connect_timeout;
     int network_timeout;
     SFNetRetryConfig net_retry_cfg;
@@ -181,8 +181,9 @@ int fs_cluster_stat(FSClientContext *client_ctx, const int data_group_id,
     return result;
 }
 
-int fs_client_slice_write(FSClientContext *client_ctx,
-        const FSBlockSliceKeyInfo *bs_key, const char *data,
+int fs_client_slice_writev(FSClientContext *client_ctx,
+        const FSBlockSliceKeyInfo *bs_key, const struct iovec *iov,
+        const int iovcnt, const int iov_offset,
         int *write_bytes, int *inc_alloc)
 {
     const FSConnectionParameters *connection_params;
@@ -253,9 +254,9 @@ int fs_client_slice_write(FSClientContext *client_ctx,
             }
 
             if (result == 0) {
-                if ((result=fs_client_proto_slice_write(client_ctx, conn,
-                                req_id, &new_key, data + *write_bytes,
-                                &current_alloc)) == 0)
+                if ((result=fs_client_proto_slice_writev(client_ctx, conn,
+                                req_id, &new_key, iov, iovcnt, iov_offset +
+                                *write_bytes, &current_alloc)) == 0)
                 {
                     break;
                 }
@@ -340,8 +341,9 @@ int fs_client_slice_write(FSClientContext *client_ctx,
     return SF_UNIX_ERRNO(result, EIO);
 }
 
-int fs_client_slice_read(FSClientContext *client_ctx,
-        const FSBlockSliceKeyInfo *bs_key, char *buff, int *read_bytes)
+int fs_client_slice_readv(FSClientContext *client_ctx,
+        const FSBlockSliceKeyInfo *bs_key, const struct iovec *iov,
+        const int iovcnt, const int iov_offset, int *read_bytes)
 {
     ConnectionInfo *conn;
     FSBlockSliceKeyInfo new_key;
@@ -367,13 +369,21 @@ int fs_client_slice_read(FSClientContext *client_ctx,
     remain = bs_key->slice.length;
     i = 0;
     while (remain > 0) {
-        if ((result=fs_client_proto_slice_read(client_ctx, conn,
-                        &new_key, buff + *read_bytes, &bytes)) == 0)
+        if ((result=fs_client_proto_slice_readv(client_ctx, conn,
+                        &new_key, iov, iovcnt, iov_offset + *read_bytes,
+                        &bytes)) == 0)
         {
             *read_bytes += bytes;
             break;
         }
 
+        if (result == SF_RETRIABLE_ERROR_NOT_ACTIVE ||
+                result == SF_RETRIABLE_ERROR_NOT_MASTER)
+        {
+            //the status or role of the server changed
+            fs_client_expire_route_cache(client_ctx, conn);
+        }
+
         SF_NET_RETRY_CHECK_AND_SLEEP(net_retry_ctx, client_ctx->
                 net_retry_cfg.network.times, ++i, result);
 
@@ -416,6 +426,151 @@ int fs_client_slice_read(FSClientContext *client_ctx,
     */
 }
 
+static int batch_slice_read_by_group(FSClientContext *client_ctx,
+        const int data_group_index, ConnectionInfo *conn,
+        FSClientBatchSlice **slices, const int count)
+{
+    int result;
+    int i;
+    SFNetRetryIntervalContext net_retry_ctx;
+
+    sf_init_net_retry_interval_context(&net_retry_ctx,
+            &client_ctx->net_retry_cfg.interval_mm,
+            &client_ctx->net_retry_cfg.network);
+
+    i = 0;
+    while (1) {
+        if ((result=fs_client_proto_batch_slice_read(client_ctx,
+                        conn, slices, count)) == 0)
+        {
+            break;
+        }
+
+        if (result == SF_RETRIABLE_ERROR_NOT_ACTIVE ||
+                result == SF_RETRIABLE_ERROR_NOT_MASTER)
+        {
+            //the status or role of the server changed
+            fs_client_expire_route_cache(client_ctx, conn);
+        }
+
+        SF_NET_RETRY_CHECK_AND_SLEEP(net_retry_ctx, client_ctx->
+                net_retry_cfg.network.times, ++i, result);
+
+        SF_CLIENT_RELEASE_CONNECTION(client_ctx, conn, result);
+        if ((conn=client_ctx->conn_manager.get_readable_connection(
+                        client_ctx, data_group_index, &result)) == NULL)
+        {
+            break;
+        }
+    }
+
+    if (conn != NULL) {
+        SF_CLIENT_RELEASE_CONNECTION(client_ctx, conn, result);
+    }
+
+    return result == 0 ? 0 : SF_UNIX_ERRNO(result, EIO);
+}
+
+int fs_client_batch_slice_read(FSClientContext *client_ctx,
+        FSClientBatchSlice *slices, const int count)
+{
+    const FSConnectionParameters *connection_params;
+    FSClientBatchSlice *batch[FS_PROTO_MAX_BATCH_SLICES];
+    FSClientBatchSlice *start;
+    FSClientBatchSlice *slice;
+    FSClientBatchSlice *end;
+    ConnectionInfo *conn;
+    int data_group_index;
+    int max_bytes;
+    int bytes;
+    int slice_bytes;
+    int first_error;
+    int result;
+    int n;
+
+    end = slices + count;
+    for (slice=slices; slice<end; slice++) {
+        slice->read_bytes = 0;
+        slice->result = EINPROGRESS;
+    }
+
+    first_error = 0;
+    for (start=slices; start<end; start++) {
+        if (start->result != EINPROGRESS) {
+            continue;
+        }
+
+        data_group_index = FS_CLIENT_DATA_GROUP_INDEX(client_ctx,
+                start->bs_key.block.hash_code);
+        if ((conn=client_ctx->conn_manager.get_readable_connection(
+                        client_ctx, data_group_index, &result)) == NULL)
+        {
+            result = SF_UNIX_ERRNO(result, EIO);
+            for (slice=start; slice<end; slice++) {
+                if (slice->result == EINPROGRESS && data_group_index ==
+                        FS_CLIENT_DATA_GROUP_INDEX(client_ctx,
+                            slice->bs_key.block.hash_code))
+                {
+                    slice->result = result;
+                }
+            }
+            if (first_error == 0) {
+                first_error = result;
+            }
+            continue;
+        }
+
+        connection_params = client_ctx->conn_manager.get_connection_params(
+                client_ctx, conn);
+        max_bytes = connection_params->buffer_size -
+            sizeof(FSProtoBatchSliceReadRespBodyHeader);
+
+        //collect the slices of the group which fit the buffer
+        n = 0;
+        bytes = 0;
+        for (slice=start; slice<end && n<FS_PROTO_MAX_BATCH_SLICES; slice++) {
+            if (slice->result != EINPROGRESS || data_group_index !=
+                    FS_CLIENT_DATA_GROUP_INDEX(client_ctx,
+                        slice->bs_key.block.hash_code))
+            {
+                continue;
+            }
+
+            slice_bytes = sizeof(FSProtoBatchSliceReadRespBodyPart) +
+                slice->bs_key.slice.length;
+            if (slice_bytes > max_bytes) {  //too large, read it alone
+                slice->result = fs_client_slice_read(client_ctx,
+                        &slice->bs_key, slice->buff, &slice->read_bytes);
+                continue;
+            }
+            if (bytes + slice_bytes > max_bytes) {  //for the next request
+                continue;
+            }
+
+            bytes += slice_bytes;
+            batch[n++] = slice;
+        }
+
+        if (n == 0) {
+            client_ctx->conn_manager.release_connection(client_ctx, conn);
+            continue;
+        }
+
+        if ((result=batch_slice_read_by_group(client_ctx,
+                        data_group_index, conn, batch, n)) != 0)
+        {
+            while (n > 0) {
+                batch[--n]->result = result;
+            }
+            if (first_error == 0) {
+                first_error = result;
+            }
+        }
+    }
+
+    return first_error;
+}
+
 #define GET_MASTER_CONNECTION(client_ctx, arg1, result)        \
     client_ctx->conn_manager.get_master_connection(client_ctx, \
             arg1, result)
@@ -81,12 +81,46 @@ int fs_unlink_file(FSClientContext *client_ctx, const int64_t oid,
 int fs_cluster_stat(FSClientContext *client_ctx, const int data_group_id,
         FSClientClusterStatEntry *stats, const int size, int *count);
 
-int fs_client_slice_write(FSClientContext *client_ctx,
-        const FSBlockSliceKeyInfo *bs_key, const char *data,
+/* write the slice from the iovec array without copying,
+   the data starts at iov_offset of the iovec array */
+int fs_client_slice_writev(FSClientContext *client_ctx,
+        const FSBlockSliceKeyInfo *bs_key, const struct iovec *iov,
+        const int iovcnt, const int iov_offset,
         int *write_bytes, int *inc_alloc);
 
-int fs_client_slice_read(FSClientContext *client_ctx,
-        const FSBlockSliceKeyInfo *bs_key, char *buff, int *read_bytes);
+/* read the slice to the iovec array without copying,
+   the data is stored from iov_offset of the iovec array */
+int fs_client_slice_readv(FSClientContext *client_ctx,
+        const FSBlockSliceKeyInfo *bs_key, const struct iovec *iov,
+        const int iovcnt, const int iov_offset, int *read_bytes);
+
+static inline int fs_client_slice_write(FSClientContext *client_ctx,
+        const FSBlockSliceKeyInfo *bs_key, const char *data,
+        int *write_bytes, int *inc_alloc)
+{
+    struct iovec iov;
+
+    iov.iov_base = (char *)data;
+    iov.iov_len = bs_key->slice.length;
+    return fs_client_slice_writev(client_ctx, bs_key, &iov, 1, 0,
+            write_bytes, inc_alloc);
+}
+
+static inline int fs_client_slice_read(FSClientContext *client_ctx,
+        const FSBlockSliceKeyInfo *bs_key, char *buff, int *read_bytes)
+{
+    struct iovec iov;
+
+    iov.iov_base = buff;
+    iov.iov_len = bs_key->slice.length;
+    return fs_client_slice_readv(client_ctx, bs_key, &iov, 1, 0, read_bytes);
+}
+
+/* read the slices in batch, the slices of the same data group are sent
+   in one request, the result and read bytes of each slice is set in the
+   slice, return 0 when all requests done, != 0 for the first error */
+int fs_client_batch_slice_read(FSClientContext *client_ctx,
+        FSClientBatchSlice *slices, const int count);
 
 int fs_client_bs_operate(FSClientContext *client_ctx,
         const void *key, const uint32_t hash_code,
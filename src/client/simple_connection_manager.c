@@ -17,6 +17,7 @@
 #include <limits.h>
 #include "fastcommon/shared_func.h"
 #include "fastcommon/logger.h"
+#include "fastcommon/sched_thread.h"
 #include "sf/idempotency/client/client_channel.h"
 #include "client_global.h"
 #include "client_func.h"
@@ -205,7 +206,7 @@ static ConnectionInfo *get_master_connection(FSClientContext *client_ctx,
     return NULL;
 }
 
-static ConnectionInfo *get_readable_connection(FSClientContext *client_ctx,
+static ConnectionInfo *query_readable_connection(FSClientContext *client_ctx,
         const int data_group_index, int *err_no)
 {
     ConnectionInfo *conn;
@@ -239,6 +240,246 @@ static ConnectionInfo *get_readable_connection(FSClientContext *client_ctx,
                 connect.times, ++i, *err_no);
     }
 
+    logError("file: "__FILE__", line: %d, "
+            "query_readable_connection fail, errno: %d",
+            __LINE__, *err_no);
+    return NULL;
+}
+
+#define CM_ROUTE_CACHE_ENTRY(client_ctx, data_group_index) \
+    (client_ctx->conn_manager.data_group_array.entries + data_group_index)
+
+static int route_cache_load(FSClientContext *client_ctx,
+        const int data_group_index, FSClientClusterStatEntry *stats,
+        const int size, int *count)
+{
+    FCServerInfoPtrArray *server_ptr_array;
+    FCAddressPtrArray *addr_array;
+    FCAddressInfo **addr;
+    FCAddressInfo **end;
+    int server_index;
+    int result;
+    int i;
+
+    server_ptr_array = &client_ctx->cluster_cfg.ptr->data_groups.mappings
+        [data_group_index].server_group->server_array;
+    server_index = rand() % server_ptr_array->count;
+    result = ENOENT;
+    for (i=0; i<server_ptr_array->count; i++) {
+        addr_array = &FS_CFG_SERVICE_ADDRESS_ARRAY(client_ctx,
+                server_ptr_array->servers[(server_index + i) %
+                server_ptr_array->count]);
+        end = addr_array->addrs + addr_array->count;
+        for (addr=addr_array->addrs; addr<end; addr++) {
+            if ((result=fs_client_proto_cluster_stat(client_ctx,
+                            &(*addr)->conn, data_group_index + 1,
+                            stats, size, count)) == 0)
+            {
+                return 0;
+            }
+        }
+    }
+
+    return result;
+}
+
+static void route_cache_set(FSClientContext *client_ctx,
+        FSClientDataGroupEntry *entry, const FSClientClusterStatEntry *stats,
+        const int count)
+{
+    const FSClientClusterStatEntry *stat;
+    const FSClientClusterStatEntry *end;
+    FSClientRouteServer *rs;
+
+    end = stats + FC_MIN(count, entry->route_cache.alloc);
+    for (stat=stats, rs=entry->route_cache.servers; stat<end; stat++, rs++) {
+        rs->server_id = stat->server_id;
+        rs->is_master = stat->is_master;
+        rs->status = stat->status;
+        conn_pool_set_server_info(&rs->conn, stat->ip_addr, stat->port);
+
+        if (rs->is_master) {
+            PTHREAD_MUTEX_LOCK(&entry->master_cache.lock);
+            if (entry->master_cache.conn->port == 0) {
+                conn_pool_set_server_info(entry->master_cache.conn,
+                        stat->ip_addr, stat->port);
+            }
+            PTHREAD_MUTEX_UNLOCK(&entry->master_cache.lock);
+        }
+    }
+
+    entry->route_cache.count = rs - entry->route_cache.servers;
+    entry->route_cache.version++;
+    entry->route_cache.expire_time = get_current_time() +
+        client_ctx->route_cache_ttl;
+}
+
+/* select the server by the read rule like the server side does:
+ *   master: the master only
+ *   slave: any active slave first, the master when no active slave
+ *   any: any active server, the master when no active server
+ */
+static int route_cache_select(FSClientContext *client_ctx,
+        FSClientDataGroupEntry *entry, ConnectionInfo *target,
+        int64_t *version)
+{
+    FSClientRouteServer *candidates[FS_MAX_GROUP_SERVERS];
+    FSClientRouteServer *master;
+    FSClientRouteServer *rs;
+    FSClientRouteServer *end;
+    int count;
+
+    master = NULL;
+    count = 0;
+    end = entry->route_cache.servers + entry->route_cache.count;
+    for (rs=entry->route_cache.servers; rs<end; rs++) {
+        if (rs->is_master) {
+            master = rs;
+        }
+
+        if (client_ctx->read_rule == sf_data_read_rule_master_only ||
+                rs->status != FS_SERVER_STATUS_ACTIVE)
+        {
+            continue;
+        }
+        if (client_ctx->read_rule == sf_data_read_rule_slave_first &&
+                rs->is_master)
+        {
+            continue;
+        }
+
+        if (count < FS_MAX_GROUP_SERVERS) {
+            candidates[count++] = rs;
+        }
+    }
+
+    if (count > 0) {
+        rs = candidates[rand() % count];
+    } else if (master != NULL) {
+        rs = master;
+    } else {
+        return SF_RETRIABLE_ERROR_NO_SERVER;
+    }
+
+    conn_pool_set_server_info(target, rs->conn.ip_addr, rs->conn.port);
+    *version = entry->route_cache.version;
+    return 0;
+}
+
+static int route_cache_get_server(FSClientContext *client_ctx,
+        const int data_group_index, ConnectionInfo *target,
+        int64_t *version)
+{
+    FSClientDataGroupEntry *entry;
+    FSClientClusterStatEntry stats[FS_MAX_GROUP_SERVERS];
+    int count;
+    int result;
+
+    entry = CM_ROUTE_CACHE_ENTRY(client_ctx, data_group_index);
+    PTHREAD_MUTEX_LOCK(&entry->route_cache.lock);
+    do {
+        if (entry->route_cache.expire_time > get_current_time()) {
+            break;
+        }
+
+        //use the old table when other thread is refreshing
+        if (entry->route_cache.refreshing && entry->route_cache.count > 0) {
+            break;
+        }
+
+        entry->route_cache.refreshing = true;
+        PTHREAD_MUTEX_UNLOCK(&entry->route_cache.lock);
+        result = route_cache_load(client_ctx, data_group_index,
+                stats, FS_MAX_GROUP_SERVERS, &count);
+        PTHREAD_MUTEX_LOCK(&entry->route_cache.lock);
+        entry->route_cache.refreshing = false;
+        if (result != 0) {
+            if (entry->route_cache.count == 0) {
+                PTHREAD_MUTEX_UNLOCK(&entry->route_cache.lock);
+                return result;
+            }
+
+            //use the stale table and reload it after the retry interval
+            entry->route_cache.expire_time = get_current_time() + FC_MIN(
+                    client_ctx->route_cache_ttl,
+                    FS_CLIENT_ROUTE_CACHE_RETRY_INTERVAL);
+            logWarning("file: "__FILE__", line: %d, "
+                    "data group id: %d, reload the routing table fail, "
+                    "errno: %d, use the stale one", __LINE__,
+                    data_group_index + 1, result);
+            break;
+        }
+
+        route_cache_set(client_ctx, entry, stats, count);
+    } while (0);
+
+    result = route_cache_select(client_ctx, entry, target, version);
+    PTHREAD_MUTEX_UNLOCK(&entry->route_cache.lock);
+    return result;
+}
+
+static inline void route_cache_expire(FSClientDataGroupEntry *entry,
+        const int64_t version)
+{
+    PTHREAD_MUTEX_LOCK(&entry->route_cache.lock);
+    if (entry->route_cache.version == version) {
+        entry->route_cache.expire_time = 0;
+    }
+    PTHREAD_MUTEX_UNLOCK(&entry->route_cache.lock);
+}
+
+static ConnectionInfo *get_readable_connection(FSClientContext *client_ctx,
+        const int data_group_index, int *err_no)
+{
+    ConnectionInfo *conn;
+    ConnectionInfo target;
+    FSConnectionParameters *params;
+    SFNetRetryIntervalContext net_retry_ctx;
+    int64_t version;
+    int i;
+
+    if (client_ctx->route_cache_ttl == 0) {
+        return query_readable_connection(client_ctx,
+                data_group_index, err_no);
+    }
+
+    memset(&target, 0, sizeof(target));
+    sf_init_net_retry_interval_context(&net_retry_ctx,
+            &client_ctx->net_retry_cfg.interval_mm,
+            &client_ctx->net_retry_cfg.connect);
+    i = 0;
+    while (1) {
+        do {
+            if ((*err_no=route_cache_get_server(client_ctx,
+                            data_group_index, &target, &version)) != 0)
+            {
+                if (*err_no != SF_RETRIABLE_ERROR_NO_SERVER) {
+                    //the routing table NOT loaded, query the readable server
+                    return query_readable_connection(client_ctx,
+                            data_group_index, err_no);
+                }
+                break;
+            }
+
+            if ((conn=get_spec_connection(client_ctx, &target,
+                            err_no)) == NULL)
+            {
+                route_cache_expire(CM_ROUTE_CACHE_ENTRY(client_ctx,
+                            data_group_index), version);
+                break;
+            }
+
+            params = (FSConnectionParameters *)conn->args;
+            params->route.data_group_id = data_group_index + 1;
+            params->route.version = version;
+            return conn;
+        } while (0);
+
+        SF_NET_RETRY_CHECK_AND_SLEEP(net_retry_ctx,
+                client_ctx->net_retry_cfg.
+                connect.times, ++i, *err_no);
+    }
+
     logError("file: "__FILE__", line: %d, "
             "get_readable_connection fail, errno: %d",
             __LINE__, *err_no);
@@ -251,6 +492,9 @@ static void release_connection(FSClientContext *client_ctx,
     if (((FSConnectionParameters *)conn->args)->data_group_id > 0) {
         ((FSConnectionParameters *)conn->args)->data_group_id = 0;
     }
+    if (((FSConnectionParameters *)conn->args)->route.data_group_id > 0) {
+        ((FSConnectionParameters *)conn->args)->route.data_group_id = 0;
+    }
 
     conn_pool_close_connection_ex((ConnectionPool *)client_ctx->
             conn_manager.args, conn, false);
@@ -268,6 +512,10 @@ static void close_connection(FSClientContext *client_ctx,
         CM_MASTER_CACHE_MUTEX_UNLOCK(client_ctx, data_group_index);
         ((FSConnectionParameters *)conn->args)->data_group_id = 0;
     }
+    if (((FSConnectionParameters *)conn->args)->route.data_group_id > 0) {
+        fs_client_expire_route_cache(client_ctx, conn);
+        ((FSConnectionParameters *)conn->args)->route.data_group_id = 0;
+    }
 
     conn_pool_close_connection_ex((ConnectionPool *)client_ctx->
             conn_manager.args, conn, true);
@@ -378,6 +626,7 @@ static int init_data_group_array(FSClientContext *client_ctx,
     int bytes;
     FSClientDataGroupEntry *entry;
     FSClientDataGroupEntry *end;
+    FCServerInfoPtrArray *server_ptr_array;
 
     data_group_array->count = FS_DATA_GROUP_COUNT(*client_ctx->cluster_cfg.ptr);
     bytes = sizeof(FSClientDataGroupEntry) * data_group_array->count;
@@ -393,6 +642,20 @@ static int init_data_group_array(FSClientContext *client_ctx,
             return result;
         }
         entry->master_cache.conn = &entry->master_cache.holder;
+
+        if ((result=init_pthread_lock(&(entry->route_cache.lock))) != 0) {
+            return result;
+        }
+        server_ptr_array = &client_ctx->cluster_cfg.ptr->data_groups.
+            mappings[entry - data_group_array->entries].server_group->
+            server_array;
+        entry->route_cache.alloc = server_ptr_array->count;
+        bytes = sizeof(FSClientRouteServer) * entry->route_cache.alloc;
+        entry->route_cache.servers = (FSClientRouteServer *)fc_malloc(bytes);
+        if (entry->route_cache.servers == NULL) {
+            return ENOMEM;
+        }
+        memset(entry->route_cache.servers, 0, bytes);
     }
 
     return 0;
@@ -448,6 +711,21 @@ int fs_simple_connection_manager_init_ex(FSClientContext *client_ctx,
 void fs_simple_connection_manager_destroy(FSConnectionManager *conn_manager)
 {
     ConnectionPool *cp;
+    FSClientDataGroupEntry *entry;
+    FSClientDataGroupEntry *end;
+
+    if (conn_manager->data_group_array.entries != NULL) {
+        end = conn_manager->data_group_array.entries +
+            conn_manager->data_group_array.count;
+        for (entry=conn_manager->data_group_array.entries;
+                entry<end; entry++)
+        {
+            if (entry->route_cache.servers != NULL) {
+                free(entry->route_cache.servers);
+                entry->route_cache.servers = NULL;
+            }
+        }
+    }
 
     if (conn_manager->args != NULL) {
         cp = (ConnectionPool *)conn_manager->args;
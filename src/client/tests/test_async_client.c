@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//check the submit, the completion and the cancel of the async client
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include "fastcommon/logger.h"
+#include "fastcommon/shared_func.h"
+#include "faststore/async_client.h"
+
+#define SLICE_LENGTH   (64 * 1024)
+#define REQUEST_COUNT  64
+
+typedef struct {
+    FSAsyncRequest req;
+    char *buff;
+    int complete_count;
+} TestRequest;
+
+static FSAsyncClient async_client;
+static TestRequest requests[REQUEST_COUNT];
+static char *write_buff;
+static volatile int callback_count = 0;
+
+static void usage(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [-c config_filename] [-i oid=1] "
+            "[-t loop_threads=%d]\n", argv[0],
+            FS_ASYNC_CLIENT_DEFAULT_THREADS);
+}
+
+static void init_bs_key(FSBlockSliceKeyInfo *bs_key,
+        const int64_t oid, const int index)
+{
+    int64_t offset;
+
+    offset = (int64_t)index * SLICE_LENGTH;
+    fs_set_block_key(&bs_key->block, oid, offset);
+    bs_key->slice.offset = offset - bs_key->block.offset;
+    bs_key->slice.length = SLICE_LENGTH;
+}
+
+//reap the requests by the notify fd until all completed
+static int reap_all(const int count)
+{
+    struct pollfd pfd;
+    FSAsyncRequest *req;
+    TestRequest *treq;
+    int done_count;
+    int i;
+
+    pfd.fd = fs_async_client_get_notify_fd(&async_client);
+    pfd.events = POLLIN;
+    done_count = 0;
+    while (done_count < count) {
+        if (poll(&pfd, 1, 60 * 1000) <= 0) {
+            fprintf(stderr, "wait completion timeout, done count: "
+                    "%d < %d\n", done_count, count);
+            return ETIMEDOUT;
+        }
+
+        req = fs_async_client_try_reap(&async_client);
+        while (req != NULL) {
+            treq = (TestRequest *)req->arg;
+            treq->complete_count++;
+            done_count++;
+            req = req->next;
+        }
+    }
+
+    for (i=0; i<count; i++) {
+        if (requests[i].complete_count != 1) {
+            fprintf(stderr, "request #%d, complete count: %d != 1\n",
+                    i, requests[i].complete_count);
+            return EINVAL;
+        }
+    }
+    return 0;
+}
+
+static int check_result(const int index, const bool can_cancel)
+{
+    FSAsyncRequest *req;
+
+    req = &requests[index].req;
+    if (req->result == ECANCELED && can_cancel) {
+        return 0;
+    }
+    if (req->result != 0 || req->done_bytes != SLICE_LENGTH) {
+        fprintf(stderr, "request #%d, op: %c, result: %d, done bytes: "
+                "%d, expect result: 0, done bytes: %d\n", index,
+                req->op_type, req->result, req->done_bytes, SLICE_LENGTH);
+        return req->result != 0 ? req->result : EINVAL;
+    }
+    return 0;
+}
+
+static int test_write(const int64_t oid)
+{
+    FSBlockSliceKeyInfo bs_key;
+    int result;
+    int i;
+
+    memset(requests, 0, sizeof(requests));
+    for (i=0; i<REQUEST_COUNT; i++) {
+        init_bs_key(&bs_key, oid, i);
+        fs_async_slice_write_init(&requests[i].req, &bs_key, write_buff +
+                (int64_t)i * SLICE_LENGTH, NULL, requests + i);
+        if ((result=fs_async_client_submit(&async_client,
+                        &requests[i].req)) != 0)
+        {
+            return result;
+        }
+    }
+
+    if ((result=reap_all(REQUEST_COUNT)) != 0) {
+        return result;
+    }
+    for (i=0; i<REQUEST_COUNT; i++) {
+        if ((result=check_result(i, false)) != 0) {
+            return result;
+        }
+    }
+
+    printf("write by the completion queue done, count: %d\n", REQUEST_COUNT);
+    return 0;
+}
+
+static void read_complete(FSAsyncRequest *req)
+{
+    ((TestRequest *)req->arg)->complete_count++;
+    __sync_add_and_fetch(&callback_count, 1);
+}
+
+static int test_read(const int64_t oid)
+{
+    FSBlockSliceKeyInfo bs_key;
+    int result;
+    int i;
+
+    memset(requests, 0, sizeof(requests));
+    callback_count = 0;
+    for (i=0; i<REQUEST_COUNT; i++) {
+        if ((requests[i].buff=(char *)fc_malloc(SLICE_LENGTH)) == NULL) {
+            return ENOMEM;
+        }
+        init_bs_key(&bs_key, oid, i);
+        fs_async_slice_read_init(&requests[i].req, &bs_key,
+                requests[i].buff, read_complete, requests + i);
+        if ((result=fs_async_client_submit(&async_client,
+                        &requests[i].req)) != 0)
+        {
+            return result;
+        }
+    }
+
+    for (i=0; i<6000 && __sync_add_and_fetch(&callback_count, 0) <
+            REQUEST_COUNT; i++)
+    {
+        fc_sleep_ms(10);
+    }
+    if (callback_count != REQUEST_COUNT) {
+        fprintf(stderr, "wait callback timeout, callback count: %d < %d\n",
+                callback_count, REQUEST_COUNT);
+        return ETIMEDOUT;
+    }
+
+    result = 0;
+    for (i=0; i<REQUEST_COUNT; i++) {
+        if (requests[i].complete_count != 1) {
+            fprintf(stderr, "request #%d, complete count: %d != 1\n",
+                    i, requests[i].complete_count);
+            result = EINVAL;
+        } else if ((result=check_result(i, false)) == 0 && memcmp(
+                    requests[i].buff, write_buff + (int64_t)i *
+                    SLICE_LENGTH, SLICE_LENGTH) != 0)
+        {
+            fprintf(stderr, "request #%d, the data read NOT "
+                    "equal to the data written\n", i);
+            result = EINVAL;
+        }
+        free(requests[i].buff);
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    printf("read by the callback done, count: %d\n", REQUEST_COUNT);
+    return 0;
+}
+
+static int test_cancel(const int64_t oid)
+{
+    FSBlockSliceKeyInfo bs_key;
+    int canceled_count;
+    int result;
+    int i;
+
+    memset(requests, 0, sizeof(requests));
+    for (i=0; i<REQUEST_COUNT; i++) {
+        init_bs_key(&bs_key, oid, i);
+        fs_async_slice_write_init(&requests[i].req, &bs_key, write_buff +
+                (int64_t)i * SLICE_LENGTH, NULL, requests + i);
+        if ((result=fs_async_client_submit(&async_client,
+                        &requests[i].req)) != 0)
+        {
+            return result;
+        }
+        if (i % 2 == 1) {
+            fs_async_client_cancel(&requests[i].req);
+        }
+    }
+
+    //the canceled requests are completed once too
+    if ((result=reap_all(REQUEST_COUNT)) != 0) {
+        return result;
+    }
+
+    canceled_count = 0;
+    for (i=0; i<REQUEST_COUNT; i++) {
+        if ((result=check_result(i, i % 2 == 1)) != 0) {
+            return result;
+        }
+        if (requests[i].req.result == ECANCELED) {
+            canceled_count++;
+        }
+    }
+
+    if (__sync_add_and_fetch(&async_client.pending_count, 0) != 0) {
+        fprintf(stderr, "pending count: %"PRId64" != 0\n",
+                async_client.pending_count);
+        return EINVAL;
+    }
+
+    printf("cancel done, count: %d, canceled before sent: %d\n",
+            REQUEST_COUNT / 2, canceled_count);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *config_filename = "/etc/fstore/client.conf";
+    int ch;
+    int threads;
+    int result;
+    int i;
+    int64_t oid;
+    char *endptr;
+
+    oid = 1;
+    threads = FS_ASYNC_CLIENT_DEFAULT_THREADS;
+    while ((ch=getopt(argc, argv, "hc:i:t:")) != -1) {
+        switch (ch) {
+            case 'h':
+                usage(argv);
+                return 0;
+            case 'c':
+                config_filename = optarg;
+                break;
+            case 'i':
+                oid = strtol(optarg, &endptr, 10);
+                break;
+            case 't':
+                threads = strtol(optarg, &endptr, 10);
+                break;
+            default:
+                usage(argv);
+                return 1;
+        }
+    }
+
+    log_init();
+    if ((write_buff=(char *)fc_malloc(SLICE_LENGTH *
+                    REQUEST_COUNT)) == NULL)
+    {
+        return ENOMEM;
+    }
+    for (i=0; i<SLICE_LENGTH * REQUEST_COUNT; i++) {
+        write_buff[i] = 'a' + i % 26;
+    }
+
+    if ((result=fs_client_init(config_filename)) != 0) {
+        return result;
+    }
+    if ((result=fs_async_client_init(&async_client, &g_fs_client_vars.
+                    client_ctx, threads)) != 0)
+    {
+        return result;
+    }
+
+    if ((result=test_write(oid)) != 0) {
+        return result;
+    }
+    if ((result=test_read(oid)) != 0) {
+        return result;
+    }
+    if ((result=test_cancel(oid + 1)) != 0) {
+        return result;
+    }
+
+    fs_async_client_destroy(&async_client);
+    return 0;
+}
@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//slice IOPS and latency benchmark, run it against the servers with
+//different storage config (such as io_engine) to compare
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "fastcommon/logger.h"
+#include "fastcommon/shared_func.h"
+#include "faststore/fs_client.h"
+
+#define BENCH_MODE_WRITE  'w'
+#define BENCH_MODE_READ   'r'
+
+typedef struct {
+    int thread_index;
+    int result;
+    int count;
+    int *latencies;  //in microseconds
+    char *buff;
+    pthread_t tid;
+} BenchThreadContext;
+
+static const char *config_filename = "/etc/fstore/client.conf";
+static int thread_count = 16;
+static int loop_count = 10000;
+static int slice_size = 4 * 1024;
+static int64_t base_oid = 1000000;
+static int mode = BENCH_MODE_WRITE;
+
+static void usage(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [-c config_filename] [-t threads=16] "
+            "[-n loop_count_per_thread=10000] [-s slice_size=4KB] "
+            "[-i base_oid=1000000] [-m mode: write | read, default write]"
+            "\n\nrun write mode before read mode with the same -t -n -s "
+            "-i options\n\n", argv[0]);
+}
+
+static void *bench_thread_func(void *arg)
+{
+    BenchThreadContext *ctx;
+    FSBlockSliceKeyInfo bs_key;
+    int64_t start_time;
+    int64_t offset;
+    int bytes;
+    int inc_alloc;
+    int i;
+
+    ctx = (BenchThreadContext *)arg;
+    for (i=0; i<loop_count; i++) {
+        offset = (int64_t)i * slice_size;
+        fs_set_block_slice(&bs_key, base_oid + ctx->thread_index,
+                offset, slice_size);
+
+        start_time = get_current_time_us();
+        if (mode == BENCH_MODE_WRITE) {
+            ctx->result = fs_client_slice_write(&g_fs_client_vars.
+                    client_ctx, &bs_key, ctx->buff, &bytes, &inc_alloc);
+        } else {
+            ctx->result = fs_client_slice_read(&g_fs_client_vars.
+                    client_ctx, &bs_key, ctx->buff, &bytes);
+        }
+        if (ctx->result != 0) {
+            break;
+        }
+
+        ctx->latencies[ctx->count++] = get_current_time_us() - start_time;
+    }
+
+    return NULL;
+}
+
+static int compare_latency(const void *p1, const void *p2)
+{
+    return *((const int *)p1) - *((const int *)p2);
+}
+
+static int output_stat(BenchThreadContext *contexts, const int64_t time_used)
+{
+    BenchThreadContext *ctx;
+    BenchThreadContext *end;
+    int *latencies;
+    int total_count;
+    int64_t total_latency;
+    int i;
+
+    total_count = 0;
+    end = contexts + thread_count;
+    for (ctx=contexts; ctx<end; ctx++) {
+        total_count += ctx->count;
+    }
+    if (total_count == 0) {
+        return ENOENT;
+    }
+
+    latencies = (int *)fc_malloc(sizeof(int) * total_count);
+    if (latencies == NULL) {
+        return ENOMEM;
+    }
+
+    total_count = 0;
+    total_latency = 0;
+    for (ctx=contexts; ctx<end; ctx++) {
+        for (i=0; i<ctx->count; i++) {
+            total_latency += ctx->latencies[i];
+        }
+        memcpy(latencies + total_count, ctx->latencies,
+                sizeof(int) * ctx->count);
+        total_count += ctx->count;
+    }
+    qsort(latencies, total_count, sizeof(int), compare_latency);
+
+    printf("mode: %s, threads: %d, slice size: %d, ops: %d, "
+            "time used: %"PRId64" ms, IOPS: %"PRId64", "
+            "throughput: %.2f MB/s\n", mode == BENCH_MODE_WRITE ?
+            "write" : "read", thread_count, slice_size, total_count,
+            time_used / 1000, (int64_t)total_count * 1000 * 1000 /
+            (time_used > 0 ? time_used : 1), (double)total_count *
+            slice_size / (1024 * 1024) * 1000 * 1000 /
+            (time_used > 0 ? time_used : 1));
+    printf("latency (us), avg: %"PRId64", p50: %d, p90: %d, "
+            "p99: %d, p999: %d, max: %d\n", total_latency / total_count,
+            latencies[total_count * 50 / 100],
+            latencies[total_count * 90 / 100],
+            latencies[total_count * 99 / 100],
+            latencies[total_count * 999 / 1000],
+            latencies[total_count - 1]);
+
+    free(latencies);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int ch;
+    int result;
+    int64_t bytes;
+    int64_t start_time;
+    BenchThreadContext *contexts;
+    BenchThreadContext *ctx;
+    BenchThreadContext *end;
+
+    while ((ch=getopt(argc, argv, "hc:t:n:s:i:m:")) != -1) {
+        switch (ch) {
+            case 'h':
+                usage(argv);
+                return 0;
+            case 'c':
+                config_filename = optarg;
+                break;
+            case 't':
+                thread_count = strtol(optarg, NULL, 10);
+                break;
+            case 'n':
+                loop_count = strtol(optarg, NULL, 10);
+                break;
+            case 's':
+                if ((result=parse_bytes(optarg, 1, &bytes)) != 0) {
+                    return result;
+                }
+                slice_size = bytes;
+                break;
+            case 'i':
+                base_oid = strtoll(optarg, NULL, 10);
+                break;
+            case 'm':
+                if (strcmp(optarg, "write") == 0) {
+                    mode = BENCH_MODE_WRITE;
+                } else if (strcmp(optarg, "read") == 0) {
+                    mode = BENCH_MODE_READ;
+                } else {
+                    usage(argv);
+                    return EINVAL;
+                }
+                break;
+            default:
+                usage(argv);
+                return EINVAL;
+        }
+    }
+
+    if (thread_count <= 0 || loop_count <= 0 || slice_size <= 0 ||
+            slice_size > FS_FILE_BLOCK_SIZE)
+    {
+        usage(argv);
+        return EINVAL;
+    }
+
+    log_init();
+    if ((result=fs_client_init(config_filename)) != 0) {
+        return result;
+    }
+
+    contexts = (BenchThreadContext *)fc_malloc(
+            sizeof(BenchThreadContext) * thread_count);
+    if (contexts == NULL) {
+        return ENOMEM;
+    }
+    memset(contexts, 0, sizeof(BenchThreadContext) * thread_count);
+
+    end = contexts + thread_count;
+    for (ctx=contexts; ctx<end; ctx++) {
+        ctx->thread_index = ctx - contexts;
+        ctx->latencies = (int *)fc_malloc(sizeof(int) * loop_count);
+        ctx->buff = (char *)fc_malloc(slice_size);
+        if (ctx->latencies == NULL || ctx->buff == NULL) {
+            return ENOMEM;
+        }
+        memset(ctx->buff, 'A' + ctx->thread_index % 26, slice_size);
+    }
+
+    start_time = get_current_time_us();
+    for (ctx=contexts; ctx<end; ctx++) {
+        if ((result=pthread_create(&ctx->tid, NULL,
+                        bench_thread_func, ctx)) != 0)
+        {
+            logError("file: "__FILE__", line: %d, "
+                    "pthread_create fail, errno: %d, error info: %s",
+                    __LINE__, result, STRERROR(result));
+            return result;
+        }
+    }
+
+    for (ctx=contexts; ctx<end; ctx++) {
+        pthread_join(ctx->tid, NULL);
+        if (ctx->result != 0) {
+            logError("file: "__FILE__", line: %d, "
+                    "thread #%d fail, errno: %d, error info: %s",
+                    __LINE__, ctx->thread_index, ctx->result,
+                    STRERROR(ctx->result));
+        }
+    }
+
+    return output_stat(contexts, get_current_time_us() - start_time);
+}
@@ -65,6 +65,10 @@ const char *fs_get_cmd_caption(const int cmd)
             return "DISK_SPACE_STAT_REQ";
         case FS_SERVICE_PROTO_DISK_SPACE_STAT_RESP:
             return "DISK_SPACE_STAT_RESP";
+        case FS_SERVICE_PROTO_IO_STAT_REQ:
+            return "IO_STAT_REQ";
+        case FS_SERVICE_PROTO_IO_STAT_RESP:
+            return "IO_STAT_RESP";
         case FS_SERVICE_PROTO_SLICE_WRITE_REQ:
             return "SLICE_WRITE_REQ";
         case FS_SERVICE_PROTO_SLICE_WRITE_RESP:
@@ -85,6 +89,10 @@ const char *fs_get_cmd_caption(const int cmd)
             return "BLOCK_DELETE_REQ";
         case FS_SERVICE_PROTO_BLOCK_DELETE_RESP:
             return "BLOCK_DELETE_RESP";
+        case FS_SERVICE_PROTO_BATCH_SLICE_READ_REQ:
+            return "BATCH_SLICE_READ_REQ";
+        case FS_SERVICE_PROTO_BATCH_SLICE_READ_RESP:
+            return "BATCH_SLICE_READ_RESP";
         case FS_SERVICE_PROTO_GET_MASTER_REQ:
             return "GET_MASTER_REQ";
         case FS_SERVICE_PROTO_GET_MASTER_RESP:
@@ -145,6 +153,14 @@ const char *fs_get_cmd_caption(const int cmd)
             return "ACTIVE_CONFIRM_REQ";
         case FS_REPLICA_PROTO_ACTIVE_CONFIRM_RESP:
             return "ACTIVE_CONFIRM_RESP";
+        case FS_REPLICA_PROTO_FETCH_RANGE_DIGESTS_REQ:
+            return "FETCH_RANGE_DIGESTS_REQ";
+        case FS_REPLICA_PROTO_FETCH_RANGE_DIGESTS_RESP:
+            return "FETCH_RANGE_DIGESTS_RESP";
+        case FS_REPLICA_PROTO_FETCH_BLOCK_DIGESTS_REQ:
+            return "FETCH_BLOCK_DIGESTS_REQ";
+        case FS_REPLICA_PROTO_FETCH_BLOCK_DIGESTS_RESP:
+            return "FETCH_BLOCK_DIGESTS_RESP";
         default:
             return sf_get_cmd_caption(cmd);
     }
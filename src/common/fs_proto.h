@@ -38,6 +38,8 @@
 #define FS_SERVICE_PROTO_SLICE_DELETE_RESP       32
 #define FS_SERVICE_PROTO_BLOCK_DELETE_REQ        33
 #define FS_SERVICE_PROTO_BLOCK_DELETE_RESP       34
+#define FS_SERVICE_PROTO_BATCH_SLICE_READ_REQ    35
+#define FS_SERVICE_PROTO_BATCH_SLICE_READ_RESP   36
 
 #define FS_SERVICE_PROTO_SERVICE_STAT_REQ        41
 #define FS_SERVICE_PROTO_SERVICE_STAT_RESP       42
@@ -45,6 +47,8 @@
 #define FS_SERVICE_PROTO_CLUSTER_STAT_RESP       44
 #define FS_SERVICE_PROTO_DISK_SPACE_STAT_REQ     45
 #define FS_SERVICE_PROTO_DISK_SPACE_STAT_RESP    46
+#define FS_SERVICE_PROTO_IO_STAT_REQ             47
+#define FS_SERVICE_PROTO_IO_STAT_RESP            48
 
 #define FS_SERVICE_PROTO_GET_MASTER_REQ           51
 #define FS_SERVICE_PROTO_GET_MASTER_RESP          52
@@ -80,6 +84,10 @@
 #define FS_REPLICA_PROTO_FETCH_BINLOG_NEXT_RESP  86
 #define FS_REPLICA_PROTO_ACTIVE_CONFIRM_REQ      87
 #define FS_REPLICA_PROTO_ACTIVE_CONFIRM_RESP     88
+#define FS_REPLICA_PROTO_FETCH_RANGE_DIGESTS_REQ  89
+#define FS_REPLICA_PROTO_FETCH_RANGE_DIGESTS_RESP 90
+#define FS_REPLICA_PROTO_FETCH_BLOCK_DIGESTS_REQ  91
+#define FS_REPLICA_PROTO_FETCH_BLOCK_DIGESTS_RESP 92
 
 // master -> slave RPC
 #define FS_REPLICA_PROTO_RPC_REQ                 99
@@ -143,6 +151,27 @@ typedef struct fs_proto_slice_read_req_header {
     FSProtoBlockSlice bs;
 } FSProtoSliceReadReqHeader;
 
+//the max slices of the batch slice read request
+#define FS_PROTO_MAX_BATCH_SLICES  256
+
+typedef struct fs_proto_batch_slice_read_req_header {
+    char count[4];
+    char padding[4];
+    FSProtoBlockSlice slices[0];  //the slices of the same data group
+} FSProtoBatchSliceReadReqHeader;
+
+typedef struct fs_proto_batch_slice_read_resp_body_header {
+    char count[4];
+    char padding[4];
+} FSProtoBatchSliceReadRespBodyHeader;
+
+/* the body parts followed by the data of the slices
+   in order, the data length of each slice is read_bytes */
+typedef struct fs_proto_batch_slice_read_resp_body_part {
+    char result[4];      //the errno of the slice, 0 for success
+    char read_bytes[4];
+} FSProtoBatchSliceReadRespBodyPart;
+
 typedef struct {
     unsigned char servers[16];
     unsigned char cluster[16];
@@ -212,6 +241,22 @@ typedef struct fs_proto_disk_space_stat_resp_body_part {
     char avail[8];
 } FSProtoDiskSpaceStatRespBodyPart;
 
+typedef struct fs_proto_io_stat_resp_body_header {
+    char count[4];
+    char padding[4];
+} FSProtoIOStatRespBodyHeader;
+
+typedef struct fs_proto_io_stat_resp_body_part {
+    char path_index[4];
+    char queue_depth[4];
+    char io_class;
+    char padding[7];
+    char total_count[8];
+    char total_bytes[8];
+    char total_latency[8];  //in us
+    char max_latency[8];    //in us
+} FSProtoIOStatRespBodyPart;
+
 typedef struct fs_proto_get_readable_server_req {
     char data_group_id[4];
     char read_rule;
@@ -323,6 +368,37 @@ typedef struct fs_proto_replia_active_confirm_req {
     char server_id[4];
 } FSProtoReplicaActiveConfirmReq;
 
+typedef struct fs_proto_replica_fetch_range_digests_req {
+    char data_group_id[4];
+    char server_id[4];
+} FSProtoReplicaFetchRangeDigestsReq;
+
+typedef struct fs_proto_replica_fetch_range_digests_resp_header {
+    char data_version[8];  //the data version before building the digests
+    char block_count[8];
+    char range_count[4];
+    char is_ready;         //the digests are building when false
+    char padding[3];
+    char digests[0];       //range_count * 4 bytes
+} FSProtoReplicaFetchRangeDigestsRespHeader;
+
+typedef struct fs_proto_replica_fetch_block_digests_req {
+    char range_index[4];
+    char start_index[4];   //the block index within the range
+} FSProtoReplicaFetchBlockDigestsReq;
+
+typedef struct fs_proto_replica_fetch_block_digests_resp_header {
+    char count[4];
+    char is_last;          //is the last package of the range
+    char padding[3];
+} FSProtoReplicaFetchBlockDigestsRespHeader;
+
+typedef struct fs_proto_block_digest {
+    FSProtoBlockKey bkey;
+    char digest[4];
+    char padding[4];
+} FSProtoBlockDigest;
+
 typedef struct fs_proto_replica_rpc_req_body_header {
     char count[4];
     char padding[4];
@@ -17,6 +17,7 @@
 #include <limits.h>
 #include "fastcommon/shared_func.h"
 #include "fastcommon/logger.h"
+#include "fs_api_pipeline.h"
 #include "fs_api.h"
 
 FSAPIContext g_fs_api_ctx;
@@ -37,8 +38,29 @@ static int opendir_session_alloc_init(void *element, void *args)
     return 0;
 }
 
+static int fs_api_load_pipeline_config(FSAPIContext *ctx,
+        IniFullContext *ini_ctx)
+{
+    int threads;
+
+    threads = iniGetIntValueEx(ini_ctx->section_name, "pipeline_io_threads",
+            ini_ctx->context, FS_API_PIPELINE_DEFAULT_THREADS, true);
+    if (threads < 0) {
+        threads = 0;
+    } else if (threads > FS_API_PIPELINE_MAX_THREADS) {
+        logWarning("file: "__FILE__", line: %d, "
+                "config file: %s, pipeline_io_threads: %d is too large, "
+                "set to %d", __LINE__, ini_ctx->filename, threads,
+                FS_API_PIPELINE_MAX_THREADS);
+        threads = FS_API_PIPELINE_MAX_THREADS;
+    }
+
+    return fs_api_pipeline_init(ctx, threads);
+}
+
 static int fs_api_common_init(FSAPIContext *ctx, FDIRClientContext *fdir,
-        FSClientContext *fs, const char *ns, const bool need_lock)
+        FSClientContext *fs, const char *ns, IniFullContext *ini_ctx,
+        const bool need_lock)
 {
     int result;
 
@@ -50,7 +72,7 @@ static int fs_api_common_init(FSAPIContext *ctx, FDIRClientContext *fdir,
     }
 
     fs_api_set_contexts_ex1(ctx, fdir, fs, ns);
-    return 0;
+    return fs_api_load_pipeline_config(ctx, ini_ctx);
 }
 
 int fs_api_init_ex1(FSAPIContext *ctx, FDIRClientContext *fdir,
@@ -71,7 +93,7 @@ int fs_api_init_ex1(FSAPIContext *ctx, FDIRClientContext *fdir,
         return result;
     }
 
-    return fs_api_common_init(ctx, fdir, fs, ns, need_lock);
+    return fs_api_common_init(ctx, fdir, fs, ns, ini_ctx, need_lock);
 }
 
 int fs_api_init_ex(FSAPIContext *ctx, const char *ns,
@@ -149,11 +171,13 @@ int fs_api_init_ex2(FSAPIContext *ctx, FDIRClientContext *fdir,
         return result;
     }
 
-    return fs_api_common_init(ctx, fdir, fs, ns, need_lock);
+    return fs_api_common_init(ctx, fdir, fs, ns, ini_ctx, need_lock);
 }
 
 void fs_api_destroy_ex(FSAPIContext *ctx)
 {
+    fs_api_pipeline_destroy(ctx);
+
     if (ctx->contexts.fdir != NULL) {
         fdir_client_destroy_ex(ctx->contexts.fdir);
         ctx->contexts.fdir = NULL;
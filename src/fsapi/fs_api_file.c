@@ -20,6 +20,7 @@
 #include "fastcommon/sockopt.h"
 #include "fastcommon/sched_thread.h"
 #include "fs_api_util.h"
+#include "fs_api_pipeline.h"
 #include "fs_api_file.h"
 
 #define FS_API_MAGIC_NUMBER    1588076578
@@ -192,9 +193,67 @@ static inline void print_block_slice_key(FSBlockSliceKeyInfo *bs_key)
 }
 */
 
-static int do_pwrite(FSAPIFileInfo *fi, const char *buff,
-        const int size, const int64_t offset, int *written_bytes,
-        int *total_inc_alloc, const bool need_report_modified)
+static FSAPIPipelineTask *alloc_pipeline_tasks(FSAPIPipelineTask
+        *fixed_tasks, const int64_t offset, const int size)
+{
+    int count;
+
+    count = fs_api_pipeline_task_count(offset, size);
+    if (count <= FS_API_PIPELINE_FIXED_TASKS) {
+        return fixed_tasks;
+    }
+
+    return (FSAPIPipelineTask *)fc_malloc(
+            sizeof(FSAPIPipelineTask) * count);
+}
+
+/* write the blocks concurrently, the written bytes is the contiguous
+   written part from the offset, and the inc_alloc is summed from all
+   the blocks even if the written is not contiguous.
+   return the error of the block which breaks the contiguous part */
+static int pipeline_write(FSAPIFileInfo *fi, const struct iovec *iov,
+        const int iovcnt, const int size, const int64_t offset,
+        int *written_bytes, int *total_inc_alloc)
+{
+    FSAPIPipelineTask fixed_tasks[FS_API_PIPELINE_FIXED_TASKS];
+    FSAPIPipelineTask *tasks;
+    FSAPIPipelineTask *task;
+    FSAPIPipelineTask *end;
+    bool contiguous;
+    int count;
+    int result;
+
+    if ((tasks=alloc_pipeline_tasks(fixed_tasks, offset, size)) == NULL) {
+        return ENOMEM;
+    }
+
+    count = fs_api_pipeline_init_tasks(fi->dentry.inode, iov, iovcnt,
+            size, offset, true, tasks);
+    if ((result=fs_api_pipeline_execute(fi->ctx, tasks, count)) == 0) {
+        contiguous = true;
+        end = tasks + count;
+        for (task=tasks; task<end; task++) {
+            *total_inc_alloc += task->inc_alloc;
+            if (contiguous) {
+                *written_bytes += task->done_bytes;
+                contiguous = (task->done_bytes == task->bs_key.slice.length);
+                if (!contiguous) {
+                    result = task->result;
+                }
+            }
+        }
+    }
+
+    if (tasks != fixed_tasks) {
+        free(tasks);
+    }
+    return result;
+}
+
+static int do_pwrite(FSAPIFileInfo *fi, const struct iovec *iov,
+        const int iovcnt, const int size, const int64_t offset,
+        int *written_bytes, int *total_inc_alloc,
+        const bool need_report_modified)
 {
     FSBlockSliceKeyInfo bs_key;
     int64_t new_offset;
@@ -203,13 +262,34 @@ static int do_pwrite(FSAPIFileInfo *fi, const char *buff,
     int inc_alloc;
     int remain;
 
+    result = 0;
     *total_inc_alloc = *written_bytes = 0;
-    new_offset = offset;
-    fs_set_block_slice(&bs_key, fi->dentry.inode, offset, size);
-    while (1) {
+    if (fs_api_pipeline_enabled(fi->ctx, offset, size)) {
+        if ((result=pipeline_write(fi, iov, iovcnt, size, offset,
+                        written_bytes, total_inc_alloc)) == ENOMEM)
+        {
+            logWarning("file: "__FILE__", line: %d, "
+                    "inode: %"PRId64", offset: %"PRId64", size: %d, "
+                    "pipeline write fail, errno: %d, error info: %s, "
+                    "write one slice by one slice", __LINE__,
+                    fi->dentry.inode, offset, size,
+                    result, STRERROR(result));
+            result = 0;
+        }
+    }
+
+    /* write the remain part (when the pipeline disabled, out of memory
+       or partially completed) one slice by one slice, the IO error of
+       the pipeline is returned as the serial write */
+    new_offset = offset + *written_bytes;
+    remain = (result == 0 ? size - *written_bytes : 0);
+    if (remain > 0) {
+        fs_set_block_slice(&bs_key, fi->dentry.inode, new_offset, remain);
+    }
+    while (remain > 0) {
         //print_block_slice_key(&bs_key);
-        if ((result=fs_client_slice_write(fi->ctx->contexts.fs,
-                        &bs_key, buff + *written_bytes,
+        if ((result=fs_client_slice_writev(fi->ctx->contexts.fs,
+                        &bs_key, iov, iovcnt, *written_bytes,
                         &current_written, &inc_alloc)) != 0)
         {
             if (current_written == 0) {
@@ -271,16 +351,37 @@ static int do_pwrite(FSAPIFileInfo *fi, const char *buff,
         }
         return 0;
     } else {
-        return EIO;
+        return (result != 0 ? result : EIO);
     }
 }
 
-int fsapi_pwrite(FSAPIFileInfo *fi, const char *buff,
-        const int size, const int64_t offset, int *written_bytes)
+//the total size of the iovec array, -1 for invalid
+static int get_iovec_size(const struct iovec *iov, const int iovcnt)
+{
+    const struct iovec *vec;
+    const struct iovec *end;
+    int64_t size;
+
+    if (iovcnt < 0) {
+        return -1;
+    }
+
+    size = 0;
+    end = iov + iovcnt;
+    for (vec=iov; vec<end; vec++) {
+        size += vec->iov_len;
+    }
+    return (size <= INT_MAX) ? size : -1;
+}
+
+int fsapi_pwritev(FSAPIFileInfo *fi, const struct iovec *iov,
+        const int iovcnt, const int64_t offset, int *written_bytes)
 {
     int total_inc_alloc;
+    int size;
 
-    if (size == 0) {
+    *written_bytes = 0;
+    if ((size=get_iovec_size(iov, iovcnt)) == 0) {
         return 0;
     } else if (size < 0) {
         return EINVAL;
@@ -292,15 +393,30 @@ int fsapi_pwrite(FSAPIFileInfo *fi, const char *buff,
         return EBADF;
     }
 
-    return do_pwrite(fi, buff, size, offset, written_bytes,
+    return do_pwrite(fi, iov, iovcnt, size, offset, written_bytes,
             &total_inc_alloc, true);
 }
 
+int fsapi_pwrite(FSAPIFileInfo *fi, const char *buff,
+        const int size, const int64_t offset, int *written_bytes)
+{
+    struct iovec iov;
+
+    if (size < 0) {
+        return EINVAL;
+    }
+
+    iov.iov_base = (char *)buff;
+    iov.iov_len = size;
+    return fsapi_pwritev(fi, &iov, 1, offset, written_bytes);
+}
+
 int fsapi_write(FSAPIFileInfo *fi, const char *buff,
         const int size, int *written_bytes)
 {
     FDIRClientSession session;
     bool need_report_modified;
+    struct iovec iov;
     int result;
     int total_inc_alloc;
     int flags;
@@ -333,7 +449,9 @@ int fsapi_write(FSAPIFileInfo *fi, const char *buff,
         need_report_modified = true;
     }
 
-    if ((result=do_pwrite(fi, buff, size, fi->offset, written_bytes,
+    iov.iov_base = (char *)buff;
+    iov.iov_len = size;
+    if ((result=do_pwrite(fi, &iov, 1, size, fi->offset, written_bytes,
                     &total_inc_alloc, need_report_modified)) == 0)
     {
         fi->offset += *written_bytes;
@@ -356,19 +474,120 @@ int fsapi_write(FSAPIFileInfo *fi, const char *buff,
     return result;
 }
 
-int fsapi_pread(FSAPIFileInfo *fi, char *buff, const int size,
-        const int64_t offset, int *read_bytes)
+/* deal file hole caused by ftruncate and lseek, the iov_offset
+   and the slice_offset are the start of the slice */
+static int fill_file_hole(FSAPIFileInfo *fi, const struct iovec *iov,
+        const int iovcnt, const int iov_offset, const int64_t slice_offset,
+        const int slice_length, int *current_read)
 {
-    FSBlockSliceKeyInfo bs_key;
     int result;
-    int current_read;
-    int remain;
     int64_t current_offset;
     int64_t hole_bytes;
     int fill_bytes;
 
+    if (*current_read >= slice_length) {
+        return 0;
+    }
+
+    current_offset = slice_offset + *current_read;
+    if (current_offset == fi->dentry.stat.size) {
+        return 0;
+    }
+
+    if (current_offset > fi->dentry.stat.size) {
+        if ((result=fdir_client_stat_dentry_by_inode(fi->
+                        ctx->contexts.fdir, fi->dentry.inode,
+                        &fi->dentry)) != 0)
+        {
+            return result;
+        }
+    }
+
+    hole_bytes = fi->dentry.stat.size - current_offset;
+    if (hole_bytes > 0) {
+        if (*current_read + hole_bytes > (int64_t)slice_length) {
+            fill_bytes = slice_length - *current_read;
+        } else {
+            fill_bytes = hole_bytes;
+        }
+
+        /*
+        logInfo("=====slice offset: %"PRId64", current_read: %d, "
+                "hole_bytes: %"PRId64", fill_bytes: %d =====",
+                slice_offset, *current_read, hole_bytes, fill_bytes);
+                */
+
+        fs_client_iovec_fill_zero(iov, iovcnt,
+                iov_offset + *current_read, fill_bytes);
+        *current_read += fill_bytes;
+    }
+
+    return 0;
+}
+
+/* read the blocks concurrently, then deal the results in the order
+   of the blocks as the sequential read */
+static int pipeline_read(FSAPIFileInfo *fi, const struct iovec *iov,
+        const int iovcnt, const int size, const int64_t offset,
+        int *read_bytes)
+{
+    FSAPIPipelineTask fixed_tasks[FS_API_PIPELINE_FIXED_TASKS];
+    FSAPIPipelineTask *tasks;
+    FSAPIPipelineTask *task;
+    FSAPIPipelineTask *end;
+    int count;
+    int result;
+    int current_read;
+
+    if ((tasks=alloc_pipeline_tasks(fixed_tasks, offset, size)) == NULL) {
+        return ENOMEM;
+    }
+
+    count = fs_api_pipeline_init_tasks(fi->dentry.inode, iov, iovcnt,
+            size, offset, false, tasks);
+    if ((result=fs_api_pipeline_execute(fi->ctx, tasks, count)) == 0) {
+        end = tasks + count;
+        for (task=tasks; task<end; task++) {
+            current_read = task->done_bytes;
+            if ((result=task->result) != 0) {
+                if (result == ENODATA) {
+                    result = 0;
+                } else {
+                    break;
+                }
+            }
+
+            if ((result=fill_file_hole(fi, iov, iovcnt, task->iov_offset,
+                            offset + *read_bytes, task->bs_key.slice.length,
+                            &current_read)) != 0)
+            {
+                break;
+            }
+
+            *read_bytes += current_read;
+            if (current_read < task->bs_key.slice.length) {
+                break;
+            }
+        }
+    }
+
+    if (tasks != fixed_tasks) {
+        free(tasks);
+    }
+    return result;
+}
+
+int fsapi_preadv(FSAPIFileInfo *fi, const struct iovec *iov,
+        const int iovcnt, const int64_t offset, int *read_bytes)
+{
+    FSBlockSliceKeyInfo bs_key;
+    int result;
+    int current_read;
+    int remain;
+    int size;
+
     *read_bytes = 0;
-    if (size == 0) {
+    if ((size=get_iovec_size(iov, iovcnt)) == 0) {
         return 0;
     } else if (size < 0) {
         return EINVAL;
@@ -378,11 +597,16 @@ int fsapi_pread(FSAPIFileInfo *fi, char *buff, const int size,
         return EBADF;
     }
 
+    if (fs_api_pipeline_enabled(fi->ctx, offset, size)) {
+        return pipeline_read(fi, iov, iovcnt, size, offset, read_bytes);
+    }
+
     fs_set_block_slice(&bs_key, fi->dentry.inode, offset, size);
     while (1) {
         //print_block_slice_key(&bs_key);
-        if ((result=fs_client_slice_read(fi->ctx->contexts.fs,
-                        &bs_key, buff + *read_bytes, &current_read)) != 0)
+        if ((result=fs_client_slice_readv(fi->ctx->contexts.fs,
+                        &bs_key, iov, iovcnt, *read_bytes,
+                        &current_read)) != 0)
         {
             if (result == ENODATA) {
                 result = 0;
@@ -391,42 +615,11 @@ int fsapi_pread(FSAPIFileInfo *fi, char *buff, const int size,
             }
         }
 
-        while (current_read < bs_key.slice.length) {
-            /* deal file hole caused by ftruncate and lseek */
-            current_offset = offset + *read_bytes + current_read;
-            if (current_offset == fi->dentry.stat.size) {
-                break;
-            }
-
-            if (current_offset > fi->dentry.stat.size) {
-                if ((result=fdir_client_stat_dentry_by_inode(fi->
-                                ctx->contexts.fdir, fi->dentry.inode,
-                                &fi->dentry)) != 0)
-                {
-                    return result;
-                }
-            }
-
-            hole_bytes = fi->dentry.stat.size - current_offset;
-            if (hole_bytes > 0) {
-                if (current_read + hole_bytes > (int64_t)bs_key.slice.length) {
-                    fill_bytes = bs_key.slice.length - current_read;
-                } else {
-                    fill_bytes = hole_bytes;
-                }
-
-                /*
-                logInfo("=====offset: %"PRId64", current_read: %d, "
-                        "hole_bytes: %"PRId64", fill_bytes: %d, "
-                        "buff offset: %d =====", offset, current_read,
-                        hole_bytes, fill_bytes, *read_bytes + current_read);
-                        */
-
-                memset(buff + *read_bytes + current_read, 0, fill_bytes);
-                current_read += fill_bytes;
-            }
-
-            break;
+        if ((result=fill_file_hole(fi, iov, iovcnt, *read_bytes,
+                        offset + *read_bytes, bs_key.slice.length,
+                        &current_read)) != 0)
+        {
+            return result;
         }
 
         *read_bytes += current_read;
@@ -441,6 +634,21 @@ int fsapi_pread(FSAPIFileInfo *fi, char *buff, const int size,
     return result;
 }
 
+int fsapi_pread(FSAPIFileInfo *fi, char *buff, const int size,
+        const int64_t offset, int *read_bytes)
+{
+    struct iovec iov;
+
+    if (size < 0) {
+        *read_bytes = 0;
+        return EINVAL;
+    }
+
+    iov.iov_base = buff;
+    iov.iov_len = size;
+    return fsapi_preadv(fi, &iov, 1, offset, read_bytes);
+}
+
 int fsapi_read(FSAPIFileInfo *fi, char *buff, const int size, int *read_bytes)
 {
     int result;
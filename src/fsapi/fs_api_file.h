@@ -86,12 +86,22 @@ extern "C" {
     int fsapi_pwrite(FSAPIFileInfo *fi, const char *buff,
             const int size, const int64_t offset, int *written_bytes);
 
+    /* write from the iovec array directly without the staging copy,
+       the total size of the iovec array should <= INT_MAX */
+    int fsapi_pwritev(FSAPIFileInfo *fi, const struct iovec *iov,
+            const int iovcnt, const int64_t offset, int *written_bytes);
+
     int fsapi_write(FSAPIFileInfo *fi, const char *buff,
             const int size, int *written_bytes);
 
     int fsapi_pread(FSAPIFileInfo *fi, char *buff, const int size,
             const int64_t offset, int *read_bytes);
 
+    /* read to the iovec array directly without the staging copy,
+       the total size of the iovec array should <= INT_MAX */
+    int fsapi_preadv(FSAPIFileInfo *fi, const struct iovec *iov,
+            const int iovcnt, const int64_t offset, int *read_bytes);
+
     int fsapi_read(FSAPIFileInfo *fi, char *buff,
             const int size, int *read_bytes);
 
@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include "fastcommon/shared_func.h"
+#include "fastcommon/pthread_func.h"
+#include "fastcommon/logger.h"
+#include "fs_api_pipeline.h"
+
+typedef struct fs_api_pipeline_batch {
+    int count;
+    int done_count;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} FSAPIPipelineBatch;
+
+static void do_task(FSAPIContext *ctx, FSAPIPipelineTask *task)
+{
+    if (task->is_write) {
+        task->result = fs_client_slice_writev(ctx->contexts.fs,
+                &task->bs_key, task->iov, task->iovcnt, task->iov_offset,
+                &task->done_bytes, &task->inc_alloc);
+    } else {
+        task->result = fs_client_slice_readv(ctx->contexts.fs,
+                &task->bs_key, task->iov, task->iovcnt, task->iov_offset,
+                &task->done_bytes);
+    }
+}
+
+static void task_done(FSAPIPipelineTask *task)
+{
+    FSAPIPipelineBatch *batch;
+
+    batch = task->batch;
+    PTHREAD_MUTEX_LOCK(&batch->lock);
+    if (++batch->done_count == batch->count) {
+        pthread_cond_signal(&batch->cond);
+    }
+    PTHREAD_MUTEX_UNLOCK(&batch->lock);
+}
+
+static void *pipeline_thread_func(void *arg)
+{
+    FSAPIContext *ctx;
+    FSAPIPipelineTask *task;
+
+    ctx = (FSAPIContext *)arg;
+    __sync_add_and_fetch(&ctx->pipeline.running_count, 1);
+    while (ctx->pipeline.continue_flag) {
+        task = (FSAPIPipelineTask *)fc_queue_pop(&ctx->pipeline.queue);
+        if (task == NULL) {
+            continue;
+        }
+
+        do_task(ctx, task);
+        task_done(task);
+    }
+    __sync_sub_and_fetch(&ctx->pipeline.running_count, 1);
+
+    return NULL;
+}
+
+int fs_api_pipeline_init(FSAPIContext *ctx, const int threads)
+{
+    const int stack_size = 256 * 1024;
+    pthread_t tid;
+    int result;
+    int i;
+
+    ctx->pipeline.threads = 0;
+    ctx->pipeline.running_count = 0;
+    if (threads <= 0) {
+        return 0;
+    }
+
+    if ((result=fc_queue_init(&ctx->pipeline.queue, (long)
+                    (&((FSAPIPipelineTask *)NULL)->next))) != 0)
+    {
+        return result;
+    }
+
+    ctx->pipeline.continue_flag = true;
+    for (i=0; i<threads; i++) {
+        if ((result=fc_create_thread(&tid, pipeline_thread_func,
+                        ctx, stack_size)) != 0)
+        {
+            break;
+        }
+    }
+
+    if (i == 0) {
+        return result;
+    }
+
+    //the threads created are enough to work
+    ctx->pipeline.threads = i;
+    return 0;
+}
+
+void fs_api_pipeline_destroy(FSAPIContext *ctx)
+{
+    int i;
+
+    if (ctx->pipeline.threads == 0) {
+        return;
+    }
+
+    ctx->pipeline.threads = 0;
+    ctx->pipeline.continue_flag = false;
+    for (i=0; i<300 && __sync_add_and_fetch(&ctx->pipeline.
+                running_count, 0) > 0; i++)
+    {
+        fc_queue_terminate(&ctx->pipeline.queue);
+        fc_sleep_ms(10);
+    }
+
+    if (ctx->pipeline.running_count == 0) {
+        fc_queue_destroy(&ctx->pipeline.queue);
+    }
+}
+
+int fs_api_pipeline_init_tasks(const int64_t oid, const struct iovec *iov,
+        const int iovcnt, const int size, const int64_t offset,
+        const bool is_write, FSAPIPipelineTask *tasks)
+{
+    FSAPIPipelineTask *task;
+    FSBlockSliceKeyInfo bs_key;
+    int done;
+    int remain;
+
+    task = tasks;
+    done = 0;
+    fs_set_block_slice(&bs_key, oid, offset, size);
+    while (1) {
+        task->bs_key = bs_key;
+        task->iov = iov;
+        task->iovcnt = iovcnt;
+        task->iov_offset = done;
+        task->is_write = is_write;
+        task->done_bytes = task->inc_alloc = 0;
+        task->result = 0;
+        task++;
+
+        done += bs_key.slice.length;
+        remain = size - done;
+        if (remain <= 0) {
+            break;
+        }
+        fs_next_block_slice_key(&bs_key, remain);
+    }
+
+    return task - tasks;
+}
+
+int fs_api_pipeline_execute(FSAPIContext *ctx,
+        FSAPIPipelineTask *tasks, const int count)
+{
+    FSAPIPipelineBatch batch;
+    FSAPIPipelineTask *task;
+    FSAPIPipelineTask *end;
+    int result;
+
+    if ((result=init_pthread_lock(&batch.lock)) != 0) {
+        return result;
+    }
+    if ((result=pthread_cond_init(&batch.cond, NULL)) != 0) {
+        pthread_mutex_destroy(&batch.lock);
+        return result;
+    }
+
+    batch.count = count - 1;  //the first task done by the caller
+    batch.done_count = 0;
+    end = tasks + count;
+    for (task=tasks + 1; task<end; task++) {
+        task->batch = &batch;
+        fc_queue_push(&ctx->pipeline.queue, task);
+    }
+
+    //do the first task in the caller thread meanwhile
+    do_task(ctx, tasks);
+
+    PTHREAD_MUTEX_LOCK(&batch.lock);
+    while (batch.done_count < batch.count) {
+        pthread_cond_wait(&batch.cond, &batch.lock);
+    }
+    PTHREAD_MUTEX_UNLOCK(&batch.lock);
+
+    pthread_cond_destroy(&batch.cond);
+    pthread_mutex_destroy(&batch.lock);
+    return 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//fs_api_pipeline.h
+
+/* the pipelined IO for the read and write across the blocks: the IO is
+ * cut into the block slices, and the slice requests are sent concurrently
+ * by the pipeline threads, each thread with its own pooled connection to
+ * the data group of the block. the thread count is the max in-flight
+ * block requests of the context.
+ */
+
+#ifndef _FS_API_PIPELINE_H
+#define _FS_API_PIPELINE_H
+
+#include "fs_api_types.h"
+
+#define FS_API_PIPELINE_DEFAULT_THREADS  8
+#define FS_API_PIPELINE_MAX_THREADS      256
+
+//the tasks on the stack, alloc the tasks when exceeds
+#define FS_API_PIPELINE_FIXED_TASKS      16
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    int fs_api_pipeline_init(FSAPIContext *ctx, const int threads);
+
+    void fs_api_pipeline_destroy(FSAPIContext *ctx);
+
+    static inline bool fs_api_pipeline_enabled(FSAPIContext *ctx,
+            const int64_t offset, const int size)
+    {
+        //only for the IO across the blocks
+        return (ctx->pipeline.threads > 0 && FS_FILE_BLOCK_ALIGN(offset) !=
+                FS_FILE_BLOCK_ALIGN(offset + size - 1));
+    }
+
+    /* cut the IO to the block slices
+       return the task count */
+    int fs_api_pipeline_init_tasks(const int64_t oid,
+            const struct iovec *iov, const int iovcnt, const int size,
+            const int64_t offset, const bool is_write,
+            FSAPIPipelineTask *tasks);
+
+    static inline int fs_api_pipeline_task_count(const int64_t offset,
+            const int size)
+    {
+        return (FS_FILE_BLOCK_ALIGN(offset + size - 1) -
+                FS_FILE_BLOCK_ALIGN(offset)) / FS_FILE_BLOCK_SIZE + 1;
+    }
+
+    /* send the tasks concurrently and wait for all done,
+       the result of each task is set in the task */
+    int fs_api_pipeline_execute(FSAPIContext *ctx,
+            FSAPIPipelineTask *tasks, const int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -19,8 +19,10 @@
 #include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include "fastcommon/fast_mblock.h"
 #include "fastcommon/fast_buffer.h"
+#include "fastcommon/fc_queue.h"
 #include "fastdir/fdir_client.h"
 #include "faststore/fs_client.h"
 
@@ -30,6 +32,27 @@ typedef struct fs_api_opendir_session {
     FastBuffer buffer;
 } FSAPIOpendirSession;
 
+struct fs_api_pipeline_batch;
+typedef struct fs_api_pipeline_task {
+    FSBlockSliceKeyInfo bs_key;
+    const struct iovec *iov;  //the buffers of the whole IO
+    int iovcnt;
+    int iov_offset;           //the offset of the slice in the buffers
+    int done_bytes;
+    int inc_alloc;
+    int result;
+    bool is_write;
+    struct fs_api_pipeline_batch *batch;
+    struct fs_api_pipeline_task *next;  //for queue
+} FSAPIPipelineTask;
+
+typedef struct fs_api_pipeline_context {
+    int threads;    //the max in-flight block requests, 0 for disabled
+    volatile int running_count;
+    volatile bool continue_flag;
+    struct fc_queue queue;
+} FSAPIPipelineContext;
+
 typedef struct fs_api_context {
     string_t ns;  //namespace
     char ns_holder[NAME_MAX];
@@ -39,6 +62,7 @@ typedef struct fs_api_context {
     } contexts;
 
     struct fast_mblock_man opendir_session_pool;
+    FSAPIPipelineContext pipeline;  //for multi-block IO
 } FSAPIContext;
 
 typedef struct fs_api_file_info {
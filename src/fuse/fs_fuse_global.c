@@ -224,6 +224,12 @@ static int load_fuse_config(IniFullContext *ini_ctx)
     g_fuse_global_vars.auto_unmount = iniGetBoolValue(ini_ctx->
             section_name, "auto_unmount", ini_ctx->context, true);
 
+    g_fuse_global_vars.splice_read = iniGetBoolValue(ini_ctx->
+            section_name, "splice_read", ini_ctx->context, false);
+
+    g_fuse_global_vars.splice_write = iniGetBoolValue(ini_ctx->
+            section_name, "splice_write", ini_ctx->context, false);
+
     allow_others = iniGetStrValue(ini_ctx->section_name,
             "allow_others", ini_ctx->context);
     if (allow_others == NULL || *allow_others == '\0') {
@@ -393,13 +399,15 @@ int fs_fuse_global_init(const char *config_filename)
     logInfo("FUSE library version %s, "
             "FastDIR namespace: %s, %sFUSE mountpoint: %s, "
             "owner_type: %s%s, singlethread: %d, clone_fd: %d, "
-            "max_idle_threads: %d, allow_others: %s, auto_unmount: %d, "
+            "max_idle_threads: %d, splice_read: %d, splice_write: %d, "
+            "allow_others: %s, auto_unmount: %d, "
             "attribute_timeout: %.1fs, entry_timeout: %.1fs",
             fuse_pkgversion(), g_fuse_global_vars.ns,
             sf_idempotency_config, g_fuse_global_vars.mountpoint,
             get_owner_type_caption(g_fuse_global_vars.owner.type),
             owner_config, g_fuse_global_vars.singlethread,
             g_fuse_global_vars.clone_fd, g_fuse_global_vars.max_idle_threads,
+            g_fuse_global_vars.splice_read, g_fuse_global_vars.splice_write,
             get_allow_others_caption(g_fuse_global_vars.allow_others),
             g_fuse_global_vars.auto_unmount,
             g_fuse_global_vars.attribute_timeout,
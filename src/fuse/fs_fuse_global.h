@@ -42,6 +42,8 @@ typedef struct {
     int max_idle_threads;
     double attribute_timeout;
     double entry_timeout;
+    bool splice_read;   //splice the write data from the kernel
+    bool splice_write;  //splice the read data to the kernel
     FUSEAllowOthersMode allow_others;
     struct {
         FUSEOwnerType type;
@@ -28,7 +28,32 @@
 #define FS_READDIR_BUFFER_INIT_NORMAL      1
 #define FS_READDIR_BUFFER_INIT_PLUS        2
 
+//the max read / write size of the kernel by default (32 pages)
+#define FS_FUSE_IO_BUFFER_SIZE   (128 * 1024)
+
+//the max memory buffers of the write_buf to write directly
+#define FS_FUSE_MAX_WRITE_IOVCNT  16
+
 static struct fast_mblock_man fh_allocator;
+static struct fast_mblock_man buffer_allocator;
+
+static inline char *alloc_io_buffer(const size_t size)
+{
+    if (size <= FS_FUSE_IO_BUFFER_SIZE) {
+        return (char *)fast_mblock_alloc_object(&buffer_allocator);
+    } else {
+        return (char *)fc_malloc(size);
+    }
+}
+
+static inline void free_io_buffer(char *buff, const size_t size)
+{
+    if (size <= FS_FUSE_IO_BUFFER_SIZE) {
+        fast_mblock_free_object(&buffer_allocator, buff);
+    } else {
+        free(buff);
+    }
+}
 
 static void fill_stat(const FDIRDEntryInfo *dentry, struct stat *stat)
 {
@@ -813,17 +838,10 @@ static void fs_do_read(fuse_req_t req, fuse_ino_t ino, size_t size,
 			  off_t offset, struct fuse_file_info *fi)
 {
     FSAPIFileInfo *fh;
+    struct fuse_bufvec bufv = FUSE_BUFVEC_INIT(0);
     int result;
     int read_bytes;
-    char fixed_buff[128 * 1024];
     char *buff;
-    
-    if (size < sizeof(fixed_buff)) {
-        buff = fixed_buff;
-    } else if ((buff=(char *)fc_malloc(size)) == NULL) {
-        fuse_reply_err(req, ENOMEM);
-        return;
-    }
 
     fh = (FSAPIFileInfo *)fi->fh;
     if (fh == NULL) {
@@ -831,6 +849,11 @@ static void fs_do_read(fuse_req_t req, fuse_ino_t ino, size_t size,
         return;
     }
 
+    if ((buff=alloc_io_buffer(size)) == NULL) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
     /*
     logInfo("file: "__FILE__", line: %d, func: %s, "
             "ino: %"PRId64", fh: %p, size: %"PRId64", offset: %"PRId64,
@@ -839,13 +862,15 @@ static void fs_do_read(fuse_req_t req, fuse_ino_t ino, size_t size,
 
     if ((result=fsapi_pread(fh, buff, size, offset, &read_bytes)) != 0) {
         fuse_reply_err(req, result);
-        return;
+    } else {
+        /* the data is copied to the device or the pipe before return,
+           so the buffer can be reused at once */
+        bufv.buf[0].mem = buff;
+        bufv.buf[0].size = read_bytes;
+        fuse_reply_data(req, &bufv, FUSE_BUF_SPLICE_MOVE);
     }
 
-    fuse_reply_buf(req, buff, read_bytes);
-    if (buff != fixed_buff) {
-        free(buff);
-    }
+    free_io_buffer(buff, size);
 }
 
 void fs_do_write(fuse_req_t req, fuse_ino_t ino, const char *buff,
@@ -881,6 +906,82 @@ void fs_do_write(fuse_req_t req, fuse_ino_t ino, const char *buff,
     fuse_reply_write(req, written_bytes);
 }
 
+/* convert the memory buffers to the iovec,
+   return the iovec count, 0 for the buffer from fd (the pipe) */
+static int write_bufv_to_iovec(struct fuse_bufvec *bufv,
+        struct iovec *iov, const int max_count)
+{
+    struct fuse_buf *buf;
+    size_t off;
+    int count;
+
+    count = 0;
+    off = bufv->off;
+    for (buf=bufv->buf + bufv->idx; buf<bufv->buf + bufv->count; buf++) {
+        if ((buf->flags & FUSE_BUF_IS_FD) || count == max_count) {
+            return 0;
+        }
+
+        if (buf->size > off) {
+            iov[count].iov_base = (char *)buf->mem + off;
+            iov[count].iov_len = buf->size - off;
+            count++;
+        }
+        off = 0;
+    }
+
+    return count;
+}
+
+static void fs_do_write_buf(fuse_req_t req, fuse_ino_t ino,
+        struct fuse_bufvec *bufv, off_t offset, struct fuse_file_info *fi)
+{
+    FSAPIFileInfo *fh;
+    struct iovec iov[FS_FUSE_MAX_WRITE_IOVCNT];
+    struct fuse_bufvec dest = FUSE_BUFVEC_INIT(0);
+    size_t size;
+    ssize_t copied;
+    int iovcnt;
+    int result;
+    int written_bytes;
+    char *buff;
+
+    fh = (FSAPIFileInfo *)fi->fh;
+    if (fh == NULL) {
+        fuse_reply_err(req, EBADF);
+        return;
+    }
+
+    if ((iovcnt=write_bufv_to_iovec(bufv, iov,
+                    FS_FUSE_MAX_WRITE_IOVCNT)) > 0)
+    {
+        //write the memory buffers of the request directly
+        result = fsapi_pwritev(fh, iov, iovcnt, offset, &written_bytes);
+    } else {
+        //the data in the pipe (splice read) or too many buffers
+        size = fuse_buf_size(bufv);
+        if ((buff=alloc_io_buffer(size)) == NULL) {
+            fuse_reply_err(req, ENOMEM);
+            return;
+        }
+
+        dest.buf[0].mem = buff;
+        dest.buf[0].size = size;
+        if ((copied=fuse_buf_copy(&dest, bufv, 0)) < 0) {
+            result = -1 * copied;
+        } else {
+            result = fsapi_pwrite(fh, buff, copied, offset, &written_bytes);
+        }
+        free_io_buffer(buff, size);
+    }
+
+    if (result != 0) {
+        fuse_reply_err(req, result);
+    } else {
+        fuse_reply_write(req, written_bytes);
+    }
+}
+
 void fs_do_lseek(fuse_req_t req, fuse_ino_t ino, off_t offset,
         int whence, struct fuse_file_info *fi)
 {
@@ -1005,6 +1106,30 @@ static void fs_do_fallocate(fuse_req_t req, fuse_ino_t ino, int mode,
     fuse_reply_err(req, result);
 }
 
+static void fs_do_init(void *userdata, struct fuse_conn_info *conn)
+{
+    /* the write data in the memory buffer is written to the server
+       directly, the splice read adds a copy from the pipe */
+    if (g_fuse_global_vars.splice_read &&
+            (conn->capable & FUSE_CAP_SPLICE_READ))
+    {
+        conn->want |= FUSE_CAP_SPLICE_READ;
+    } else {
+        conn->want &= ~FUSE_CAP_SPLICE_READ;
+    }
+
+    if (g_fuse_global_vars.splice_write &&
+            (conn->capable & FUSE_CAP_SPLICE_WRITE))
+    {
+        conn->want |= FUSE_CAP_SPLICE_WRITE;
+        if (conn->capable & FUSE_CAP_SPLICE_MOVE) {
+            conn->want |= FUSE_CAP_SPLICE_MOVE;
+        }
+    } else {
+        conn->want &= ~(FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE);
+    }
+}
+
 int fs_fuse_wrapper_init(struct fuse_lowlevel_ops *ops)
 {
     int result;
@@ -1014,7 +1139,14 @@ int fs_fuse_wrapper_init(struct fuse_lowlevel_ops *ops)
         return result;
     }
 
+    if ((result=fast_mblock_init_ex1(&buffer_allocator, "fuse_io_buffer",
+                    FS_FUSE_IO_BUFFER_SIZE, 16, 0, NULL, NULL, true)) != 0)
+    {
+        return result;
+    }
+
     memset(ops, 0, sizeof(*ops));
+    ops->init    = fs_do_init;
     ops->lookup  = fs_do_lookup;
     ops->getattr = fs_do_getattr;
     ops->setattr = fs_do_setattr;
@@ -1030,6 +1162,7 @@ int fs_fuse_wrapper_init(struct fuse_lowlevel_ops *ops)
     ops->release = fs_do_release;
     ops->read    = fs_do_read;
     ops->write   = fs_do_write;
+    ops->write_buf = fs_do_write_buf;
     ops->mknod   = fs_do_mknod;
     ops->mkdir   = fs_do_mkdir;
     ops->rmdir   = fs_do_rmdir;
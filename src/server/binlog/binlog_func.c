@@ -24,6 +24,7 @@
 #include <errno.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <pthread.h>
 #include "fastcommon/shared_func.h"
 #include "fastcommon/logger.h"
@@ -138,11 +139,20 @@ static int get_start_binlog_index_by_timestamp(const char *subdir_name,
 {
     char filename[PATH_MAX];
     int result;
+    int start_index;
     time_t timestamp;
 
+    start_index = *binlog_index;
     while (*binlog_index >= 0) {
         binlog_reader_get_filename(subdir_name, *binlog_index,
                 filename, sizeof(filename));
+        if (*binlog_index < start_index && access(filename, F_OK) != 0
+                && errno == ENOENT)
+        {
+            //the old binlog files removed after the index snapshot
+            (*binlog_index)++;
+            break;
+        }
         result = binlog_get_first_timestamp(filename, &timestamp);
         if (result == 0) {
             if (timestamp < from_timestamp) {
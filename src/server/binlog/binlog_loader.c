@@ -58,8 +58,9 @@ static int parse_binlog(BinlogParseContext *ctx)
     return result;
 }
 
-int binlog_loader_load(const char *subdir_name,
+int binlog_loader_load_ex(const char *subdir_name,
         struct sf_binlog_writer_info *writer,
+        const SFBinlogFilePosition *position,
         binlog_parse_line_func parse_line)
 {
     BinlogReadThreadContext read_thread_ctx;
@@ -73,7 +74,7 @@ int binlog_loader_load(const char *subdir_name,
     start_time = get_current_time_ms();
 
     if ((result=binlog_read_thread_init(&read_thread_ctx, subdir_name,
-                    writer, NULL, BINLOG_BUFFER_SIZE)) != 0)
+                    writer, position, BINLOG_BUFFER_SIZE)) != 0)
     {
         return result;
     }
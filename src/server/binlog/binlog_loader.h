@@ -80,8 +80,12 @@ typedef int (*binlog_parse_line_func)(BinlogReadThreadResult *r, \
 extern "C" {
 #endif
 
-    int binlog_loader_load(const char *subdir_name,
+#define binlog_loader_load(subdir_name, writer, parse_line) \
+    binlog_loader_load_ex(subdir_name, writer, NULL, parse_line)
+
+    int binlog_loader_load_ex(const char *subdir_name,
             struct sf_binlog_writer_info *writer,
+            const SFBinlogFilePosition *position,
             binlog_parse_line_func parse_line);
 
 
@@ -30,9 +30,11 @@
 #include "sf/sf_global.h"
 #include "../../common/fs_func.h"
 #include "../server_global.h"
+#include "../storage/object_block_snapshot.h"
 #include "binlog_func.h"
 #include "binlog_reader.h"
 #include "slice_binlog.h"
+#include "slice_binlog_bin.h"
 #include "replica_binlog.h"
 #include "binlog_repair.h"
 
@@ -497,6 +499,20 @@ static int binlog_repair_finish(const int data_group_id,
         }
 
         rename_count++;
+        if (data_group_id == 0) {  //the binary file is stale
+            binlog_reader_get_filename_ex(subdir_name,
+                    SLICE_BIN_FILENAME_SUFFIX, index,
+                    dest_filename, sizeof(dest_filename));
+            unlink(dest_filename);
+        }
+    }
+
+    /* the snapshot maybe contains the slices of the removed records
+       and its binlog position maybe invalid */
+    if (data_group_id == 0 && rename_count > 0) {
+        if ((result=ob_snapshot_remove()) != 0) {
+            return result;
+        }
     }
 
     /*
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "fastcommon/shared_func.h"
+#include "fastcommon/logger.h"
+#include "sf/sf_global.h"
+#include "sf/sf_binlog_writer.h"
+#include "../server_global.h"
+#include "slice_binlog.h"
+#include "replica_binlog.h"
+#include "binlog_sync.h"
+
+typedef struct binlog_sync_file {
+    struct sf_binlog_writer_info *writer;
+    int index;   //the binlog index of the fd
+    int fd;
+    int64_t synced_size;
+} BinlogSyncFile;
+
+typedef struct binlog_sync_context {
+    int interval;  //in ms
+    int count;
+    BinlogSyncFile *files;
+} BinlogSyncContext;
+
+static BinlogSyncContext binlog_sync_ctx = {0, 0, NULL};
+
+static int sync_file_fd(BinlogSyncFile *file, const char *filename)
+{
+    struct stat stbuf;
+    int result;
+
+    if (fstat(file->fd, &stbuf) != 0) {
+        result = errno != 0 ? errno : EIO;
+        logError("file: "__FILE__", line: %d, "
+                "fstat binlog file: %s fail, errno: %d, error info: %s",
+                __LINE__, filename, result, STRERROR(result));
+        return result;
+    }
+
+    if (stbuf.st_size == file->synced_size) {
+        return 0;
+    }
+
+    if (fdatasync(file->fd) != 0) {
+        result = errno != 0 ? errno : EIO;
+        logError("file: "__FILE__", line: %d, "
+                "fdatasync binlog file: %s fail, errno: %d, error info: %s",
+                __LINE__, filename, result, STRERROR(result));
+        return result;
+    }
+
+    file->synced_size = stbuf.st_size;
+    return 0;
+}
+
+static int sync_file(BinlogSyncFile *file)
+{
+    char filename[PATH_MAX];
+    int index;
+    int result;
+
+    index = sf_binlog_get_current_write_index(file->writer);
+    if (file->fd >= 0 && file->index != index) {
+        //the binlog writer switched to the next file, sync the old at last
+        sf_binlog_writer_get_filename(file->writer->cfg.subdir_name,
+                file->index, filename, sizeof(filename));
+        sync_file_fd(file, filename);
+        close(file->fd);
+        file->fd = -1;
+    }
+
+    sf_binlog_writer_get_filename(file->writer->cfg.subdir_name,
+            index, filename, sizeof(filename));
+    if (file->fd < 0) {
+        if ((file->fd=open(filename, O_RDONLY)) < 0) {
+            result = errno != 0 ? errno : EACCES;
+            if (result == ENOENT) {  //NOT created yet
+                return 0;
+            }
+            logError("file: "__FILE__", line: %d, "
+                    "open binlog file: %s fail, errno: %d, error info: %s",
+                    __LINE__, filename, result, STRERROR(result));
+            return result;
+        }
+        file->index = index;
+        file->synced_size = 0;
+    }
+
+    return sync_file_fd(file, filename);
+}
+
+static void *binlog_sync_thread_func(void *arg)
+{
+    BinlogSyncFile *file;
+    BinlogSyncFile *end;
+
+    end = binlog_sync_ctx.files + binlog_sync_ctx.count;
+    while (SF_G_CONTINUE_FLAG) {
+        fc_sleep_ms(binlog_sync_ctx.interval);
+        for (file=binlog_sync_ctx.files; file<end; file++) {
+            sync_file(file);
+        }
+    }
+
+    for (file=binlog_sync_ctx.files; file<end; file++) {
+        if (file->fd >= 0) {
+            sync_file(file);
+            close(file->fd);
+            file->fd = -1;
+        }
+    }
+    return NULL;
+}
+
+static int init_sync_files()
+{
+    FSIdArray *id_array;
+    BinlogSyncFile *file;
+    int bytes;
+    int i;
+
+    if ((id_array=fs_cluster_cfg_get_my_data_group_ids(&CLUSTER_CONFIG_CTX,
+                    CLUSTER_MYSELF_PTR->server->id)) == NULL)
+    {
+        logError("file: "__FILE__", line: %d, "
+                "cluster config file no data group", __LINE__);
+        return ENOENT;
+    }
+
+    binlog_sync_ctx.count = 1 + id_array->count;
+    bytes = sizeof(BinlogSyncFile) * binlog_sync_ctx.count;
+    binlog_sync_ctx.files = (BinlogSyncFile *)fc_malloc(bytes);
+    if (binlog_sync_ctx.files == NULL) {
+        return ENOMEM;
+    }
+    memset(binlog_sync_ctx.files, 0, bytes);
+
+    file = binlog_sync_ctx.files;
+    file->writer = slice_binlog_get_writer();
+    file->fd = -1;
+    for (i=0; i<id_array->count; i++) {
+        file++;
+        file->writer = replica_binlog_get_writer(id_array->ids[i]);
+        file->fd = -1;
+    }
+
+    return 0;
+}
+
+int binlog_sync_init()
+{
+    int result;
+    pthread_t tid;
+
+    switch (STORAGE_CFG.durability.mode) {
+        case FS_DURABILITY_MODE_PERIODIC:
+            binlog_sync_ctx.interval = STORAGE_CFG.durability.fsync_interval;
+            break;
+        case FS_DURABILITY_MODE_GROUP_COMMIT:
+            binlog_sync_ctx.interval = FC_MAX(STORAGE_CFG.
+                    durability.group_window, 1);
+            break;
+        default:
+            return 0;
+    }
+
+    if ((result=init_sync_files()) != 0) {
+        return result;
+    }
+
+    return fc_create_thread(&tid, binlog_sync_thread_func,
+            NULL, SF_G_THREAD_STACK_SIZE);
+}
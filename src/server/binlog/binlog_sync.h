@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//binlog_sync.h
+
+/* sync the current files of the slice binlog and the replica binlogs
+ * by the global durability mode of the storage config:
+ *   periodic: per fsync_interval
+ *   group_commit: per fsync_group_window, the records written within
+ *                 the window are synced by one fdatasync per binlog file
+ * the file is synced only when it grows since the last sync, and synced
+ * at last when the binlog writer switches to the next file
+ */
+
+#ifndef _BINLOG_SYNC_H
+#define _BINLOG_SYNC_H
+
+#include "../../common/fs_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    //start the sync thread after the binlogs inited
+    int binlog_sync_init();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -45,6 +45,9 @@
 
 #define BINLOG_SOURCE_RPC           'C'  //by user call
 #define BINLOG_SOURCE_REPLAY        'R'  //by binlog replay
+#define BINLOG_SOURCE_MIGRATE       'M'  //by write cache migrating
+#define BINLOG_SOURCE_RECLAIM       'L'  //by trunk space reclaiming
+#define BINLOG_SOURCE_DEFRAG        'D'  //by block defragmenting
 
 #define BINLOG_IS_INTERNAL_RECORD(op_type, data_version)  \
     (op_type == BINLOG_OP_TYPE_NO_OP || data_version == 0)
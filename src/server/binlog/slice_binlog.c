@@ -15,6 +15,7 @@
 
 #include <limits.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include "fastcommon/shared_func.h"
 #include "fastcommon/logger.h"
@@ -26,7 +27,9 @@
 #include "../dio/trunk_io_thread.h"
 #include "../storage/storage_allocator.h"
 #include "../storage/trunk_id_info.h"
+#include "../storage/object_block_snapshot.h"
 #include "binlog_loader.h"
+#include "slice_binlog_bin.h"
 #include "slice_binlog.h"
 
 #define ADD_SLICE_FIELD_INDEX_SPACE_PATH_INDEX 8
@@ -125,6 +128,14 @@ static int add_slice(BinlogReadThreadResult *r, string_t *line,
     SLICE_PARSE_INT(slice->space.size,
             ADD_SLICE_FIELD_INDEX_SPACE_SIZE, '\n', 0);
 
+    /* the trunk is deleted after its slices migrated to another trunk */
+    if (!storage_allocator_trunk_exists(path_index,
+                slice->space.id_info.id))
+    {
+        ob_index_free_slice(slice);
+        return 0;
+    }
+
     return ob_index_add_slice_by_binlog(slice);
 }
 
@@ -248,6 +259,192 @@ static int slice_parse_line(BinlogReadThreadResult *r, string_t *line)
     return result;
 }
 
+static int bin_add_slice(const SliceBinlogRecord *record,
+        const OBSliceType slice_type)
+{
+    FSBlockKey bkey;
+    OBSliceEntry *slice;
+
+    if (record->space.path_index > STORAGE_CFG.max_store_path_index ||
+            PATHS_BY_INDEX_PPTR[record->space.path_index] == NULL)
+    {
+        logError("file: "__FILE__", line: %d, "
+                "path_index: %d not exist", __LINE__,
+                record->space.path_index);
+        return ENOENT;
+    }
+
+    /* the trunk is deleted after its slices migrated to another trunk */
+    if (!storage_allocator_trunk_exists(record->space.path_index,
+                record->space.trunk_id))
+    {
+        return 0;
+    }
+
+    bkey.oid = record->block.oid;
+    bkey.offset = record->block.offset;
+    fs_calc_block_hashcode(&bkey);
+    if ((slice=ob_index_alloc_slice(&bkey)) == NULL) {
+        return ENOMEM;
+    }
+
+    slice->read_offset = 0;
+    slice->type = slice_type;
+    slice->ssize.offset = record->slice.offset;
+    slice->ssize.length = record->slice.length;
+    slice->space.store = &PATHS_BY_INDEX_PPTR[
+        record->space.path_index]->store;
+    slice->space.id_info.id = record->space.trunk_id;
+    slice->space.id_info.subdir = record->space.subdir;
+    slice->space.offset = record->space.offset;
+    slice->space.size = record->space.size;
+    return ob_index_add_slice_by_binlog(slice);
+}
+
+static int bin_replay_record(const SliceBinlogRecord *record)
+{
+    FSBlockSliceKeyInfo bs_key;
+
+    switch (record->op_type) {
+        case SLICE_BINLOG_OP_TYPE_WRITE_SLICE:
+            return bin_add_slice(record, OB_SLICE_TYPE_FILE);
+        case SLICE_BINLOG_OP_TYPE_ALLOC_SLICE:
+            return bin_add_slice(record, OB_SLICE_TYPE_ALLOC);
+        case SLICE_BINLOG_OP_TYPE_DEL_SLICE:
+            bs_key.block.oid = record->block.oid;
+            bs_key.block.offset = record->block.offset;
+            bs_key.slice.offset = record->slice.offset;
+            bs_key.slice.length = record->slice.length;
+            fs_calc_block_hashcode(&bs_key.block);
+            return ob_index_delete_slices_by_binlog(&bs_key);
+        case SLICE_BINLOG_OP_TYPE_DEL_BLOCK:
+            bs_key.block.oid = record->block.oid;
+            bs_key.block.offset = record->block.offset;
+            fs_calc_block_hashcode(&bs_key.block);
+            return ob_index_delete_block_by_binlog(&bs_key.block);
+        default:
+            logError("file: "__FILE__", line: %d, "
+                    "invalid op_type: %c (0x%02x)", __LINE__,
+                    record->op_type, (unsigned char)record->op_type);
+            return EINVAL;
+    }
+}
+
+static int load_bin_file(const char *filename, int64_t *record_count)
+{
+    SliceBinReader reader;
+    SliceBinRecord *records;
+    SliceBinRecord *bin;
+    SliceBinRecord *end;
+    SliceBinlogRecord record;
+    int count;
+    int result;
+
+    if ((result=slice_bin_reader_open(&reader, filename)) != 0) {
+        return result;
+    }
+
+    *record_count = 0;
+    while ((result=slice_bin_reader_next(&reader,
+                    &records, &count)) == 0)
+    {
+        end = records + count;
+        for (bin=records; bin<end; bin++) {
+            slice_bin_unpack_record(bin, &record);
+            if ((result=bin_replay_record(&record)) != 0) {
+                logError("file: "__FILE__", line: %d, "
+                        "binary binlog file %s, offset: %"PRId64", "
+                        "op_type: %c, add to index fail, errno: %d",
+                        __LINE__, filename, reader.offset,
+                        record.op_type, result);
+                slice_bin_reader_close(&reader);
+                return result;
+            }
+        }
+        *record_count += count;
+    }
+
+    if (result == ENOENT) {
+        if (*record_count == reader.record_count) {
+            result = 0;
+        } else {
+            logError("file: "__FILE__", line: %d, "
+                    "binary binlog file %s, record count: %"PRId64" "
+                    "!= %"PRId64" in file header", __LINE__, filename,
+                    *record_count, reader.record_count);
+            result = EINVAL;
+        }
+    }
+
+    slice_bin_reader_close(&reader);
+    return result;
+}
+
+/* load the binary binlog files converted from the text files from
+   the position, stop at the first binlog file without valid binary file */
+static int load_bin_binlogs(SFBinlogFilePosition *position)
+{
+    char filename[PATH_MAX];
+    char bin_filename[PATH_MAX];
+    struct stat stbuf;
+    int64_t source_size;
+    int64_t record_count;
+    int64_t total_count;
+    int64_t start_time;
+    int start_index;
+    int write_index;
+    int result;
+
+    if (position->offset > 0) {  //the binary file can't seek by offset
+        return 0;
+    }
+
+    start_time = get_current_time_ms();
+    write_index = slice_binlog_get_current_write_index();
+    total_count = 0;
+    start_index = position->index;
+    for (; position->index<=write_index; position->index++) {
+        binlog_reader_get_filename_ex(FS_SLICE_BINLOG_SUBDIR_NAME,
+                SLICE_BIN_FILENAME_SUFFIX, position->index,
+                bin_filename, sizeof(bin_filename));
+        if (slice_bin_get_source_size(bin_filename, &source_size) != 0) {
+            break;
+        }
+
+        binlog_reader_get_filename(FS_SLICE_BINLOG_SUBDIR_NAME,
+                position->index, filename, sizeof(filename));
+        if (stat(filename, &stbuf) != 0 || stbuf.st_size != source_size) {
+            logWarning("file: "__FILE__", line: %d, "
+                    "binary binlog file %s is stale, load from "
+                    "the text binlog file", __LINE__, bin_filename);
+            break;
+        }
+
+        if ((result=load_bin_file(bin_filename, &record_count)) != 0) {
+            if (result != EINVAL) {
+                return result;
+            }
+
+            /* the replay of the slice binlog is idempotent,
+               so reload the whole text file is safe */
+            logWarning("file: "__FILE__", line: %d, "
+                    "binary binlog file %s is corrupted, load from "
+                    "the text binlog file", __LINE__, bin_filename);
+            break;
+        }
+        total_count += record_count;
+    }
+
+    if (position->index > start_index) {
+        logInfo("file: "__FILE__", line: %d, "
+                "load %d binary %s binlog files done. record count: "
+                "%"PRId64", time used: %"PRId64" ms", __LINE__,
+                position->index - start_index, FS_SLICE_BINLOG_SUBDIR_NAME,
+                total_count, get_current_time_ms() - start_time);
+    }
+    return 0;
+}
+
 static int init_binlog_writer()
 {
     int result;
@@ -274,16 +471,162 @@ int slice_binlog_get_current_write_index()
     return sf_binlog_get_current_write_index(&binlog_writer.writer);
 }
 
+/* the binlogs before the snapshot maybe removed, the object block index
+   is incomplete when replay from the start without the snapshot */
+static int check_first_binlog_exists()
+{
+    char filename[PATH_MAX];
+
+    if (slice_binlog_get_current_write_index() == 0) {
+        return 0;
+    }
+
+    binlog_reader_get_filename(FS_SLICE_BINLOG_SUBDIR_NAME,
+            0, filename, sizeof(filename));
+    if (access(filename, F_OK) != 0 && errno == ENOENT) {
+        logError("file: "__FILE__", line: %d, "
+                "no valid snapshot and the %s binlog file %s "
+                "NOT exist (removed after the snapshot saved), "
+                "can't load the object block index", __LINE__,
+                FS_SLICE_BINLOG_SUBDIR_NAME, filename);
+        return ENOENT;
+    }
+
+    return 0;
+}
+
 int slice_binlog_init()
 {
+    SFBinlogFilePosition position;
     int result;
 
     if ((result=init_binlog_writer()) != 0) {
         return result;
     }
 
-    return binlog_loader_load(FS_SLICE_BINLOG_SUBDIR_NAME,
-            &binlog_writer.writer, slice_parse_line);
+    /* load the snapshot of the object block index, then replay
+       the slice binlog after the snapshot */
+    result = ob_snapshot_load(&position);
+    if (result == EINVAL) {
+        logWarning("file: "__FILE__", line: %d, "
+                "the snapshot is invalid, replay the %s binlog "
+                "from the start", __LINE__, FS_SLICE_BINLOG_SUBDIR_NAME);
+    } else if (result != 0 && result != ENOENT) {
+        return result;
+    }
+    if (result != 0) {
+        if ((result=check_first_binlog_exists()) != 0) {
+            return result;
+        }
+        position.index = 0;
+        position.offset = 0;
+    }
+
+    if ((result=load_bin_binlogs(&position)) != 0) {
+        return result;
+    }
+    if (position.index > slice_binlog_get_current_write_index()) {
+        return 0;
+    }
+
+    return binlog_loader_load_ex(FS_SLICE_BINLOG_SUBDIR_NAME,
+            &binlog_writer.writer, &position, slice_parse_line);
+}
+
+int slice_binlog_get_current_position(SFBinlogFilePosition *position)
+{
+    char filename[PATH_MAX];
+    char buff[FS_SLICE_BINLOG_MAX_RECORD_SIZE];
+    struct stat stbuf;
+    char *line_end;
+    int64_t read_offset;
+    int read_bytes;
+    int fd;
+    int result;
+
+    position->index = slice_binlog_get_current_write_index();
+    binlog_reader_get_filename(FS_SLICE_BINLOG_SUBDIR_NAME,
+            position->index, filename, sizeof(filename));
+    if ((fd=open(filename, O_RDONLY)) < 0) {
+        result = errno != 0 ? errno : EACCES;
+        if (result == ENOENT) {  //not created yet
+            position->offset = 0;
+            return 0;
+        }
+        logError("file: "__FILE__", line: %d, "
+                "open file \"%s\" fail, "
+                "errno: %d, error info: %s",
+                __LINE__, filename, result, STRERROR(result));
+        return result;
+    }
+
+    if (fstat(fd, &stbuf) != 0) {
+        result = errno != 0 ? errno : EACCES;
+        logError("file: "__FILE__", line: %d, "
+                "stat file \"%s\" fail, "
+                "errno: %d, error info: %s",
+                __LINE__, filename, result, STRERROR(result));
+        close(fd);
+        return result;
+    }
+
+    /* the writer maybe writing the last record,
+       so the position is the end of the last whole line */
+    read_offset = stbuf.st_size > sizeof(buff) ?
+        stbuf.st_size - sizeof(buff) : 0;
+    read_bytes = pread(fd, buff, stbuf.st_size - read_offset, read_offset);
+    close(fd);
+    if (read_bytes < 0) {
+        result = errno != 0 ? errno : EIO;
+        logError("file: "__FILE__", line: %d, "
+                "read file \"%s\" fail, "
+                "errno: %d, error info: %s",
+                __LINE__, filename, result, STRERROR(result));
+        return result;
+    }
+
+    line_end = (char *)fc_memrchr(buff, '\n', read_bytes);
+    if (line_end == NULL) {
+        if (read_offset > 0) {
+            logError("file: "__FILE__", line: %d, "
+                    "binlog file: %s, expect new line (\\n) in the "
+                    "last %d bytes", __LINE__, filename, read_bytes);
+            return EINVAL;
+        }
+        position->offset = 0;
+    } else {
+        position->offset = read_offset + (line_end - buff) + 1;
+    }
+
+    return 0;
+}
+
+void slice_binlog_remove_files_before(const int binlog_index)
+{
+    char filename[PATH_MAX];
+    int index;
+
+    for (index=binlog_index-1; index>=0; index--) {
+        binlog_reader_get_filename_ex(FS_SLICE_BINLOG_SUBDIR_NAME,
+                SLICE_BIN_FILENAME_SUFFIX, index,
+                filename, sizeof(filename));
+        unlink(filename);
+
+        binlog_reader_get_filename(FS_SLICE_BINLOG_SUBDIR_NAME,
+                index, filename, sizeof(filename));
+        if (unlink(filename) != 0) {
+            if (errno != ENOENT) {
+                logWarning("file: "__FILE__", line: %d, "
+                        "unlink file \"%s\" fail, "
+                        "errno: %d, error info: %s", __LINE__,
+                        filename, errno, STRERROR(errno));
+            }
+            break;  //the files before are removed already
+        }
+
+        logInfo("file: "__FILE__", line: %d, "
+                "slice binlog file %s removed", __LINE__, filename);
+    }
 }
 
 void slice_binlog_destroy()
@@ -18,12 +18,9 @@
 #define _SLICE_BINLOG_H
 
 #include "fastcommon/sched_thread.h"
+#include "sf/sf_binlog_writer.h"
 #include "../storage/object_block_index.h"
-
-#define SLICE_BINLOG_OP_TYPE_WRITE_SLICE  BINLOG_OP_TYPE_WRITE_SLICE
-#define SLICE_BINLOG_OP_TYPE_ALLOC_SLICE  BINLOG_OP_TYPE_ALLOC_SLICE
-#define SLICE_BINLOG_OP_TYPE_DEL_SLICE    BINLOG_OP_TYPE_DEL_SLICE
-#define SLICE_BINLOG_OP_TYPE_DEL_BLOCK    BINLOG_OP_TYPE_DEL_BLOCK
+#include "slice_binlog_bin.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -36,6 +33,12 @@ extern "C" {
 
     struct sf_binlog_writer_info *slice_binlog_get_writer();
 
+    //the position after the last whole record of the current write file
+    int slice_binlog_get_current_position(SFBinlogFilePosition *position);
+
+    //remove the binlog files before the binlog index
+    void slice_binlog_remove_files_before(const int binlog_index);
+
     int slice_binlog_log_add_slice(const OBSliceEntry *slice,
             const time_t current_time, const uint64_t sn,
             const uint64_t data_version, const int source);
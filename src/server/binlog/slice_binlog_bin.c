@@ -0,0 +1,646 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+#include "fastcommon/shared_func.h"
+#include "fastcommon/logger.h"
+#include "slice_binlog_bin.h"
+
+#define SLICE_BIN_READ_BUFFER_SIZE  (1024 * 1024)
+
+#define SLICE_BIN_BLOCK_BODY_MAX_SIZE  (sizeof(SliceBinRecord) * \
+        SLICE_BIN_MAX_RECORDS_PER_BLOCK)
+
+#define SLICE_BIN_BLOCK_CRC_FIELD_OFFSET \
+    ((long)&((SliceBinBlockHeader *)0)->crc32c)
+
+#define SLICE_BIN_FILE_CRC_FIELD_OFFSET \
+    ((long)&((SliceBinFileHeader *)0)->crc32c)
+
+#define TEXT_FIELD_COUNT_ADD_SLICE  13
+#define TEXT_FIELD_COUNT_DEL_SLICE   8
+#define TEXT_FIELD_COUNT_DEL_BLOCK   6
+#define TEXT_MAX_FIELD_COUNT        16
+
+#define TEXT_PARSE_INT(var, caption, index, endchr, min_val) \
+    do {   \
+        var = strtoll(cols[index].str, &endptr, 10);  \
+        if (*endptr != endchr || var < min_val) {     \
+            sprintf(error_info, "invalid %s: %.*s",   \
+                    caption, cols[index].len, cols[index].str); \
+            return EINVAL;  \
+        }  \
+    } while (0)
+
+#if !defined(__SSE4_2__)
+//the tables for slicing-by-8
+static uint32_t crc32c_table[8][256];
+static pthread_once_t crc32c_table_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init_table()
+{
+    uint32_t crc;
+    int i;
+    int k;
+
+    for (i=0; i<256; i++) {
+        crc = i;
+        for (k=0; k<8; k++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+        }
+        crc32c_table[0][i] = crc;
+    }
+
+    for (i=0; i<256; i++) {
+        crc = crc32c_table[0][i];
+        for (k=1; k<8; k++) {
+            crc = crc32c_table[0][crc & 0xFF] ^ (crc >> 8);
+            crc32c_table[k][i] = crc;
+        }
+    }
+}
+#endif
+
+uint32_t slice_bin_crc32c(uint32_t crc, const void *buff, const int len)
+{
+    const unsigned char *p;
+    const unsigned char *end;
+
+    p = (const unsigned char *)buff;
+    end = p + len;
+    crc = ~crc;
+#if defined(__SSE4_2__)
+    while (end - p >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = (uint32_t)_mm_crc32_u64(crc, v);
+        p += 8;
+    }
+    while (p < end) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+#else
+    pthread_once(&crc32c_table_once, crc32c_init_table);
+    while (end - p >= 8) {
+        uint32_t lo;
+        uint32_t hi;
+
+        lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24));
+        hi = p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t)p[7] << 24);
+        crc = crc32c_table[7][lo & 0xFF] ^
+            crc32c_table[6][(lo >> 8) & 0xFF] ^
+            crc32c_table[5][(lo >> 16) & 0xFF] ^
+            crc32c_table[4][lo >> 24] ^
+            crc32c_table[3][hi & 0xFF] ^
+            crc32c_table[2][(hi >> 8) & 0xFF] ^
+            crc32c_table[1][(hi >> 16) & 0xFF] ^
+            crc32c_table[0][hi >> 24];
+        p += 8;
+    }
+    while (p < end) {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+#endif
+
+    return ~crc;
+}
+
+void slice_bin_pack_record(const SliceBinlogRecord *record,
+        SliceBinRecord *bin)
+{
+    int2buff(record->timestamp, bin->timestamp);
+    bin->source = record->source;
+    bin->op_type = record->op_type;
+    short2buff(record->space.path_index, bin->path_index);
+    long2buff(record->data_version, bin->data_version);
+    long2buff(record->block.oid, bin->oid);
+    long2buff(record->block.offset, bin->block_offset);
+    int2buff(record->slice.offset, bin->slice_offset);
+    int2buff(record->slice.length, bin->slice_length);
+    long2buff(record->space.trunk_id, bin->trunk_id);
+    int2buff(record->space.subdir, bin->subdir);
+    int2buff(record->space.size, bin->space_size);
+    long2buff(record->space.offset, bin->space_offset);
+}
+
+void slice_bin_unpack_record(const SliceBinRecord *bin,
+        SliceBinlogRecord *record)
+{
+    record->timestamp = (uint32_t)buff2int(bin->timestamp);
+    record->source = bin->source;
+    record->op_type = bin->op_type;
+    record->space.path_index = buff2short(bin->path_index);
+    record->data_version = buff2long(bin->data_version);
+    record->block.oid = buff2long(bin->oid);
+    record->block.offset = buff2long(bin->block_offset);
+    record->slice.offset = buff2int(bin->slice_offset);
+    record->slice.length = buff2int(bin->slice_length);
+    record->space.trunk_id = buff2long(bin->trunk_id);
+    record->space.subdir = (uint32_t)buff2int(bin->subdir);
+    record->space.size = (uint32_t)buff2int(bin->space_size);
+    record->space.offset = buff2long(bin->space_offset);
+}
+
+int slice_bin_parse_text_line(const string_t *line,
+        SliceBinlogRecord *record, char *error_info)
+{
+    string_t cols[TEXT_MAX_FIELD_COUNT];
+    char *endptr;
+    int expect_count;
+    int count;
+
+    count = split_string_ex((string_t *)line, ' ', cols,
+            TEXT_MAX_FIELD_COUNT, false);
+    if (count < TEXT_FIELD_COUNT_DEL_BLOCK) {
+        sprintf(error_info, "field count: %d < %d",
+                count, TEXT_FIELD_COUNT_DEL_BLOCK);
+        return EINVAL;
+    }
+
+    record->source = cols[2].str[0];
+    record->op_type = cols[3].str[0];
+    switch (record->op_type) {
+        case SLICE_BINLOG_OP_TYPE_WRITE_SLICE:
+        case SLICE_BINLOG_OP_TYPE_ALLOC_SLICE:
+            expect_count = TEXT_FIELD_COUNT_ADD_SLICE;
+            break;
+        case SLICE_BINLOG_OP_TYPE_DEL_SLICE:
+            expect_count = TEXT_FIELD_COUNT_DEL_SLICE;
+            break;
+        case SLICE_BINLOG_OP_TYPE_DEL_BLOCK:
+            expect_count = TEXT_FIELD_COUNT_DEL_BLOCK;
+            break;
+        default:
+            sprintf(error_info, "invalid op_type: %c (0x%02x)",
+                    record->op_type, (unsigned char)record->op_type);
+            return EINVAL;
+    }
+    if (count != expect_count) {
+        sprintf(error_info, "field count: %d != %d", count, expect_count);
+        return EINVAL;
+    }
+
+    TEXT_PARSE_INT(record->timestamp, "timestamp", 0, ' ', 0);
+    TEXT_PARSE_INT(record->data_version, "data version", 1, ' ', 0);
+    TEXT_PARSE_INT(record->block.oid, "object ID", 4, ' ', 1);
+    memset(&record->space, 0, sizeof(record->space));
+    if (record->op_type == SLICE_BINLOG_OP_TYPE_DEL_BLOCK) {
+        TEXT_PARSE_INT(record->block.offset, "block offset", 5, '\n', 0);
+        record->slice.offset = record->slice.length = 0;
+        return 0;
+    }
+
+    TEXT_PARSE_INT(record->block.offset, "block offset", 5, ' ', 0);
+    TEXT_PARSE_INT(record->slice.offset, "slice offset", 6, ' ', 0);
+    if (record->op_type == SLICE_BINLOG_OP_TYPE_DEL_SLICE) {
+        TEXT_PARSE_INT(record->slice.length, "slice length", 7, '\n', 1);
+        return 0;
+    }
+
+    TEXT_PARSE_INT(record->slice.length, "slice length", 7, ' ', 1);
+    TEXT_PARSE_INT(record->space.path_index, "path index", 8, ' ', 0);
+    TEXT_PARSE_INT(record->space.trunk_id, "trunk id", 9, ' ', 1);
+    TEXT_PARSE_INT(record->space.subdir, "subdir", 10, ' ', 1);
+    TEXT_PARSE_INT(record->space.offset, "space offset", 11, ' ', 0);
+    TEXT_PARSE_INT(record->space.size, "space size", 12, '\n', 0);
+    if (record->space.path_index > SHRT_MAX || record->space.subdir >
+            UINT32_MAX || record->space.size > UINT32_MAX)
+    {
+        sprintf(error_info, "path index: %d, subdir: %"PRId64" or "
+                "space size: %"PRId64" out of range",
+                record->space.path_index, record->space.subdir,
+                record->space.size);
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+static int check_file_header(SliceBinReader *reader,
+        const SliceBinFileHeader *header)
+{
+    uint32_t crc32c;
+
+    if (memcmp(header->magic, SLICE_BIN_FILE_MAGIC,
+                sizeof(header->magic)) != 0)
+    {
+        logError("file: "__FILE__", line: %d, "
+                "binary binlog file: %s, invalid magic",
+                __LINE__, reader->filename);
+        return EINVAL;
+    }
+
+    crc32c = slice_bin_crc32c(0, header, SLICE_BIN_FILE_CRC_FIELD_OFFSET);
+    if ((uint32_t)buff2int(header->crc32c) != crc32c) {
+        logError("file: "__FILE__", line: %d, "
+                "binary binlog file: %s, file header crc32c: %08x "
+                "!= expect: %08x", __LINE__, reader->filename,
+                (uint32_t)buff2int(header->crc32c), crc32c);
+        return EINVAL;
+    }
+
+    if (header->version != SLICE_BIN_FORMAT_VERSION ||
+            buff2int(header->record_size) != sizeof(SliceBinRecord))
+    {
+        logError("file: "__FILE__", line: %d, "
+                "binary binlog file: %s, unsupported version: %d "
+                "or record size: %d", __LINE__, reader->filename,
+                header->version, buff2int(header->record_size));
+        return EINVAL;
+    }
+
+    reader->source_size = buff2long(header->source_size);
+    reader->record_count = buff2long(header->record_count);
+    return 0;
+}
+
+static int read_file_header(SliceBinReader *reader)
+{
+    SliceBinFileHeader header;
+    int result;
+    int bytes;
+
+    if ((bytes=read(reader->fd, &header, sizeof(header))) !=
+            sizeof(header))
+    {
+        result = bytes < 0 ? (errno != 0 ? errno : EIO) : EINVAL;
+        logError("file: "__FILE__", line: %d, "
+                "read binary binlog file: %s fail, "
+                "errno: %d, error info: %s", __LINE__,
+                reader->filename, result, STRERROR(result));
+        return result;
+    }
+
+    return check_file_header(reader, &header);
+}
+
+int slice_bin_reader_open(SliceBinReader *reader, const char *filename)
+{
+    int result;
+
+    snprintf(reader->filename, sizeof(reader->filename), "%s", filename);
+    reader->buffer.size = SLICE_BIN_READ_BUFFER_SIZE;
+    reader->buffer.buff = (char *)fc_malloc(reader->buffer.size);
+    if (reader->buffer.buff == NULL) {
+        return ENOMEM;
+    }
+    reader->buffer.current = reader->buffer.end = reader->buffer.buff;
+
+    if ((reader->fd=open(filename, O_RDONLY)) < 0) {
+        result = errno != 0 ? errno : EACCES;
+        logError("file: "__FILE__", line: %d, "
+                "open file \"%s\" fail, "
+                "errno: %d, error info: %s",
+                __LINE__, filename, result, STRERROR(result));
+        free(reader->buffer.buff);
+        reader->buffer.buff = NULL;
+        return result;
+    }
+
+    if ((result=read_file_header(reader)) != 0) {
+        slice_bin_reader_close(reader);
+        return result;
+    }
+
+    reader->offset = sizeof(SliceBinFileHeader);
+    return 0;
+}
+
+//make sure the buffer contains the bytes, return ENOENT for EOF
+static int reader_ensure_bytes(SliceBinReader *reader, const int bytes)
+{
+    int remain;
+    int read_bytes;
+    int result;
+
+    while ((remain=reader->buffer.end - reader->buffer.current) < bytes) {
+        if (reader->buffer.current != reader->buffer.buff) {
+            if (remain > 0) {
+                memmove(reader->buffer.buff, reader->buffer.current, remain);
+            }
+            reader->buffer.current = reader->buffer.buff;
+            reader->buffer.end = reader->buffer.buff + remain;
+        }
+
+        read_bytes = read(reader->fd, reader->buffer.end,
+                reader->buffer.size - remain);
+        if (read_bytes < 0) {
+            result = errno != 0 ? errno : EIO;
+            logError("file: "__FILE__", line: %d, "
+                    "read binary binlog file: %s fail, "
+                    "errno: %d, error info: %s", __LINE__,
+                    reader->filename, result, STRERROR(result));
+            return result;
+        } else if (read_bytes == 0) {
+            return ENOENT;
+        }
+        reader->buffer.end += read_bytes;
+    }
+
+    return 0;
+}
+
+int slice_bin_reader_next(SliceBinReader *reader,
+        SliceBinRecord **records, int *count)
+{
+    SliceBinBlockHeader *header;
+    uint32_t crc32c;
+    int body_len;
+    int result;
+
+    if ((result=reader_ensure_bytes(reader,
+                    sizeof(SliceBinBlockHeader))) != 0)
+    {
+        if (result == ENOENT && reader->buffer.current !=
+                reader->buffer.end)
+        {
+            logError("file: "__FILE__", line: %d, "
+                    "binary binlog file: %s, offset: %"PRId64", "
+                    "incomplete block header", __LINE__,
+                    reader->filename, reader->offset);
+            return EINVAL;
+        }
+        return result;
+    }
+
+    header = (SliceBinBlockHeader *)reader->buffer.current;
+    *count = buff2int(header->record_count);
+    if (memcmp(header->magic, SLICE_BIN_BLOCK_MAGIC,
+                sizeof(header->magic)) != 0 || header->version !=
+            SLICE_BIN_FORMAT_VERSION || *count <= 0 ||
+            *count > SLICE_BIN_MAX_RECORDS_PER_BLOCK)
+    {
+        logError("file: "__FILE__", line: %d, "
+                "binary binlog file: %s, offset: %"PRId64", "
+                "invalid block header, record count: %d", __LINE__,
+                reader->filename, reader->offset, *count);
+        return EINVAL;
+    }
+
+    body_len = sizeof(SliceBinRecord) * (*count);
+    if ((result=reader_ensure_bytes(reader, sizeof(SliceBinBlockHeader)
+                    + body_len)) != 0)
+    {
+        if (result == ENOENT) {
+            logError("file: "__FILE__", line: %d, "
+                    "binary binlog file: %s, offset: %"PRId64", "
+                    "incomplete block", __LINE__,
+                    reader->filename, reader->offset);
+            return EINVAL;
+        }
+        return result;
+    }
+
+    //the buffer maybe moved
+    header = (SliceBinBlockHeader *)reader->buffer.current;
+    *records = (SliceBinRecord *)(header + 1);
+    crc32c = slice_bin_crc32c(0, *records, body_len);
+    crc32c = slice_bin_crc32c(crc32c, header,
+            SLICE_BIN_BLOCK_CRC_FIELD_OFFSET);
+    if ((uint32_t)buff2int(header->crc32c) != crc32c) {
+        logError("file: "__FILE__", line: %d, "
+                "binary binlog file: %s, offset: %"PRId64", "
+                "block crc32c: %08x != expect: %08x", __LINE__,
+                reader->filename, reader->offset,
+                (uint32_t)buff2int(header->crc32c), crc32c);
+        return EINVAL;
+    }
+
+    reader->buffer.current += sizeof(SliceBinBlockHeader) + body_len;
+    reader->offset += sizeof(SliceBinBlockHeader) + body_len;
+    return 0;
+}
+
+void slice_bin_reader_close(SliceBinReader *reader)
+{
+    if (reader->fd >= 0) {
+        close(reader->fd);
+        reader->fd = -1;
+    }
+
+    if (reader->buffer.buff != NULL) {
+        free(reader->buffer.buff);
+        reader->buffer.buff = NULL;
+    }
+}
+
+static int writer_write(SliceBinWriter *writer,
+        const void *buff, const int len)
+{
+    int result;
+
+    if (fc_safe_write(writer->fd, (const char *)buff, len) != len) {
+        result = errno != 0 ? errno : EIO;
+        logError("file: "__FILE__", line: %d, "
+                "write to file \"%s\" fail, "
+                "errno: %d, error info: %s", __LINE__,
+                writer->tmp_filename, result, STRERROR(result));
+        return result;
+    }
+
+    writer->file_size += len;
+    return 0;
+}
+
+int slice_bin_writer_open(SliceBinWriter *writer, const char *filename)
+{
+    SliceBinFileHeader header;
+    int result;
+    int bytes;
+
+    snprintf(writer->filename, sizeof(writer->filename), "%s", filename);
+    snprintf(writer->tmp_filename, sizeof(writer->tmp_filename),
+            "%s.tmp", filename);
+    writer->record_count = 0;
+    writer->file_size = 0;
+    writer->block.count = 0;
+
+    bytes = sizeof(SliceBinBlockHeader) + SLICE_BIN_BLOCK_BODY_MAX_SIZE;
+    writer->block.header = (SliceBinBlockHeader *)fc_malloc(bytes);
+    if (writer->block.header == NULL) {
+        return ENOMEM;
+    }
+    writer->block.records = (SliceBinRecord *)(writer->block.header + 1);
+
+    if ((writer->fd=open(writer->tmp_filename, O_WRONLY |
+                    O_CREAT | O_TRUNC, 0644)) < 0)
+    {
+        result = errno != 0 ? errno : EACCES;
+        logError("file: "__FILE__", line: %d, "
+                "open file \"%s\" fail, "
+                "errno: %d, error info: %s", __LINE__,
+                writer->tmp_filename, result, STRERROR(result));
+        free(writer->block.header);
+        writer->block.header = NULL;
+        return result;
+    }
+
+    //placeholder, rewrite when close
+    memset(&header, 0, sizeof(header));
+    if ((result=writer_write(writer, &header, sizeof(header))) != 0) {
+        slice_bin_writer_abort(writer);
+        return result;
+    }
+
+    return 0;
+}
+
+static int writer_flush_block(SliceBinWriter *writer)
+{
+    SliceBinBlockHeader *header;
+    uint32_t crc32c;
+    int body_len;
+
+    if (writer->block.count == 0) {
+        return 0;
+    }
+
+    header = writer->block.header;
+    body_len = sizeof(SliceBinRecord) * writer->block.count;
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, SLICE_BIN_BLOCK_MAGIC, sizeof(header->magic));
+    header->version = SLICE_BIN_FORMAT_VERSION;
+    int2buff(writer->block.count, header->record_count);
+    crc32c = slice_bin_crc32c(0, writer->block.records, body_len);
+    crc32c = slice_bin_crc32c(crc32c, header,
+            SLICE_BIN_BLOCK_CRC_FIELD_OFFSET);
+    int2buff(crc32c, header->crc32c);
+
+    writer->block.count = 0;
+    return writer_write(writer, header,
+            sizeof(SliceBinBlockHeader) + body_len);
+}
+
+int slice_bin_writer_add(SliceBinWriter *writer,
+        const SliceBinlogRecord *record)
+{
+    slice_bin_pack_record(record, writer->block.records +
+            writer->block.count);
+    writer->record_count++;
+    if (++(writer->block.count) == SLICE_BIN_MAX_RECORDS_PER_BLOCK) {
+        return writer_flush_block(writer);
+    }
+
+    return 0;
+}
+
+int slice_bin_writer_close(SliceBinWriter *writer,
+        const int64_t source_size)
+{
+    SliceBinFileHeader header;
+    int result;
+
+    if ((result=writer_flush_block(writer)) != 0) {
+        slice_bin_writer_abort(writer);
+        return result;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SLICE_BIN_FILE_MAGIC, sizeof(header.magic));
+    header.version = SLICE_BIN_FORMAT_VERSION;
+    int2buff(sizeof(SliceBinRecord), header.record_size);
+    long2buff(source_size, header.source_size);
+    long2buff(writer->record_count, header.record_count);
+    int2buff(slice_bin_crc32c(0, &header, SLICE_BIN_FILE_CRC_FIELD_OFFSET),
+            header.crc32c);
+
+    if (pwrite(writer->fd, &header, sizeof(header), 0) != sizeof(header) ||
+            fsync(writer->fd) != 0)
+    {
+        result = errno != 0 ? errno : EIO;
+        logError("file: "__FILE__", line: %d, "
+                "write to file \"%s\" fail, "
+                "errno: %d, error info: %s", __LINE__,
+                writer->tmp_filename, result, STRERROR(result));
+        slice_bin_writer_abort(writer);
+        return result;
+    }
+
+    close(writer->fd);
+    writer->fd = -1;
+    free(writer->block.header);
+    writer->block.header = NULL;
+
+    if (rename(writer->tmp_filename, writer->filename) != 0) {
+        result = errno != 0 ? errno : EPERM;
+        logError("file: "__FILE__", line: %d, "
+                "rename file \"%s\" to \"%s\" fail, "
+                "errno: %d, error info: %s", __LINE__,
+                writer->tmp_filename, writer->filename,
+                result, STRERROR(result));
+        unlink(writer->tmp_filename);
+        return result;
+    }
+
+    return 0;
+}
+
+void slice_bin_writer_abort(SliceBinWriter *writer)
+{
+    if (writer->fd >= 0) {
+        close(writer->fd);
+        writer->fd = -1;
+    }
+    unlink(writer->tmp_filename);
+
+    if (writer->block.header != NULL) {
+        free(writer->block.header);
+        writer->block.header = NULL;
+    }
+}
+
+int slice_bin_get_source_size(const char *filename, int64_t *source_size)
+{
+    SliceBinReader reader;
+    SliceBinFileHeader header;
+    int result;
+
+    if (access(filename, F_OK) != 0) {
+        result = errno != 0 ? errno : ENOENT;
+        return result;
+    }
+
+    snprintf(reader.filename, sizeof(reader.filename), "%s", filename);
+    if ((reader.fd=open(filename, O_RDONLY)) < 0) {
+        result = errno != 0 ? errno : EACCES;
+        logError("file: "__FILE__", line: %d, "
+                "open file \"%s\" fail, "
+                "errno: %d, error info: %s",
+                __LINE__, filename, result, STRERROR(result));
+        return result;
+    }
+
+    if (read(reader.fd, &header, sizeof(header)) != sizeof(header)) {
+        result = EINVAL;
+    } else {
+        result = check_file_header(&reader, &header);
+    }
+    close(reader.fd);
+
+    if (result == 0) {
+        *source_size = reader.source_size;
+    }
+    return result;
+}
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//slice_binlog_bin.h
+
+/* the binary format of the slice binlog:
+ *
+ *   file header | block header | records | block header | records ...
+ *
+ * the binary file is converted from the text binlog file with the same
+ * index and named as binlog.<index>.bin. the file header records the size
+ * of the source text file, so the stale binary file is ignored when the
+ * text file appended after converting.
+ *
+ * all integers are big endian, the records are fixed size, the block
+ * CRC32C covers the records and the block header (except the CRC field),
+ * so the reader can validate or skip the whole block at once.
+ *
+ * this module only depends on libfastcommon for the tools.
+ */
+
+#ifndef _SLICE_BINLOG_BIN_H
+#define _SLICE_BINLOG_BIN_H
+
+#include <time.h>
+#include <limits.h>
+#include "fastcommon/common_define.h"
+
+//the same as BINLOG_OP_TYPE_* of binlog_types.h
+#define SLICE_BINLOG_OP_TYPE_WRITE_SLICE  'w'
+#define SLICE_BINLOG_OP_TYPE_ALLOC_SLICE  'a'
+#define SLICE_BINLOG_OP_TYPE_DEL_SLICE    'd'
+#define SLICE_BINLOG_OP_TYPE_DEL_BLOCK    'D'
+
+#define SLICE_BIN_FILENAME_SUFFIX  ".bin"
+
+#define SLICE_BIN_FILE_MAGIC       "FSSLCBIN"
+#define SLICE_BIN_BLOCK_MAGIC      "FSBK"
+#define SLICE_BIN_FORMAT_VERSION   1
+
+//the max record count of one block, the block size is about 256KB
+#define SLICE_BIN_MAX_RECORDS_PER_BLOCK  4096
+
+typedef struct slice_bin_file_header {
+    char magic[8];
+    char version;
+    char padding[3];
+    char record_size[4];   //for the format check
+    char source_size[8];   //the size of the source text binlog file
+    char record_count[8];
+    char padding2[4];
+    char crc32c[4];        //of the fields above
+} SliceBinFileHeader;
+
+typedef struct slice_bin_block_header {
+    char magic[4];
+    char version;
+    char padding[3];
+    char record_count[4];
+    char crc32c[4];        //of the records and the fields above
+} SliceBinBlockHeader;
+
+/* the fixed layout record of 64 bytes, the space fields are zero
+   for delete slice and delete block */
+typedef struct slice_bin_record {
+    char timestamp[4];
+    char source;
+    char op_type;
+    char path_index[2];
+    char data_version[8];
+    char oid[8];
+    char block_offset[8];
+    char slice_offset[4];
+    char slice_length[4];
+    char trunk_id[8];
+    char subdir[4];
+    char space_size[4];
+    char space_offset[8];
+} SliceBinRecord;
+
+//the unpacked record
+typedef struct slice_binlog_record {
+    time_t timestamp;
+    int64_t data_version;
+    char source;
+    char op_type;
+    struct {
+        int64_t oid;
+        int64_t offset;
+    } block;
+    struct {
+        int offset;
+        int length;
+    } slice;
+    struct {
+        int path_index;
+        int64_t trunk_id;
+        int64_t subdir;
+        int64_t offset;
+        int64_t size;
+    } space;
+} SliceBinlogRecord;
+
+typedef struct slice_bin_reader {
+    char filename[PATH_MAX];
+    int fd;
+    int64_t offset;   //the file offset of the current block
+    int64_t source_size;
+    int64_t record_count;
+    struct {
+        char *buff;
+        char *current;
+        char *end;
+        int size;
+    } buffer;
+} SliceBinReader;
+
+typedef struct slice_bin_writer {
+    char filename[PATH_MAX];
+    char tmp_filename[PATH_MAX];
+    int fd;
+    int64_t record_count;
+    int64_t file_size;
+    struct {
+        SliceBinBlockHeader *header;
+        SliceBinRecord *records;
+        int count;
+    } block;
+} SliceBinWriter;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    uint32_t slice_bin_crc32c(uint32_t crc, const void *buff, const int len);
+
+    void slice_bin_pack_record(const SliceBinlogRecord *record,
+            SliceBinRecord *bin);
+
+    void slice_bin_unpack_record(const SliceBinRecord *bin,
+            SliceBinlogRecord *record);
+
+    /* parse one line of the text binlog, the line ends with \n
+       return 0 for success, EINVAL for format error */
+    int slice_bin_parse_text_line(const string_t *line,
+            SliceBinlogRecord *record, char *error_info);
+
+    int slice_bin_reader_open(SliceBinReader *reader, const char *filename);
+
+    /* read and check the next block
+       return 0 for success, ENOENT for the end of file,
+       EINVAL for the corrupted block */
+    int slice_bin_reader_next(SliceBinReader *reader,
+            SliceBinRecord **records, int *count);
+
+    void slice_bin_reader_close(SliceBinReader *reader);
+
+    //write to a temp file which renamed when close
+    int slice_bin_writer_open(SliceBinWriter *writer, const char *filename);
+
+    int slice_bin_writer_add(SliceBinWriter *writer,
+            const SliceBinlogRecord *record);
+
+    /* flush, write the file header with the source size, then
+       rename to the filename */
+    int slice_bin_writer_close(SliceBinWriter *writer,
+            const int64_t source_size);
+
+    void slice_bin_writer_abort(SliceBinWriter *writer);
+
+    /* get the size of the source text file recorded in the binary file
+       return 0 for success, ENOENT for the file not exist */
+    int slice_bin_get_source_size(const char *filename, int64_t *source_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -34,6 +34,7 @@
 #include "common/fs_proto.h"
 #include "server_global.h"
 #include "server_recovery.h"
+#include "data_thread.h"
 #include "cluster_topology.h"
 #include "cluster_relationship.h"
 
@@ -790,9 +791,7 @@ static void cluster_relationship_on_status_change(FSClusterDataServerInfo *ds,
                     (old_status == FS_SERVER_STATUS_OFFLINE &&
                      new_status == FS_SERVER_STATUS_ACTIVE))
             {
-                PTHREAD_MUTEX_LOCK(&ds->replica.notify.lock);
-                pthread_cond_broadcast(&ds->replica.notify.cond);
-                PTHREAD_MUTEX_UNLOCK(&ds->replica.notify.lock);
+                data_thread_retry_parked();
             }
         }
     }
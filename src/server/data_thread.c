@@ -44,10 +44,7 @@ static void *data_thread_func(void *arg);
 static inline int init_thread_ctx(FSDataThreadContext *context)
 {
     int result;
-
-    if ((result=init_pthread_lock_cond_pair(&context->lc_pair)) != 0) {
-        return result;
-    }
+    int bytes;
 
     if ((result=fast_mblock_init_ex1(&context->allocator,
                     "data_operation", sizeof(FSDataOperation),
@@ -62,6 +59,30 @@ static inline int init_thread_ctx(FSDataThreadContext *context)
         return result;
     }
 
+    if (DATA_WRITE_MERGE_MAX_BYTES > 0) {
+        if ((result=fast_mblock_init_ex1(&context->merger_allocator,
+                        "write_merger", sizeof(FSSliceWriteMerger) +
+                        DATA_WRITE_MERGE_MAX_BYTES, 16, 0,
+                        NULL, NULL, true)) != 0)
+        {
+            return result;
+        }
+    }
+
+    bytes = sizeof(FSDataOrderLane) * DATA_THREAD_ORDER_LANE_COUNT;
+    context->lanes = (FSDataOrderLane *)fc_malloc(bytes);
+    if (context->lanes == NULL) {
+        return ENOMEM;
+    }
+    memset(context->lanes, 0, bytes);
+
+    context->inflight.count = 0;
+    context->inflight.max_count = DATA_THREAD_QUEUE_DEPTH;
+    context->waiting.head = context->waiting.tail = NULL;
+    context->parked.head = context->parked.tail = NULL;
+    context->parked.notified = 0;
+    context->parked.notify_op.operation = DATA_OPERATION_RETRY_PARKED;
+    context->parked.notify_op.stage = DATA_OPERATION_STAGE_NONE;
     return 0;
 }
 
@@ -128,9 +149,12 @@ void data_thread_destroy()
         for (context=g_data_thread_vars.thread_array.contexts;
                 context<end; context++)
         {
-            destroy_pthread_lock_cond_pair(&context->lc_pair);
             fc_queue_destroy(&context->queue);
             fast_mblock_destroy(&context->allocator);
+            if (DATA_WRITE_MERGE_MAX_BYTES > 0) {
+                fast_mblock_destroy(&context->merger_allocator);
+            }
+            free(context->lanes);
         }
         free(g_data_thread_vars.thread_array.contexts);
         g_data_thread_vars.thread_array.contexts = NULL;
@@ -159,18 +183,79 @@ void data_thread_terminate()
     }
 }
 
-#define DATA_THREAD_COND_WAIT(thread_ctx) \
-    do { \
-        do {  \
-            pthread_cond_wait(&thread_ctx->lc_pair.cond,  \
-                    &thread_ctx->lc_pair.lock);  \
-        } while (!thread_ctx->notify_done && SF_G_CONTINUE_FLAG); \
-        \
-        if (!SF_G_CONTINUE_FLAG) {  \
-            PTHREAD_MUTEX_UNLOCK(&thread_ctx->lc_pair.lock); \
-            return;  \
-        }  \
-    } while (0)
+void data_thread_retry_parked()
+{
+    FSDataThreadContext *context;
+    FSDataThreadContext *end;
+
+    end = g_data_thread_vars.thread_array.contexts +
+        g_data_thread_vars.thread_array.count;
+    for (context=g_data_thread_vars.thread_array.contexts;
+            context<end; context++)
+    {
+        //the notify op is pushed once until the data thread deals it
+        if (__sync_bool_compare_and_swap(&context->parked.notified, 0, 1)) {
+            fc_queue_push(&context->queue, &context->parked.notify_op);
+        }
+    }
+}
+
+int data_thread_batch_init(FSDataOperationBatch *batch)
+{
+    int bytes;
+
+    bytes = sizeof(FSDataOperationChain) * DATA_THREAD_COUNT;
+    batch->chains = (FSDataOperationChain *)fc_malloc(bytes);
+    if (batch->chains == NULL) {
+        return ENOMEM;
+    }
+    memset(batch->chains, 0, bytes);
+    batch->in_progress = false;
+    return 0;
+}
+
+void data_thread_batch_commit(FSDataOperationBatch *batch)
+{
+    FSDataThreadContext *context;
+    FSDataOperationChain *chain;
+    FSDataOperation *carrier;
+    FSDataOperation *op;
+    FSDataOperation *current;
+    int i;
+
+    batch->in_progress = false;
+    for (i=0; i<g_data_thread_vars.thread_array.count; i++) {
+        chain = batch->chains + i;
+        if (chain->head == NULL) {
+            continue;
+        }
+
+        context = g_data_thread_vars.thread_array.contexts + i;
+        op = chain->head;
+        chain->head = chain->tail = NULL;
+        if (op->next == NULL) {
+            fc_queue_push(&context->queue, op);
+            continue;
+        }
+
+        carrier = (FSDataOperation *)fast_mblock_alloc_object(
+                &context->allocator);
+        if (carrier != NULL) {
+            carrier->operation = DATA_OPERATION_BATCH;
+            carrier->stage = DATA_OPERATION_STAGE_NONE;
+            carrier->ctx = NULL;
+            carrier->arg = op;
+            fc_queue_push(&context->queue, carrier);
+            continue;
+        }
+
+        do {  //push one by one when out of memory
+            current = op;
+            op = op->next;
+            fc_queue_push(&context->queue, current);
+        } while (op != NULL);
+    }
+}
 
 static inline int log_data_update(const int operation,
         FSSliceOpContext *op_ctx)
@@ -192,77 +277,384 @@ static inline int log_data_update(const int operation,
     }
 }
 
-static void deal_one_operation(FSDataThreadContext *thread_ctx,
+static inline FSDataOrderLane *get_order_lane(FSDataThreadContext
+        *thread_ctx, FSDataOperation *op)
+{
+    return thread_ctx->lanes + (FS_BLOCK_HASH_CODE(op->ctx->info.
+                bs_key.block) / g_data_thread_vars.thread_array.count) %
+        DATA_THREAD_ORDER_LANE_COUNT;
+}
+
+static inline void push_to_waiting_queue(FSDataThreadContext *thread_ctx,
+        FSDataOperation *op)
+{
+    op->next = NULL;
+    if (thread_ctx->waiting.tail == NULL) {
+        thread_ctx->waiting.head = op;
+    } else {
+        thread_ctx->waiting.tail->next = op;
+    }
+    thread_ctx->waiting.tail = op;
+}
+
+/* return the next operation to start */
+static FSDataOperation *finish_operation(FSDataThreadContext *thread_ctx,
         FSDataOperation *op)
 {
     bool is_update;
+    FSDataOrderLane *lane;
+    FSDataOperation *leader;
+    FSDataOperation *next;
+
+    is_update = (op->operation != DATA_OPERATION_SLICE_READ);
+    if (op->ctx->result == 0 && is_update) {
+        log_data_update(op->operation, op->ctx);
+    }
+
+    next = NULL;
+    if (is_update) {
+        /* the merged writes hold the lane until all of them finished,
+           and the leader is freed by the last one */
+        leader = (op->merge.leader != NULL ? op->merge.leader : op);
+        if (--leader->merge.pending == 0) {
+            lane = get_order_lane(thread_ctx, op);
+            next = leader->lane_next;
+            lane->head = next;
+            if (next == NULL) {
+                lane->tail = NULL;
+            }
+        }
+    } else {
+        leader = op;
+    }
+
+    /* the op context maybe reused after notify */
+    op->ctx->notify_func(op);
+
+    /*
+    logInfo("file: "__FILE__", line: %d, op: %p, "
+            "operation: %c, inflight count: %d", __LINE__,
+            op, op->operation, thread_ctx->inflight.count);
+            */
+
+    if (leader != op) {
+        if (leader->merge.pending == 0) {
+            fast_mblock_free_object(&thread_ctx->allocator, leader);
+        }
+        fast_mblock_free_object(&thread_ctx->allocator, op);
+    } else if (!is_update || op->merge.pending == 0) {
+        fast_mblock_free_object(&thread_ctx->allocator, op);
+    }
+    thread_ctx->inflight.count--;
+
+    if (thread_ctx->waiting.head == NULL) {
+        return next;  //the next update of the same lane
+    }
+
+    if (next != NULL) {  //queue the lane successor for fairness
+        push_to_waiting_queue(thread_ctx, next);
+    }
+
+    next = thread_ctx->waiting.head;
+    thread_ctx->waiting.head = next->next;
+    if (thread_ctx->waiting.head == NULL) {
+        thread_ctx->waiting.tail = NULL;
+    }
+    return next;
+}
+
+/* park the operation in flight until the slave status changed */
+static inline void park_operation(FSDataThreadContext *thread_ctx,
+        FSDataOperation *op)
+{
+    op->next = NULL;
+    if (thread_ctx->parked.tail == NULL) {
+        thread_ctx->parked.head = op;
+    } else {
+        thread_ctx->parked.tail->next = op;
+    }
+    thread_ctx->parked.tail = op;
+}
+
+/* return the next operation to start */
+static FSDataOperation *deal_io_done(FSDataThreadContext *thread_ctx,
+        FSDataOperation *op)
+{
     int result;
 
+    if (op->ctx->result == 0 && op->operation != DATA_OPERATION_SLICE_READ
+            && op->source == DATA_SOURCE_MASTER_SERVICE)
+    {
+        /* set stage before push because the notify maybe very quick */
+        op->stage = DATA_OPERATION_STAGE_WAITING_RPC;
+        result = replication_caller_push_to_slave_queues(
+                (struct fast_task_info *)op->arg);
+        if (result == TASK_STATUS_CONTINUE) {
+            return NULL;
+        } else if (result == EAGAIN) {
+            park_operation(thread_ctx, op);
+            return NULL;
+        }
+    }
+
+    return finish_operation(thread_ctx, op);
+}
+
+static inline bool can_merge_write(const FSDataOperation *leader,
+        const FSDataOperation *op, const int end, const int length)
+{
+    const FSSliceOpContext *op_ctx;
+
+    op_ctx = op->ctx;
+    return op->operation == DATA_OPERATION_SLICE_WRITE &&
+        op->source == leader->source &&
+        op_ctx->info.write_binlog.log_replica ==
+        leader->ctx->info.write_binlog.log_replica &&
+        FS_BLOCK_KEY_EQUAL(op_ctx->info.bs_key.block,
+                leader->ctx->info.bs_key.block) &&
+        op_ctx->info.bs_key.slice.offset == end &&
+        length + op_ctx->info.bs_key.slice.length <=
+        DATA_WRITE_MERGE_MAX_BYTES;
+}
+
+/* merge the adjacent writes waiting in the lane after the leader as one
+   space allocation and one disk write, return true for merged.
+   the followers are counted in flight one by one, so the merge group
+   is capped by the free slots of the inflight window */
+static bool start_merged_write(FSDataThreadContext *thread_ctx,
+        FSDataOperation *leader)
+{
+    FSDataOperation *ops[FS_SLICE_WRITE_MERGE_MAX_OPS];
+    FSDataOperation *op;
+    FSDataOrderLane *lane;
+    FSSliceWriteMerger *merger;
+    int max_ops;
+    int count;
+    int end;
+    int length;
+    int i;
+
+    //the leader is already counted in flight
+    max_ops = 1 + thread_ctx->inflight.max_count -
+        thread_ctx->inflight.count;
+    if (max_ops > FS_SLICE_WRITE_MERGE_MAX_OPS) {
+        max_ops = FS_SLICE_WRITE_MERGE_MAX_OPS;
+    }
+    if (max_ops <= 1) {
+        return false;
+    }
+
+    ops[0] = leader;
+    count = 1;
+    length = leader->ctx->info.bs_key.slice.length;
+    end = leader->ctx->info.bs_key.slice.offset + length;
+    op = leader->lane_next;
+    while (op != NULL && count < max_ops &&
+            can_merge_write(leader, op, end, length))
+    {
+        ops[count++] = op;
+        end += op->ctx->info.bs_key.slice.length;
+        length += op->ctx->info.bs_key.slice.length;
+        op = op->lane_next;
+    }
+
+    if (count == 1) {
+        return false;
+    }
+
+    if ((merger=(FSSliceWriteMerger *)fast_mblock_alloc_object(
+                    &thread_ctx->merger_allocator)) == NULL)
+    {
+        return false;
+    }
+
+    merger->allocator = &thread_ctx->merger_allocator;
+    merger->buff = (char *)(merger + 1);
+    merger->count = count;
+    merger->bs_key.block = leader->ctx->info.bs_key.block;
+    merger->bs_key.slice.offset = leader->ctx->info.bs_key.slice.offset;
+    merger->bs_key.slice.length = length;
+    for (i=0; i<count; i++) {
+        merger->op_ctxs[i] = ops[i]->ctx;
+        if (i > 0) {
+            ops[i]->ctx->data_thread_ctx = thread_ctx;
+            ops[i]->ctx->data_op = ops[i];
+            ops[i]->stage = DATA_OPERATION_STAGE_DOING_IO;
+            ops[i]->merge.leader = leader;
+        }
+    }
+
+    if (fs_slice_write_merged(merger) != 0) {
+        //write one by one as usual
+        for (i=1; i<count; i++) {
+            ops[i]->stage = DATA_OPERATION_STAGE_NONE;
+            ops[i]->merge.leader = NULL;
+        }
+        fast_mblock_free_object(&thread_ctx->merger_allocator, merger);
+        return false;
+    }
+
+    //the followers leave the lane and are in flight with the leader
+    leader->merge.pending = count;
+    leader->lane_next = ops[count - 1]->lane_next;
+    lane = get_order_lane(thread_ctx, leader);
+    if (lane->tail == ops[count - 1]) {
+        lane->tail = leader;
+    }
+    thread_ctx->inflight.count += count - 1;
+    return true;
+}
+
+/* return true for async IO in progress */
+static bool start_operation(FSDataThreadContext *thread_ctx,
+        FSDataOperation *op)
+{
+    int result;
+
+    thread_ctx->inflight.count++;
     op->ctx->data_thread_ctx = thread_ctx;
+    op->ctx->data_op = op;
+    op->stage = DATA_OPERATION_STAGE_DOING_IO;
     switch (op->operation) {
         case DATA_OPERATION_SLICE_READ:
-            is_update = false;
-            PTHREAD_MUTEX_LOCK(&thread_ctx->lc_pair.lock);
-            thread_ctx->notify_done = false;
-            if ((op->ctx->result=fs_slice_read(op->ctx)) == 0) {
-                DATA_THREAD_COND_WAIT(thread_ctx);
+            if ((result=fs_slice_read(op->ctx)) == 0) {
+                return true;
             }
-            PTHREAD_MUTEX_UNLOCK(&thread_ctx->lc_pair.lock);
+            op->ctx->result = result;
             break;
         case DATA_OPERATION_SLICE_WRITE:
-            is_update = true;
-            PTHREAD_MUTEX_LOCK(&thread_ctx->lc_pair.lock);
-            thread_ctx->notify_done = false;
-            if ((op->ctx->result=fs_slice_write(op->ctx)) == 0) {
-                DATA_THREAD_COND_WAIT(thread_ctx);
+            if (DATA_WRITE_MERGE_MAX_BYTES > 0 && op->lane_next != NULL &&
+                    start_merged_write(thread_ctx, op))
+            {
+                return true;
+            }
+            if ((result=fs_slice_write(op->ctx)) == 0) {
+                return true;
             }
-            PTHREAD_MUTEX_UNLOCK(&thread_ctx->lc_pair.lock);
+            op->ctx->result = result;
             break;
         case DATA_OPERATION_SLICE_ALLOCATE:
-            is_update = true;
             op->ctx->result = fs_slice_allocate(op->ctx);
             break;
         case DATA_OPERATION_SLICE_DELETE:
-            is_update = true;
             op->ctx->result = fs_delete_slices(op->ctx);
             break;
         case DATA_OPERATION_BLOCK_DELETE:
-            is_update = true;
             op->ctx->result = fs_delete_block(op->ctx);
             break;
         default:
-            is_update = false;
             op->ctx->result = EINVAL;
             logInfo("file: "__FILE__", line: %d, "
                     "unkown operation: %d", __LINE__, op->operation);
             break;
     }
 
-    if (op->ctx->result == 0 && is_update) {
-        if (op->source == DATA_SOURCE_MASTER_SERVICE) {
-            PTHREAD_MUTEX_LOCK(&thread_ctx->lc_pair.lock);
-            thread_ctx->notify_done = false;
-            if ((result=replication_caller_push_to_slave_queues(
-                            (struct fast_task_info *)op->arg)) ==
-                    TASK_STATUS_CONTINUE)
-            {
-                DATA_THREAD_COND_WAIT(thread_ctx);
-            }
-            PTHREAD_MUTEX_UNLOCK(&thread_ctx->lc_pair.lock);
+    return false;
+}
+
+static void run_operations(FSDataThreadContext *thread_ctx,
+        FSDataOperation *op)
+{
+    do {
+        if (start_operation(thread_ctx, op)) {
+            break;
         }
+        op = deal_io_done(thread_ctx, op);
+    } while (op != NULL);
+}
 
-        log_data_update(op->operation, op->ctx);
+static void retry_parked_operations(FSDataThreadContext *thread_ctx)
+{
+    FSDataOperation *op;
+    FSDataOperation *current;
+    FSDataOperation *next;
+
+    //clear before retry, so the later status change notifies again
+    __sync_bool_compare_and_swap(&thread_ctx->parked.notified, 1, 0);
+
+    op = thread_ctx->parked.head;
+    thread_ctx->parked.head = thread_ctx->parked.tail = NULL;
+    while (op != NULL) {
+        current = op;
+        op = op->next;  //the current maybe parked again
+        if ((next=deal_io_done(thread_ctx, current)) != NULL) {
+            run_operations(thread_ctx, next);
+        }
     }
+}
 
-    op->ctx->notify_func(op);
+static void accept_operation(FSDataThreadContext *thread_ctx,
+        FSDataOperation *op)
+{
+    FSDataOrderLane *lane;
 
-    /*
-    logInfo("file: "__FILE__", line: %d, record: %p, "
-            "operation: %d, hash code: %u, inode: %"PRId64
-             ", data_version: %"PRId64", result: %d", __LINE__,
-             record, record->operation, record->hash_code,
-             record->inode, record->data_version, result);
-             */
+    op->lane_next = NULL;
+    op->merge.leader = NULL;
+    op->merge.pending = 1;
+    if (op->operation != DATA_OPERATION_SLICE_READ) {
+        lane = get_order_lane(thread_ctx, op);
+        if (lane->head != NULL) {
+            /* wait for the former update operations of this lane */
+            lane->tail->lane_next = op;
+            lane->tail = op;
+            return;
+        }
+        lane->head = lane->tail = op;
+    }
+
+    if (thread_ctx->inflight.count >= thread_ctx->inflight.max_count) {
+        push_to_waiting_queue(thread_ctx, op);
+        return;
+    }
+
+    run_operations(thread_ctx, op);
+}
+
+static void accept_batch_operations(FSDataThreadContext *thread_ctx,
+        FSDataOperation *carrier)
+{
+    FSDataOperation *op;
+    FSDataOperation *current;
+
+    op = (FSDataOperation *)carrier->arg;
+    fast_mblock_free_object(&thread_ctx->allocator, carrier);
+    do {
+        current = op;
+        op = op->next;  //the current maybe pushed to the waiting queue
+        accept_operation(thread_ctx, current);
+    } while (op != NULL);
+}
+
+static void deal_one_operation(FSDataThreadContext *thread_ctx,
+        FSDataOperation *op)
+{
+    FSDataOperation *next;
+
+    switch (op->stage) {
+        case DATA_OPERATION_STAGE_NONE:
+            if (op->operation == DATA_OPERATION_BATCH) {
+                accept_batch_operations(thread_ctx, op);
+            } else if (op->operation == DATA_OPERATION_RETRY_PARKED) {
+                retry_parked_operations(thread_ctx);
+            } else {
+                accept_operation(thread_ctx, op);
+            }
+            return;
+        case DATA_OPERATION_STAGE_DOING_IO:
+            next = deal_io_done(thread_ctx, op);
+            break;
+        case DATA_OPERATION_STAGE_WAITING_RPC:
+            next = finish_operation(thread_ctx, op);
+            break;
+        default:
+            logError("file: "__FILE__", line: %d, "
+                    "invalid stage: %d", __LINE__, op->stage);
+            return;
+    }
+
+    if (next != NULL) {
+        run_operations(thread_ctx, next);
+    }
 }
 
 static void *data_thread_func(void *arg)
@@ -281,9 +673,8 @@ static void *data_thread_func(void *arg)
 
         do {
             current = op;
-            op = op->next;
+            op = op->next;  //the current maybe pushed to the queue again
             deal_one_operation(thread_ctx, current);
-            fast_mblock_free_object(&thread_ctx->allocator, current);
         } while (op != NULL);
     }
 
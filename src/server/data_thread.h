@@ -27,24 +27,59 @@
 #define DATA_OPERATION_SLICE_ALLOCATE 'a'
 #define DATA_OPERATION_SLICE_DELETE   'd'
 #define DATA_OPERATION_BLOCK_DELETE   'D'
+#define DATA_OPERATION_BATCH          'B'  //the carrier of the batch ops
+#define DATA_OPERATION_RETRY_PARKED   'R'  //retry the parked operations
 
 #define DATA_SOURCE_MASTER_SERVICE     1
 #define DATA_SOURCE_SLAVE_REPLICA      2
 #define DATA_SOURCE_SLAVE_RECOVERY     3
 
+#define DATA_OPERATION_STAGE_NONE         0  //not dispatched yet
+#define DATA_OPERATION_STAGE_DOING_IO     1  //waiting for trunk IO done
+#define DATA_OPERATION_STAGE_WAITING_RPC  2  //waiting for slaves replicate
+
+#define DATA_THREAD_ORDER_LANE_COUNT   1024
+
 typedef struct fs_data_operation {
     int operation;
     int source;
+    int stage;
     FSSliceOpContext *ctx;
     void *arg;
+    struct {
+        struct fs_data_operation *leader;  //NULL for the leader
+        int pending;  //the unfinished operations of the leader's group
+    } merge;  //for the adjacent writes merged as one disk write
+    struct fs_data_operation *lane_next;  //for update order lane
     struct fs_data_operation *next;  //for queue
 } FSDataOperation;
 
+/* the update operations of the same lane (by block hash code)
+   are dealt in FIFO order, only the head is in flight */
+typedef struct fs_data_order_lane {
+    FSDataOperation *head;
+    FSDataOperation *tail;
+} FSDataOrderLane;
+
 typedef struct fs_data_thread_context {
-    bool notify_done;
-    pthread_lock_cond_pair_t lc_pair;
-    struct fc_queue queue;
+    struct fc_queue queue;  //for new operations and the done operations
     struct fast_mblock_man allocator;
+    struct fast_mblock_man merger_allocator;  //for the merged writes
+    FSDataOrderLane *lanes;
+    struct {
+        int count;     //current in flight operations
+        int max_count; //the queue depth
+    } inflight;
+    struct {
+        FSDataOperation *head;  //waiting for in flight slot
+        FSDataOperation *tail;
+    } waiting;
+    struct {
+        FSDataOperation *head;  //waiting for the ONLINE slaves become ACTIVE
+        FSDataOperation *tail;
+        volatile int notified;  //the notify op is in the queue
+        FSDataOperation notify_op;
+    } parked;
 } FSDataThreadContext;
 
 typedef struct fs_data_thread_array {
@@ -67,15 +102,34 @@ extern "C" {
     void data_thread_destroy();
     void data_thread_terminate();
 
-    static inline int push_to_data_thread_queue(const int operation,
-            const int source, void *arg, FSSliceOpContext *op_ctx)
+    int data_thread_batch_init(FSDataOperationBatch *batch);
+
+    /* called when the status of the slave changed,
+       the data threads retry the parked operations */
+    void data_thread_retry_parked();
+
+    static inline void data_thread_batch_begin(FSDataOperationBatch *batch)
+    {
+        batch->in_progress = true;
+    }
+
+    /* push the collected operations, one queue push per data thread */
+    void data_thread_batch_commit(FSDataOperationBatch *batch);
+
+    /* the operation is collected to the batch when the batch in progress,
+       otherwise pushed to the data thread directly */
+    static inline int push_to_data_thread_queue_ex(const int operation,
+            const int source, void *arg, FSSliceOpContext *op_ctx,
+            FSDataOperationBatch *batch)
     {
         FSDataThreadContext *context;
+        FSDataOperationChain *chain;
         FSDataOperation *op;
+        int index;
 
-        context = g_data_thread_vars.thread_array.contexts +
-            FS_BLOCK_HASH_CODE(op_ctx->info.bs_key.block) %
+        index = FS_BLOCK_HASH_CODE(op_ctx->info.bs_key.block) %
             g_data_thread_vars.thread_array.count;
+        context = g_data_thread_vars.thread_array.contexts + index;
         op = (FSDataOperation *)fast_mblock_alloc_object(&context->allocator);
         if (op == NULL) {
             return ENOMEM;
@@ -83,18 +137,50 @@ extern "C" {
 
         op->operation = operation;
         op->source = source;
+        op->stage = DATA_OPERATION_STAGE_NONE;
         op->arg = arg;
         op->ctx = op_ctx;
-        fc_queue_push(&context->queue, op);
+        if (batch != NULL && batch->in_progress) {
+            chain = batch->chains + index;
+            op->next = NULL;
+            if (chain->tail == NULL) {
+                chain->head = op;
+            } else {
+                chain->tail->next = op;
+            }
+            chain->tail = op;
+        } else {
+            fc_queue_push(&context->queue, op);
+        }
         return 0;
     }
 
-    static inline void data_thread_notify(FSDataThreadContext *thread_ctx)
+    #define push_to_data_thread_queue(operation, source, arg, op_ctx) \
+        push_to_data_thread_queue_ex(operation, source, arg, op_ctx, NULL)
+
+    /* called by the async callers when the slice IO or
+       the replication of the operation done */
+    static inline void data_thread_notify(FSSliceOpContext *op_ctx)
+    {
+        fc_queue_push(&op_ctx->data_thread_ctx->queue, op_ctx->data_op);
+    }
+
+    //the in flight operations of all data threads, for background IO throttle
+    static inline int data_thread_get_inflight_count()
     {
-        PTHREAD_MUTEX_LOCK(&thread_ctx->lc_pair.lock);
-        thread_ctx->notify_done = true;
-        pthread_cond_signal(&thread_ctx->lc_pair.cond);
-        PTHREAD_MUTEX_UNLOCK(&thread_ctx->lc_pair.lock);
+        FSDataThreadContext *context;
+        FSDataThreadContext *end;
+        int count;
+
+        count = 0;
+        end = g_data_thread_vars.thread_array.contexts +
+            g_data_thread_vars.thread_array.count;
+        for (context=g_data_thread_vars.thread_array.contexts;
+                context<end; context++)
+        {
+            count += __sync_add_and_fetch(&context->inflight.count, 0);
+        }
+        return count;
     }
 
     static inline const char *fs_get_data_operation_caption(const int operation)
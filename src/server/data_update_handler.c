@@ -260,11 +260,11 @@ static void slave_data_update_done_notify(FSDataOperation *op)
         }
     }
 
-    if (op->operation == DATA_OPERATION_SLICE_WRITE) {
-        op_buffer_ctx = fc_list_entry(op->ctx, FSSliceOpBufferContext, op_ctx);
+    op_buffer_ctx = fc_list_entry(op->ctx, FSSliceOpBufferContext, op_ctx);
+    if (op_buffer_ctx->buffer != NULL) {
         shared_buffer_release(op_buffer_ctx->buffer);
-        replication_callee_free_op_buffer_ctx(SERVER_CTX, op_buffer_ctx);
     }
+    replication_callee_free_op_buffer_ctx(SERVER_CTX, op_buffer_ctx);
 }
 
 static inline void set_block_op_error_msg(struct fast_task_info *task,
@@ -298,19 +298,22 @@ static inline void set_block_op_error_msg(struct fast_task_info *task,
 static inline int du_push_to_data_queue(struct fast_task_info *task,
         FSSliceOpContext *op_ctx, const int operation)
 {
+    FSDataOperationBatch *batch;
     int result;
 
     if (TASK_CTX.which_side == FS_WHICH_SIDE_MASTER) {
         op_ctx->notify_func = master_data_update_done_notify;
+        batch = NULL;
     } else {
         op_ctx->notify_func = slave_data_update_done_notify;
+        batch = &SERVER_CTX->replica.op_batch;
     }
 
     op_ctx->info.write_binlog.log_replica = true;
-    if ((result=push_to_data_thread_queue(operation,
+    if ((result=push_to_data_thread_queue_ex(operation,
                    TASK_CTX.which_side == FS_WHICH_SIDE_MASTER ?
                    DATA_SOURCE_MASTER_SERVICE : DATA_SOURCE_SLAVE_REPLICA,
-                   task, op_ctx)) != 0)
+                   task, op_ctx, batch)) != 0)
     {
         const char *caption;
         caption = fs_get_data_operation_caption(operation);
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include "fastcommon/shared_func.h"
+#include "fastcommon/logger.h"
+#include "aligned_buffer_pool.h"
+
+int aligned_buffer_pool_init(AlignedBufferPool *pool,
+        const int max_free_per_class)
+{
+    memset(pool->freelists, 0, sizeof(pool->freelists));
+    pool->max_free_per_class = max_free_per_class;
+    return fast_mblock_init_ex1(&pool->allocator, "aligned_buffer",
+            sizeof(AlignedBuffer), 256, 0, NULL, NULL, false);
+}
+
+void aligned_buffer_pool_destroy(AlignedBufferPool *pool)
+{
+    AlignedBufferFreelist *freelist;
+    AlignedBufferFreelist *end;
+    AlignedBuffer *buffer;
+
+    end = pool->freelists + ALIGNED_BUFFER_SIZE_CLASSES;
+    for (freelist=pool->freelists; freelist<end; freelist++) {
+        while (freelist->head != NULL) {
+            buffer = freelist->head;
+            freelist->head = buffer->next;
+            free(buffer->buff);
+        }
+        freelist->count = 0;
+    }
+    fast_mblock_destroy(&pool->allocator);
+}
+
+static inline int get_size_class(const int size, int *alloc_size)
+{
+    int index;
+
+    index = 0;
+    *alloc_size = FS_DIRECT_IO_ALIGN_SIZE;
+    while (*alloc_size < size) {
+        *alloc_size *= 2;
+        index++;
+    }
+    return index;
+}
+
+AlignedBuffer *aligned_buffer_pool_alloc(AlignedBufferPool *pool,
+        const int size)
+{
+    AlignedBufferFreelist *freelist;
+    AlignedBuffer *buffer;
+    int alloc_size;
+    int index;
+    int result;
+
+    index = get_size_class(size, &alloc_size);
+    if (index >= ALIGNED_BUFFER_SIZE_CLASSES) {
+        logError("file: "__FILE__", line: %d, "
+                "buffer size: %d is too large", __LINE__, size);
+        return NULL;
+    }
+
+    freelist = pool->freelists + index;
+    if (freelist->head != NULL) {
+        buffer = freelist->head;
+        freelist->head = buffer->next;
+        freelist->count--;
+        return buffer;
+    }
+
+    buffer = (AlignedBuffer *)fast_mblock_alloc_object(&pool->allocator);
+    if (buffer == NULL) {
+        return NULL;
+    }
+
+    if ((result=posix_memalign((void **)&buffer->buff,
+                    FS_DIRECT_IO_ALIGN_SIZE, alloc_size)) != 0)
+    {
+        logError("file: "__FILE__", line: %d, "
+                "posix_memalign %d bytes fail, "
+                "errno: %d, error info: %s", __LINE__,
+                alloc_size, result, STRERROR(result));
+        fast_mblock_free_object(&pool->allocator, buffer);
+        return NULL;
+    }
+
+    buffer->size = alloc_size;
+    return buffer;
+}
+
+void aligned_buffer_pool_free(AlignedBufferPool *pool,
+        AlignedBuffer *buffer)
+{
+    AlignedBufferFreelist *freelist;
+    int alloc_size;
+
+    freelist = pool->freelists + get_size_class(buffer->size, &alloc_size);
+    if (freelist->count >= pool->max_free_per_class) {
+        free(buffer->buff);
+        fast_mblock_free_object(&pool->allocator, buffer);
+        return;
+    }
+
+    buffer->next = freelist->head;
+    freelist->head = buffer;
+    freelist->count++;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//aligned_buffer_pool.h
+
+#ifndef _ALIGNED_BUFFER_POOL_H
+#define _ALIGNED_BUFFER_POOL_H
+
+#include "fastcommon/fast_mblock.h"
+#include "../storage/storage_types.h"
+
+//from 4KB to 8MB (the block size 4MB plus the aligned head and tail)
+#define ALIGNED_BUFFER_SIZE_CLASSES  12
+
+typedef struct aligned_buffer {
+    int size;
+    char *buff;
+    struct aligned_buffer *next;
+} AlignedBuffer;
+
+typedef struct {
+    int count;
+    AlignedBuffer *head;
+} AlignedBufferFreelist;
+
+/* the pool is NOT thread safe, one pool per IO thread */
+typedef struct {
+    int max_free_per_class;  //the max cached buffers per size class
+    AlignedBufferFreelist freelists[ALIGNED_BUFFER_SIZE_CLASSES];
+    struct fast_mblock_man allocator;  //for AlignedBuffer
+} AlignedBufferPool;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    int aligned_buffer_pool_init(AlignedBufferPool *pool,
+            const int max_free_per_class);
+
+    void aligned_buffer_pool_destroy(AlignedBufferPool *pool);
+
+    AlignedBuffer *aligned_buffer_pool_alloc(AlignedBufferPool *pool,
+            const int size);
+
+    void aligned_buffer_pool_free(AlignedBufferPool *pool,
+            AlignedBuffer *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
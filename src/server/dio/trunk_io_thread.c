@@ -14,8 +14,14 @@
  */
 
 #include <limits.h>
+#include <time.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#ifdef OS_HAVE_IO_URING
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <liburing.h>
+#endif
 #include "fastcommon/shared_func.h"
 #include "fastcommon/logger.h"
 #include "fastcommon/fast_mblock.h"
@@ -28,9 +34,41 @@
 #define IO_THREAD_ROLE_WRITER   'W'
 #define IO_THREAD_ROLE_READER   'R'
 
-typedef struct trunk_io_thread_context {
+//the max writes waiting for the sync in group commit durability mode
+#define IO_THREAD_GROUP_COMMIT_MAX_WRITES  256
+
+#define IO_THREAD_SCHED_MIN_COST      4096  //the min bytes charged per IO
+#define IO_THREAD_SCHED_PASS_SCALE    1024  //for the pass of low weight
+#define IO_THREAD_BUCKET_BURST_MS      100  //the max tokens saved
+#define IO_THREAD_ELEVATOR_SCAN_MAX     64  //the max IOs scanned per pick
+
+typedef struct trunk_io_class_queue {
     TrunkIOBuffer *head;
     TrunkIOBuffer *tail;
+    int weight;
+    int deadline;    //in ms, 0 for none
+    int64_t pass;    //the virtual time for the weighted fair queuing
+    struct {
+        int64_t rate;    //bytes per second, 0 for no limit
+        int64_t tokens;  //in bytes, negative for the overdraft
+        int64_t last_refill_time;  //in ms
+    } bucket;
+    TrunkIOClassStat stat;
+} TrunkIOClassQueue;
+
+typedef struct trunk_io_position {
+    int64_t trunk_id;
+    int64_t offset;
+} TrunkIOPosition;
+
+typedef struct trunk_io_thread_context {
+    struct {
+        TrunkIOClassQueue queues[FS_IO_CLASS_COUNT];
+        int count;      //the queued IOs of all classes
+        int64_t vtime;  //the pass of the last dispatched class
+        bool rotational;
+        TrunkIOPosition position;  //the end of the last IO for elevator
+    } sched;
     pthread_mutex_t lock;
     pthread_cond_t cond;
     struct fast_mblock_man mblock;
@@ -39,8 +77,40 @@ typedef struct trunk_io_thread_context {
         TrunkIdFDPair pair;
     } fd_cache;
     int role;
+    int io_engine;
+    bool direct_io;
+    AlignedBufferPool buffer_pool;  //for direct IO
+    FSDurabilityConfig durability;  //for the writer
+    struct {
+        bool dirty;  //the cached write fd NOT synced
+        int64_t first_write_time;  //in ms, the first write since the sync
+        int count;
+        TrunkIOBuffer *head;  //the writes waiting for the group commit
+        TrunkIOBuffer *tail;
+    } sync;
+#ifdef OS_HAVE_IO_URING
+    struct {
+        struct io_uring ring;
+        int efd;        //eventfd for push notify
+        int depth;      //max in flight IOs
+        int inflight;   //submitted slice IOs
+        int prepared;   //prepared SQEs but not submitted
+        struct {
+            TrunkIOBuffer *head;
+            TrunkIOBuffer *tail;
+        } waitings;     //waiting for submit
+        bool timer_armed;  //waiting for the tokens of the IO classes
+        struct __kernel_timespec timeout;
+    } uring;
+#endif
 } TrunkIOThreadContext;
 
+typedef struct trunk_io_range {
+    char *buff;
+    int length;
+    int64_t offset;
+} TrunkIORange;
+
 typedef struct trunk_io_thread_context_array {
     int count;
     TrunkIOThreadContext *contexts;
@@ -57,9 +127,48 @@ typedef struct trunk_io_path_contexts_array {
 } TrunkIOPathContextArray;
 
 static TrunkIOPathContextArray io_path_context_array = {0, NULL};
+static volatile int running_count = 0;
+
+char *g_trunk_io_gap_buffer = NULL;
 
 static void *trunk_io_thread_func(void *arg);
 
+#ifdef OS_HAVE_IO_URING
+static void *trunk_io_uring_thread_func(void *arg);
+
+static int init_io_uring(TrunkIOThreadContext *ctx)
+{
+    int result;
+
+    /* two SQEs reserved for the eventfd poll and the timer */
+    ctx->uring.depth = STORAGE_CFG.io_uring_queue_depth;
+    if ((result=io_uring_queue_init(ctx->uring.depth + 2,
+                    &ctx->uring.ring, 0)) < 0)
+    {
+        result = -1 * result;
+        logError("file: "__FILE__", line: %d, "
+                "io_uring_queue_init fail, entries: %d, "
+                "errno: %d, error info: %s", __LINE__,
+                ctx->uring.depth + 2, result, STRERROR(result));
+        return result;
+    }
+
+    if ((ctx->uring.efd=eventfd(0, EFD_CLOEXEC)) < 0) {
+        result = errno != 0 ? errno : EMFILE;
+        logError("file: "__FILE__", line: %d, "
+                "eventfd fail, errno: %d, error info: %s",
+                __LINE__, result, STRERROR(result));
+        return result;
+    }
+
+    ctx->uring.inflight = 0;
+    ctx->uring.prepared = 0;
+    ctx->uring.waitings.head = ctx->uring.waitings.tail = NULL;
+    ctx->uring.timer_armed = false;
+    return 0;
+}
+#endif
+
 static int alloc_path_contexts()
 {
     int bytes;
@@ -88,10 +197,33 @@ static TrunkIOThreadContext *alloc_thread_contexts(const int count)
     return contexts;
 }
 
+static void init_sched(TrunkIOThreadContext *ctx,
+        const FSStoragePathInfo *path, const int thread_count)
+{
+    TrunkIOClassQueue *queue;
+    FSIOClassConfig *cfg;
+    int i;
+
+    ctx->sched.rotational = path->rotational;
+    for (i=0; i<FS_IO_CLASS_COUNT; i++) {
+        queue = ctx->sched.queues + i;
+        cfg = STORAGE_CFG.io_classes + i;
+        queue->weight = cfg->weight;
+        queue->deadline = cfg->deadline;
+
+        //the limit of the store path is shared by the threads of the role
+        queue->bucket.rate = cfg->max_bytes_per_second / thread_count;
+        if (cfg->max_bytes_per_second > 0 && queue->bucket.rate == 0) {
+            queue->bucket.rate = 1;
+        }
+    }
+}
+
 static int init_thread_context(TrunkIOThreadContext *ctx)
 {
     int result;
     pthread_t tid;
+    void *(*thread_func)(void *arg);
 
     if ((result=init_pthread_lock(&ctx->lock)) != 0) {
         logError("file: "__FILE__", line: %d, "
@@ -125,12 +257,35 @@ static int init_thread_context(TrunkIOThreadContext *ctx)
         }
     }
 
-    return fc_create_thread(&tid, trunk_io_thread_func,
+    if (ctx->direct_io) {
+        if ((result=aligned_buffer_pool_init(&ctx->buffer_pool,
+                        ctx->io_engine == FS_IO_ENGINE_IO_URING ?
+                        FC_MIN(STORAGE_CFG.io_uring_queue_depth, 64) :
+                        2)) != 0)
+        {
+            return result;
+        }
+    }
+
+#ifdef OS_HAVE_IO_URING
+    if (ctx->io_engine == FS_IO_ENGINE_IO_URING) {
+        if ((result=init_io_uring(ctx)) != 0) {
+            return result;
+        }
+        thread_func = trunk_io_uring_thread_func;
+    } else {
+        thread_func = trunk_io_thread_func;
+    }
+#else
+    thread_func = trunk_io_thread_func;
+#endif
+
+    return fc_create_thread(&tid, thread_func,
             ctx, SF_G_THREAD_STACK_SIZE);
 }
 
 static int init_thread_contexts(TrunkIOThreadContextArray *ctx_array,
-        const int role)
+        const int role, const int io_engine, const FSStoragePathInfo *path)
 {
     int result;
     TrunkIOThreadContext *ctx;
@@ -139,6 +294,10 @@ static int init_thread_contexts(TrunkIOThreadContextArray *ctx_array,
     end = ctx_array->contexts + ctx_array->count;
     for (ctx=ctx_array->contexts; ctx<end; ctx++) {
         ctx->role = role;
+        ctx->io_engine = io_engine;
+        ctx->direct_io = path->direct_io;
+        ctx->durability = path->durability;
+        init_sched(ctx, path, ctx_array->count);
         if ((result=init_thread_context(ctx)) != 0) {
             return result;
         }
@@ -155,6 +314,7 @@ static int init_path_contexts(FSStoragePathArray *parray)
     TrunkIOPathContext *path_ctx;
     int result;
     int thread_count;
+    int write_io_engine;
 
     end = parray->paths + parray->count;
     for (p=parray->paths; p<end; p++) {
@@ -165,10 +325,18 @@ static int init_path_contexts(FSStoragePathArray *parray)
             return ENOMEM;
         }
 
+        /* the writes are synced by the writer thread before the notify,
+           the submitted writes of io_uring complete out of the thread */
+        if (p->durability.mode != FS_DURABILITY_MODE_NONE) {
+            write_io_engine = FS_IO_ENGINE_THREAD;
+        } else {
+            write_io_engine = p->io_engine;
+        }
+
         path_ctx->writes.contexts = thread_ctxs;
         path_ctx->writes.count = p->write_thread_count;
         if ((result=init_thread_contexts(&path_ctx->writes,
-                        IO_THREAD_ROLE_WRITER)) != 0)
+                        IO_THREAD_ROLE_WRITER, write_io_engine, p)) != 0)
         {
             return result;
         }
@@ -176,7 +344,7 @@ static int init_path_contexts(FSStoragePathArray *parray)
         path_ctx->reads.contexts = thread_ctxs + p->write_thread_count;
         path_ctx->reads.count = p->read_thread_count;
         if ((result=init_thread_contexts(&path_ctx->reads,
-                        IO_THREAD_ROLE_READER)) != 0)
+                        IO_THREAD_ROLE_READER, p->io_engine, p)) != 0)
         {
             return result;
         }
@@ -193,6 +361,14 @@ int trunk_io_thread_init()
         return result;
     }
 
+    if (STORAGE_CFG.read_merge_max_gap > 0) {
+        g_trunk_io_gap_buffer = (char *)fc_malloc(
+                STORAGE_CFG.read_merge_max_gap);
+        if (g_trunk_io_gap_buffer == NULL) {
+            return ENOMEM;
+        }
+    }
+
     if ((result=init_path_contexts(&STORAGE_CFG.write_cache)) != 0) {
         return result;
     }
@@ -204,13 +380,399 @@ int trunk_io_thread_init()
     return 0;
 }
 
+static void wakeup_thread_contexts(TrunkIOThreadContextArray *ctx_array)
+{
+    TrunkIOThreadContext *ctx;
+    TrunkIOThreadContext *end;
+
+    end = ctx_array->contexts + ctx_array->count;
+    for (ctx=ctx_array->contexts; ctx<end; ctx++) {
+#ifdef OS_HAVE_IO_URING
+        if (ctx->io_engine == FS_IO_ENGINE_IO_URING) {
+            eventfd_write(ctx->uring.efd, 1);
+            continue;
+        }
+#endif
+        pthread_mutex_lock(&ctx->lock);
+        pthread_cond_signal(&ctx->cond);
+        pthread_mutex_unlock(&ctx->lock);
+    }
+}
+
 void trunk_io_thread_terminate()
 {
+    TrunkIOPathContext *path_ctx;
+    TrunkIOPathContext *end;
+    int count;
+
+    end = io_path_context_array.paths + io_path_context_array.count;
+    for (path_ctx=io_path_context_array.paths; path_ctx<end; path_ctx++) {
+        wakeup_thread_contexts(&path_ctx->writes);
+        wakeup_thread_contexts(&path_ctx->reads);
+    }
+
+    //the threads sync the waiting writes and cancel the queued IOs on exit
+    count = 0;
+    while (__sync_add_and_fetch(&running_count, 0) != 0 && count++ < 500) {
+        fc_sleep_ms(10);
+    }
+    if (running_count != 0) {
+        logWarning("file: "__FILE__", line: %d, "
+                "wait trunk io threads exit timeout, running count: %d",
+                __LINE__, running_count);
+    }
+}
+
+static inline int get_io_bytes(const TrunkIOBuffer *iob)
+{
+    switch (iob->type) {
+        case FS_IO_TYPE_READ_SLICES:
+            return iob->merged.length;
+        case FS_IO_TYPE_READ_SLICE:
+        case FS_IO_TYPE_WRITE_SLICE:
+            return iob->slice->ssize.length;
+        default:
+            return 0;
+    }
 }
 
-int trunk_io_thread_push(const int type, const int path_index,
-        const uint32_t hash_code, void *entry, char *buff,
-        trunk_io_notify_func notify_func, void *notify_arg)
+static inline void get_io_position(const TrunkIOBuffer *iob,
+        TrunkIOPosition *position)
+{
+    if (iob->type == FS_IO_TYPE_CREATE_TRUNK ||
+            iob->type == FS_IO_TYPE_DELETE_TRUNK)
+    {
+        position->trunk_id = iob->space.id_info.id;
+        position->offset = 0;
+    } else {
+        position->trunk_id = iob->slice->space.id_info.id;
+        position->offset = iob->slice->space.offset;
+        if (iob->type != FS_IO_TYPE_WRITE_SLICE) {
+            position->offset += iob->slice->read_offset;
+        }
+    }
+}
+
+static inline int compare_io_position(const TrunkIOPosition *pos1,
+        const TrunkIOPosition *pos2)
+{
+    if (pos1->trunk_id != pos2->trunk_id) {
+        return pos1->trunk_id < pos2->trunk_id ? -1 : 1;
+    }
+    if (pos1->offset != pos2->offset) {
+        return pos1->offset < pos2->offset ? -1 : 1;
+    }
+    return 0;
+}
+
+/* push the IO to the queue of its class, called under the lock,
+   return true when the class queue was empty */
+static bool sched_push(TrunkIOThreadContext *ctx, TrunkIOBuffer *iob)
+{
+    TrunkIOClassQueue *queue;
+    bool was_empty;
+
+    queue = ctx->sched.queues + iob->io_class;
+    was_empty = (queue->head == NULL);
+    if (was_empty) {
+        //the idle class can NOT save the virtual time for a burst
+        if (queue->pass < ctx->sched.vtime) {
+            queue->pass = ctx->sched.vtime;
+        }
+        queue->head = iob;
+    } else {
+        queue->tail->next = iob;
+    }
+    queue->tail = iob;
+    queue->stat.queue_depth++;
+    ctx->sched.count++;
+    return was_empty;
+}
+
+static inline void refill_bucket(TrunkIOClassQueue *queue,
+        const int64_t current_time_ms)
+{
+    int64_t elapsed;
+    int64_t capacity;
+
+    if ((elapsed=current_time_ms - queue->bucket.last_refill_time) <= 0) {
+        return;
+    }
+
+    queue->bucket.tokens += queue->bucket.rate * elapsed / 1000;
+    capacity = queue->bucket.rate * IO_THREAD_BUCKET_BURST_MS / 1000;
+    if (queue->bucket.tokens > capacity) {
+        queue->bucket.tokens = capacity;
+    }
+    queue->bucket.last_refill_time = current_time_ms;
+}
+
+/* pick the IO with the nearest position after the last IO from the
+   first IOs of the queue, wrap around to the lowest as C-SCAN */
+static TrunkIOBuffer *elevator_pick(TrunkIOThreadContext *ctx,
+        TrunkIOClassQueue *queue, TrunkIOBuffer **prev)
+{
+    TrunkIOBuffer *iob;
+    TrunkIOBuffer *last;
+    TrunkIOBuffer *best;
+    TrunkIOBuffer *best_prev;
+    TrunkIOBuffer *lowest;
+    TrunkIOBuffer *lowest_prev;
+    TrunkIOPosition position;
+    TrunkIOPosition best_pos;
+    TrunkIOPosition lowest_pos;
+    int count;
+
+    best = best_prev = NULL;
+    lowest = lowest_prev = NULL;
+    last = NULL;
+    count = 0;
+    for (iob=queue->head; iob!=NULL && count<IO_THREAD_ELEVATOR_SCAN_MAX;
+            iob=iob->next, count++)
+    {
+        get_io_position(iob, &position);
+        if (compare_io_position(&position, &ctx->sched.position) >= 0) {
+            if (best == NULL || compare_io_position(&position,
+                        &best_pos) < 0)
+            {
+                best = iob;
+                best_prev = last;
+                best_pos = position;
+            }
+        } else if (lowest == NULL || compare_io_position(&position,
+                    &lowest_pos) < 0)
+        {
+            lowest = iob;
+            lowest_prev = last;
+            lowest_pos = position;
+        }
+        last = iob;
+    }
+
+    if (best != NULL) {
+        *prev = best_prev;
+        return best;
+    } else {
+        *prev = lowest_prev;
+        return lowest;
+    }
+}
+
+static TrunkIOBuffer *class_queue_pop(TrunkIOThreadContext *ctx,
+        TrunkIOClassQueue *queue, const bool by_deadline)
+{
+    TrunkIOBuffer *iob;
+    TrunkIOBuffer *prev;
+
+    if (ctx->sched.rotational && !by_deadline && queue->head != queue->tail) {
+        iob = elevator_pick(ctx, queue, &prev);
+    } else {
+        iob = queue->head;
+        prev = NULL;
+    }
+
+    if (prev == NULL) {
+        queue->head = iob->next;
+    } else {
+        prev->next = iob->next;
+    }
+    if (queue->tail == iob) {
+        queue->tail = prev;
+    }
+    iob->next = NULL;
+
+    if (ctx->sched.rotational) {
+        get_io_position(iob, &ctx->sched.position);
+        ctx->sched.position.offset += get_io_bytes(iob);
+    }
+    return iob;
+}
+
+/* pop the IO to dispatch, called under the lock: the expired deadline
+   first, otherwise the class with the min pass within its token bucket.
+   return NULL when no IO can be dispatched, and wait_ms is set to the
+   time waiting for the tokens, -1 for NO IO queued */
+static TrunkIOBuffer *sched_pop(TrunkIOThreadContext *ctx, int *wait_ms)
+{
+    TrunkIOClassQueue *queue;
+    TrunkIOClassQueue *end;
+    TrunkIOClassQueue *selected;
+    TrunkIOBuffer *iob;
+    int64_t current_time_us;
+    int64_t current_time_ms;
+    int wait;
+    int cost;
+    bool by_deadline;
+
+    *wait_ms = -1;
+    if (ctx->sched.count == 0) {
+        return NULL;
+    }
+
+    current_time_us = get_current_time_us();
+    current_time_ms = current_time_us / 1000;
+    selected = NULL;
+    end = ctx->sched.queues + FS_IO_CLASS_COUNT;
+    for (queue=ctx->sched.queues; queue<end; queue++) {
+        if (queue->head == NULL || queue->deadline == 0) {
+            continue;
+        }
+        if (current_time_us - queue->head->push_time >= queue->
+                deadline * 1000LL && (selected == NULL || queue->head->
+                    push_time < selected->head->push_time))
+        {
+            selected = queue;
+        }
+    }
+
+    by_deadline = (selected != NULL);
+    if (!by_deadline) {
+        for (queue=ctx->sched.queues; queue<end; queue++) {
+            if (queue->head == NULL) {
+                continue;
+            }
+
+            if (queue->bucket.rate > 0) {
+                refill_bucket(queue, current_time_ms);
+                if (queue->bucket.tokens <= 0) {
+                    wait = (1 - queue->bucket.tokens) * 1000 /
+                        queue->bucket.rate + 1;
+                    if (*wait_ms < 0 || wait < *wait_ms) {
+                        *wait_ms = wait;
+                    }
+                    continue;
+                }
+            }
+
+            if (selected == NULL || queue->pass < selected->pass) {
+                selected = queue;
+            }
+        }
+
+        if (selected == NULL) {
+            return NULL;
+        }
+    }
+
+    iob = class_queue_pop(ctx, selected, by_deadline);
+    cost = FC_MAX(get_io_bytes(iob), IO_THREAD_SCHED_MIN_COST);
+    if (selected->bucket.rate > 0) {
+        //the expired IO overdraws the tokens
+        refill_bucket(selected, current_time_ms);
+        selected->bucket.tokens -= cost;
+    }
+    selected->pass += (int64_t)cost * IO_THREAD_SCHED_PASS_SCALE /
+        selected->weight;
+    ctx->sched.vtime = selected->pass;
+    selected->stat.queue_depth--;
+    ctx->sched.count--;
+    return iob;
+}
+
+static void notify_io_done(TrunkIOThreadContext *ctx,
+        TrunkIOBuffer *iob, const int result)
+{
+    TrunkIOClassStat *stat;
+    int64_t latency;
+
+    stat = &ctx->sched.queues[iob->io_class].stat;
+    latency = get_current_time_us() - iob->push_time;
+    stat->total_count++;
+    stat->total_bytes += get_io_bytes(iob);
+    stat->total_latency += latency;
+    if (latency > stat->max_latency) {
+        stat->max_latency = latency;
+    }
+
+    if (iob->notify.func != NULL) {
+        iob->notify.func(iob, result);
+    }
+}
+
+static void cancel_buffer_chain(TrunkIOThreadContext *ctx,
+        TrunkIOBuffer *head)
+{
+    TrunkIOBuffer *iob;
+    TrunkIOBuffer *next;
+
+    for (iob=head; iob!=NULL; iob=iob->next) {
+        notify_io_done(ctx, iob, EINTR);
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    iob = head;
+    while (iob != NULL) {
+        next = iob->next;
+        fast_mblock_free_object(&ctx->mblock, iob);
+        iob = next;
+    }
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+//notify the IOs NOT dispatched with EINTR when the thread exits
+static void cancel_queued_buffers(TrunkIOThreadContext *ctx)
+{
+    TrunkIOClassQueue *queue;
+    TrunkIOBuffer *heads[FS_IO_CLASS_COUNT];
+    int i;
+
+    pthread_mutex_lock(&ctx->lock);
+    for (i=0; i<FS_IO_CLASS_COUNT; i++) {
+        queue = ctx->sched.queues + i;
+        heads[i] = queue->head;
+        queue->head = queue->tail = NULL;
+        queue->stat.queue_depth = 0;
+    }
+    ctx->sched.count = 0;
+    pthread_mutex_unlock(&ctx->lock);
+
+    for (i=0; i<FS_IO_CLASS_COUNT; i++) {
+        if (heads[i] != NULL) {
+            cancel_buffer_chain(ctx, heads[i]);
+        }
+    }
+}
+
+int trunk_io_thread_get_class_stats(const int path_index,
+        TrunkIOClassStat *stats)
+{
+    TrunkIOPathContext *path_ctx;
+    TrunkIOThreadContext *ctx;
+    TrunkIOThreadContext *end;
+    TrunkIOClassStat *src;
+    TrunkIOClassStat *dest;
+    int i;
+
+    if (path_index < 0 || path_index >= io_path_context_array.count) {
+        return ENOENT;
+    }
+    path_ctx = io_path_context_array.paths + path_index;
+    if (path_ctx->writes.contexts == NULL) {
+        return ENOENT;
+    }
+
+    memset(stats, 0, sizeof(TrunkIOClassStat) * FS_IO_CLASS_COUNT);
+    end = path_ctx->writes.contexts + path_ctx->writes.count +
+        path_ctx->reads.count;
+    for (ctx=path_ctx->writes.contexts; ctx<end; ctx++) {
+        for (i=0; i<FS_IO_CLASS_COUNT; i++) {
+            src = &ctx->sched.queues[i].stat;
+            dest = stats + i;
+            dest->queue_depth += src->queue_depth;
+            dest->total_count += src->total_count;
+            dest->total_bytes += src->total_bytes;
+            dest->total_latency += src->total_latency;
+            if (src->max_latency > dest->max_latency) {
+                dest->max_latency = src->max_latency;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int push_io_buffer(const int path_index, const uint32_t hash_code,
+        const TrunkIOBuffer *src)
 {
     TrunkIOPathContext *path_ctx;
     TrunkIOThreadContext *thread_ctx;
@@ -219,7 +781,9 @@ int trunk_io_thread_push(const int type, const int path_index,
     bool notify;
 
     path_ctx = io_path_context_array.paths + path_index;
-    if (type == FS_IO_TYPE_READ_SLICE) {
+    if (src->type == FS_IO_TYPE_READ_SLICE ||
+            src->type == FS_IO_TYPE_READ_SLICES)
+    {
         ctx_array = &path_ctx->reads;
     } else {
         ctx_array = &path_ctx->writes;
@@ -233,39 +797,78 @@ int trunk_io_thread_push(const int type, const int path_index,
         return ENOMEM;
     }
 
-    iob->type = type;
-    if (type == FS_IO_TYPE_CREATE_TRUNK || type == FS_IO_TYPE_DELETE_TRUNK) {
-        iob->space = *((FSTrunkSpaceInfo *)entry);
-    } else {
-        iob->slice = (OBSliceEntry *)entry;
-    }
-
-    if (buff != NULL) {
-        iob->data.str = buff;
-    } else {
-        iob->data.str = NULL;
-    }
-    iob->data.len = 0;
-    iob->notify.func = notify_func;
-    iob->notify.arg = notify_arg;
-    iob->next = NULL;
-
-    if (thread_ctx->tail == NULL) {
-        thread_ctx->head = iob;
-        notify = true;
-    } else {
-        thread_ctx->tail->next = iob;
-        notify = false;
-    }
-    thread_ctx->tail = iob;
+    *iob = *src;
+    iob->push_time = get_current_time_us();
+    notify = sched_push(thread_ctx, iob);
     pthread_mutex_unlock(&thread_ctx->lock);
 
     if (notify) {
+#ifdef OS_HAVE_IO_URING
+        if (thread_ctx->io_engine == FS_IO_ENGINE_IO_URING) {
+            eventfd_write(thread_ctx->uring.efd, 1);
+        } else {
+            pthread_cond_signal(&thread_ctx->cond);
+        }
+#else
         pthread_cond_signal(&thread_ctx->cond);
+#endif
     }
     return 0;
 }
 
+int trunk_io_thread_push(const int type, const int io_class,
+        const int path_index, const uint32_t hash_code, void *entry,
+        char *buff, trunk_io_notify_func notify_func, void *notify_arg)
+{
+    TrunkIOBuffer iob;
+
+    iob.type = type;
+    iob.io_class = io_class;
+    if (type == FS_IO_TYPE_CREATE_TRUNK || type == FS_IO_TYPE_DELETE_TRUNK) {
+        iob.space = *((FSTrunkSpaceInfo *)entry);
+    } else {
+        iob.slice = (OBSliceEntry *)entry;
+    }
+
+    iob.data.str = buff;
+    iob.data.len = 0;
+    iob.abuffer = NULL;
+    iob.merged.slices = NULL;
+    iob.merged.count = 0;
+    iob.merged.iovs = NULL;
+    iob.merged.iovcnt = 0;
+    iob.merged.length = 0;
+    iob.notify.func = notify_func;
+    iob.notify.arg = notify_arg;
+    iob.next = NULL;
+    return push_io_buffer(path_index, hash_code, &iob);
+}
+
+int io_thread_push_merged_read(const int io_class,
+        OBSliceEntry **slices, const int count,
+        struct iovec *iovs, const int iovcnt, const int length,
+        trunk_io_notify_func notify_func, void *notify_arg)
+{
+    TrunkIOBuffer iob;
+
+    iob.type = FS_IO_TYPE_READ_SLICES;
+    iob.io_class = io_class;
+    iob.slice = slices[0];
+    iob.data.str = NULL;
+    iob.data.len = 0;
+    iob.abuffer = NULL;
+    iob.merged.slices = slices;
+    iob.merged.count = count;
+    iob.merged.iovs = iovs;
+    iob.merged.iovcnt = iovcnt;
+    iob.merged.length = length;
+    iob.notify.func = notify_func;
+    iob.notify.arg = notify_arg;
+    iob.next = NULL;
+    return push_io_buffer(slices[0]->space.store->index,
+            FS_BLOCK_HASH_CODE(slices[0]->ob->bkey), &iob);
+}
+
 static inline void get_trunk_filename(FSTrunkSpaceInfo *space,
         char *trunk_filename, const int size)
 {
@@ -274,9 +877,87 @@ static inline void get_trunk_filename(FSTrunkSpaceInfo *space,
             space->id_info.id);
 }
 
+static inline void mark_write_fd_dirty(TrunkIOThreadContext *ctx)
+{
+    if (ctx->durability.mode != FS_DURABILITY_MODE_NONE &&
+            !ctx->sync.dirty)
+    {
+        ctx->sync.dirty = true;
+        ctx->sync.first_write_time = get_current_time_ms();
+    }
+}
+
+static inline int get_sync_timeout(TrunkIOThreadContext *ctx)
+{
+    if (ctx->durability.mode == FS_DURABILITY_MODE_PERIODIC) {
+        return ctx->durability.fsync_interval;
+    } else {
+        return ctx->durability.group_window;
+    }
+}
+
+static inline bool is_sync_timeout(TrunkIOThreadContext *ctx)
+{
+    return get_current_time_ms() - ctx->sync.first_write_time >=
+        get_sync_timeout(ctx);
+}
+
+static void notify_synced_writes(TrunkIOThreadContext *ctx,
+        const int result)
+{
+    TrunkIOBuffer *iob;
+    TrunkIOBuffer *next;
+
+    if (ctx->sync.head == NULL) {
+        return;
+    }
+
+    for (iob=ctx->sync.head; iob!=NULL; iob=iob->next) {
+        notify_io_done(ctx, iob, result);
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    iob = ctx->sync.head;
+    while (iob != NULL) {
+        next = iob->next;
+        fast_mblock_free_object(&ctx->mblock, iob);
+        iob = next;
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    ctx->sync.head = ctx->sync.tail = NULL;
+    ctx->sync.count = 0;
+}
+
+/* sync the cached write fd by one fdatasync, then notify the writes
+   waiting for it (group commit durability mode) */
+static void flush_write_fd(TrunkIOThreadContext *ctx)
+{
+    int result;
+
+    if (!ctx->sync.dirty) {
+        return;
+    }
+
+    ctx->sync.dirty = false;
+    if (fdatasync(ctx->fd_cache.pair.fd) == 0) {
+        result = 0;
+    } else {
+        result = errno != 0 ? errno : EIO;
+        logError("file: "__FILE__", line: %d, "
+                "fdatasync trunk id: %"PRId64" fail, writes: %d, "
+                "errno: %d, error info: %s", __LINE__,
+                ctx->fd_cache.pair.trunk_id, ctx->sync.count,
+                result, STRERROR(result));
+    }
+
+    notify_synced_writes(ctx, result);
+}
+
 static inline void clear_write_fd(TrunkIOThreadContext *ctx)
 {
     if (ctx->fd_cache.pair.fd >= 0) {
+        flush_write_fd(ctx);
         close(ctx->fd_cache.pair.fd);
         ctx->fd_cache.pair.fd = -1;
         ctx->fd_cache.pair.trunk_id = 0;
@@ -295,7 +976,8 @@ static int get_write_fd(TrunkIOThreadContext *ctx,
     }
 
     get_trunk_filename(space, trunk_filename, sizeof(trunk_filename));
-    *fd = open(trunk_filename, O_WRONLY, 0644);
+    *fd = open(trunk_filename, ctx->direct_io ?
+            (O_WRONLY | O_DIRECT) : O_WRONLY, 0644);
     if (*fd < 0) {
         result = errno != 0 ? errno : EACCES;
         logError("file: "__FILE__", line: %d, "
@@ -305,6 +987,7 @@ static int get_write_fd(TrunkIOThreadContext *ctx,
     }
 
     if (ctx->fd_cache.pair.fd >= 0) {
+        flush_write_fd(ctx);  //one sync per trunk file touched
         close(ctx->fd_cache.pair.fd);
     }
 
@@ -326,7 +1009,8 @@ static int get_read_fd(TrunkIOThreadContext *ctx,
     }
 
     get_trunk_filename(space, trunk_filename, sizeof(trunk_filename));
-    *fd = open(trunk_filename, O_RDONLY);
+    *fd = open(trunk_filename, ctx->direct_io ?
+            (O_RDONLY | O_DIRECT) : O_RDONLY);
     if (*fd < 0) {
         result = errno != 0 ? errno : EACCES;
         logError("file: "__FILE__", line: %d, "
@@ -413,10 +1097,130 @@ static int do_delete_trunk(TrunkIOThreadContext *ctx, TrunkIOBuffer *iob)
     return result;
 }
 
-static int do_write_slice(TrunkIOThreadContext *ctx, TrunkIOBuffer *iob)
+/* get the IO range of the slice, the data is copied to (for write)
+   or from (for read) the aligned bounce buffer when the slice buffer,
+   offset or length is NOT aligned for direct IO.
+   the buff of the range is NULL for the merged read by the iovecs */
+static int get_io_range(TrunkIOThreadContext *ctx,
+        TrunkIOBuffer *iob, TrunkIORange *range)
 {
-    int fd;
-    int remain;
+    int64_t pos;
+    int64_t end;
+    int length;
+    int padding;
+
+    pos = iob->slice->space.offset;
+    if (iob->type != FS_IO_TYPE_WRITE_SLICE) {
+        pos += iob->slice->read_offset;
+    }
+
+    if (iob->type == FS_IO_TYPE_READ_SLICES) {
+        length = iob->merged.length;
+        if (!ctx->direct_io) {
+            range->buff = NULL;
+            range->length = length;
+            range->offset = pos;
+            return 0;
+        }
+    } else {
+        length = iob->slice->ssize.length;
+        if (!ctx->direct_io || (FS_DIRECT_IO_IS_ALIGNED(pos) &&
+                    FS_DIRECT_IO_IS_ALIGNED(length) &&
+                    FS_DIRECT_IO_IS_ALIGNED((long)iob->data.str)))
+        {
+            range->buff = iob->data.str;
+            range->length = length;
+            range->offset = pos;
+            return 0;
+        }
+    }
+
+    range->offset = FS_DIRECT_IO_ALIGN_DOWN(pos);
+    end = FS_DIRECT_IO_ALIGN_UP(pos + length);
+    range->length = end - range->offset;
+    if (iob->abuffer == NULL) {
+        if ((iob->abuffer=aligned_buffer_pool_alloc(&ctx->buffer_pool,
+                        range->length)) == NULL)
+        {
+            return ENOMEM;
+        }
+
+        if (iob->type == FS_IO_TYPE_WRITE_SLICE) {
+            //the space offset and size are aligned for direct IO
+            memcpy(iob->abuffer->buff, iob->data.str,
+                    iob->slice->ssize.length);
+            padding = range->length - iob->slice->ssize.length;
+            if (padding > 0) {
+                memset(iob->abuffer->buff + iob->slice->ssize.length,
+                        0, padding);
+            }
+        }
+    }
+    range->buff = iob->abuffer->buff;
+    return 0;
+}
+
+//scatter the data of the merged read to the slice buffers
+static void scatter_to_iovecs(TrunkIOBuffer *iob, const char *buff)
+{
+    struct iovec *iov;
+    struct iovec *end;
+
+    end = iob->merged.iovs + iob->merged.iovcnt;
+    for (iov=iob->merged.iovs; iov<end; iov++) {
+        if (iov->iov_base != g_trunk_io_gap_buffer) {
+            memcpy(iov->iov_base, buff, iov->iov_len);
+        }
+        buff += iov->iov_len;
+    }
+}
+
+//skip the iovecs of the bytes read
+static void skip_iovecs(TrunkIOBuffer *iob, int bytes)
+{
+    while (bytes > 0) {
+        if ((size_t)bytes >= iob->merged.iovs->iov_len) {
+            bytes -= iob->merged.iovs->iov_len;
+            iob->merged.iovs++;
+            iob->merged.iovcnt--;
+        } else {
+            iob->merged.iovs->iov_base = (char *)
+                iob->merged.iovs->iov_base + bytes;
+            iob->merged.iovs->iov_len -= bytes;
+            break;
+        }
+    }
+}
+
+static void finish_io_range(TrunkIOThreadContext *ctx,
+        TrunkIOBuffer *iob, TrunkIORange *range, const int result)
+{
+    int64_t pos;
+
+    if (iob->abuffer == NULL) {
+        return;
+    }
+
+    if (result == 0 && iob->type != FS_IO_TYPE_WRITE_SLICE) {
+        pos = iob->slice->space.offset + iob->slice->read_offset;
+        if (iob->type == FS_IO_TYPE_READ_SLICES) {
+            scatter_to_iovecs(iob, iob->abuffer->buff +
+                    (pos - range->offset));
+        } else {
+            memcpy(iob->data.str, iob->abuffer->buff +
+                    (pos - range->offset), iob->slice->ssize.length);
+        }
+    }
+
+    aligned_buffer_pool_free(&ctx->buffer_pool, iob->abuffer);
+    iob->abuffer = NULL;
+}
+
+static int do_write_slice(TrunkIOThreadContext *ctx, TrunkIOBuffer *iob)
+{
+    TrunkIORange range;
+    int fd;
+    int remain;
     int bytes;
     int result;
 
@@ -424,10 +1228,14 @@ static int do_write_slice(TrunkIOThreadContext *ctx, TrunkIOBuffer *iob)
         return result;
     }
 
-    remain = iob->slice->ssize.length;
+    if ((result=get_io_range(ctx, iob, &range)) != 0) {
+        return result;
+    }
+
+    remain = range.length;
     while (remain > 0) {
-        if ((bytes=pwrite(fd, iob->data.str + iob->data.len, remain,
-                        iob->slice->space.offset + iob->data.len)) < 0)
+        if ((bytes=pwrite(fd, range.buff + iob->data.len, remain,
+                        range.offset + iob->data.len)) < 0)
         {
             char trunk_filename[PATH_MAX];
 
@@ -443,8 +1251,9 @@ static int do_write_slice(TrunkIOThreadContext *ctx, TrunkIOBuffer *iob)
             logError("file: "__FILE__", line: %d, "
                     "write to trunk file: %s fail, offset: %"PRId64", "
                     "errno: %d, error info: %s", __LINE__, trunk_filename,
-                    iob->slice->space.offset + iob->data.len,
+                    range.offset + iob->data.len,
                     result, STRERROR(result));
+            finish_io_range(ctx, iob, &range, result);
             return result;
         }
 
@@ -452,11 +1261,14 @@ static int do_write_slice(TrunkIOThreadContext *ctx, TrunkIOBuffer *iob)
         remain -= bytes;
     }
 
+    mark_write_fd_dirty(ctx);
+    finish_io_range(ctx, iob, &range, 0);
     return 0;
 }
 
 static int do_read_slice(TrunkIOThreadContext *ctx, TrunkIOBuffer *iob)
 {
+    TrunkIORange range;
     int fd;
     int remain;
     int bytes;
@@ -477,17 +1289,29 @@ static int do_read_slice(TrunkIOThreadContext *ctx, TrunkIOBuffer *iob)
     }
     */
 
-    remain = iob->slice->ssize.length;
+    if ((result=get_io_range(ctx, iob, &range)) != 0) {
+        return result;
+    }
+
+    remain = range.length;
     while (remain > 0) {
-        if ((bytes=pread(fd, iob->data.str + iob->data.len, remain,
-                        iob->slice->space.offset + iob->slice->read_offset +
-                        iob->data.len)) < 0)
-        {
+        if (range.buff == NULL) {
+            bytes = preadv(fd, iob->merged.iovs, iob->merged.iovcnt,
+                    range.offset + iob->data.len);
+        } else {
+            bytes = pread(fd, range.buff + iob->data.len, remain,
+                    range.offset + iob->data.len);
+        }
+        if (bytes <= 0) {
             char trunk_filename[PATH_MAX];
 
-            result = errno != 0 ? errno : EIO;
-            if (result == EINTR) {
-                continue;
+            if (bytes == 0) {
+                result = EIO;
+            } else {
+                result = errno != 0 ? errno : EIO;
+                if (result == EINTR) {
+                    continue;
+                }
             }
 
             trunk_fd_cache_delete(&ctx->fd_cache.context,
@@ -498,15 +1322,20 @@ static int do_read_slice(TrunkIOThreadContext *ctx, TrunkIOBuffer *iob)
             logError("file: "__FILE__", line: %d, "
                     "read trunk file: %s fail, offset: %"PRId64", "
                     "errno: %d, error info: %s", __LINE__, trunk_filename,
-                    iob->slice->space.offset + iob->data.len,
+                    range.offset + iob->data.len,
                     result, STRERROR(result));
+            finish_io_range(ctx, iob, &range, result);
             return result;
         }
 
         iob->data.len += bytes;
         remain -= bytes;
+        if (range.buff == NULL && remain > 0) {
+            skip_iovecs(iob, bytes);
+        }
     }
 
+    finish_io_range(ctx, iob, &range, 0);
     return 0;
 }
 
@@ -525,6 +1354,7 @@ static int trunk_io_deal_buffer(TrunkIOThreadContext *ctx, TrunkIOBuffer *iob)
             result = do_write_slice(ctx, iob);
             break;
         case FS_IO_TYPE_READ_SLICE:
+        case FS_IO_TYPE_READ_SLICES:
             result = do_read_slice(ctx, iob);
             break;
         default:
@@ -534,36 +1364,110 @@ static int trunk_io_deal_buffer(TrunkIOThreadContext *ctx, TrunkIOBuffer *iob)
             break;
     }
 
-    if (iob->notify.func != NULL) {
-        iob->notify.func(iob, result);
-    }
+    notify_io_done(ctx, iob, result);
     return result;
 }
 
+static void timed_wait_ms(TrunkIOThreadContext *ctx, const int64_t remain)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += remain / 1000;
+    ts.tv_nsec += (remain % 1000) * 1000 * 1000;
+    if (ts.tv_nsec >= 1000 * 1000 * 1000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000 * 1000 * 1000;
+    }
+    pthread_cond_timedwait(&ctx->cond, &ctx->lock, &ts);
+}
+
+/* the write is notified after the fdatasync in group commit mode,
+   the IO buffer is kept until then */
+static void group_commit_write(TrunkIOThreadContext *ctx, TrunkIOBuffer *iob)
+{
+    int result;
+
+    if ((result=do_write_slice(ctx, iob)) != 0) {
+        logError("file: "__FILE__", line: %d, "
+                "trunk_io_deal_buffer fail, result: %d",
+                __LINE__, result);
+        notify_io_done(ctx, iob, result);
+
+        pthread_mutex_lock(&ctx->lock);
+        fast_mblock_free_object(&ctx->mblock, iob);
+        pthread_mutex_unlock(&ctx->lock);
+        return;
+    }
+
+    iob->next = NULL;
+    if (ctx->sync.tail == NULL) {
+        ctx->sync.head = iob;
+    } else {
+        ctx->sync.tail->next = iob;
+    }
+    ctx->sync.tail = iob;
+    ctx->sync.count++;
+}
+
 static void *trunk_io_thread_func(void *arg)
 {
     TrunkIOThreadContext *ctx;
     TrunkIOBuffer *iob;
     TrunkIOBuffer *iob_ptr;
     TrunkIOBuffer iob_obj;
+    int64_t sync_remain;
+    int wait_ms;
+    bool group_commit;
     int result;
 
     ctx = (TrunkIOThreadContext *)arg;
+    __sync_add_and_fetch(&running_count, 1);
     while (SF_G_CONTINUE_FLAG) {
         pthread_mutex_lock(&ctx->lock);
-        if (ctx->head == NULL) {
-            pthread_cond_wait(&ctx->cond, &ctx->lock);
+        if ((iob=sched_pop(ctx, &wait_ms)) == NULL) {
+            if (ctx->sync.dirty && ctx->durability.mode ==
+                    FS_DURABILITY_MODE_GROUP_COMMIT)
+            {
+                /* the queue drained, sync the waiting writes at once
+                   instead of waiting for the rest of the group window */
+                pthread_mutex_unlock(&ctx->lock);
+                flush_write_fd(ctx);
+                continue;
+            }
+
+            if (ctx->sync.dirty) {
+                sync_remain = ctx->sync.first_write_time +
+                    get_sync_timeout(ctx) - get_current_time_ms();
+                if (wait_ms < 0 || sync_remain < wait_ms) {
+                    wait_ms = FC_MAX(sync_remain, 0);
+                }
+            }
+
+            /* recheck the flag under the lock, the terminate
+               signals under the lock after the flag cleared */
+            if (!SF_G_CONTINUE_FLAG) {
+                pthread_mutex_unlock(&ctx->lock);
+                break;
+            }
+
+            if (wait_ms < 0) {
+                pthread_cond_wait(&ctx->cond, &ctx->lock);
+            } else if (wait_ms > 0) {
+                timed_wait_ms(ctx, wait_ms);
+            }
+            iob = sched_pop(ctx, &wait_ms);
         }
 
-        if (ctx->head == NULL) {
+        group_commit = false;
+        if (iob == NULL) {
             iob_ptr = NULL;
+        } else if (iob->type == FS_IO_TYPE_WRITE_SLICE && ctx->
+                durability.mode == FS_DURABILITY_MODE_GROUP_COMMIT)
+        {
+            iob_ptr = iob;
+            group_commit = true;
         } else {
-            iob = ctx->head;
-            ctx->head = ctx->head->next;
-            if (ctx->head == NULL) {
-                ctx->tail = NULL;
-            }
-
             iob_ptr = &iob_obj;
             iob_obj = *iob;
             fast_mblock_free_object(&ctx->mblock, iob);
@@ -571,15 +1475,413 @@ static void *trunk_io_thread_func(void *arg)
         pthread_mutex_unlock(&ctx->lock);
 
         if (iob_ptr == NULL) {
+            //the queue is empty or throttled
+            if (ctx->sync.dirty && is_sync_timeout(ctx)) {
+                flush_write_fd(ctx);
+            }
             continue;
         }
 
-        if ((result=trunk_io_deal_buffer(ctx, iob_ptr)) != 0) {
+        if (group_commit) {
+            group_commit_write(ctx, iob_ptr);
+            if (ctx->sync.count >= IO_THREAD_GROUP_COMMIT_MAX_WRITES) {
+                flush_write_fd(ctx);
+                continue;
+            }
+        } else if ((result=trunk_io_deal_buffer(ctx, iob_ptr)) != 0) {
             logError("file: "__FILE__", line: %d, "
                     "trunk_io_deal_buffer fail, result: %d",
                     __LINE__, result);
         }
+
+        /* the group window bounds the wait of the first write while the
+           queue keeps busy, window 0 syncs only when the queue drained */
+        if (ctx->sync.dirty && get_sync_timeout(ctx) > 0 &&
+                is_sync_timeout(ctx))
+        {
+            flush_write_fd(ctx);
+        }
     }
 
+    //sync and notify the writes waiting for the group commit
+    flush_write_fd(ctx);
+    notify_synced_writes(ctx, EINTR);
+    cancel_queued_buffers(ctx);
+    __sync_sub_and_fetch(&running_count, 1);
     return NULL;
 }
+
+#ifdef OS_HAVE_IO_URING
+
+static inline void uring_submit(TrunkIOThreadContext *ctx)
+{
+    int result;
+
+    if (ctx->uring.prepared == 0) {
+        return;
+    }
+
+    if ((result=io_uring_submit(&ctx->uring.ring)) < 0) {
+        result = -1 * result;
+        logError("file: "__FILE__", line: %d, "
+                "io_uring_submit fail, errno: %d, error info: %s",
+                __LINE__, result, STRERROR(result));
+    }
+    ctx->uring.prepared = 0;
+}
+
+static inline struct io_uring_sqe *uring_get_sqe(TrunkIOThreadContext *ctx)
+{
+    struct io_uring_sqe *sqe;
+
+    if ((sqe=io_uring_get_sqe(&ctx->uring.ring)) == NULL) {
+        uring_submit(ctx);
+        sqe = io_uring_get_sqe(&ctx->uring.ring);
+    }
+    return sqe;
+}
+
+static int uring_arm_notify_poll(TrunkIOThreadContext *ctx)
+{
+    struct io_uring_sqe *sqe;
+
+    if ((sqe=uring_get_sqe(ctx)) == NULL) {
+        logError("file: "__FILE__", line: %d, "
+                "io_uring_get_sqe fail", __LINE__);
+        return EBUSY;
+    }
+
+    io_uring_prep_poll_add(sqe, ctx->uring.efd, POLLIN);
+    io_uring_sqe_set_data(sqe, NULL);
+    ctx->uring.prepared++;
+    return 0;
+}
+
+static inline void uring_push_to_waitings(TrunkIOThreadContext *ctx,
+        TrunkIOBuffer *iob)
+{
+    iob->next = NULL;
+    if (ctx->uring.waitings.tail == NULL) {
+        ctx->uring.waitings.head = iob;
+    } else {
+        ctx->uring.waitings.tail->next = iob;
+    }
+    ctx->uring.waitings.tail = iob;
+}
+
+static int uring_prep_slice_op(TrunkIOThreadContext *ctx, TrunkIOBuffer *iob)
+{
+    struct io_uring_sqe *sqe;
+    FSTrunkSpaceInfo *space;
+    TrunkIORange range;
+    int fd;
+    int result;
+
+    /* the prepared SQEs MUST be submitted before the cached fd closed,
+       the kernel holds the file reference after submit */
+    space = &iob->slice->space;
+    if (iob->type == FS_IO_TYPE_WRITE_SLICE) {
+        if (ctx->uring.prepared > 0 && space->id_info.id !=
+                ctx->fd_cache.pair.trunk_id)
+        {
+            uring_submit(ctx);
+        }
+        result = get_write_fd(ctx, space, &fd);
+    } else {
+        if (ctx->uring.prepared > 0 && ctx->fd_cache.context.lru.count >=
+                ctx->fd_cache.context.lru.capacity && trunk_fd_cache_get(
+                    &ctx->fd_cache.context, space->id_info.id) < 0)
+        {
+            uring_submit(ctx);
+        }
+        result = get_read_fd(ctx, space, &fd);
+    }
+    if (result != 0) {
+        return result;
+    }
+
+    if ((result=get_io_range(ctx, iob, &range)) != 0) {
+        return result;
+    }
+
+    if ((sqe=uring_get_sqe(ctx)) == NULL) {
+        logError("file: "__FILE__", line: %d, "
+                "io_uring_get_sqe fail", __LINE__);
+        return EBUSY;
+    }
+
+    if (iob->type == FS_IO_TYPE_WRITE_SLICE) {
+        io_uring_prep_write(sqe, fd, range.buff + iob->data.len,
+                range.length - iob->data.len,
+                range.offset + iob->data.len);
+    } else if (range.buff == NULL) {
+        io_uring_prep_readv(sqe, fd, iob->merged.iovs,
+                iob->merged.iovcnt, range.offset + iob->data.len);
+    } else {
+        io_uring_prep_read(sqe, fd, range.buff + iob->data.len,
+                range.length - iob->data.len,
+                range.offset + iob->data.len);
+    }
+    io_uring_sqe_set_data(sqe, iob);
+    ctx->uring.prepared++;
+    ctx->uring.inflight++;
+    return 0;
+}
+
+static void uring_io_done(TrunkIOThreadContext *ctx,
+        TrunkIOBuffer *iob, const int result)
+{
+    if (result != 0) {
+        logError("file: "__FILE__", line: %d, "
+                "trunk_io_deal_buffer fail, result: %d",
+                __LINE__, result);
+    }
+
+    if (iob->abuffer != NULL) {
+        aligned_buffer_pool_free(&ctx->buffer_pool, iob->abuffer);
+        iob->abuffer = NULL;
+    }
+
+    notify_io_done(ctx, iob, result);
+
+    pthread_mutex_lock(&ctx->lock);
+    fast_mblock_free_object(&ctx->mblock, iob);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+static void uring_deal_buffer(TrunkIOThreadContext *ctx, TrunkIOBuffer *iob)
+{
+    int result;
+
+    switch (iob->type) {
+        case FS_IO_TYPE_WRITE_SLICE:
+        case FS_IO_TYPE_READ_SLICE:
+        case FS_IO_TYPE_READ_SLICES:
+            if ((result=uring_prep_slice_op(ctx, iob)) == 0) {
+                return;
+            }
+            break;
+        case FS_IO_TYPE_CREATE_TRUNK:
+            result = do_create_trunk(ctx, iob);
+            break;
+        case FS_IO_TYPE_DELETE_TRUNK:
+            result = do_delete_trunk(ctx, iob);
+            break;
+        default:
+            logError("file: "__FILE__", line: %d, "
+                    "invalid IO type: %d", __LINE__, iob->type);
+            result = EINVAL;
+            break;
+    }
+
+    uring_io_done(ctx, iob, result);
+}
+
+static void uring_deal_cqe(TrunkIOThreadContext *ctx,
+        TrunkIOBuffer *iob, const int res)
+{
+    char trunk_filename[PATH_MAX];
+    TrunkIORange range;
+    int result;
+
+    ctx->uring.inflight--;
+    if (res > 0) {
+        iob->data.len += res;
+        get_io_range(ctx, iob, &range);  //the bounce buffer already set
+        if (iob->data.len < range.length) {
+            if (range.buff == NULL) {
+                skip_iovecs(iob, res);
+            }
+            uring_push_to_waitings(ctx, iob);  //for the remain
+            return;
+        }
+        finish_io_range(ctx, iob, &range, 0);
+        uring_io_done(ctx, iob, 0);
+        return;
+    }
+
+    result = (res < 0) ? -1 * res : EIO;
+    if (result == EINTR || result == EAGAIN) {
+        uring_push_to_waitings(ctx, iob);  //retry
+        return;
+    }
+
+    get_trunk_filename(&iob->slice->space, trunk_filename,
+            sizeof(trunk_filename));
+    if (iob->type == FS_IO_TYPE_WRITE_SLICE) {
+        clear_write_fd(ctx);
+        logError("file: "__FILE__", line: %d, "
+                "write to trunk file: %s fail, offset: %"PRId64", "
+                "errno: %d, error info: %s", __LINE__, trunk_filename,
+                iob->slice->space.offset + iob->data.len,
+                result, STRERROR(result));
+    } else {
+        trunk_fd_cache_delete(&ctx->fd_cache.context,
+                iob->slice->space.id_info.id);
+        logError("file: "__FILE__", line: %d, "
+                "read trunk file: %s fail, offset: %"PRId64", "
+                "errno: %d, error info: %s", __LINE__, trunk_filename,
+                iob->slice->space.offset + iob->data.len,
+                result, STRERROR(result));
+    }
+
+    uring_io_done(ctx, iob, result);
+}
+
+static void uring_rearm_notify(TrunkIOThreadContext *ctx)
+{
+    eventfd_t value;
+
+    eventfd_read(ctx->uring.efd, &value);
+    uring_arm_notify_poll(ctx);
+}
+
+static void uring_arm_timer(TrunkIOThreadContext *ctx, const int wait_ms)
+{
+    struct io_uring_sqe *sqe;
+
+    if ((sqe=uring_get_sqe(ctx)) == NULL) {
+        logError("file: "__FILE__", line: %d, "
+                "io_uring_get_sqe fail", __LINE__);
+        return;
+    }
+
+    ctx->uring.timeout.tv_sec = wait_ms / 1000;
+    ctx->uring.timeout.tv_nsec = (wait_ms % 1000) * 1000 * 1000;
+    io_uring_prep_timeout(sqe, &ctx->uring.timeout, 0, 0);
+    io_uring_sqe_set_data(sqe, &ctx->uring.timeout);
+    ctx->uring.prepared++;
+    ctx->uring.timer_armed = true;
+}
+
+/* dispatch the queued IOs by the scheduler within the queue depth */
+static void uring_dispatch_buffers(TrunkIOThreadContext *ctx)
+{
+    TrunkIOBuffer *iob;
+    int wait_ms;
+
+    while (ctx->uring.inflight < ctx->uring.depth) {
+        pthread_mutex_lock(&ctx->lock);
+        iob = sched_pop(ctx, &wait_ms);
+        pthread_mutex_unlock(&ctx->lock);
+
+        if (iob == NULL) {
+            if (wait_ms > 0 && !ctx->uring.timer_armed) {
+                uring_arm_timer(ctx, wait_ms);
+            }
+            break;
+        }
+        uring_deal_buffer(ctx, iob);
+    }
+}
+
+/* wait for the submitted IOs done before the ring destroyed, the kernel
+   MUST NOT access the buffers of the IOs after they notified */
+static void uring_drain_inflight(TrunkIOThreadContext *ctx)
+{
+    TrunkIOBuffer *iob;
+    struct io_uring_cqe *cqe;
+    int result;
+
+    uring_submit(ctx);
+    while (ctx->uring.inflight > 0) {
+        if ((result=io_uring_wait_cqe(&ctx->uring.ring, &cqe)) < 0) {
+            result = -1 * result;
+            if (result == EINTR) {
+                continue;
+            }
+            logError("file: "__FILE__", line: %d, "
+                    "io_uring_wait_cqe fail, inflight count: %d, "
+                    "errno: %d, error info: %s", __LINE__,
+                    ctx->uring.inflight, result, STRERROR(result));
+            break;
+        }
+
+        //the remain of the partial IO is pushed to the waitings
+        iob = (TrunkIOBuffer *)io_uring_cqe_get_data(cqe);
+        if (iob != NULL && (void *)iob != (void *)&ctx->uring.timeout) {
+            uring_deal_cqe(ctx, iob, cqe->res);
+        }
+        io_uring_cqe_seen(&ctx->uring.ring, cqe);
+    }
+}
+
+static void *trunk_io_uring_thread_func(void *arg)
+{
+    TrunkIOThreadContext *ctx;
+    TrunkIOBuffer *iob;
+    struct io_uring_cqe *cqe;
+    unsigned head;
+    unsigned count;
+    bool notified;
+    int result;
+    int efd;
+
+    ctx = (TrunkIOThreadContext *)arg;
+    __sync_add_and_fetch(&running_count, 1);
+    uring_arm_notify_poll(ctx);
+    while (SF_G_CONTINUE_FLAG) {
+        result = io_uring_submit_and_wait(&ctx->uring.ring, 1);
+        ctx->uring.prepared = 0;
+        if (result < 0) {
+            result = -1 * result;
+            if (result != EINTR) {
+                logError("file: "__FILE__", line: %d, "
+                        "io_uring_submit_and_wait fail, "
+                        "errno: %d, error info: %s",
+                        __LINE__, result, STRERROR(result));
+            }
+            continue;
+        }
+
+        count = 0;
+        notified = false;
+        io_uring_for_each_cqe(&ctx->uring.ring, head, cqe) {
+            count++;
+            iob = (TrunkIOBuffer *)io_uring_cqe_get_data(cqe);
+            if (iob == NULL) {
+                notified = true;
+            } else if ((void *)iob == (void *)&ctx->uring.timeout) {
+                ctx->uring.timer_armed = false;
+            } else {
+                uring_deal_cqe(ctx, iob, cqe->res);
+            }
+        }
+        io_uring_cq_advance(&ctx->uring.ring, count);
+
+        if (notified) {
+            uring_rearm_notify(ctx);
+        }
+
+        /* submit the remains and the queued IOs in one batch */
+        while (ctx->uring.waitings.head != NULL &&
+                ctx->uring.inflight < ctx->uring.depth)
+        {
+            iob = ctx->uring.waitings.head;
+            ctx->uring.waitings.head = iob->next;
+            if (ctx->uring.waitings.head == NULL) {
+                ctx->uring.waitings.tail = NULL;
+            }
+            uring_deal_buffer(ctx, iob);
+        }
+        uring_dispatch_buffers(ctx);
+    }
+
+    /* complete the submitted IOs, then cancel the remains
+       and the queued IOs before the ring destroyed */
+    uring_drain_inflight(ctx);
+    if (ctx->uring.waitings.head != NULL) {
+        cancel_buffer_chain(ctx, ctx->uring.waitings.head);
+        ctx->uring.waitings.head = ctx->uring.waitings.tail = NULL;
+    }
+    cancel_queued_buffers(ctx);
+
+    io_uring_queue_exit(&ctx->uring.ring);
+    efd = ctx->uring.efd;
+    ctx->uring.efd = -1;  //the later push notify fails without the fd
+    close(efd);
+    __sync_sub_and_fetch(&running_count, 1);
+    return NULL;
+}
+
+#endif
@@ -20,11 +20,13 @@
 #include "../../common/fs_types.h"
 #include "../storage/storage_config.h"
 #include "../storage/object_block_index.h"
+#include "aligned_buffer_pool.h"
 
 #define FS_IO_TYPE_CREATE_TRUNK   'C'
 #define FS_IO_TYPE_DELETE_TRUNK   'D'
 #define FS_IO_TYPE_READ_SLICE     'R'
 #define FS_IO_TYPE_WRITE_SLICE    'W'
+#define FS_IO_TYPE_READ_SLICES    'M'  //the merged read of the slices
 
 struct trunk_io_buffer;
 
@@ -34,6 +36,8 @@ typedef void (*trunk_io_notify_func)(struct trunk_io_buffer *record,
 
 typedef struct trunk_io_buffer {
     int type;
+    int io_class;
+    int64_t push_time;  //in us
 
     union {
         FSTrunkSpaceInfo space;  //for trunk op
@@ -41,6 +45,14 @@ typedef struct trunk_io_buffer {
     };
 
     string_t data;
+    AlignedBuffer *abuffer;  //the bounce buffer for direct IO
+    struct {
+        OBSliceEntry **slices;  //sorted by the space, the first is slice
+        int count;
+        int iovcnt;
+        struct iovec *iovs;     //the slices and the gaps between them
+        int length;  //from the start of the first slice to the last end
+    } merged;  //for FS_IO_TYPE_READ_SLICES
     struct {
         trunk_io_notify_func func;
         void *arg;
@@ -48,35 +60,62 @@ typedef struct trunk_io_buffer {
     struct trunk_io_buffer *next;
 } TrunkIOBuffer;
 
+typedef struct trunk_io_class_stat {
+    int queue_depth;      //the queued IOs waiting for dispatch
+    int64_t total_count;  //the done IOs
+    int64_t total_bytes;
+    int64_t total_latency;  //in us, from push to the notify
+    int64_t max_latency;    //in us
+} TrunkIOClassStat;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+    //the data of the gaps between the merged slices is read to it
+    extern char *g_trunk_io_gap_buffer;
+
     int trunk_io_thread_init();
     void trunk_io_thread_terminate();
 
-    int trunk_io_thread_push(const int type, const int path_index,
-            const uint32_t hash_code, void *entry, char *buff,
-            trunk_io_notify_func notify_func, void *notify_arg);
+    /* the IO is scheduled by the io_class (FS_IO_CLASS_xxx) in the
+       queue of the IO thread: the expired deadline first, then by the
+       weight of the classes within the token bucket limits */
+    int trunk_io_thread_push(const int type, const int io_class,
+            const int path_index, const uint32_t hash_code, void *entry,
+            char *buff, trunk_io_notify_func notify_func, void *notify_arg);
 
     static inline int io_thread_push_trunk_op(const int type,
-            const FSTrunkSpaceInfo *space, trunk_io_notify_func
-            notify_func, void *notify_arg)
+            const int io_class, const FSTrunkSpaceInfo *space,
+            trunk_io_notify_func notify_func, void *notify_arg)
     {
-        return trunk_io_thread_push(type, space->store->index,
+        return trunk_io_thread_push(type, io_class, space->store->index,
                 space->id_info.id, (void *)space, NULL,
                 notify_func, notify_arg);
     }
 
     static inline int io_thread_push_slice_op(const int type,
-            OBSliceEntry *slice, char *buff, trunk_io_notify_func
-            notify_func, void *notify_arg)
+            const int io_class, OBSliceEntry *slice, char *buff,
+            trunk_io_notify_func notify_func, void *notify_arg)
     {
-        return trunk_io_thread_push(type, slice->space.store->index,
+        return trunk_io_thread_push(type, io_class,
+                slice->space.store->index,
                 FS_BLOCK_HASH_CODE(slice->ob->bkey), slice, buff,
                 notify_func, notify_arg);
     }
 
+    /* push the slices in the same trunk file as one vectored read,
+       the slices are sorted by the space offset without overlap */
+    int io_thread_push_merged_read(const int io_class,
+            OBSliceEntry **slices, const int count,
+            struct iovec *iovs, const int iovcnt, const int length,
+            trunk_io_notify_func notify_func, void *notify_arg);
+
+    /* get the IO stats of the classes of the store path,
+       return ENOENT when the store path NOT exist */
+    int trunk_io_thread_get_class_stats(const int path_index,
+            TrunkIOClassStat *stats);
+
 #ifdef __cplusplus
 }
 #endif
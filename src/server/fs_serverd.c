@@ -190,6 +190,22 @@ int main(int argc, char *argv[])
             return result;
         }
 
+        if ((result=trunk_migrate_init()) != 0) {
+            break;
+        }
+
+        if ((result=trunk_reclaim_init()) != 0) {
+            break;
+        }
+
+        if ((result=block_defrag_start()) != 0) {
+            break;
+        }
+
+        if ((result=ob_snapshot_init()) != 0) {
+            break;
+        }
+
         if ((result=server_recovery_init()) != 0) {
             break;
         }
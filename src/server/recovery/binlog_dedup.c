@@ -24,43 +24,96 @@
 #include <pthread.h>
 #include "fastcommon/shared_func.h"
 #include "fastcommon/logger.h"
+#include "fastcommon/pthread_func.h"
 #include "fastcommon/sched_thread.h"
+#include "fastcommon/fast_mblock.h"
 #include "sf/sf_global.h"
 #include "../../common/fs_func.h"
 #include "../server_global.h"
 #include "../server_binlog.h"
 #include "../binlog/replica_binlog.h"
 #include "../binlog/binlog_read_thread.h"
-#include "../storage/object_block_index.h"
+#include "../storage/storage_types.h"
 #include "binlog_fetch.h"
 #include "data_recovery.h"
 #include "binlog_dedup.h"
 
+/* the records are partitioned to the shards by the block hash code and
+ * the shards are dealt by their own threads in parallel. the slices of
+ * a block are kept as the sorted, non-overlapping intervals, and each
+ * shard outputs a run sorted by the block key */
+
+#define DEDUP_RECORD_BATCH_SIZE      4096
+#define DEDUP_BATCHES_PER_SHARD         4
+#define DEDUP_INTERVAL_INIT_ALLOC       4
+
 typedef struct {
     FILE *fp;
     char filename[PATH_MAX];
 } BinlogFileWriter;
 
 typedef struct {
-    OBHashtable create;   //create operation
-    OBHashtable remove;   //remove operation
-} BinlogHashtables;
+    int offset;
+    int length;
+    int type;    //OB_SLICE_TYPE_FILE or OB_SLICE_TYPE_ALLOC
+} DedupInterval;
+
+typedef struct {
+    int alloc;
+    int count;
+    DedupInterval *intervals;  //sorted by offset
+} DedupIntervalArray;
+
+typedef struct dedup_block_entry {
+    FSBlockKey bkey;
+    DedupIntervalArray create;   //create operation
+    DedupIntervalArray remove;   //remove operation
+    struct dedup_block_entry *next;  //for hashtable
+} DedupBlockEntry;
+
+typedef struct dedup_record_batch {
+    int count;    //0 for the end mark
+    ReplicaBinlogRecord records[DEDUP_RECORD_BATCH_SIZE];
+    struct dedup_record_batch *next;  //for queue
+} DedupRecordBatch;
+
+typedef struct {
+    FSCounterTripple create;  //add slice index
+    FSCounterTripple remove;  //remove slice index
+    int64_t partial_deletes;
+} DedupRecordStat;
 
+struct binlog_dedup_context;
 typedef struct {
-    BinlogHashtables htables;
+    struct {
+        DedupBlockEntry **buckets;
+        int64_t capacity;
+        int64_t count;
+    } htable;
+    struct fast_mblock_man block_allocator;
+    struct fc_queue queue;     //the batches to deal
+    struct fc_queue freelist;  //the free batches
+    DedupRecordBatch *batches; //holder
+    DedupRecordBatch *current; //filling by the reader
+    DedupBlockEntry **blocks;  //sorted for output
+    DedupRecordStat rstat;
+    int64_t output_count;
+    int result;
+    struct binlog_dedup_context *dedup_ctx;
+} DedupShard;
+
+typedef struct binlog_dedup_context {
+    struct {
+        DedupShard *shards;
+        int count;
+    } shard_array;
+    volatile int running_count;
     BinlogReadThreadContext rdthread_ctx;
     BinlogReadThreadResult *r;
-    ReplicaBinlogRecord record;
-    struct {
-        FSCounterTripple create;  //add slice index
-        FSCounterTripple remove;  //remove slice index
-        int64_t partial_deletes;
-    } rstat;  //record stat
+    DedupRecordStat rstat;   //summed from the shards
 
     struct {
-        OBSlicePtrArray slice_array;  //for sort
         BinlogFileWriter writer;
-        int current_op_type;
         uint64_t current_version;
         struct {
             int64_t create;
@@ -69,26 +122,403 @@ typedef struct {
     } out;
 } BinlogDedupContext;
 
-static int realloc_slice_ptr_array(OBSlicePtrArray *sarray);
+//return the first interval which end > offset
+static int interval_bsearch(const DedupIntervalArray *array, const int offset)
+{
+    int low;
+    int high;
+    int mid;
+    const DedupInterval *iv;
+
+    low = 0;
+    high = array->count - 1;
+    while (low <= high) {
+        mid = (low + high) / 2;
+        iv = array->intervals + mid;
+        if (iv->offset + iv->length > offset) {
+            high = mid - 1;
+        } else {
+            low = mid + 1;
+        }
+    }
+
+    return low;
+}
+
+static int interval_check_alloc(DedupIntervalArray *array, const int inc)
+{
+    DedupInterval *intervals;
+    int alloc;
+
+    if (array->count + inc <= array->alloc) {
+        return 0;
+    }
+
+    alloc = array->alloc > 0 ? array->alloc : DEDUP_INTERVAL_INIT_ALLOC;
+    while (alloc < array->count + inc) {
+        alloc *= 2;
+    }
+    intervals = (DedupInterval *)realloc(array->intervals,
+            sizeof(DedupInterval) * alloc);
+    if (intervals == NULL) {
+        logError("file: "__FILE__", line: %d, "
+                "realloc %d bytes fail", __LINE__,
+                (int)sizeof(DedupInterval) * alloc);
+        return ENOMEM;
+    }
+
+    array->intervals = intervals;
+    array->alloc = alloc;
+    return 0;
+}
+
+/* remove the range from the intervals, return the removed bytes */
+static int interval_remove(DedupIntervalArray *array,
+        const int offset, const int length, int *removed)
+{
+    DedupInterval *iv;
+    int result;
+    int end;
+    int iv_end;
+    int first;
+    int i;
+
+    *removed = 0;
+    end = offset + length;
+    i = interval_bsearch(array, offset);
+    if (i < array->count && array->intervals[i].offset < offset) {
+        iv = array->intervals + i;
+        iv_end = iv->offset + iv->length;
+        if (iv_end > end) {  //split the interval to two
+            if ((result=interval_check_alloc(array, 1)) != 0) {
+                return result;
+            }
+
+            iv = array->intervals + i;
+            memmove(iv + 2, iv + 1, sizeof(DedupInterval) *
+                    (array->count - (i + 1)));
+            (iv + 1)->offset = end;
+            (iv + 1)->length = iv_end - end;
+            (iv + 1)->type = iv->type;
+            iv->length = offset - iv->offset;
+            array->count++;
+            *removed = length;
+            return 0;
+        }
+
+        *removed += iv_end - offset;
+        iv->length = offset - iv->offset;
+        i++;
+    }
+
+    first = i;
+    while (i < array->count && array->intervals[i].offset +
+            array->intervals[i].length <= end)
+    {
+        *removed += array->intervals[i].length;
+        i++;
+    }
+
+    if (i < array->count && array->intervals[i].offset < end) {
+        iv = array->intervals + i;
+        *removed += end - iv->offset;
+        iv->length -= end - iv->offset;
+        iv->offset = end;
+    }
+
+    if (i > first) {
+        memmove(array->intervals + first, array->intervals + i,
+                sizeof(DedupInterval) * (array->count - i));
+        array->count -= i - first;
+    }
+    return 0;
+}
+
+/* overwrite the range, merge with the adjacent intervals of the same type */
+static int interval_add(DedupIntervalArray *array, const int offset,
+        const int length, const int type)
+{
+    DedupInterval *iv;
+    bool merge_left;
+    bool merge_right;
+    int removed;
+    int result;
+    int i;
+
+    if ((result=interval_remove(array, offset, length, &removed)) != 0) {
+        return result;
+    }
+
+    i = interval_bsearch(array, offset);
+    merge_left = (i > 0 && array->intervals[i - 1].type == type &&
+            array->intervals[i - 1].offset + array->intervals[i - 1].
+            length == offset);
+    merge_right = (i < array->count && array->intervals[i].type == type &&
+            array->intervals[i].offset == offset + length);
+    if (merge_left) {
+        iv = array->intervals + (i - 1);
+        iv->length += length;
+        if (merge_right) {
+            iv->length += (iv + 1)->length;
+            memmove(iv + 1, iv + 2, sizeof(DedupInterval) *
+                    (array->count - (i + 1)));
+            array->count--;
+        }
+        return 0;
+    } else if (merge_right) {
+        iv = array->intervals + i;
+        iv->length += iv->offset - offset;
+        iv->offset = offset;
+        return 0;
+    }
+
+    if ((result=interval_check_alloc(array, 1)) != 0) {
+        return result;
+    }
+    iv = array->intervals + i;
+    memmove(iv + 1, iv, sizeof(DedupInterval) * (array->count - i));
+    iv->offset = offset;
+    iv->length = length;
+    iv->type = type;
+    array->count++;
+    return 0;
+}
+
+static DedupBlockEntry *get_block_entry(DedupShard *shard,
+        const FSBlockKey *bkey)
+{
+    DedupBlockEntry **bucket;
+    DedupBlockEntry *block;
+
+    bucket = shard->htable.buckets + (FS_BLOCK_HASH_CODE(*bkey) /
+            shard->dedup_ctx->shard_array.count) % shard->htable.capacity;
+    block = *bucket;
+    while (block != NULL) {
+        if (block->bkey.oid == bkey->oid &&
+                block->bkey.offset == bkey->offset)
+        {
+            return block;
+        }
+        block = block->next;
+    }
+
+    block = (DedupBlockEntry *)fast_mblock_alloc_object(
+            &shard->block_allocator);
+    if (block == NULL) {
+        return NULL;
+    }
+
+    memset(block, 0, sizeof(*block));
+    block->bkey = *bkey;
+    block->next = *bucket;
+    *bucket = block;
+    shard->htable.count++;
+    return block;
+}
+
+static int deal_record(DedupShard *shard, ReplicaBinlogRecord *record)
+{
+    DedupBlockEntry *block;
+    int result;
+    int removed;
+    int target_len;
+
+    if ((block=get_block_entry(shard, &record->bs_key.block)) == NULL) {
+        return ENOMEM;
+    }
+
+    switch (record->op_type) {
+        case REPLICA_BINLOG_OP_TYPE_WRITE_SLICE:
+        case REPLICA_BINLOG_OP_TYPE_ALLOC_SLICE:
+            shard->rstat.create.total++;
+            if ((result=interval_add(&block->create, record->bs_key.
+                            slice.offset, record->bs_key.slice.length,
+                            record->op_type == REPLICA_BINLOG_OP_TYPE_WRITE_SLICE
+                            ? OB_SLICE_TYPE_FILE : OB_SLICE_TYPE_ALLOC)) != 0)
+            {
+                return result;
+            }
+            shard->rstat.create.success++;
+            break;
+        case REPLICA_BINLOG_OP_TYPE_DEL_SLICE:
+        case REPLICA_BINLOG_OP_TYPE_DEL_BLOCK:
+            shard->rstat.remove.total++;
+            if (record->op_type == REPLICA_BINLOG_OP_TYPE_DEL_BLOCK) {
+                record->bs_key.slice.offset = 0;
+                record->bs_key.slice.length = FS_FILE_BLOCK_SIZE;
+            }
+            target_len = record->bs_key.slice.length;
+            if ((result=interval_remove(&block->create, record->bs_key.
+                            slice.offset, target_len, &removed)) != 0)
+            {
+                return result;
+            }
+
+            if (removed != target_len) {
+                if ((result=interval_add(&block->remove, record->bs_key.
+                                slice.offset, target_len,
+                                OB_SLICE_TYPE_FILE)) != 0)
+                {
+                    return result;
+                }
+                shard->rstat.partial_deletes++;
+            }
+
+            if (removed > 0) {
+                shard->rstat.remove.success++;
+            } else {
+                shard->rstat.remove.ignore++;
+            }
+            break;
+        default:
+            break;
+    }
 
-static int add_slice(OBHashtable *htable, ReplicaBinlogRecord *record,
-        const OBSliceType stype)
+    return 0;
+}
+
+static int compare_block(const DedupBlockEntry **b1,
+        const DedupBlockEntry **b2)
 {
-    OBSliceEntry *slice;
-    int inc_alloc;
+    int64_t sub;
 
-    slice = ob_index_alloc_slice_ex(htable, &record->bs_key.block, 0);
-    if (slice == NULL) {
+    sub = (*b1)->bkey.oid - (*b2)->bkey.oid;
+    if (sub < 0) {
+        return -1;
+    } else if (sub > 0) {
+        return 1;
+    }
+
+    sub = (*b1)->bkey.offset - (*b2)->bkey.offset;
+    if (sub < 0) {
+        return -1;
+    } else if (sub > 0) {
+        return 1;
+    }
+    return 0;
+}
+
+/* remove the ranges created later from the remove intervals,
+   then sort the blocks for output */
+static int shard_finish(DedupShard *shard)
+{
+    DedupBlockEntry **bucket;
+    DedupBlockEntry **end;
+    DedupBlockEntry *block;
+    DedupInterval *iv;
+    DedupInterval *iv_end;
+    int64_t count;
+    int removed;
+    int result;
+
+    if (shard->htable.count == 0) {
+        return 0;
+    }
+
+    shard->blocks = (DedupBlockEntry **)fc_malloc(
+            sizeof(DedupBlockEntry *) * shard->htable.count);
+    if (shard->blocks == NULL) {
         return ENOMEM;
     }
 
-    slice->type = stype;
-    slice->ssize = record->bs_key.slice;
-    return ob_index_add_slice_ex(htable, slice, NULL, &inc_alloc);
+    count = 0;
+    end = shard->htable.buckets + shard->htable.capacity;
+    for (bucket=shard->htable.buckets; bucket<end; bucket++) {
+        for (block=*bucket; block!=NULL; block=block->next) {
+            if (block->remove.count > 0) {
+                iv_end = block->create.intervals + block->create.count;
+                for (iv=block->create.intervals; iv<iv_end; iv++) {
+                    if ((result=interval_remove(&block->remove, iv->offset,
+                                    iv->length, &removed)) != 0)
+                    {
+                        return result;
+                    }
+                }
+            }
+
+            if (block->create.count + block->remove.count > 0) {
+                shard->blocks[count++] = block;
+                shard->output_count += block->create.count +
+                    block->remove.count;
+            }
+        }
+    }
+
+    shard->htable.count = count;
+    if (count > 1) {
+        qsort(shard->blocks, count, sizeof(DedupBlockEntry *),
+                (int (*)(const void *, const void *))compare_block);
+    }
+    return 0;
+}
+
+static void *dedup_shard_thread_func(void *arg)
+{
+    DedupShard *shard;
+    DedupRecordBatch *batch;
+    ReplicaBinlogRecord *record;
+    ReplicaBinlogRecord *end;
+
+    shard = (DedupShard *)arg;
+    while (1) {
+        if ((batch=(DedupRecordBatch *)fc_queue_pop(
+                        &shard->queue)) == NULL)
+        {
+            if (!SF_G_CONTINUE_FLAG) {
+                break;
+            }
+            continue;
+        }
+
+        if (batch->count == 0) {  //the end mark
+            if (shard->result == 0) {
+                shard->result = shard_finish(shard);
+            }
+            fc_queue_push(&shard->freelist, batch);
+            break;
+        }
+
+        if (shard->result == 0) {
+            end = batch->records + batch->count;
+            for (record=batch->records; record<end; record++) {
+                if ((shard->result=deal_record(shard, record)) != 0) {
+                    logError("file: "__FILE__", line: %d, "
+                            "%s fail, errno: %d, error info: %s",
+                            __LINE__, replica_binlog_get_op_type_caption(
+                                record->op_type), shard->result,
+                            STRERROR(shard->result));
+                    break;
+                }
+            }
+        }
+
+        batch->count = 0;
+        fc_queue_push(&shard->freelist, batch);
+    }
+
+    __sync_sub_and_fetch(&shard->dedup_ctx->running_count, 1);
+    return NULL;
+}
+
+static DedupRecordBatch *pop_free_batch(DedupShard *shard)
+{
+    DedupRecordBatch *batch;
+
+    while ((batch=(DedupRecordBatch *)fc_queue_pop(
+                    &shard->freelist)) == NULL)
+    {
+        if (!SF_G_CONTINUE_FLAG) {
+            return NULL;
+        }
+    }
+
+    return batch;
 }
 
 static int deal_binlog_buffer(BinlogDedupContext *dedup_ctx)
 {
+    ReplicaBinlogRecord record;
+    DedupShard *shard;
     char *p;
     char *line_end;
     char *end;
@@ -96,13 +526,8 @@ static int deal_binlog_buffer(BinlogDedupContext *dedup_ctx)
     string_t line;
     char error_info[256];
     int result;
-    int r;
-    int op_type;
-    int target_len;
-    int dec_alloc;
 
     result = 0;
-    dec_alloc = 0;
     *error_info = '\0';
     buffer = &dedup_ctx->r->buffer;
     end = buffer->buff + buffer->length;
@@ -119,77 +544,21 @@ static int deal_binlog_buffer(BinlogDedupContext *dedup_ctx)
         line.str = p;
         line.len = line_end - p;
         if ((result=replica_binlog_record_unpack(&line,
-                        &dedup_ctx->record, error_info)) != 0)
+                        &record, error_info)) != 0)
         {
             break;
         }
 
-        op_type = dedup_ctx->record.op_type;
-        fs_calc_block_hashcode(&dedup_ctx->record.bs_key.block);
-        switch (op_type) {
-            case REPLICA_BINLOG_OP_TYPE_WRITE_SLICE:
-            case REPLICA_BINLOG_OP_TYPE_ALLOC_SLICE:
-                if (op_type == REPLICA_BINLOG_OP_TYPE_WRITE_SLICE) {
-                    result = add_slice(&dedup_ctx->htables.create,
-                            &dedup_ctx->record, OB_SLICE_TYPE_FILE);
-                } else {
-                    result = add_slice(&dedup_ctx->htables.create,
-                            &dedup_ctx->record, OB_SLICE_TYPE_ALLOC);
-                }
-                dedup_ctx->rstat.create.total++;
-                if (result == 0) {
-                    dedup_ctx->rstat.create.success++;
-                }
-                break;
-            case REPLICA_BINLOG_OP_TYPE_DEL_SLICE:
-            case REPLICA_BINLOG_OP_TYPE_DEL_BLOCK:
-                if (op_type == REPLICA_BINLOG_OP_TYPE_DEL_SLICE) {
-                    result = ob_index_delete_slices_ex(&dedup_ctx->
-                            htables.create, &dedup_ctx->record.bs_key,
-                            NULL, &dec_alloc);
-                    target_len = dedup_ctx->record.bs_key.slice.length;
-                } else {
-                    result = ob_index_delete_block_ex(&dedup_ctx->
-                            htables.create, &dedup_ctx->record.bs_key.
-                            block, NULL, &dec_alloc);
-                    target_len = FS_FILE_BLOCK_SIZE;
-                }
-
-                if (dec_alloc != target_len) {
-                    if (op_type == REPLICA_BINLOG_OP_TYPE_DEL_BLOCK) {
-                        dedup_ctx->record.bs_key.slice.offset = 0;
-                        dedup_ctx->record.bs_key.slice.length =
-                            FS_FILE_BLOCK_SIZE;
-                    }
-
-                    if ((r=add_slice(&dedup_ctx->htables.remove,
-                                    &dedup_ctx->record,
-                                    OB_SLICE_TYPE_FILE)) == 0)
-                    {
-                        dedup_ctx->rstat.partial_deletes++;
-                    } else {
-                        result = r;
-                    }
-                }
-
-                dedup_ctx->rstat.remove.total++;
-                if (result == 0) {
-                    dedup_ctx->rstat.remove.success++;
-                } else if (result == ENOENT) {
-                    dedup_ctx->rstat.remove.ignore++;
-                    result = 0;
-                }
-                break;
-            default:
-                break;
-        }
-
-        if (result != 0) {
-            snprintf(error_info, sizeof(error_info),
-                    "%s fail, errno: %d, error info: %s",
-                    replica_binlog_get_op_type_caption(op_type),
-                    result, STRERROR(result));
-            break;
+        fs_calc_block_hashcode(&record.bs_key.block);
+        shard = dedup_ctx->shard_array.shards +
+            FS_BLOCK_HASH_CODE(record.bs_key.block) %
+            dedup_ctx->shard_array.count;
+        shard->current->records[shard->current->count] = record;
+        if (++(shard->current->count) == DEDUP_RECORD_BATCH_SIZE) {
+            fc_queue_push(&shard->queue, shard->current);
+            if ((shard->current=pop_free_batch(shard)) == NULL) {
+                return EINTR;
+            }
         }
 
         p = line_end;
@@ -213,6 +582,49 @@ static int deal_binlog_buffer(BinlogDedupContext *dedup_ctx)
     return result;
 }
 
+//push the last batches and the end marks to the shards
+static int push_end_marks(BinlogDedupContext *dedup_ctx)
+{
+    DedupShard *shard;
+    DedupShard *end;
+
+    end = dedup_ctx->shard_array.shards + dedup_ctx->shard_array.count;
+    for (shard=dedup_ctx->shard_array.shards; shard<end; shard++) {
+        if (shard->current == NULL) {  //interrupted
+            continue;
+        }
+
+        if (shard->current->count > 0) {
+            fc_queue_push(&shard->queue, shard->current);
+            if ((shard->current=pop_free_batch(shard)) == NULL) {
+                return EINTR;
+            }
+        }
+
+        fc_queue_push(&shard->queue, shard->current);
+        shard->current = NULL;
+    }
+
+    return 0;
+}
+
+static void wait_shard_threads_exit(BinlogDedupContext *dedup_ctx)
+{
+    DedupShard *shard;
+    DedupShard *end;
+
+    while (__sync_add_and_fetch(&dedup_ctx->running_count, 0) > 0) {
+        if (!SF_G_CONTINUE_FLAG) {
+            end = dedup_ctx->shard_array.shards +
+                dedup_ctx->shard_array.count;
+            for (shard=dedup_ctx->shard_array.shards; shard<end; shard++) {
+                fc_queue_terminate(&shard->queue);
+            }
+        }
+        fc_sleep_ms(10);
+    }
+}
+
 static int do_dedup_binlog(DataRecoveryContext *ctx)
 {
     BinlogDedupContext *dedup_ctx;
@@ -269,95 +681,71 @@ static int do_dedup_binlog(DataRecoveryContext *ctx)
     return result;
 }
 
-static int slice_array_to_file(BinlogDedupContext *dedup_ctx)
+static inline int write_record(BinlogDedupContext *dedup_ctx,
+        const FSBlockKey *bkey, const DedupInterval *iv, const int op_type)
 {
-    OBSliceEntry **pp;
-    OBSliceEntry **end;
     int result;
-    int op_type;
     uint64_t data_version;
 
-    result = 0;
-    end = dedup_ctx->out.slice_array.slices +
-        dedup_ctx->out.slice_array.count;
-    for (pp=dedup_ctx->out.slice_array.slices; pp<end; pp++) {
-        if (dedup_ctx->out.current_op_type == SLICE_BINLOG_OP_TYPE_DEL_SLICE) {
-            op_type = REPLICA_BINLOG_OP_TYPE_DEL_SLICE;
-        } else {
-            if ((*pp)->type == OB_SLICE_TYPE_FILE) {
-                op_type = REPLICA_BINLOG_OP_TYPE_WRITE_SLICE;
-            } else {
-                op_type = REPLICA_BINLOG_OP_TYPE_ALLOC_SLICE;
-            }
-        }
-
-        data_version = ++(dedup_ctx->out.current_version);
-        if (fprintf(dedup_ctx->out.writer.fp,
-                    "%d %"PRId64" %c %c %"PRId64" %"PRId64" %d %d\n",
-                    (int)g_current_time, data_version, BINLOG_SOURCE_REPLAY,
-                    op_type, (*pp)->ob->bkey.oid, (*pp)->ob->bkey.offset,
-                    (*pp)->ssize.offset, (*pp)->ssize.length) <= 0)
-        {
-            result = errno != 0 ? errno : EPERM;
-            logError("file: "__FILE__", line: %d, "
-                    "write to file: %s fail, "
-                    "errno: %d, error info: %s", __LINE__,
-                    dedup_ctx->out.writer.filename,
-                    result, STRERROR(result));
-            break;
-        }
-    }
-
-    return result;
-}
-
-static inline int add_to_sarray(OBSlicePtrArray *sarray,
-        OBSliceEntry *first, OBSliceEntry *last)
-{
-    int result;
-
-    if (first != last) {
-        first->ssize.length = (last->ssize.offset - first->ssize.offset) +
-            last->ssize.length;
-    }
-
-    if (sarray->count >= sarray->alloc) {
-        if ((result=realloc_slice_ptr_array(sarray)) != 0) {
-            return result;
-        }
+    data_version = ++(dedup_ctx->out.current_version);
+    if (fprintf(dedup_ctx->out.writer.fp,
+                "%d %"PRId64" %c %c %"PRId64" %"PRId64" %d %d\n",
+                (int)g_current_time, data_version, BINLOG_SOURCE_REPLAY,
+                op_type, bkey->oid, bkey->offset, iv->offset,
+                iv->length) <= 0)
+    {
+        result = errno != 0 ? errno : EPERM;
+        logError("file: "__FILE__", line: %d, "
+                "write to file: %s fail, "
+                "errno: %d, error info: %s", __LINE__,
+                dedup_ctx->out.writer.filename,
+                result, STRERROR(result));
+        return result;
     }
 
-    sarray->slices[sarray->count++] = first;
     return 0;
 }
 
-static int dump_to_array(BinlogDedupContext *dedup_ctx, const OBEntry *ob)
+/* write the run of the shard, the removes of a block are disjoint
+   with its creates, so they are written block by block */
+static int shard_to_file(BinlogDedupContext *dedup_ctx, DedupShard *shard)
 {
-    UniqSkiplistIterator it;
-    OBSliceEntry *first;
-    OBSliceEntry *previous;
-    OBSliceEntry *slice;
+    DedupBlockEntry **pp;
+    DedupBlockEntry **end;
+    DedupInterval *iv;
+    DedupInterval *iv_end;
+    int op_type;
     int result;
 
-    uniq_skiplist_iterator(ob->slices, &it);
-    first = previous = (OBSliceEntry *)uniq_skiplist_next(&it);
-    while ((slice=(OBSliceEntry *)uniq_skiplist_next(&it)) != NULL) {
-        if (!((previous->ssize.offset + previous->ssize.length ==
-                        slice->ssize.offset) && (previous->type == slice->type)))
-        {
-            if ((result=add_to_sarray(&dedup_ctx->out.slice_array,
-                            first, previous)) != 0)
+    end = shard->blocks + shard->htable.count;
+    for (pp=shard->blocks; pp<end; pp++) {
+        iv_end = (*pp)->remove.intervals + (*pp)->remove.count;
+        for (iv=(*pp)->remove.intervals; iv<iv_end; iv++) {
+            if ((result=write_record(dedup_ctx, &(*pp)->bkey, iv,
+                            REPLICA_BINLOG_OP_TYPE_DEL_SLICE)) != 0)
             {
                 return result;
             }
-
-            first = slice;
         }
+        dedup_ctx->out.binlog_counts.remove += (*pp)->remove.count;
 
-        previous = slice;
+        iv_end = (*pp)->create.intervals + (*pp)->create.count;
+        for (iv=(*pp)->create.intervals; iv<iv_end; iv++) {
+            if (iv->type == OB_SLICE_TYPE_FILE) {
+                op_type = REPLICA_BINLOG_OP_TYPE_WRITE_SLICE;
+            } else {
+                op_type = REPLICA_BINLOG_OP_TYPE_ALLOC_SLICE;
+            }
+            if ((result=write_record(dedup_ctx, &(*pp)->bkey,
+                            iv, op_type)) != 0)
+            {
+                return result;
+            }
+        }
+        dedup_ctx->out.binlog_counts.create += (*pp)->create.count;
     }
 
-    return add_to_sarray(&dedup_ctx->out.slice_array, first, previous);
+    return 0;
 }
 
 static int open_output_files(DataRecoveryContext *ctx)
@@ -394,251 +782,224 @@ static void close_output_files(BinlogDedupContext *dedup_ctx)
     }
 }
 
-static int compare_slice(const OBSliceEntry **s1, const OBSliceEntry **s2)
+static void sum_shard_stats(BinlogDedupContext *dedup_ctx,
+        int64_t *output_count)
 {
-    int64_t sub;
-
-    sub = (*s1)->ob->bkey.oid - (*s2)->ob->bkey.oid;
-    if (sub < 0) {
-        return -1;
-    } else if (sub > 0) {
-        return 1;
-    }
-
-    sub = (*s1)->ob->bkey.offset - (*s2)->ob->bkey.offset;
-    if (sub < 0) {
-        return -1;
-    } else if (sub > 0) {
-        return 1;
+    DedupShard *shard;
+    DedupShard *end;
+
+    *output_count = 0;
+    end = dedup_ctx->shard_array.shards + dedup_ctx->shard_array.count;
+    for (shard=dedup_ctx->shard_array.shards; shard<end; shard++) {
+        dedup_ctx->rstat.create.total += shard->rstat.create.total;
+        dedup_ctx->rstat.create.success += shard->rstat.create.success;
+        dedup_ctx->rstat.remove.total += shard->rstat.remove.total;
+        dedup_ctx->rstat.remove.success += shard->rstat.remove.success;
+        dedup_ctx->rstat.remove.ignore += shard->rstat.remove.ignore;
+        dedup_ctx->rstat.partial_deletes += shard->rstat.partial_deletes;
+        *output_count += shard->output_count;
     }
-
-    return (*s1)->ssize.offset - (*s2)->ssize.offset;
 }
 
-static int htable_dump(BinlogDedupContext *dedup_ctx, OBHashtable *htable,
-        int64_t *binlog_count)
+static int dedup_binlog(DataRecoveryContext *ctx)
 {
-    OBEntry **bucket;
-    OBEntry **end;
-    OBEntry *ob;
+    BinlogDedupContext *dedup_ctx;
+    DedupShard *shard;
+    DedupShard *end;
+    int64_t output_count;
     int result;
+    int r;
 
-    dedup_ctx->out.slice_array.count = 0;
-    end = htable->buckets + htable->capacity;
-    for (bucket = htable->buckets, result = 0;
-            bucket < end && result == 0; bucket++)
-    {
-        if (*bucket == NULL) {
-            continue;
-        }
-
-        ob = *bucket;
-        do {
-            if (!uniq_skiplist_empty(ob->slices)) {
-                if ((result=dump_to_array(dedup_ctx, ob)) != 0) {
-                    return result;
-                }
-            }
-            ob = ob->next;
-        } while (ob != NULL);
+    dedup_ctx = (BinlogDedupContext *)ctx->arg;
+    result = do_dedup_binlog(ctx);
+    if ((r=push_end_marks(dedup_ctx)) != 0 && result == 0) {
+        result = r;
     }
-
-    *binlog_count = dedup_ctx->out.slice_array.count;
-    if (dedup_ctx->out.slice_array.count > 1) {
-        qsort(dedup_ctx->out.slice_array.slices,
-                dedup_ctx->out.slice_array.count,
-                sizeof(OBSliceEntry *), (int (*)
-                    (const void *, const void *))compare_slice);
+    wait_shard_threads_exit(dedup_ctx);
+    if (result != 0) {
+        return result;
     }
-    return slice_array_to_file(dedup_ctx);
-}
 
-static void htable_reverse_remove(BinlogHashtables *htables)
-{
-    OBEntry **bucket;
-    OBEntry **end;
-    OBEntry *ob;
-    OBSliceEntry *slice;
-    UniqSkiplistIterator it;
-    FSBlockSliceKeyInfo bs_key;
-    int dec_alloc;
-
-    end = htables->create.buckets + htables->create.capacity;
-    for (bucket = htables->create.buckets; bucket < end; bucket++) {
-        if (*bucket == NULL) {
-            continue;
+    end = dedup_ctx->shard_array.shards + dedup_ctx->shard_array.count;
+    for (shard=dedup_ctx->shard_array.shards; shard<end; shard++) {
+        if (shard->result != 0) {
+            return shard->result;
         }
-
-        ob = *bucket;
-        do {
-            do {
-                if (uniq_skiplist_empty(ob->slices)) {
-                    break;
-                }
-
-                if (ob_index_get_ob_entry(&htables->remove,
-                            &ob->bkey) == NULL)
-                {
-                    break;
-                }
-
-                uniq_skiplist_iterator(ob->slices, &it);
-                while ((slice=(OBSliceEntry *)uniq_skiplist_next(&it)) != NULL) {
-                    bs_key.block = slice->ob->bkey;
-                    bs_key.slice = slice->ssize;
-                    ob_index_delete_slices_ex(&htables->remove,
-                            &bs_key, NULL, &dec_alloc);
-                }
-            } while (0);
-
-            ob = ob->next;
-        } while (ob != NULL);
     }
-}
 
-static int init_slice_ptr_array(OBSlicePtrArray *slice_ptr_array,
-        const int64_t count)
-{
-    int64_t n;
-    if (count <= 8) {
-        slice_ptr_array->alloc = 8;
-    } else if (count <= 64) {
-        slice_ptr_array->alloc = 64;
-    } else if (count <= 512) {
-        slice_ptr_array->alloc = 512;
-    } else if (count <= 4 * 1024) {
-        slice_ptr_array->alloc = 1024;
-    } else {
-        n = count / 4;
-        if (n <= 2 * 1024) {
-            slice_ptr_array->alloc = 2 * 1024;
-        } else if (n <= 8 * 1024) {
-            slice_ptr_array->alloc = 8 * 1024;
-        } else if (n <= 64 * 1024) {
-            slice_ptr_array->alloc = 64 * 1024;
-        } else if (n <= 512 * 1024) {
-            slice_ptr_array->alloc = 512 * 1024;
-        } else {
-            slice_ptr_array->alloc = 1024 * 1024;
-        }
+    sum_shard_stats(dedup_ctx, &output_count);
+    if (output_count == 0) {
+        return 0;
     }
 
-    slice_ptr_array->slices = (OBSliceEntry **)fc_malloc(
-            sizeof(OBSliceEntry *) * slice_ptr_array->alloc);
-    if (slice_ptr_array->slices == NULL) {
-        return ENOMEM;
+    if ((result=open_output_files(ctx)) != 0) {
+        close_output_files(dedup_ctx);
+        return result;
     }
-    return 0;
-}
 
-static int realloc_slice_ptr_array(OBSlicePtrArray *sarray)
-{
-    OBSliceEntry **slices;
-    int new_alloc;
-    int bytes;
-
-    new_alloc = 2 * sarray->alloc;
-    bytes = sizeof(OBSliceEntry *) * new_alloc;
-    slices = (OBSliceEntry **)fc_malloc(bytes);
-    if (slices == NULL) {
-        return ENOMEM;
+    for (shard=dedup_ctx->shard_array.shards; shard<end; shard++) {
+        if ((result=shard_to_file(dedup_ctx, shard)) != 0) {
+            break;
+        }
     }
 
-    memcpy(slices, sarray->slices, sarray->count *
-            sizeof(OBSliceEntry *));
-    free(sarray->slices);
-
-    sarray->alloc = new_alloc;
-    sarray->slices = slices;
-    return 0;
+    close_output_files(dedup_ctx);
+    return result;
 }
 
-static int dedup_binlog(DataRecoveryContext *ctx)
+static int init_shard(DedupShard *shard, const int64_t capacity)
 {
-    BinlogDedupContext *dedup_ctx;
+    DedupRecordBatch *batch;
+    DedupRecordBatch *end;
+    int64_t bytes;
     int result;
-    int64_t count;
 
-    dedup_ctx = (BinlogDedupContext *)ctx->arg;
-    if ((result=do_dedup_binlog(ctx)) != 0) {
-        return result;
+    shard->htable.capacity = capacity;
+    bytes = sizeof(DedupBlockEntry *) * capacity;
+    shard->htable.buckets = (DedupBlockEntry **)fc_malloc(bytes);
+    if (shard->htable.buckets == NULL) {
+        return ENOMEM;
     }
+    memset(shard->htable.buckets, 0, bytes);
 
-    if (dedup_ctx->rstat.create.success == 0 && 
-            dedup_ctx->rstat.partial_deletes == 0)
+    if ((result=fast_mblock_init_ex1(&shard->block_allocator,
+                    "dedup_block", sizeof(DedupBlockEntry), 8 * 1024,
+                    0, NULL, NULL, false)) != 0)
     {
-        return 0;
+        return result;
     }
 
-    if ((result=open_output_files(ctx)) != 0) {
-        close_output_files(dedup_ctx);
+    if ((result=fc_queue_init(&shard->queue, (long)
+                    (&((DedupRecordBatch *)NULL)->next))) != 0)
+    {
         return result;
     }
 
-    count = FC_MAX(dedup_ctx->rstat.partial_deletes,
-            dedup_ctx->rstat.create.success);
-    if ((result=init_slice_ptr_array(&dedup_ctx->out.
-                    slice_array, count)) != 0)
+    if ((result=fc_queue_init(&shard->freelist, (long)
+                    (&((DedupRecordBatch *)NULL)->next))) != 0)
     {
         return result;
     }
 
-    if (dedup_ctx->rstat.partial_deletes > 0) {
-        if (dedup_ctx->rstat.create.success > 0) {
-            htable_reverse_remove(&dedup_ctx->htables);
-        }
+    shard->batches = (DedupRecordBatch *)fc_malloc(sizeof(
+                DedupRecordBatch) * DEDUP_BATCHES_PER_SHARD);
+    if (shard->batches == NULL) {
+        return ENOMEM;
+    }
+
+    shard->current = shard->batches;
+    shard->current->count = 0;
+    end = shard->batches + DEDUP_BATCHES_PER_SHARD;
+    for (batch=shard->batches + 1; batch<end; batch++) {
+        batch->count = 0;
+        fc_queue_push(&shard->freelist, batch);
+    }
+
+    return 0;
+}
 
-        dedup_ctx->out.current_op_type = SLICE_BINLOG_OP_TYPE_DEL_SLICE;
-        result = htable_dump(dedup_ctx, &dedup_ctx->htables.remove,
-                 &dedup_ctx->out.binlog_counts.remove);
+static void destroy_shard(DedupShard *shard)
+{
+    DedupBlockEntry **bucket;
+    DedupBlockEntry **end;
+    DedupBlockEntry *block;
+
+    if (shard->htable.buckets != NULL) {
+        end = shard->htable.buckets + shard->htable.capacity;
+        for (bucket=shard->htable.buckets; bucket<end; bucket++) {
+            for (block=*bucket; block!=NULL; block=block->next) {
+                if (block->create.intervals != NULL) {
+                    free(block->create.intervals);
+                }
+                if (block->remove.intervals != NULL) {
+                    free(block->remove.intervals);
+                }
+            }
+        }
+        free(shard->htable.buckets);
+        fast_mblock_destroy(&shard->block_allocator);
     }
 
-    if (dedup_ctx->rstat.create.success > 0) {
-        dedup_ctx->out.current_op_type = SLICE_BINLOG_OP_TYPE_WRITE_SLICE;
-        result = htable_dump(dedup_ctx, &dedup_ctx->htables.create,
-                &dedup_ctx->out.binlog_counts.create);
+    if (shard->batches != NULL) {
+        fc_queue_destroy(&shard->queue);
+        fc_queue_destroy(&shard->freelist);
+        free(shard->batches);
     }
 
-    free(dedup_ctx->out.slice_array.slices);
-    close_output_files(dedup_ctx);
-    return result;
+    if (shard->blocks != NULL) {
+        free(shard->blocks);
+    }
 }
 
-static int init_htables(DataRecoveryContext *ctx)
+static int init_shards(DataRecoveryContext *ctx)
 {
     BinlogDedupContext *dedup_ctx;
+    DedupShard *shard;
+    DedupShard *end;
+    pthread_t tid;
+    int64_t block_capacity;
     int result;
-    int64_t slice_capacity;
-    int64_t deleted_capacity;
+    int bytes;
 
     dedup_ctx = (BinlogDedupContext *)ctx->arg;
-
-    slice_capacity = ctx->master->data.version -
-        ctx->master->dg->myself->data.version;
-    if (slice_capacity < 256) {
-        slice_capacity = 256;
-    } else if (slice_capacity > STORAGE_CFG.object_block.hashtable_capacity) {
-        slice_capacity = STORAGE_CFG.object_block.hashtable_capacity;
+    dedup_ctx->shard_array.count = RECOVERY_THREADS_PER_DATA_GROUP;
+    bytes = sizeof(DedupShard) * dedup_ctx->shard_array.count;
+    dedup_ctx->shard_array.shards = (DedupShard *)fc_malloc(bytes);
+    if (dedup_ctx->shard_array.shards == NULL) {
+        return ENOMEM;
     }
-    if ((result=ob_index_init_htable_ex(&dedup_ctx->htables.create,
-                    slice_capacity, false, false)) != 0)
+    memset(dedup_ctx->shard_array.shards, 0, bytes);
+
+    block_capacity = (ctx->master->data.version - ctx->master->
+            dg->myself->data.version) / dedup_ctx->shard_array.count;
+    if (block_capacity < 256) {
+        block_capacity = 256;
+    } else if (block_capacity > STORAGE_CFG.object_block.
+            hashtable_capacity)
     {
-        return result;
+        block_capacity = STORAGE_CFG.object_block.hashtable_capacity;
     }
 
-    deleted_capacity = slice_capacity / 4;
-    if (deleted_capacity > 10240) {
-        deleted_capacity = 10240;
+    end = dedup_ctx->shard_array.shards + dedup_ctx->shard_array.count;
+    for (shard=dedup_ctx->shard_array.shards; shard<end; shard++) {
+        shard->dedup_ctx = dedup_ctx;
+        if ((result=init_shard(shard, block_capacity)) != 0) {
+            return result;
+        }
     }
-    if ((result=ob_index_init_htable_ex(&dedup_ctx->htables.remove,
-                    deleted_capacity, false, false)) != 0)
-    {
-        return result;
+
+    for (shard=dedup_ctx->shard_array.shards; shard<end; shard++) {
+        __sync_add_and_fetch(&dedup_ctx->running_count, 1);
+        if ((result=fc_create_thread(&tid, dedup_shard_thread_func,
+                        shard, SF_G_THREAD_STACK_SIZE)) != 0)
+        {
+            __sync_sub_and_fetch(&dedup_ctx->running_count, 1);
+            push_end_marks(dedup_ctx);
+            wait_shard_threads_exit(dedup_ctx);
+            return result;
+        }
     }
 
     return 0;
 }
 
+static void destroy_shards(BinlogDedupContext *dedup_ctx)
+{
+    DedupShard *shard;
+    DedupShard *end;
+
+    if (dedup_ctx->shard_array.shards == NULL) {
+        return;
+    }
+
+    end = dedup_ctx->shard_array.shards + dedup_ctx->shard_array.count;
+    for (shard=dedup_ctx->shard_array.shards; shard<end; shard++) {
+        destroy_shard(shard);
+    }
+    free(dedup_ctx->shard_array.shards);
+    dedup_ctx->shard_array.shards = NULL;
+}
+
 int data_recovery_dedup_binlog(DataRecoveryContext *ctx, int64_t *binlog_count)
 {
     int result;
@@ -651,15 +1012,12 @@ int data_recovery_dedup_binlog(DataRecoveryContext *ctx, int64_t *binlog_count)
     memset(&dedup_ctx, 0, sizeof(dedup_ctx));
     ctx->arg = &dedup_ctx;
 
-    if ((result=init_htables(ctx)) != 0) {
-        return result;
-    }
-    
     dedup_ctx.out.current_version = __sync_fetch_and_add(
             &ctx->master->dg->myself->data.version, 0);
-
-    result = dedup_binlog(ctx);
-    ob_index_destroy_htable(&dedup_ctx.htables.create);
+    if ((result=init_shards(ctx)) == 0) {
+        result = dedup_binlog(ctx);
+    }
+    destroy_shards(&dedup_ctx);
 
     *binlog_count = dedup_ctx.out.binlog_counts.remove +
         dedup_ctx.out.binlog_counts.create;
@@ -668,13 +1026,14 @@ int data_recovery_dedup_binlog(DataRecoveryContext *ctx, int64_t *binlog_count)
         long_to_comma_str(end_time - start_time, time_buff);
 
         logInfo("file: "__FILE__", line: %d, "
-                "dedup data group id: %d done. "
+                "dedup data group id: %d done, shard count: %d. "
                 "input: {all : {total : %"PRId64", success : %"PRId64"}, "
                 "create : {total : %"PRId64", success : %"PRId64"}, "
                 "delete : {total : %"PRId64", success : %"PRId64", "
                 "ignore : %"PRId64", partial : %"PRId64"}}, "
                 "output: {create : %"PRId64", delete : %"PRId64"}, "
                 "time used: %s ms", __LINE__, ctx->ds->dg->id,
+                dedup_ctx.shard_array.count,
                 dedup_ctx.rstat.create.total + dedup_ctx.rstat.remove.total,
                 dedup_ctx.rstat.create.success + dedup_ctx.rstat.remove.success,
                 dedup_ctx.rstat.create.total, dedup_ctx.rstat.create.success,
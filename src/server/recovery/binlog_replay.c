@@ -49,6 +49,8 @@ struct replay_thread_context;
 
 typedef struct replay_task_info {
     int op_type;
+    bool log_padding;
+    char *buff;   //for slice write
     FSSliceOpContext op_ctx;
     struct replay_thread_context *thread_ctx;
     struct replay_task_info *next;
@@ -58,6 +60,7 @@ typedef struct {
     FSCounterTripple write;
     FSCounterTripple allocate;
     FSCounterTripple remove;
+    int64_t write_bytes;
 } ReplayStatInfo;
 
 typedef struct replay_thread_context {
@@ -66,11 +69,6 @@ typedef struct replay_thread_context {
         struct fc_queue waiting;  //element: ReplayTaskInfo
     } queues;
 
-    struct {
-        pthread_lock_cond_pair_t lcp;
-        bool done;
-    } notify;
-
     ReplayStatInfo stat;
     struct binlog_replay_context *replay_ctx;
 } ReplayThreadContext;
@@ -80,6 +78,8 @@ typedef struct binlog_replay_context {
     volatile bool continue_flag;
     int64_t total_count;
     volatile int64_t fail_count;
+    volatile int64_t done_count;
+    volatile int inflight_count;  //the writes in the data threads
     BinlogReadThreadContext rdthread_ctx;
     BinlogReadThreadResult *r;
     struct {
@@ -94,31 +94,18 @@ typedef struct binlog_replay_context {
 
 static FCThreadPool replay_thread_pool;
 
-static void *alloc_thread_extra_data_func()
-{
-    return fc_malloc(FS_FILE_BLOCK_SIZE);
-}
-
-static void free_thread_extra_data_func(void *ptr)
-{
-    free(ptr);
-}
-
 int binlog_replay_init()
 {
     int result;
     int limit;
     const int max_idle_time = 60;
     const int min_idle_count = 0;
-    FCThreadExtraDataCallbacks extra_data_callbacks;
 
     limit = DATA_RECOVERY_THREADS_LIMIT * RECOVERY_THREADS_PER_DATA_GROUP;
-    extra_data_callbacks.alloc = alloc_thread_extra_data_func;
-    extra_data_callbacks.free = free_thread_extra_data_func;
     if ((result=fc_thread_pool_init_ex(&replay_thread_pool, "binlog replay",
                     limit, SF_G_THREAD_STACK_SIZE, max_idle_time,
                     min_idle_count, (bool *)&SF_G_CONTINUE_FLAG,
-                    &extra_data_callbacks)) != 0)
+                    NULL)) != 0)
     {
         return result;
     }
@@ -142,30 +129,89 @@ void binlog_replay_destroy()
 {
 }
 
-static void slice_write_done_notify(FSDataOperation *op)
+/* the task is done, record the result and return it to the freelist,
+   called by the replay thread or the data thread */
+static void task_finish(ReplayTaskInfo *task, int result)
 {
     ReplayThreadContext *thread_ctx;
 
-    thread_ctx = ((ReplayTaskInfo *)op->arg)->thread_ctx;
-    PTHREAD_MUTEX_LOCK(&thread_ctx->notify.lcp.lock);
-    if (!thread_ctx->notify.done) {
-        thread_ctx->notify.done = true;
-        pthread_cond_signal(&thread_ctx->notify.lcp.cond);
+    thread_ctx = task->thread_ctx;
+    if (result == 0) {
+        if (task->log_padding) {
+            result = replica_binlog_log_no_op(thread_ctx->replay_ctx->
+                    recovery_ctx->ds->dg->id, task->op_ctx.info.data_version,
+                    &task->op_ctx.info.bs_key.block);
+        }
+    }
+
+    if (result != 0) {
+        __sync_add_and_fetch(&thread_ctx->replay_ctx->fail_count, 1);
+        thread_ctx->replay_ctx->continue_flag = false;
+        logError("file: "__FILE__", line: %d, "
+                "data group id: %d, %s fail, "
+                "oid: %"PRId64", block offset: %"PRId64", "
+                "slice offset: %d, length: %d, "
+                "errno: %d, error info: %s",
+                __LINE__, thread_ctx->replay_ctx->recovery_ctx->ds->dg->id,
+                replica_binlog_get_op_type_caption(task->op_type),
+                task->op_ctx.info.bs_key.block.oid,
+                task->op_ctx.info.bs_key.block.offset,
+                task->op_ctx.info.bs_key.slice.offset,
+                task->op_ctx.info.bs_key.slice.length,
+                result, STRERROR(result));
+    }
+
+    __sync_add_and_fetch(&thread_ctx->replay_ctx->done_count, 1);
+    fc_queue_push(&thread_ctx->queues.freelist, task);
+}
+
+static void data_update_done_notify(FSDataOperation *op)
+{
+    ReplayTaskInfo *task;
+    BinlogReplayContext *replay_ctx;
+    ReplayStatInfo *stat;
+    int result;
+
+    task = (ReplayTaskInfo *)op->arg;
+    replay_ctx = task->thread_ctx->replay_ctx;
+    stat = &task->thread_ctx->stat;
+    result = task->op_ctx.result;
+    if (result == 0) {
+        switch (op->operation) {
+            case DATA_OPERATION_SLICE_WRITE:
+                __sync_add_and_fetch(&stat->write.success, 1);
+                __sync_add_and_fetch(&stat->write_bytes,
+                        task->op_ctx.info.bs_key.slice.length);
+                break;
+            case DATA_OPERATION_SLICE_ALLOCATE:
+                __sync_add_and_fetch(&stat->allocate.success, 1);
+                break;
+            case DATA_OPERATION_SLICE_DELETE:
+                __sync_add_and_fetch(&stat->remove.success, 1);
+                break;
+        }
+    } else if (result == ENOENT && op->operation ==
+            DATA_OPERATION_SLICE_DELETE)
+    {
+        result = 0;
+        task->log_padding = true;
+        __sync_add_and_fetch(&stat->remove.ignore, 1);
     }
-    PTHREAD_MUTEX_UNLOCK(&thread_ctx->notify.lcp.lock);
+
+    task_finish(task, result);
+    __sync_sub_and_fetch(&replay_ctx->inflight_count, 1);
 }
 
-static int deal_task(ReplayTaskInfo *task, char *buff)
+/* the local update is pushed to the data thread without waiting,
+   the task is finished by the data thread when the update done */
+static void deal_task(ReplayTaskInfo *task)
 {
     int result;
     int read_bytes;
     int operation;
-    bool log_padding;
-    int64_t *success_ptr;
 
-    log_padding = false;
+    task->log_padding = false;
     operation = DATA_OPERATION_NONE;
-    success_ptr = NULL;
     switch (task->op_type) {
         case REPLICA_BINLOG_OP_TYPE_WRITE_SLICE:
             task->thread_ctx->stat.write.total++;
@@ -180,7 +226,7 @@ static int deal_task(ReplayTaskInfo *task, char *buff)
 
             if ((result=fs_client_slice_read(&g_fs_client_vars.
                             client_ctx, &task->op_ctx.info.bs_key,
-                            buff, &read_bytes)) == 0)
+                            task->buff, &read_bytes)) == 0)
             {
                 if (read_bytes != task->op_ctx.info.bs_key.slice.length) {
                     logWarning("file: "__FILE__", line: %d, "
@@ -195,9 +241,8 @@ static int deal_task(ReplayTaskInfo *task, char *buff)
                             read_bytes);
                     task->op_ctx.info.bs_key.slice.length = read_bytes;
                 }
-                task->op_ctx.info.buff = buff;
+                task->op_ctx.info.buff = task->buff;
                 operation = DATA_OPERATION_SLICE_WRITE;
-                success_ptr = &task->thread_ctx->stat.write.success;
             } else if (result == ENODATA) {
                 logWarning("file: "__FILE__", line: %d, "
                         "oid: %"PRId64", block offset: %"PRId64", "
@@ -208,19 +253,19 @@ static int deal_task(ReplayTaskInfo *task, char *buff)
                         task->op_ctx.info.bs_key.slice.offset,
                         task->op_ctx.info.bs_key.slice.length);
                 result = 0;
-                log_padding = true;
+                task->log_padding = true;
                 task->thread_ctx->stat.write.ignore++;
             }
             break;
         case REPLICA_BINLOG_OP_TYPE_ALLOC_SLICE:
             task->thread_ctx->stat.allocate.total++;
             operation = DATA_OPERATION_SLICE_ALLOCATE;
-            success_ptr = &task->thread_ctx->stat.allocate.success;
+            result = 0;
             break;
         case REPLICA_BINLOG_OP_TYPE_DEL_SLICE:
             task->thread_ctx->stat.remove.total++;
             operation = DATA_OPERATION_SLICE_DELETE;
-            success_ptr = &task->thread_ctx->stat.remove.success;
+            result = 0;
             break;
         default:
             logError("file: "__FILE__", line: %d, "
@@ -231,66 +276,28 @@ static int deal_task(ReplayTaskInfo *task, char *buff)
     }
 
     if (operation != DATA_OPERATION_NONE) {
-        PTHREAD_MUTEX_LOCK(&task->thread_ctx->notify.lcp.lock);
-        task->thread_ctx->notify.done = false;
+        /* the updates of the same block are in the same replay thread and
+           the same data thread lane, so they are applied in binlog order */
+        __sync_add_and_fetch(&task->thread_ctx->replay_ctx->
+                inflight_count, 1);
         if ((result=push_to_data_thread_queue(operation,
                         DATA_SOURCE_SLAVE_RECOVERY, task,
                         &task->op_ctx)) == 0)
         {
-            while (!task->thread_ctx->notify.done) {
-                pthread_cond_wait(&task->thread_ctx->notify.lcp.cond,
-                        &task->thread_ctx->notify.lcp.lock);
-            }
-            result = task->op_ctx.result;
+            return;
         }
-        PTHREAD_MUTEX_UNLOCK(&task->thread_ctx->notify.lcp.lock);
-
-        if (result == 0) {
-            (*success_ptr)++;
-        } else if (result == ENOENT) {
-            if (operation == DATA_OPERATION_SLICE_DELETE) {
-                result = 0;
-                log_padding = true;
-                task->thread_ctx->stat.remove.ignore++;
-            }
-        }
-    }
-
-    if (result == 0) {
-        if (log_padding) {
-            result = replica_binlog_log_no_op(task->thread_ctx->
-                    replay_ctx->recovery_ctx->ds->dg->id,
-                    task->op_ctx.info.data_version,
-                    &task->op_ctx.info.bs_key.block);
-        }
-    } else {
-        __sync_add_and_fetch(&task->thread_ctx->replay_ctx->fail_count, 1);
-        task->thread_ctx->replay_ctx->continue_flag = false;
-        logError("file: "__FILE__", line: %d, "
-                "data group id: %d, %s fail, "
-                "oid: %"PRId64", block offset: %"PRId64", "
-                "slice offset: %d, length: %d, "
-                "errno: %d, error info: %s",
-                __LINE__, task->thread_ctx->replay_ctx->
-                recovery_ctx->ds->dg->id,
-                replica_binlog_get_op_type_caption(task->op_type),
-                task->op_ctx.info.bs_key.block.oid,
-                task->op_ctx.info.bs_key.block.offset,
-                task->op_ctx.info.bs_key.slice.offset,
-                task->op_ctx.info.bs_key.slice.length,
-                result, STRERROR(result));
+        __sync_sub_and_fetch(&task->thread_ctx->replay_ctx->
+                inflight_count, 1);
     }
 
-    return result;
+    task_finish(task, result);
 }
 
 static void binlog_replay_run(void *arg, void *thread_data)
 {
     ReplayThreadContext *thread_ctx;
     ReplayTaskInfo *task;
-    char *buff;
 
-    buff = (char *)thread_data;
     thread_ctx = (ReplayThreadContext *)arg;
     __sync_add_and_fetch(&thread_ctx->replay_ctx->running_count, 1);
     while (thread_ctx->replay_ctx->continue_flag) {
@@ -302,14 +309,11 @@ static void binlog_replay_run(void *arg, void *thread_data)
         }
 
         do {
-            if (deal_task(task, buff) != 0) {
-                break;
-            }
-            fc_queue_push(&thread_ctx->queues.freelist, task);
-
+            deal_task(task);
             task = (ReplayTaskInfo *)fc_queue_try_pop(
                     &thread_ctx->queues.waiting);
-        } while (task != NULL && SF_G_CONTINUE_FLAG);
+        } while (task != NULL && thread_ctx->replay_ctx->continue_flag &&
+                SF_G_CONTINUE_FLAG);
     }
 
     __sync_sub_and_fetch(&thread_ctx->replay_ctx->running_count, 1);
@@ -363,7 +367,7 @@ static int deal_binlog_buffer(DataRecoveryContext *ctx)
                 break;
             }
 
-            if (!SF_G_CONTINUE_FLAG) {
+            if (!(SF_G_CONTINUE_FLAG && replay_ctx->continue_flag)) {
                 return EINTR;
             }
         }
@@ -413,6 +417,7 @@ static void calc_replay_stat(BinlogReplayContext *replay_ctx,
         stat->remove.total += context->stat.remove.total;
         stat->remove.success += context->stat.remove.success;
         stat->remove.ignore += context->stat.remove.ignore;
+        stat->write_bytes += context->stat.write_bytes;
     }
 }
 
@@ -428,24 +433,26 @@ static void waiting_replay_threads_exit(DataRecoveryContext *ctx)
                     &replay_ctx->running_count, 0));
         fc_sleep_ms(10);
     }
+
+    //the tasks MUST NOT be freed before the data threads done
+    while (__sync_add_and_fetch(&replay_ctx->inflight_count, 0) > 0) {
+        fc_sleep_ms(1);
+    }
 }
 
 static void replay_finish(DataRecoveryContext *ctx, const int err_no)
 {
 #define REPLAY_WAIT_TIMES  30
     BinlogReplayContext *replay_ctx;
-    ReplayStatInfo stat;
-    int64_t total_count;
+    int64_t done_count;
     int i;
 
     replay_ctx = (BinlogReplayContext *)ctx->arg;
     if (err_no == 0) {
         for (i=0; i<REPLAY_WAIT_TIMES; i++) {
             fc_sleep_ms(100);
-            calc_replay_stat(replay_ctx, &stat);
-            total_count = stat.write.total + stat.allocate.total +
-                stat.remove.total;
-            if (total_count == replay_ctx->total_count) {
+            done_count = __sync_add_and_fetch(&replay_ctx->done_count, 0);
+            if (done_count == replay_ctx->total_count) {
                 break;
             }
         }
@@ -454,10 +461,10 @@ static void replay_finish(DataRecoveryContext *ctx, const int err_no)
             logWarning("file: "__FILE__", line: %d, "
                     "data group id: %d, replay running threads: %d, "
                     "waiting thread ready timeout, input record "
-                    "count: %"PRId64", current deal count: %"PRId64,
+                    "count: %"PRId64", current done count: %"PRId64,
                     __LINE__, ctx->ds->dg->id, __sync_add_and_fetch(
                         &replay_ctx->running_count, 0),
-                    replay_ctx->total_count, total_count);
+                    replay_ctx->total_count, done_count);
         }
     }
 
@@ -471,6 +478,8 @@ static int replay_output(DataRecoveryContext *ctx, const int err_no)
     char prompt[32];
     char time_buff[32];
     int64_t end_time;
+    int64_t time_used;
+    double write_mbps;
     int64_t total_count;
     int64_t success_count;
     int64_t fail_count;
@@ -492,10 +501,14 @@ static int replay_output(DataRecoveryContext *ctx, const int err_no)
     }
 
     end_time = get_current_time_ms();
-    long_to_comma_str(end_time - ctx->start_time, time_buff);
+    time_used = end_time - ctx->start_time;
+    long_to_comma_str(time_used, time_buff);
+    write_mbps = (double)stat.write_bytes * 1000 / (1024 * 1024) /
+        (time_used > 0 ? time_used : 1);
     logInfo("file: "__FILE__", line: %d, "
             "data group id: %d, last_data_version: %"PRId64", "
-            "data recovery %s, time used: %s ms. "
+            "data recovery %s, time used: %s ms, "
+            "write bytes: %"PRId64", speed: %.2f MB/s. "
             "all : {total : %"PRId64", success : %"PRId64", "
             "fail : %"PRId64", ignore : %"PRId64"}, "
             "write : {total : %"PRId64", success : %"PRId64", "
@@ -504,8 +517,8 @@ static int replay_output(DataRecoveryContext *ctx, const int err_no)
             "ignore : %"PRId64"}, "
             "remove: {total : %"PRId64", success : %"PRId64", "
             "ignore : %"PRId64"}", __LINE__, ctx->ds->dg->id,
-            ctx->fetch.last_data_version, prompt,
-            time_buff, total_count, success_count, fail_count, ignore_count,
+            ctx->fetch.last_data_version, prompt, time_buff,
+            stat.write_bytes, write_mbps, total_count, success_count, fail_count, ignore_count,
             stat.write.total, stat.write.success, stat.write.ignore,
             stat.allocate.total, stat.allocate.success, stat.allocate.ignore,
             stat.remove.total, stat.remove.success, stat.remove.ignore);
@@ -607,13 +620,9 @@ static int init_rthread_context(ReplayThreadContext *thread_ctx,
         return result;
     }
 
-    if ((result=init_pthread_lock_cond_pair(&thread_ctx->notify.lcp)) != 0) {
-        return result;
-    }
-
     end = tasks + RECOVERY_MAX_QUEUE_DEPTH;
     for (task=tasks; task<end; task++) {
-        task->op_ctx.notify_func = slice_write_done_notify;
+        task->op_ctx.notify_func = data_update_done_notify;
         task->thread_ctx = thread_ctx;
         fc_queue_push_ex(&thread_ctx->queues.freelist, task, &notify);
     }
@@ -637,9 +646,17 @@ static int init_replay_tasks(DataRecoveryContext *ctx)
     if (replay_ctx->thread_env.tasks == NULL) {
         return ENOMEM;
     }
+    memset(replay_ctx->thread_env.tasks, 0, bytes);
+    replay_ctx->thread_env.task_count = count;
 
+    /* each task has its own buffer because the write is pushed
+       to the data thread without waiting */
     end = replay_ctx->thread_env.tasks + count;
     for (task=replay_ctx->thread_env.tasks; task<end; task++) {
+        if ((task->buff=(char *)fc_malloc(FS_FILE_BLOCK_SIZE)) == NULL) {
+            return ENOMEM;
+        }
+
         task->op_ctx.info.write_binlog.log_replica = true;
         task->op_ctx.info.data_group_id = ctx->ds->dg->id;
         task->op_ctx.info.myself = ctx->master->dg->myself;
@@ -648,7 +665,6 @@ static int init_replay_tasks(DataRecoveryContext *ctx)
             return result;
         }
     }
-    replay_ctx->thread_env.task_count = count;
 
     return 0;
 }
@@ -715,13 +731,14 @@ static void destroy_replay_context(BinlogReplayContext *replay_ctx)
     for (context=replay_ctx->thread_env.contexts; context<cend; context++) {
         fc_queue_destroy(&context->queues.freelist);
         fc_queue_destroy(&context->queues.waiting);
-
-        destroy_pthread_lock_cond_pair(&context->notify.lcp);
     }
 
     tend = replay_ctx->thread_env.tasks + replay_ctx->thread_env.task_count;
     for (task=replay_ctx->thread_env.tasks; task<tend; task++) {
         fs_free_slice_op_ctx(&task->op_ctx.update.sarray);
+        if (task->buff != NULL) {
+            free(task->buff);
+        }
     }
     free(replay_ctx->thread_env.tasks);
 
@@ -0,0 +1,491 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "fastcommon/shared_func.h"
+#include "fastcommon/logger.h"
+#include "fastcommon/pthread_func.h"
+#include "sf/sf_global.h"
+#include "../binlog/slice_binlog_bin.h"
+#include "../storage/object_block_index.h"
+#include "../storage/slice_op.h"
+#include "../data_thread.h"
+#include "block_digest.h"
+
+typedef struct block_digest_reader {
+    FSSliceOpContext op_ctx;
+    BlockDigestEntry *entry;
+    int64_t version;
+    char *buff;
+    struct block_digest_builder *builder;
+    struct block_digest_reader *next;
+} BlockDigestReader;
+
+typedef struct block_digest_builder {
+    int data_group_id;
+    int inflight_count;
+    BlockDigestReader readers[BLOCK_DIGEST_READ_DEPTH];
+    BlockDigestReader *freelist;
+    BlockDigestReader *done_list;  //waiting for computing the digest
+    pthread_lock_cond_pair_t lcp;
+} BlockDigestBuilder;
+
+typedef struct block_digest_collector {
+    int data_group_id;
+    const OBEntry *last_ob;
+    BlockDigestArray *array;
+} BlockDigestCollector;
+
+//the digest of the block without data, such as the deleted block
+static uint32_t empty_block_digest = 0;
+
+int block_digest_init()
+{
+    char *buff;
+
+    buff = (char *)fc_malloc(FS_FILE_BLOCK_SIZE);
+    if (buff == NULL) {
+        return ENOMEM;
+    }
+
+    memset(buff, 0, FS_FILE_BLOCK_SIZE);
+    empty_block_digest = slice_bin_crc32c(0, buff, FS_FILE_BLOCK_SIZE);
+    free(buff);
+    return 0;
+}
+
+static inline bool is_canceled(volatile bool *canceled)
+{
+    return (!SF_G_CONTINUE_FLAG || (canceled != NULL && *canceled));
+}
+
+static int add_block_entry(BlockDigestArray *array, const FSBlockKey *bkey)
+{
+    BlockDigestEntry *entries;
+    int64_t alloc;
+
+    if (array->count >= array->alloc) {
+        alloc = array->alloc > 0 ? array->alloc * 2 : 4096;
+        entries = (BlockDigestEntry *)fc_malloc(
+                sizeof(BlockDigestEntry) * alloc);
+        if (entries == NULL) {
+            return ENOMEM;
+        }
+
+        if (array->entries != NULL) {
+            memcpy(entries, array->entries,
+                    sizeof(BlockDigestEntry) * array->count);
+            free(array->entries);
+        }
+        array->entries = entries;
+        array->alloc = alloc;
+    }
+
+    array->entries[array->count].bkey = *bkey;
+    array->entries[array->count].digest = 0;
+    array->count++;
+    return 0;
+}
+
+static int collect_block(void *arg, const OBSliceEntry *slice)
+{
+    BlockDigestCollector *collector;
+
+    collector = (BlockDigestCollector *)arg;
+    if (slice->ob == collector->last_ob) {  //the same block
+        return 0;
+    }
+
+    collector->last_ob = slice->ob;
+    if (FS_DATA_GROUP_ID(slice->ob->bkey) != collector->data_group_id) {
+        return 0;
+    }
+    return add_block_entry(collector->array, &slice->ob->bkey);
+}
+
+//the blocks without slice are skipped
+static int collect_blocks(const int data_group_id, BlockDigestArray *array,
+        volatile bool *canceled)
+{
+    BlockDigestCollector collector;
+    int64_t bucket_index;
+    int ob_count;
+    int result;
+
+    collector.data_group_id = data_group_id;
+    collector.array = array;
+    for (bucket_index=0; bucket_index<g_ob_hashtable.capacity;
+            bucket_index++)
+    {
+        collector.last_ob = NULL;
+        if ((result=ob_index_walk_bucket(&g_ob_hashtable, bucket_index,
+                        collect_block, &collector, &ob_count)) != 0)
+        {
+            return result;
+        }
+
+        if (bucket_index % 10000 == 0 && is_canceled(canceled)) {
+            return EINTR;
+        }
+    }
+
+    return 0;
+}
+
+static int compare_block_entry(const BlockDigestEntry *entry1,
+        const BlockDigestEntry *entry2)
+{
+    int sub;
+
+    if ((sub=block_digest_range_index(&entry1->bkey) -
+                block_digest_range_index(&entry2->bkey)) != 0)
+    {
+        return sub;
+    }
+
+    if ((sub=fc_compare_int64(entry1->bkey.oid, entry2->bkey.oid)) != 0) {
+        return sub;
+    }
+    return fc_compare_int64(entry1->bkey.offset, entry2->bkey.offset);
+}
+
+static void set_range_starts(BlockDigestArray *array)
+{
+    BlockDigestEntry *entry;
+    BlockDigestEntry *end;
+    int range_index;
+    int current;
+
+    current = 0;
+    array->range_starts[0] = 0;
+    end = array->entries + array->count;
+    for (entry=array->entries; entry<end; entry++) {
+        range_index = block_digest_range_index(&entry->bkey);
+        while (current < range_index) {
+            array->range_starts[++current] = entry - array->entries;
+        }
+    }
+
+    while (current < BLOCK_DIGEST_RANGE_COUNT) {
+        array->range_starts[++current] = array->count;
+    }
+}
+
+static void block_read_done_notify(FSDataOperation *op)
+{
+    BlockDigestReader *reader;
+    BlockDigestBuilder *builder;
+
+    reader = (BlockDigestReader *)op->arg;
+    builder = reader->builder;
+
+    PTHREAD_MUTEX_LOCK(&builder->lcp.lock);
+    reader->next = builder->done_list;
+    builder->done_list = reader;
+    pthread_cond_signal(&builder->lcp.cond);
+    PTHREAD_MUTEX_UNLOCK(&builder->lcp.lock);
+}
+
+static int read_block(BlockDigestBuilder *builder, BlockDigestReader *reader)
+{
+    memset(reader->buff, 0, FS_FILE_BLOCK_SIZE);  //for the holes
+    reader->op_ctx.result = 0;
+    reader->op_ctx.info.data_group_id = builder->data_group_id;
+    reader->op_ctx.info.bs_key.block = reader->entry->bkey;
+    reader->op_ctx.info.bs_key.slice.offset = 0;
+    reader->op_ctx.info.bs_key.slice.length = FS_FILE_BLOCK_SIZE;
+    reader->op_ctx.info.buff = reader->buff;
+    return push_to_data_thread_queue(DATA_OPERATION_SLICE_READ,
+            DATA_SOURCE_SLAVE_RECOVERY, reader, &reader->op_ctx);
+}
+
+//compute the digest out of the data thread
+static int reader_done(BlockDigestReader *reader)
+{
+    int result;
+
+    result = reader->op_ctx.result;
+    if (result == ENOENT) {  //deleted after collected
+        reader->entry->digest = empty_block_digest;
+        return 0;
+    } else if (result != 0) {
+        logError("file: "__FILE__", line: %d, "
+                "data group id: %d, read block fail, oid: %"PRId64", "
+                "block offset: %"PRId64", errno: %d, error info: %s",
+                __LINE__, reader->builder->data_group_id,
+                reader->entry->bkey.oid, reader->entry->bkey.offset,
+                result, STRERROR(result));
+        return result;
+    }
+
+    reader->entry->digest = slice_bin_crc32c(0,
+            reader->buff, FS_FILE_BLOCK_SIZE);
+    ob_index_set_block_digest(&reader->entry->bkey,
+            reader->version, reader->entry->digest);
+    return 0;
+}
+
+/* deal the done readers, wait for one done when the wait flag set,
+   the freelist is accessed by the builder thread only */
+static int deal_done_readers(BlockDigestBuilder *builder, const bool wait)
+{
+    BlockDigestReader *done_list;
+    BlockDigestReader *reader;
+    int result;
+    int r;
+
+    PTHREAD_MUTEX_LOCK(&builder->lcp.lock);
+    while (wait && builder->done_list == NULL) {
+        pthread_cond_wait(&builder->lcp.cond, &builder->lcp.lock);
+    }
+    done_list = builder->done_list;
+    builder->done_list = NULL;
+    PTHREAD_MUTEX_UNLOCK(&builder->lcp.lock);
+
+    result = 0;
+    while (done_list != NULL) {
+        reader = done_list;
+        done_list = done_list->next;
+        if ((r=reader_done(reader)) != 0 && result == 0) {
+            result = r;
+        }
+
+        builder->inflight_count--;
+        reader->next = builder->freelist;
+        builder->freelist = reader;
+    }
+
+    return result;
+}
+
+static int do_compute_digests(BlockDigestBuilder *builder,
+        BlockDigestArray *array, volatile bool *canceled)
+{
+    BlockDigestEntry *entry;
+    BlockDigestEntry *end;
+    BlockDigestReader *reader;
+    int64_t version;
+    int64_t digest;
+    int result;
+    int r;
+
+    result = 0;
+    end = array->entries + array->count;
+    for (entry=array->entries; entry<end; entry++) {
+        if (is_canceled(canceled)) {
+            result = EINTR;
+            break;
+        }
+
+        if (ob_index_get_block_digest(&entry->bkey,
+                    &version, &digest) != 0)
+        {
+            entry->digest = empty_block_digest;  //deleted after collected
+            continue;
+        }
+        if (digest != OB_BLOCK_DIGEST_NONE) {
+            entry->digest = digest;
+            continue;
+        }
+
+        if ((result=deal_done_readers(builder, builder->
+                        freelist == NULL)) != 0)
+        {
+            break;
+        }
+
+        reader = builder->freelist;
+        builder->freelist = reader->next;
+        reader->entry = entry;
+        reader->version = version;
+        if ((result=read_block(builder, reader)) != 0) {
+            reader->next = builder->freelist;
+            builder->freelist = reader;
+            break;
+        }
+        builder->inflight_count++;
+    }
+
+    //waiting for the in-flight reads done
+    while (builder->inflight_count > 0) {
+        if ((r=deal_done_readers(builder, true)) != 0 && result == 0) {
+            result = r;
+        }
+    }
+
+    return result;
+}
+
+static int compute_block_digests(const int data_group_id,
+        BlockDigestArray *array, volatile bool *canceled)
+{
+    BlockDigestBuilder builder;
+    BlockDigestReader *reader;
+    BlockDigestReader *end;
+    int result;
+
+    memset(&builder, 0, sizeof(builder));
+    builder.data_group_id = data_group_id;
+    if ((result=init_pthread_lock_cond_pair(&builder.lcp)) != 0) {
+        return result;
+    }
+
+    end = builder.readers + BLOCK_DIGEST_READ_DEPTH;
+    for (reader=builder.readers; reader<end; reader++) {
+        reader->buff = (char *)fc_malloc(FS_FILE_BLOCK_SIZE);
+        if (reader->buff == NULL) {
+            result = ENOMEM;
+            break;
+        }
+        reader->builder = &builder;
+        reader->op_ctx.notify_func = block_read_done_notify;
+        reader->next = builder.freelist;
+        builder.freelist = reader;
+    }
+
+    if (result == 0) {
+        result = do_compute_digests(&builder, array, canceled);
+    }
+
+    for (reader=builder.readers; reader<end; reader++) {
+        if (reader->buff != NULL) {
+            free(reader->buff);
+        }
+        ob_index_free_slice_ptr_array(&reader->op_ctx.slice_ptr_array);
+        fs_free_read_iovecs(&reader->op_ctx);
+    }
+    destroy_pthread_lock_cond_pair(&builder.lcp);
+    return result;
+}
+
+static void compute_range_digests(BlockDigestArray *array)
+{
+    BlockDigestEntry *entry;
+    BlockDigestEntry *end;
+    char buff[20];
+    uint32_t digest;
+    int range_index;
+
+    for (range_index=0; range_index<BLOCK_DIGEST_RANGE_COUNT;
+            range_index++)
+    {
+        digest = 0;
+        end = array->entries + array->range_starts[range_index + 1];
+        for (entry=array->entries + array->range_starts[range_index];
+                entry<end; entry++)
+        {
+            long2buff(entry->bkey.oid, buff);
+            long2buff(entry->bkey.offset, buff + 8);
+            int2buff(entry->digest, buff + 16);
+            digest = slice_bin_crc32c(digest, buff, sizeof(buff));
+        }
+        array->range_digests[range_index] = digest;
+    }
+}
+
+int block_digest_build(const int data_group_id, BlockDigestArray *array,
+        volatile bool *canceled)
+{
+    int result;
+    int64_t start_time;
+    char time_buff[32];
+
+    start_time = get_current_time_ms();
+    if ((result=collect_blocks(data_group_id, array, canceled)) != 0) {
+        return result;
+    }
+
+    if (array->count > 1) {
+        qsort(array->entries, array->count, sizeof(BlockDigestEntry),
+                (int (*)(const void *, const void *))compare_block_entry);
+    }
+    set_range_starts(array);
+
+    if ((result=compute_block_digests(data_group_id,
+                    array, canceled)) != 0)
+    {
+        return result;
+    }
+    compute_range_digests(array);
+
+    long_to_comma_str(get_current_time_ms() - start_time, time_buff);
+    logInfo("file: "__FILE__", line: %d, "
+            "data group id: %d, build the digests of %"PRId64" blocks, "
+            "time used: %s ms", __LINE__, data_group_id,
+            array->count, time_buff);
+    return 0;
+}
+
+void block_digest_free(BlockDigestArray *array)
+{
+    if (array->entries != NULL) {
+        free(array->entries);
+        array->entries = NULL;
+    }
+    array->alloc = array->count = 0;
+}
+
+void block_digest_session_release(BlockDigestSession *session)
+{
+    if (__sync_sub_and_fetch(&session->reffer_count, 1) == 0) {
+        block_digest_free(&session->array);
+        free(session);
+    }
+}
+
+static void *session_thread_func(void *arg)
+{
+    BlockDigestSession *session;
+
+    session = (BlockDigestSession *)arg;
+    session->result = block_digest_build(session->data_group_id,
+            &session->array, &session->canceled);
+    __sync_synchronize();
+    session->stage = BLOCK_DIGEST_STAGE_DONE;
+
+    block_digest_session_release(session);
+    return NULL;
+}
+
+BlockDigestSession *block_digest_session_create(const int data_group_id,
+        const uint64_t data_version, int *err_no)
+{
+    BlockDigestSession *session;
+    pthread_t tid;
+
+    session = (BlockDigestSession *)fc_malloc(sizeof(BlockDigestSession));
+    if (session == NULL) {
+        *err_no = ENOMEM;
+        return NULL;
+    }
+
+    memset(session, 0, sizeof(BlockDigestSession));
+    session->data_group_id = data_group_id;
+    session->data_version = data_version;
+    session->stage = BLOCK_DIGEST_STAGE_BUILDING;
+    session->reffer_count = 2;
+    if ((*err_no=fc_create_thread(&tid, session_thread_func,
+                    session, SF_G_THREAD_STACK_SIZE)) != 0)
+    {
+        free(session);
+        return NULL;
+    }
+
+    return session;
+}
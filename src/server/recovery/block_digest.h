@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//block_digest.h
+
+/* the block digests of a data group for the anti-entropy recovery:
+ *   1. the digest of a block is the CRC32C of the block data (the holes
+ *      read as zeros), it is cached in the object block index until the
+ *      slices of the block changed
+ *   2. the blocks are divided into the fixed ranges by the hash code,
+ *      the digest of a range is the CRC32C of its block keys and digests
+ *      sorted by the block key
+ *   3. the slave compares the range digests with the master's first, then
+ *      fetches the block digests of the different ranges only
+ */
+
+#ifndef _BLOCK_DIGEST_H_
+#define _BLOCK_DIGEST_H_
+
+#include "../server_global.h"
+
+#define BLOCK_DIGEST_RANGE_COUNT   4096
+
+//the in-flight block reads when computing the digests
+#define BLOCK_DIGEST_READ_DEPTH       4
+
+#define BLOCK_DIGEST_STAGE_BUILDING   0
+#define BLOCK_DIGEST_STAGE_DONE       1
+
+typedef struct block_digest_entry {
+    FSBlockKey bkey;
+    uint32_t digest;
+} BlockDigestEntry;
+
+typedef struct block_digest_array {
+    int64_t alloc;
+    int64_t count;
+    BlockDigestEntry *entries;  //sorted by the range, oid and block offset
+    int64_t range_starts[BLOCK_DIGEST_RANGE_COUNT + 1];
+    uint32_t range_digests[BLOCK_DIGEST_RANGE_COUNT];
+} BlockDigestArray;
+
+//the digests built by the master for a recovering slave
+typedef struct block_digest_session {
+    int data_group_id;
+    uint64_t data_version;  //the data version before building
+    volatile int stage;
+    volatile int result;
+    volatile bool canceled;
+    volatile int reffer_count;  //the task and the building thread
+    BlockDigestArray array;
+} BlockDigestSession;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    static inline int block_digest_range_index(const FSBlockKey *bkey)
+    {
+        return (FS_BLOCK_HASH_CODE(*bkey) / FS_DATA_GROUP_COUNT(
+                    CLUSTER_CONFIG_CTX)) % BLOCK_DIGEST_RANGE_COUNT;
+    }
+
+    static inline int64_t block_digest_range_count(
+            const BlockDigestArray *array, const int range_index)
+    {
+        return array->range_starts[range_index + 1] -
+            array->range_starts[range_index];
+    }
+
+    int block_digest_init();
+
+    /* build the digests of the blocks which belong to the data group,
+       stop building when the canceled flag set (NULL for none) */
+    int block_digest_build(const int data_group_id, BlockDigestArray *array,
+            volatile bool *canceled);
+
+    void block_digest_free(BlockDigestArray *array);
+
+    /* create the session and start the thread to build the digests,
+       the session is released by block_digest_session_release */
+    BlockDigestSession *block_digest_session_create(const int data_group_id,
+            const uint64_t data_version, int *err_no);
+
+    void block_digest_session_release(BlockDigestSession *session);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -38,6 +38,8 @@
 #include "binlog_fetch.h"
 #include "binlog_dedup.h"
 #include "binlog_replay.h"
+#include "block_digest.h"
+#include "digest_sync.h"
 #include "data_recovery.h"
 
 #define DATA_RECOVERY_SYS_DATA_FILENAME       "data_recovery.dat"
@@ -58,6 +60,10 @@ int data_recovery_init()
         return result;
     }
 
+    if ((result=block_digest_init()) != 0) {
+        return result;
+    }
+
     return 0;
 }
 
@@ -488,6 +494,30 @@ static int do_data_recovery(DataRecoveryContext *ctx)
     return 0;
 }
 
+/* replay the different blocks with the master instead of the binlog
+   when falls far behind, the binlog after is fetched as usual */
+static int sync_block_digests(DataRecoveryContext *ctx)
+{
+    int result;
+    int64_t binlog_count;
+
+    if ((ctx->master=data_recovery_get_master(ctx, &result)) == NULL) {
+        return result;
+    }
+
+    if ((result=data_recovery_sync_block_digests(ctx,
+                    &binlog_count)) != 0)
+    {
+        return result;
+    }
+
+    if (binlog_count > 0) {
+        ctx->stage = DATA_RECOVERY_STAGE_REPLAY;
+        return data_recovery_save_sys_data(ctx);
+    }
+    return 0;
+}
+
 int data_recovery_start(FSClusterDataServerInfo *ds)
 {
     DataRecoveryContext ctx;
@@ -499,6 +529,13 @@ int data_recovery_start(FSClusterDataServerInfo *ds)
     }
 
     ctx.catch_up = DATA_RECOVERY_CATCH_UP_DOING;
+    if (ctx.stage == DATA_RECOVERY_STAGE_FETCH) {
+        if ((result=sync_block_digests(&ctx)) != 0) {
+            destroy_data_recovery_ctx(&ctx);
+            return result;
+        }
+    }
+
     do {
         if ((ctx.master=data_recovery_get_master(&ctx, &result)) == NULL) {
             break;
@@ -0,0 +1,555 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include "fastcommon/shared_func.h"
+#include "fastcommon/logger.h"
+#include "fastcommon/sched_thread.h"
+#include "sf/sf_func.h"
+#include "../../common/fs_proto.h"
+#include "../server_global.h"
+#include "../server_replication.h"
+#include "../binlog/replica_binlog.h"
+#include "data_recovery.h"
+#include "block_digest.h"
+#include "digest_sync.h"
+
+//the max waiting times of the status ready on the master
+#define DIGEST_SYNC_MAX_RETRY_TIMES  30
+
+typedef struct {
+    DataRecoveryContext *ctx;
+    ConnectionInfo conn;
+    SharedBuffer *buffer;  //for network
+    BlockDigestSession *local;
+    struct {
+        FILE *fp;
+        char filename[PATH_MAX];
+    } writer;
+    uint64_t master_version;   //the data version of the master digests
+    uint64_t current_version;  //the data version of the last replay record
+    FSBlockKey last_bkey;
+    uint32_t range_digests[BLOCK_DIGEST_RANGE_COUNT];  //of the master
+    struct {
+        int ranges;
+        int64_t removes;
+        int64_t writes;
+    } stat;
+} DigestSyncContext;
+
+static int do_request(DigestSyncContext *sync_ctx, const unsigned char
+        req_cmd, const unsigned char resp_cmd, char *out_buff,
+        const int out_bytes, const int min_body_len, int *body_len)
+{
+    int result;
+    SFResponseInfo response;
+
+    response.error.length = 0;
+    SF_PROTO_SET_HEADER((FSProtoHeader *)out_buff, req_cmd,
+            out_bytes - sizeof(FSProtoHeader));
+    if ((result=sf_send_and_check_response_header(&sync_ctx->conn,
+                    out_buff, out_bytes, &response,
+                    SF_G_NETWORK_TIMEOUT, resp_cmd)) != 0)
+    {
+        if (result != EAGAIN) {
+            sf_log_network_error(&response, &sync_ctx->conn, result);
+        }
+        return result;
+    }
+
+    if (response.header.body_len < min_body_len) {
+        logError("file: "__FILE__", line: %d, "
+                "response body length: %d is too short, "
+                "the min body length is %d", __LINE__,
+                response.header.body_len, min_body_len);
+        return EINVAL;
+    }
+    if (response.header.body_len > sync_ctx->buffer->capacity) {
+        logError("file: "__FILE__", line: %d, "
+                "response body length: %d is too large, "
+                "the max body length is %d", __LINE__,
+                response.header.body_len, sync_ctx->buffer->capacity);
+        return EOVERFLOW;
+    }
+
+    if ((result=tcprecvdata_nb(sync_ctx->conn.sock, sync_ctx->buffer->buff,
+                    response.header.body_len, SF_G_NETWORK_TIMEOUT)) != 0)
+    {
+        response.error.length = snprintf(response.error.message,
+                sizeof(response.error.message),
+                "recv data fail, errno: %d, error info: %s",
+                result, STRERROR(result));
+        sf_log_network_error(&response, &sync_ctx->conn, result);
+        return result;
+    }
+
+    *body_len = response.header.body_len;
+    return 0;
+}
+
+static int fetch_range_digests(DigestSyncContext *sync_ctx, bool *is_ready)
+{
+    FSProtoReplicaFetchRangeDigestsReq *req;
+    FSProtoReplicaFetchRangeDigestsRespHeader *resp;
+    char out_buff[sizeof(FSProtoHeader) +
+        sizeof(FSProtoReplicaFetchRangeDigestsReq)];
+    char *p;
+    int body_len;
+    int range_count;
+    int result;
+    int i;
+
+    req = (FSProtoReplicaFetchRangeDigestsReq *)
+        (out_buff + sizeof(FSProtoHeader));
+    int2buff(sync_ctx->ctx->ds->dg->id, req->data_group_id);
+    int2buff(CLUSTER_MYSELF_PTR->server->id, req->server_id);
+    if ((result=do_request(sync_ctx,
+                    FS_REPLICA_PROTO_FETCH_RANGE_DIGESTS_REQ,
+                    FS_REPLICA_PROTO_FETCH_RANGE_DIGESTS_RESP,
+                    out_buff, sizeof(out_buff), sizeof(*resp),
+                    &body_len)) != 0)
+    {
+        return result;
+    }
+
+    resp = (FSProtoReplicaFetchRangeDigestsRespHeader *)
+        sync_ctx->buffer->buff;
+    if (!(*is_ready=resp->is_ready)) {
+        return 0;
+    }
+
+    range_count = buff2int(resp->range_count);
+    if (range_count != BLOCK_DIGEST_RANGE_COUNT) {
+        logError("file: "__FILE__", line: %d, "
+                "data group id: %d, range count: %d != mine: %d",
+                __LINE__, sync_ctx->ctx->ds->dg->id,
+                range_count, BLOCK_DIGEST_RANGE_COUNT);
+        return EINVAL;
+    }
+    if (body_len != sizeof(*resp) + 4 * range_count) {
+        logError("file: "__FILE__", line: %d, "
+                "response body length: %d != expected: %d",
+                __LINE__, body_len, (int)(sizeof(*resp) +
+                    4 * range_count));
+        return EINVAL;
+    }
+
+    sync_ctx->master_version = buff2long(resp->data_version);
+    p = resp->digests;
+    for (i=0; i<range_count; i++) {
+        sync_ctx->range_digests[i] = buff2int(p);
+        p += 4;
+    }
+
+    return 0;
+}
+
+/* the master starts building the digests when received the first request,
+   build the local digests meanwhile and wait for both done */
+static int wait_digests_ready(DigestSyncContext *sync_ctx)
+{
+    int result;
+    int retry_times;
+    bool is_ready;
+
+    retry_times = 0;
+    is_ready = false;
+    while (SF_G_CONTINUE_FLAG) {
+        if ((result=fetch_range_digests(sync_ctx, &is_ready)) != 0) {
+            //waiting for my status ready on the master
+            if (!(result == EAGAIN && ++retry_times <
+                        DIGEST_SYNC_MAX_RETRY_TIMES))
+            {
+                return result;
+            }
+        } else if (sync_ctx->local == NULL) {
+            if ((sync_ctx->local=block_digest_session_create(sync_ctx->
+                            ctx->ds->dg->id, __sync_add_and_fetch(
+                                &sync_ctx->ctx->ds->data.version, 0),
+                            &result)) == NULL)
+            {
+                return result;
+            }
+        }
+
+        if (is_ready && sync_ctx->local != NULL && __sync_add_and_fetch(
+                    &sync_ctx->local->stage, 0) == BLOCK_DIGEST_STAGE_DONE)
+        {
+            return sync_ctx->local->result;
+        }
+        fc_sleep_ms(100);
+    }
+
+    return EINTR;
+}
+
+static int fetch_block_digests(DigestSyncContext *sync_ctx,
+        const int range_index, const int start_index,
+        FSProtoBlockDigest **parts, int *count, bool *is_last)
+{
+    FSProtoReplicaFetchBlockDigestsReq *req;
+    FSProtoReplicaFetchBlockDigestsRespHeader *resp;
+    char out_buff[sizeof(FSProtoHeader) +
+        sizeof(FSProtoReplicaFetchBlockDigestsReq)];
+    int body_len;
+    int result;
+
+    req = (FSProtoReplicaFetchBlockDigestsReq *)
+        (out_buff + sizeof(FSProtoHeader));
+    int2buff(range_index, req->range_index);
+    int2buff(start_index, req->start_index);
+    if ((result=do_request(sync_ctx,
+                    FS_REPLICA_PROTO_FETCH_BLOCK_DIGESTS_REQ,
+                    FS_REPLICA_PROTO_FETCH_BLOCK_DIGESTS_RESP,
+                    out_buff, sizeof(out_buff), sizeof(*resp),
+                    &body_len)) != 0)
+    {
+        return result;
+    }
+
+    resp = (FSProtoReplicaFetchBlockDigestsRespHeader *)
+        sync_ctx->buffer->buff;
+    *count = buff2int(resp->count);
+    *is_last = resp->is_last;
+    if (body_len != sizeof(*resp) + sizeof(FSProtoBlockDigest) * *count ||
+            (*count == 0 && !*is_last))
+    {
+        logError("file: "__FILE__", line: %d, "
+                "response body length: %d, block count: %d, "
+                "is_last: %d, invalid response", __LINE__,
+                body_len, *count, *is_last);
+        return EINVAL;
+    }
+
+    *parts = (FSProtoBlockDigest *)(resp + 1);
+    return 0;
+}
+
+static int write_record(DigestSyncContext *sync_ctx,
+        const FSBlockKey *bkey, const int op_type)
+{
+    int result;
+
+    //the data version of the master is reserved for the padding
+    if (sync_ctx->current_version + 1 >= sync_ctx->master_version) {
+        return EOVERFLOW;
+    }
+
+    if (fprintf(sync_ctx->writer.fp,
+                "%d %"PRId64" %c %c %"PRId64" %"PRId64" %d %d\n",
+                (int)g_current_time, ++(sync_ctx->current_version),
+                BINLOG_SOURCE_REPLAY, op_type, bkey->oid, bkey->offset,
+                0, FS_FILE_BLOCK_SIZE) <= 0)
+    {
+        result = errno != 0 ? errno : EPERM;
+        logError("file: "__FILE__", line: %d, "
+                "write to file: %s fail, "
+                "errno: %d, error info: %s", __LINE__,
+                sync_ctx->writer.filename,
+                result, STRERROR(result));
+        return result;
+    }
+
+    sync_ctx->last_bkey = *bkey;
+    if (op_type == REPLICA_BINLOG_OP_TYPE_DEL_SLICE) {
+        sync_ctx->stat.removes++;
+    } else {
+        sync_ctx->stat.writes++;
+    }
+    return 0;
+}
+
+static inline int remove_block(DigestSyncContext *sync_ctx,
+        const FSBlockKey *bkey)
+{
+    return write_record(sync_ctx, bkey, REPLICA_BINLOG_OP_TYPE_DEL_SLICE);
+}
+
+//the slices of the block are replaced by the whole block of the master
+static inline int copy_block(DigestSyncContext *sync_ctx,
+        const FSBlockKey *bkey, const bool exists)
+{
+    int result;
+
+    if (exists) {
+        if ((result=remove_block(sync_ctx, bkey)) != 0) {
+            return result;
+        }
+    }
+    return write_record(sync_ctx, bkey, REPLICA_BINLOG_OP_TYPE_WRITE_SLICE);
+}
+
+//the same order with the entries in the range
+static inline int compare_block_key(const FSBlockKey *bkey1,
+        const FSBlockKey *bkey2)
+{
+    int sub;
+
+    if ((sub=fc_compare_int64(bkey1->oid, bkey2->oid)) != 0) {
+        return sub;
+    }
+    return fc_compare_int64(bkey1->offset, bkey2->offset);
+}
+
+/* merge the block digests of the master with the local sorted entries
+   of the range */
+static int sync_range(DigestSyncContext *sync_ctx, const int range_index)
+{
+    BlockDigestArray *array;
+    BlockDigestEntry *entry;
+    BlockDigestEntry *end;
+    FSProtoBlockDigest *part;
+    FSProtoBlockDigest *pend;
+    FSBlockKey bkey;
+    uint32_t digest;
+    int start_index;
+    int count;
+    int sub;
+    int result;
+    bool is_last;
+
+    array = &sync_ctx->local->array;
+    entry = array->entries + array->range_starts[range_index];
+    end = array->entries + array->range_starts[range_index + 1];
+    start_index = 0;
+    do {
+        if ((result=fetch_block_digests(sync_ctx, range_index,
+                        start_index, &part, &count, &is_last)) != 0)
+        {
+            return result;
+        }
+
+        pend = part + count;
+        for (; part<pend; part++) {
+            bkey.oid = buff2long(part->bkey.oid);
+            bkey.offset = buff2long(part->bkey.offset);
+            digest = buff2int(part->digest);
+
+            sub = 1;
+            while (entry < end && (sub=compare_block_key(
+                            &entry->bkey, &bkey)) < 0)
+            {
+                //the block not exist on the master
+                if ((result=remove_block(sync_ctx, &entry->bkey)) != 0) {
+                    return result;
+                }
+                entry++;
+            }
+
+            if (entry < end && sub == 0) {
+                if (entry->digest != digest) {
+                    result = copy_block(sync_ctx, &bkey, true);
+                } else {
+                    result = 0;
+                }
+                entry++;
+            } else {
+                result = copy_block(sync_ctx, &bkey, false);
+            }
+            if (result != 0) {
+                return result;
+            }
+        }
+
+        start_index += count;
+    } while (!is_last);
+
+    for (; entry<end; entry++) {
+        if ((result=remove_block(sync_ctx, &entry->bkey)) != 0) {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+static int sync_ranges(DigestSyncContext *sync_ctx)
+{
+    int result;
+    int range_index;
+
+    for (range_index=0; range_index<BLOCK_DIGEST_RANGE_COUNT;
+            range_index++)
+    {
+        if (sync_ctx->local->array.range_digests[range_index] ==
+                sync_ctx->range_digests[range_index])
+        {
+            continue;
+        }
+
+        sync_ctx->stat.ranges++;
+        if ((result=sync_range(sync_ctx, range_index)) != 0) {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+static int open_replay_binlog(DigestSyncContext *sync_ctx)
+{
+    char subdir_name[FS_BINLOG_SUBDIR_NAME_SIZE];
+    int result;
+
+    data_recovery_get_subdir_name(sync_ctx->ctx,
+            RECOVERY_BINLOG_SUBDIR_NAME_REPLAY, subdir_name);
+    binlog_reader_get_filename(subdir_name, 0, sync_ctx->writer.filename,
+            sizeof(sync_ctx->writer.filename));
+    if ((sync_ctx->writer.fp=fopen(sync_ctx->writer.filename,
+                    "wb")) == NULL)
+    {
+        result = errno != 0 ? errno : EPERM;
+        logError("file: "__FILE__", line: %d, "
+                "open file: %s to write fail, "
+                "errno: %d, error info: %s", __LINE__,
+                sync_ctx->writer.filename, result, STRERROR(result));
+        return result;
+    }
+
+    return 0;
+}
+
+static int close_replay_binlog(DigestSyncContext *sync_ctx)
+{
+    int result;
+
+    if (fclose(sync_ctx->writer.fp) != 0) {
+        result = errno != 0 ? errno : EIO;
+        logError("file: "__FILE__", line: %d, "
+                "close file: %s fail, errno: %d, error info: %s",
+                __LINE__, sync_ctx->writer.filename,
+                result, STRERROR(result));
+    } else {
+        result = 0;
+    }
+    sync_ctx->writer.fp = NULL;
+    return result;
+}
+
+static int do_sync_block_digests(DigestSyncContext *sync_ctx)
+{
+    int result;
+    uint64_t my_version;
+
+    if ((result=wait_digests_ready(sync_ctx)) != 0) {
+        return result;
+    }
+
+    my_version = sync_ctx->local->data_version;
+    if (sync_ctx->master_version <= my_version) {
+        return 0;
+    }
+
+    if ((result=open_replay_binlog(sync_ctx)) != 0) {
+        return result;
+    }
+
+    sync_ctx->current_version = my_version;
+    result = sync_ranges(sync_ctx);
+    if (close_replay_binlog(sync_ctx) != 0 && result == 0) {
+        result = EIO;
+    }
+    return result;
+}
+
+int data_recovery_sync_block_digests(DataRecoveryContext *ctx,
+        int64_t *binlog_count)
+{
+    DigestSyncContext *sync_ctx;
+    int64_t distance;
+    int64_t start_time;
+    char time_buff[32];
+    int result;
+
+    *binlog_count = 0;
+    if (RECOVERY_DIGEST_MIN_DISTANCE == 0) {
+        return 0;
+    }
+
+    distance = (int64_t)__sync_add_and_fetch(&ctx->master->data.version, 0)
+        - (int64_t)__sync_add_and_fetch(&ctx->ds->data.version, 0);
+    if (distance < RECOVERY_DIGEST_MIN_DISTANCE) {
+        return 0;
+    }
+
+    sync_ctx = (DigestSyncContext *)fc_malloc(sizeof(DigestSyncContext));
+    if (sync_ctx == NULL) {
+        return ENOMEM;
+    }
+    memset(sync_ctx, 0, sizeof(DigestSyncContext));
+    sync_ctx->ctx = ctx;
+    if ((sync_ctx->buffer=replication_callee_alloc_shared_buffer(
+                    ctx->server_ctx)) == NULL)
+    {
+        free(sync_ctx);
+        return ENOMEM;
+    }
+
+    logInfo("file: "__FILE__", line: %d, "
+            "data group id: %d, data version distance with the master: "
+            "%"PRId64", sync the block digests ...", __LINE__,
+            ctx->ds->dg->id, distance);
+
+    start_time = get_current_time_ms();
+    if ((result=fc_server_make_connection_ex(&REPLICA_GROUP_ADDRESS_ARRAY(
+                        ctx->master->cs->server), &sync_ctx->conn,
+                    SF_G_CONNECT_TIMEOUT, NULL, true)) == 0)
+    {
+        result = do_sync_block_digests(sync_ctx);
+        conn_pool_disconnect_server(&sync_ctx->conn);
+    }
+
+    if (sync_ctx->local != NULL) {
+        sync_ctx->local->canceled = true;
+        block_digest_session_release(sync_ctx->local);
+    }
+    shared_buffer_release(sync_ctx->buffer);
+
+    if (result == 0) {
+        *binlog_count = sync_ctx->stat.removes + sync_ctx->stat.writes;
+        if (*binlog_count > 0) {
+            ctx->fetch.last_data_version = sync_ctx->master_version;
+            ctx->fetch.last_bkey = sync_ctx->last_bkey;
+        }
+
+        long_to_comma_str(get_current_time_ms() - start_time, time_buff);
+        logInfo("file: "__FILE__", line: %d, "
+                "data group id: %d, sync the block digests done, "
+                "master data version: %"PRId64", different ranges: %d, "
+                "delete records: %"PRId64", write records: %"PRId64", "
+                "time used: %s ms", __LINE__, ctx->ds->dg->id,
+                sync_ctx->master_version, sync_ctx->stat.ranges,
+                sync_ctx->stat.removes, sync_ctx->stat.writes, time_buff);
+    } else if (SF_G_CONTINUE_FLAG) {
+        //the binlog fetch is always the last resort
+        logWarning("file: "__FILE__", line: %d, "
+                "data group id: %d, sync the block digests fail, "
+                "errno: %d, error info: %s, fall back to fetch the binlog",
+                __LINE__, ctx->ds->dg->id, result, (result == EOVERFLOW ?
+                    "the data versions are not enough" : STRERROR(result)));
+        result = 0;
+    }
+
+    if (*binlog_count == 0 && sync_ctx->writer.filename[0] != '\0') {
+        fc_delete_file(sync_ctx->writer.filename);
+    }
+
+    free(sync_ctx);
+    return result;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//digest_sync.h
+
+/* the recovery of the replica which falls far behind the master: compare
+ * the block digests with the master and write the replay binlog of the
+ * different blocks only, instead of fetching the long binlog. the data
+ * version is set to the master's when the digests built, the binlog after
+ * it is fetched as usual.
+ */
+
+#ifndef _DIGEST_SYNC_H_
+#define _DIGEST_SYNC_H_
+
+#include "recovery_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* write the replay binlog of the different blocks when the data version
+   distance with the master reaches recovery_digest_min_distance,
+   binlog_count is 0 for skipped or fallen back to the binlog fetch */
+int data_recovery_sync_block_digests(DataRecoveryContext *ctx,
+        int64_t *binlog_count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -46,7 +46,9 @@
 #include "cluster_topology.h"
 #include "cluster_relationship.h"
 #include "common_handler.h"
+#include "data_thread.h"
 #include "data_update_handler.h"
+#include "recovery/block_digest.h"
 #include "replica_handler.h"
 
 int replica_handler_init()
@@ -83,6 +85,17 @@ static inline void replica_release_reader(struct fast_task_info *task,
     SERVER_TASK_TYPE = SF_SERVER_TASK_TYPE_NONE;
 }
 
+static inline void replica_release_digest_session(
+        struct fast_task_info *task)
+{
+    if (REPLICA_DIGEST_SESSION != NULL) {
+        REPLICA_DIGEST_SESSION->canceled = true;
+        block_digest_session_release(REPLICA_DIGEST_SESSION);
+        REPLICA_DIGEST_SESSION = NULL;
+    }
+    SERVER_TASK_TYPE = SF_SERVER_TASK_TYPE_NONE;
+}
+
 int replica_recv_timeout_callback(struct fast_task_info *task)
 {
     if (SERVER_TASK_TYPE == FS_SERVER_TASK_TYPE_REPLICATION &&
@@ -136,6 +149,9 @@ void replica_task_finish_cleanup(struct fast_task_info *task)
             }
             replica_release_reader(task, true);
             break;
+        case FS_SERVER_TASK_TYPE_FETCH_DIGEST:
+            replica_release_digest_session(task);
+            break;
         default:
             break;
     }
@@ -410,6 +426,168 @@ static int replica_deal_fetch_binlog_next(struct fast_task_info *task)
     return replica_fetch_binlog_next_output(task);
 }
 
+static int replica_deal_fetch_range_digests(struct fast_task_info *task)
+{
+    FSProtoReplicaFetchRangeDigestsReq *req;
+    FSProtoReplicaFetchRangeDigestsRespHeader *resp;
+    FSClusterDataServerInfo *myself;
+    FSClusterDataServerInfo *peer;
+    BlockDigestSession *session;
+    char *p;
+    int data_group_id;
+    int server_id;
+    int body_len;
+    int result;
+    int i;
+
+    RESPONSE.header.cmd = FS_REPLICA_PROTO_FETCH_RANGE_DIGESTS_RESP;
+    if ((result=server_expect_body_length(task, sizeof(*req))) != 0) {
+        return result;
+    }
+
+    req = (FSProtoReplicaFetchRangeDigestsReq *)REQUEST.body;
+    data_group_id = buff2int(req->data_group_id);
+    server_id = buff2int(req->server_id);
+    if ((result=fetch_binlog_check_peer(task, data_group_id,
+                    server_id, &peer)) != 0)
+    {
+        return result;
+    }
+    if ((result=check_myself_master(task, data_group_id, &myself)) != 0) {
+        return result;
+    }
+
+    body_len = sizeof(*resp) + 4 * BLOCK_DIGEST_RANGE_COUNT;
+    if (body_len > task->size - sizeof(FSProtoHeader)) {
+        RESPONSE.error.length = sprintf(RESPONSE.error.message,
+                "response body length: %d > task buffer size: %d",
+                body_len, (int)(task->size - sizeof(FSProtoHeader)));
+        return EOVERFLOW;
+    }
+
+    if (SERVER_TASK_TYPE == SF_SERVER_TASK_TYPE_NONE) {
+        //the digests are built in the background, the slave polls
+        if ((session=block_digest_session_create(data_group_id,
+                        __sync_add_and_fetch(&myself->data.version, 0),
+                        &result)) == NULL)
+        {
+            RESPONSE.error.length = sprintf(RESPONSE.error.message,
+                    "create digest session fail, errno: %d, "
+                    "error info: %s", result, STRERROR(result));
+            return result;
+        }
+        REPLICA_DIGEST_SESSION = session;
+        SERVER_TASK_TYPE = FS_SERVER_TASK_TYPE_FETCH_DIGEST;
+    } else if (!(SERVER_TASK_TYPE == FS_SERVER_TASK_TYPE_FETCH_DIGEST &&
+                REPLICA_DIGEST_SESSION->data_group_id == data_group_id))
+    {
+        RESPONSE.error.length = sprintf(RESPONSE.error.message,
+                "already in progress. task type: %d", SERVER_TASK_TYPE);
+        return EALREADY;
+    }
+
+    session = REPLICA_DIGEST_SESSION;
+    resp = (FSProtoReplicaFetchRangeDigestsRespHeader *)REQUEST.body;
+    memset(resp, 0, sizeof(*resp));
+    if (__sync_add_and_fetch(&session->stage, 0) ==
+            BLOCK_DIGEST_STAGE_BUILDING)
+    {
+        resp->is_ready = 0;
+        body_len = sizeof(*resp);
+    } else if (session->result != 0) {
+        RESPONSE.error.length = sprintf(RESPONSE.error.message,
+                "build the block digests fail, errno: %d, error info: %s",
+                session->result, STRERROR(session->result));
+        return session->result;
+    } else {
+        resp->is_ready = 1;
+        long2buff(session->data_version, resp->data_version);
+        long2buff(session->array.count, resp->block_count);
+        int2buff(BLOCK_DIGEST_RANGE_COUNT, resp->range_count);
+        p = resp->digests;
+        for (i=0; i<BLOCK_DIGEST_RANGE_COUNT; i++) {
+            int2buff(session->array.range_digests[i], p);
+            p += 4;
+        }
+    }
+
+    RESPONSE.header.body_len = body_len;
+    TASK_ARG->context.response_done = true;
+    return 0;
+}
+
+static int replica_deal_fetch_block_digests(struct fast_task_info *task)
+{
+    FSProtoReplicaFetchBlockDigestsReq *req;
+    FSProtoReplicaFetchBlockDigestsRespHeader *resp;
+    FSProtoBlockDigest *part;
+    BlockDigestSession *session;
+    BlockDigestEntry *entry;
+    BlockDigestEntry *end;
+    int64_t remain;
+    int range_index;
+    int start_index;
+    int max_count;
+    int count;
+    int result;
+
+    RESPONSE.header.cmd = FS_REPLICA_PROTO_FETCH_BLOCK_DIGESTS_RESP;
+    if ((result=server_expect_body_length(task, sizeof(*req))) != 0) {
+        return result;
+    }
+
+    session = REPLICA_DIGEST_SESSION;
+    if (!(SERVER_TASK_TYPE == FS_SERVER_TASK_TYPE_FETCH_DIGEST &&
+                __sync_add_and_fetch(&session->stage, 0) ==
+                BLOCK_DIGEST_STAGE_DONE && session->result == 0))
+    {
+        RESPONSE.error.length = sprintf(RESPONSE.error.message,
+                "please send cmd %d (%s) until ready first",
+                FS_REPLICA_PROTO_FETCH_RANGE_DIGESTS_REQ,
+                fs_get_cmd_caption(FS_REPLICA_PROTO_FETCH_RANGE_DIGESTS_REQ));
+        return EINVAL;
+    }
+
+    req = (FSProtoReplicaFetchBlockDigestsReq *)REQUEST.body;
+    range_index = buff2int(req->range_index);
+    start_index = buff2int(req->start_index);
+    if (range_index < 0 || range_index >= BLOCK_DIGEST_RANGE_COUNT) {
+        RESPONSE.error.length = sprintf(RESPONSE.error.message,
+                "invalid range index: %d", range_index);
+        return EINVAL;
+    }
+
+    remain = block_digest_range_count(&session->array,
+            range_index) - start_index;
+    if (start_index < 0 || remain < 0) {
+        RESPONSE.error.length = sprintf(RESPONSE.error.message,
+                "invalid start index: %d", start_index);
+        return EINVAL;
+    }
+
+    max_count = (task->size - sizeof(FSProtoHeader) -
+            sizeof(*resp)) / sizeof(FSProtoBlockDigest);
+    count = FC_MIN(remain, max_count);
+    resp = (FSProtoReplicaFetchBlockDigestsRespHeader *)REQUEST.body;
+    int2buff(count, resp->count);
+    resp->is_last = (count == remain);
+
+    part = (FSProtoBlockDigest *)(resp + 1);
+    entry = session->array.entries + session->array.
+        range_starts[range_index] + start_index;
+    end = entry + count;
+    for (; entry<end; entry++, part++) {
+        long2buff(entry->bkey.oid, part->bkey.oid);
+        long2buff(entry->bkey.offset, part->bkey.offset);
+        int2buff(entry->digest, part->digest);
+    }
+
+    RESPONSE.header.body_len = sizeof(*resp) +
+        sizeof(FSProtoBlockDigest) * count;
+    TASK_ARG->context.response_done = true;
+    return 0;
+}
+
 static int replica_deal_active_confirm(struct fast_task_info *task)
 {
     FSProtoReplicaActiveConfirmReq *req;
@@ -568,24 +746,23 @@ static inline int replica_deal_active_test_req(struct fast_task_info *task)
     return sf_proto_deal_active_test(task, &REQUEST, &RESPONSE);
 }
 
-static int handle_rpc_req(struct fast_task_info *task, SharedBuffer *buffer,
-        const int count)
+/* check the body parts of the RPC request in the receive buffer,
+   and calculate the total body length of the slice writes */
+static int check_rpc_body_parts(struct fast_task_info *task,
+        const int count, int *write_bytes)
 {
     FSProtoReplicaRPCReqBodyPart *body_part;
-    FSSliceOpBufferContext *op_buffer_ctx;
-    FSSliceOpContext *op_ctx;
-    int result;
     int current_len;
     int last_index;
     int blen;
     int i;
 
-    TASK_CTX.which_side = FS_WHICH_SIDE_SLAVE;
+    *write_bytes = 0;
     last_index = count - 1;
     current_len = sizeof(FSProtoReplicaRPCReqBodyHeader);
     for (i=0; i<count; i++) {
         body_part = (FSProtoReplicaRPCReqBodyPart *)
-            (buffer->buff + current_len);
+            (REQUEST.body + current_len);
         blen = buff2int(body_part->body_len);
         if (blen <= 0) {
             RESPONSE.error.length = sprintf(RESPONSE.error.message,
@@ -610,61 +787,129 @@ static int handle_rpc_req(struct fast_task_info *task, SharedBuffer *buffer,
         }
 
         if (body_part->cmd == FS_SERVICE_PROTO_SLICE_WRITE_REQ) {
-            if ((op_buffer_ctx=replication_callee_alloc_op_buffer_ctx(
-                            SERVER_CTX)) == NULL)
-            {
-                return ENOMEM;
-            }
-
-            shared_buffer_hold(buffer);
-            op_buffer_ctx->buffer = buffer;
-            op_ctx = &op_buffer_ctx->op_ctx;
-        } else {
-            op_ctx = &SLICE_OP_CTX;
+            *write_bytes += blen;
         }
+    }
+
+    return 0;
+}
+
+static inline void free_op_buffer_ctx(struct fast_task_info *task,
+        FSSliceOpBufferContext *op_buffer_ctx)
+{
+    if (op_buffer_ctx->buffer != NULL) {
+        shared_buffer_release(op_buffer_ctx->buffer);
+    }
+    replication_callee_free_op_buffer_ctx(SERVER_CTX, op_buffer_ctx);
+}
+
+static int handle_rpc_body_part(struct fast_task_info *task,
+        SharedBuffer *buffer, FSProtoReplicaRPCReqBodyPart *body_part,
+        const int blen, int *buffer_len)
+{
+    FSSliceOpBufferContext *op_buffer_ctx;
+    FSSliceOpContext *op_ctx;
+    int result;
 
-        op_ctx->info.source = BINLOG_SOURCE_RPC;
-        op_ctx->info.data_version = buff2long(body_part->data_version);
-        if (op_ctx->info.data_version <= 0) {
+    if ((op_buffer_ctx=replication_callee_alloc_op_buffer_ctx(
+                    SERVER_CTX)) == NULL)
+    {
+        return ENOMEM;
+    }
+
+    op_ctx = &op_buffer_ctx->op_ctx;
+    if (body_part->cmd == FS_SERVICE_PROTO_SLICE_WRITE_REQ) {
+        shared_buffer_hold(buffer);
+        op_buffer_ctx->buffer = buffer;
+        op_ctx->info.body = buffer->buff + *buffer_len;
+        memcpy(op_ctx->info.body, body_part->body, blen);
+        *buffer_len += blen;
+    } else {
+        op_buffer_ctx->buffer = NULL;
+        op_ctx->info.body = body_part->body;
+    }
+
+    op_ctx->info.source = BINLOG_SOURCE_RPC;
+    op_ctx->info.data_version = buff2long(body_part->data_version);
+    if (op_ctx->info.data_version <= 0) {
+        RESPONSE.error.length = sprintf(RESPONSE.error.message,
+                "invalid data version: %"PRId64, op_ctx->info.data_version);
+        free_op_buffer_ctx(task, op_buffer_ctx);
+        return EINVAL;
+    }
+
+    op_ctx->info.body_len = blen;
+    switch (body_part->cmd) {
+        case FS_SERVICE_PROTO_SLICE_WRITE_REQ:
+            result = du_handler_deal_slice_write(task, op_ctx);
+            break;
+        case FS_SERVICE_PROTO_SLICE_ALLOCATE_REQ:
+            result = du_handler_deal_slice_allocate(task, op_ctx);
+            break;
+        case FS_SERVICE_PROTO_SLICE_DELETE_REQ:
+            result = du_handler_deal_slice_delete(task, op_ctx);
+            break;
+        case FS_SERVICE_PROTO_BLOCK_DELETE_REQ:
+            result = du_handler_deal_block_delete(task, op_ctx);
+            break;
+        default:
             RESPONSE.error.length = sprintf(RESPONSE.error.message,
-                    "invalid data version: %"PRId64, op_ctx->info.data_version);
+                    "unkown cmd: %d", body_part->cmd);
+            free_op_buffer_ctx(task, op_buffer_ctx);
             return EINVAL;
-        }
+    }
 
-        op_ctx->info.body = (char *)(body_part + 1);
-        op_ctx->info.body_len = blen;
-        switch (body_part->cmd) {
-            case FS_SERVICE_PROTO_SLICE_WRITE_REQ:
-                result = du_handler_deal_slice_write(task, op_ctx);
-                break;
-            case FS_SERVICE_PROTO_SLICE_ALLOCATE_REQ:
-                result = du_handler_deal_slice_allocate(task, op_ctx);
-                break;
-            case FS_SERVICE_PROTO_SLICE_DELETE_REQ:
-                result = du_handler_deal_slice_delete(task, op_ctx);
-                break;
-            case FS_SERVICE_PROTO_BLOCK_DELETE_REQ:
-                result = du_handler_deal_block_delete(task, op_ctx);
-                break;
-            default:
-                RESPONSE.error.length = sprintf(RESPONSE.error.message,
-                        "unkown cmd: %d", body_part->cmd);
-                return EINVAL;
+    if (result != TASK_STATUS_CONTINUE) {
+        int r;
+
+        r = replication_callee_push_to_rpc_result_queue(
+                REPLICA_REPLICATION, op_ctx->info.data_group_id,
+                op_ctx->info.data_version, result);
+        free_op_buffer_ctx(task, op_buffer_ctx);
+        if (r != 0) {
+            return r;
         }
+    }
 
-        if (result != TASK_STATUS_CONTINUE) {
-            int r;
+    return 0;
+}
 
-            r = replication_callee_push_to_rpc_result_queue(
-                    REPLICA_REPLICATION, op_ctx->info.data_group_id,
-                    op_ctx->info.data_version, result);
-            if (r != 0) {
-                return r;
-            }
+/* the body parts are parsed in the receive buffer directly, only the
+   bodies of the slice writes are copied to the shared buffer because
+   they are accessed by the trunk write threads after the task buffer
+   is reused for the next request.
+
+   each op has its own context, and the ops are collected by the data
+   thread and dispatched at the end, one queue push per data thread */
+static int handle_rpc_req(struct fast_task_info *task, SharedBuffer *buffer,
+        const int count)
+{
+    FSProtoReplicaRPCReqBodyPart *body_part;
+    int result;
+    int current_len;
+    int buffer_len;
+    int blen;
+    int i;
+
+    TASK_CTX.which_side = FS_WHICH_SIDE_SLAVE;
+    current_len = sizeof(FSProtoReplicaRPCReqBodyHeader);
+    buffer_len = 0;
+    result = 0;
+    data_thread_batch_begin(&SERVER_CTX->replica.op_batch);
+    for (i=0; i<count; i++) {
+        body_part = (FSProtoReplicaRPCReqBodyPart *)
+            (REQUEST.body + current_len);
+        blen = buff2int(body_part->body_len);
+        current_len += sizeof(*body_part) + blen;
+        if ((result=handle_rpc_body_part(task, buffer, body_part,
+                        blen, &buffer_len)) != 0)
+        {
+            break;
         }
     }
+    data_thread_batch_commit(&SERVER_CTX->replica.op_batch);
 
-    return 0;
+    return result;
 }
 
 static int replica_deal_rpc_req(struct fast_task_info *task)
@@ -674,6 +919,7 @@ static int replica_deal_rpc_req(struct fast_task_info *task)
     int result;
     int min_body_len;
     int count;
+    int write_bytes;
 
     if ((result=replica_check_replication_task(task)) != 0) {
         return result;
@@ -703,11 +949,18 @@ static int replica_deal_rpc_req(struct fast_task_info *task)
         return EINVAL;
     }
 
+    if ((result=check_rpc_body_parts(task, count, &write_bytes)) != 0) {
+        return result;
+    }
+
+    if (write_bytes == 0) {  //no slice write, the buffer is NOT needed
+        return handle_rpc_req(task, NULL, count);
+    }
+
     if ((buffer=replication_callee_alloc_shared_buffer(SERVER_CTX)) == NULL) {
         return ENOMEM;
     }
 
-    memcpy(buffer->buff, REQUEST.body, task->length - sizeof(FSProtoHeader));
     result = handle_rpc_req(task, buffer, count);
     shared_buffer_release(buffer);
 
@@ -844,6 +1097,12 @@ int replica_deal_task(struct fast_task_info *task, const int stage)
             case FS_REPLICA_PROTO_ACTIVE_CONFIRM_REQ:
                 result = replica_deal_active_confirm(task);
                 break;
+            case FS_REPLICA_PROTO_FETCH_RANGE_DIGESTS_REQ:
+                result = replica_deal_fetch_range_digests(task);
+                break;
+            case FS_REPLICA_PROTO_FETCH_BLOCK_DIGESTS_REQ:
+                result = replica_deal_fetch_block_digests(task);
+                break;
             default:
                 RESPONSE.error.length = sprintf(RESPONSE.error.message,
                         "unkown cmd: %d", REQUEST.header.cmd);
@@ -36,6 +36,7 @@
 #include "../server_global.h"
 #include "../server_group_info.h"
 #include "../storage/slice_op.h"
+#include "../data_thread.h"
 #include "replication_processor.h"
 #include "rpc_result_ring.h"
 #include "replication_callee.h"
@@ -87,6 +88,12 @@ int replication_callee_init_allocator(FSServerContext *server_context)
         return result;
     }
 
+    if ((result=data_thread_batch_init(&server_context->
+                    replica.op_batch)) != 0)
+    {
+        return result;
+    }
+
     return 0;
 }
 
@@ -118,16 +118,6 @@ static int push_to_slave_queues(FSClusterDataGroupInfo *group,
     end = group->slave_ds_array.servers + group->slave_ds_array.count;
     for (ds=group->slave_ds_array.servers; ds<end; ds++) {
         status = __sync_fetch_and_add(&(*ds)->status, 0);
-        if (status == FS_SERVER_STATUS_ONLINE) {  //waiting for status change
-            do {
-                PTHREAD_MUTEX_LOCK(&(*ds)->replica.notify.lock);
-                pthread_cond_wait(&(*ds)->replica.notify.cond,
-                        &(*ds)->replica.notify.lock);
-                PTHREAD_MUTEX_UNLOCK(&(*ds)->replica.notify.lock);
-                status = __sync_fetch_and_add(&(*ds)->status, 0);
-            } while (status == FS_SERVER_STATUS_ONLINE && SF_G_CONTINUE_FLAG);
-        }
-
         if (status != FS_SERVER_STATUS_ACTIVE) {
             inactive_count++;
             continue;
@@ -143,10 +133,12 @@ static int push_to_slave_queues(FSClusterDataGroupInfo *group,
         push_to_slave_replica_queue(replication, rpc);
     }
 
-    if (inactive_count > 0) {
-        __sync_sub_and_fetch(&rpc->reffer_count, inactive_count);
+    if (inactive_count == 0) {
+        /* the last rpc done will notify the data thread */
+        return TASK_STATUS_CONTINUE;
     }
 
+    __sync_sub_and_fetch(&rpc->reffer_count, inactive_count);
     if (__sync_sub_and_fetch(&((FSServerTaskArg *)rpc->task->arg)->
                 context.service.waiting_rpc_count, inactive_count) == 0)
     {
@@ -156,6 +148,23 @@ static int push_to_slave_queues(FSClusterDataGroupInfo *group,
     }
 }
 
+static inline bool has_online_slave(FSClusterDataGroupInfo *group)
+{
+    FSClusterDataServerInfo **ds;
+    FSClusterDataServerInfo **end;
+
+    end = group->slave_ds_array.servers + group->slave_ds_array.count;
+    for (ds=group->slave_ds_array.servers; ds<end; ds++) {
+        if (__sync_fetch_and_add(&(*ds)->status, 0) ==
+                FS_SERVER_STATUS_ONLINE)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 int replication_caller_push_to_slave_queues(struct fast_task_info *task)
 {
     FSClusterDataGroupInfo *group;
@@ -170,6 +179,12 @@ int replication_caller_push_to_slave_queues(struct fast_task_info *task)
         return 0;
     }
 
+    /* the slave in ONLINE status becomes ACTIVE soon, the caller
+       retries after the status changed instead of waiting here */
+    if (has_online_slave(group)) {
+        return EAGAIN;
+    }
+
     if ((rpc=replication_caller_alloc_rpc_entry()) == NULL) {
         return ENOMEM;
     }
@@ -29,6 +29,8 @@ void replication_caller_destroy();
 
 void replication_caller_release_rpc_entry(ReplicationRPCEntry *rpc);
 
+/* return TASK_STATUS_CONTINUE for waiting the slaves to replicate,
+   EAGAIN when some slave in ONLINE status, without blocking */
 int replication_caller_push_to_slave_queues(struct fast_task_info *task);
 
 #ifdef __cplusplus
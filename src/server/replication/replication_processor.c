@@ -333,7 +333,7 @@ static void decrease_task_waiting_rpc_count(ReplicationRPCEntry *rb)
     if (__sync_sub_and_fetch(&task_arg->context.service.
                 waiting_rpc_count, 1) == 0)
     {
-        data_thread_notify(task_arg->context.slice_op_ctx.data_thread_ctx);
+        data_thread_notify(&task_arg->context.slice_op_ctx);
         //sf_nio_notify(rb->task, SF_NIO_STAGE_CONTINUE);
     }
 }
@@ -514,11 +514,12 @@ static int replication_rpc_from_queue(FSReplication *replication)
             context.slice_op_ctx.info.data_group_id;
         data_version = ((FSServerTaskArg *)rb->task->arg)->
             context.slice_op_ctx.info.data_version;
-        memcpy(body_part->body, rb->task->data +
-                rb->body_offset, rb->body_length);
         if (rb->task_version == ((FSServerTaskArg *)
                     rb->task->arg)->task_version)
         {
+            //copy the body only when the task is still valid
+            memcpy(body_part->body, rb->task->data +
+                    rb->body_offset, rb->body_length);
             ++count;
             task->length = pkg_len;
             long2buff(data_version, body_part->data_version);
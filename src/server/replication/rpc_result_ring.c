@@ -113,7 +113,7 @@ static inline void desc_task_waiting_rpc_count(
                     entry->waiting_task->arg)->context.
                 service.waiting_rpc_count, 1) == 0)
     {
-        data_thread_notify(task_arg->context.slice_op_ctx.data_thread_ctx);
+        data_thread_notify(&task_arg->context.slice_op_ctx);
         //sf_nio_notify(entry->waiting_task, SF_NIO_STAGE_CONTINUE);
     }
 }
@@ -31,6 +31,7 @@
 #include "server_binlog.h"
 #include "binlog/binlog_check.h"
 #include "binlog/binlog_repair.h"
+#include "binlog/binlog_sync.h"
 
 static int do_binlog_check()
 {
@@ -76,7 +77,11 @@ int server_binlog_init()
         return result;
     }
 
-	return do_binlog_check();
+    if ((result=do_binlog_check()) != 0) {
+        return result;
+    }
+
+    return binlog_sync_init();
 }
 
 void server_binlog_destroy()
@@ -193,18 +193,24 @@ static void server_log_configs()
 
     snprintf(sz_server_config, sizeof(sz_server_config),
             "my server id = %d, data_path = %s, data_threads = %d, "
+            "data_thread_queue_depth = %d, "
+            "data_write_merge_max_bytes = %d KB, "
             "replica_channels_between_two_servers = %d, "
             "recovery_threads_per_data_group = %d, "
             "recovery_max_queue_depth = %d, "
+            "recovery_digest_min_distance = %"PRId64", "
             "binlog_buffer_size = %d KB, "
             "local_binlog_check_last_seconds = %d s, "
             "slave_binlog_check_last_rows = %d, "
             "cluster server count = %d, "
             "idempotency_max_channel_count: %d",
             CLUSTER_MY_SERVER_ID, DATA_PATH_STR, DATA_THREAD_COUNT,
+            DATA_THREAD_QUEUE_DEPTH,
+            DATA_WRITE_MERGE_MAX_BYTES / 1024,
             REPLICA_CHANNELS_BETWEEN_TWO_SERVERS,
             RECOVERY_THREADS_PER_DATA_GROUP,
             RECOVERY_MAX_QUEUE_DEPTH,
+            RECOVERY_DIGEST_MIN_DISTANCE,
             BINLOG_BUFFER_SIZE / 1024,
             LOCAL_BINLOG_CHECK_LAST_SECONDS,
             SLAVE_BINLOG_CHECK_LAST_ROWS,
@@ -243,6 +249,33 @@ static int load_binlog_buffer_size(IniContext *ini_context,
     return 0;
 }
 
+static int load_write_merge_max_bytes(IniContext *ini_context,
+        const char *filename)
+{
+    int64_t bytes;
+    int result;
+
+    if ((result=get_bytes_item_config(ini_context, filename,
+                    "data_write_merge_max_bytes",
+                    FS_DEFAULT_DATA_WRITE_MERGE_MAX_BYTES, &bytes)) != 0)
+    {
+        return result;
+    }
+    if (bytes <= 0) {
+        DATA_WRITE_MERGE_MAX_BYTES = 0;
+    } else if (bytes > FS_FILE_BLOCK_SIZE) {
+        logWarning("file: "__FILE__", line: %d, "
+                "config file: %s , data_write_merge_max_bytes: %"PRId64
+                " is too large, set it to block size: %d", __LINE__,
+                filename, bytes, FS_FILE_BLOCK_SIZE);
+        DATA_WRITE_MERGE_MAX_BYTES = FS_FILE_BLOCK_SIZE;
+    } else {
+        DATA_WRITE_MERGE_MAX_BYTES = bytes;
+    }
+
+    return 0;
+}
+
 static int load_storage_cfg(IniContext *ini_context, const char *filename)
 {
     char *storage_config_filename;
@@ -307,6 +340,16 @@ int server_load_config(const char *filename)
         DATA_THREAD_COUNT = FS_DEFAULT_DATA_THREAD_COUNT;
     }
 
+    DATA_THREAD_QUEUE_DEPTH = iniGetIntValue(NULL, "data_thread_queue_depth",
+            &ini_context, FS_DEFAULT_DATA_THREAD_QUEUE_DEPTH);
+    if (DATA_THREAD_QUEUE_DEPTH <= 0) {
+        DATA_THREAD_QUEUE_DEPTH = FS_DEFAULT_DATA_THREAD_QUEUE_DEPTH;
+    }
+
+    if ((result=load_write_merge_max_bytes(&ini_context, filename)) != 0) {
+        return result;
+    }
+
     REPLICA_CHANNELS_BETWEEN_TWO_SERVERS = iniGetIntValue(NULL,
             "replica_channels_between_two_servers",
             &ini_context, FS_DEFAULT_REPLICA_CHANNELS_BETWEEN_TWO_SERVERS);
@@ -331,6 +374,12 @@ int server_load_config(const char *filename)
             FS_DEFAULT_RECOVERY_MAX_QUEUE_DEPTH;
     }
 
+    RECOVERY_DIGEST_MIN_DISTANCE = iniGetInt64Value(NULL,
+            "recovery_digest_min_distance", &ini_context, 0);
+    if (RECOVERY_DIGEST_MIN_DISTANCE < 0) {
+        RECOVERY_DIGEST_MIN_DISTANCE = 0;
+    }
+
     LOCAL_BINLOG_CHECK_LAST_SECONDS = iniGetIntValue(NULL,
             "local_binlog_check_last_seconds", &ini_context,
             FS_DEFAULT_LOCAL_BINLOG_CHECK_LAST_SECONDS);
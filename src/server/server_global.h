@@ -47,6 +47,8 @@ typedef struct server_global_vars {
     struct {
         string_t path;   //data path
         int thread_count;
+        int thread_queue_depth;
+        int write_merge_max_bytes;  //0 for never merge the writes
         int binlog_buffer_size;
         int local_binlog_check_last_seconds;
         int slave_binlog_check_last_rows;
@@ -60,6 +62,7 @@ typedef struct server_global_vars {
         int channels_between_two_servers;
         int recovery_threads_per_data_group;
         int recovery_max_queue_depth;
+        int64_t recovery_digest_min_distance;
         int active_test_interval;   //round(nework_timeout / 2)
         SFContext sf_context;       //for replica communication
     } replica;
@@ -97,6 +100,9 @@ typedef struct server_global_vars {
 #define NEXT_TASK_VERSION     g_server_global_vars.next_task_version
 
 #define DATA_THREAD_COUNT     g_server_global_vars.data.thread_count
+#define DATA_THREAD_QUEUE_DEPTH g_server_global_vars.data.thread_queue_depth
+#define DATA_WRITE_MERGE_MAX_BYTES \
+    g_server_global_vars.data.write_merge_max_bytes
 #define BINLOG_BUFFER_SIZE    g_server_global_vars.data.binlog_buffer_size
 #define DATA_PATH             g_server_global_vars.data.path
 #define DATA_PATH_STR         DATA_PATH.str
@@ -111,6 +117,9 @@ typedef struct server_global_vars {
 #define RECOVERY_MAX_QUEUE_DEPTH \
     g_server_global_vars.replica.recovery_max_queue_depth
 
+#define RECOVERY_DIGEST_MIN_DISTANCE \
+    g_server_global_vars.replica.recovery_digest_min_distance
+
 #define FS_DATA_GROUP_ID(bkey) (FS_BLOCK_HASH_CODE(bkey) % \
        FS_DATA_GROUP_COUNT(CLUSTER_CONFIG_CTX) + 1)
 
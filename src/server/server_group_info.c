@@ -138,9 +138,6 @@ static int init_cluster_data_server_array(FSClusterDataGroupInfo *group)
         if ((result=init_pthread_lock(&ds->data.lock)) != 0) {
             return result;
         }
-        if ((result=init_pthread_lock_cond_pair(&ds->replica.notify)) != 0) {
-            return result;
-        }
         if ((result=add_to_ds_ptr_array(&ds->cs->ds_ptr_array, ds)) != 0) {
             return result;
         }
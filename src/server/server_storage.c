@@ -44,6 +44,14 @@ int server_storage_init()
         return result;
     }
 
+    if ((result=ob_index_setup_rcu_reclaim_task()) != 0) {
+        return result;
+    }
+
+    if ((result=block_defrag_init()) != 0) {
+        return result;
+    }
+
 	return 0;
 }
 
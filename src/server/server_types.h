@@ -47,6 +47,7 @@
 #define FS_SERVER_TASK_TYPE_RELATIONSHIP        1   //slave  -> master
 #define FS_SERVER_TASK_TYPE_FETCH_BINLOG        2   //slave  -> master
 #define FS_SERVER_TASK_TYPE_REPLICATION         3
+#define FS_SERVER_TASK_TYPE_FETCH_DIGEST        4   //slave  -> master
 
 #define FS_REPLICATION_STAGE_NONE               0
 #define FS_REPLICATION_STAGE_INITED             1
@@ -59,9 +60,11 @@
 #define FS_CLUSTER_DELAY_DECISION_SELECT_MASTER 2
 
 #define FS_DEFAULT_DATA_THREAD_COUNT                     8
+#define FS_DEFAULT_DATA_THREAD_QUEUE_DEPTH              64
+#define FS_DEFAULT_DATA_WRITE_MERGE_MAX_BYTES   (256 * 1024)
 #define FS_DEFAULT_REPLICA_CHANNELS_BETWEEN_TWO_SERVERS  2
 #define FS_DEFAULT_RECOVERY_THREADS_PER_DATA_GROUP       2
-#define FS_DEFAULT_RECOVERY_MAX_QUEUE_DEPTH              2
+#define FS_DEFAULT_RECOVERY_MAX_QUEUE_DEPTH              4
 #define FS_DEFAULT_LOCAL_BINLOG_CHECK_LAST_SECONDS       3
 #define FS_DEFAULT_SLAVE_BINLOG_CHECK_LAST_ROWS          3
 #define FS_MAX_SLAVE_BINLOG_CHECK_LAST_ROWS            128
@@ -74,6 +77,17 @@
 #define FS_DISCARD_REMAIN_SPACE_MIN_SIZE       256
 #define FS_DISCARD_REMAIN_SPACE_MAX_SIZE      (256 * 1024)
 
+#define FS_DEFAULT_RECLAIM_MAX_BYTES_PER_SECOND  (64 * 1024 * 1024)
+
+#define FS_DEFAULT_DEFRAG_MIN_SLICES              64
+#define FS_DEFAULT_DEFRAG_MAX_BYTES_PER_SECOND   (16 * 1024 * 1024)
+
+#define FS_DEFAULT_READ_MERGE_MAX_GAP  (64 * 1024)
+#define FS_READ_MERGE_MAX_GAP_LIMIT    (1024 * 1024)
+
+#define FS_DEFAULT_FSYNC_INTERVAL       1000  //in ms
+#define FS_DEFAULT_FSYNC_GROUP_WINDOW   1     //in ms
+
 #define TASK_STATUS_CONTINUE   12345
 
 #define FS_WHICH_SIDE_MASTER    'M'
@@ -99,9 +113,11 @@
 #define CLUSTER_PEER         TASK_CTX.shared.cluster.peer
 #define REPLICA_REPLICATION  TASK_CTX.shared.replica.replication
 #define REPLICA_READER       TASK_CTX.shared.replica.reader
+#define REPLICA_DIGEST_SESSION  TASK_CTX.shared.replica.digest_session
 #define IDEMPOTENCY_CHANNEL  TASK_CTX.shared.service.idempotency_channel
 #define IDEMPOTENCY_REQUEST  TASK_CTX.service.idempotency_request
 #define WAITING_RPC_COUNT    TASK_CTX.service.waiting_rpc_count
+#define BATCH_READ_CTX       TASK_CTX.service.batch_read
 #define SERVER_TASK_TYPE  TASK_CTX.task_type
 #define SLICE_OP_CTX      TASK_CTX.slice_op_ctx
 #define OP_CTX_INFO       TASK_CTX.slice_op_ctx.info
@@ -194,7 +210,6 @@ typedef struct fs_cluster_data_server_info {
     } recovery;
 
     struct {
-        pthread_lock_cond_pair_t notify; //lock and waiting for slave status change
         uint64_t rpc_start_version;      //for slave check data version
     } replica;
 
@@ -319,6 +334,7 @@ typedef struct {
             union {
                 FSReplication *replication;
                 struct server_binlog_reader *reader;  //for fetch binlog
+                struct block_digest_session *digest_session;  //for fetch digest
             };
         } replica;
     } shared;
@@ -326,6 +342,13 @@ typedef struct {
     struct {
         struct idempotency_request *idempotency_request;
         volatile int waiting_rpc_count;
+
+        struct {
+            FSSliceOpContext *op_ctxs;  //reused by the requests of the task
+            int alloc;
+            int count;
+            volatile int waiting_count;
+        } batch_read;
     } service;
 
     int which_side;   //master or slave
@@ -340,6 +363,18 @@ typedef struct server_task_arg {
 } FSServerTaskArg;
 
 
+struct fs_data_operation;
+typedef struct fs_data_operation_chain {
+    struct fs_data_operation *head;
+    struct fs_data_operation *tail;
+} FSDataOperationChain;
+
+//collect the operations by the data thread, then dispatch them at once
+typedef struct fs_data_operation_batch {
+    bool in_progress;
+    FSDataOperationChain *chains;  //indexed by the data thread
+} FSDataOperationBatch;
+
 struct ob_slice_ptr_array;
 typedef struct fs_server_context {
     union {
@@ -356,6 +391,7 @@ typedef struct fs_server_context {
             FSReplicationPtrArray connected;
             struct fast_mblock_man op_ctx_allocator; //for slice op buffer context
             SharedBufferContext shared_buffer_ctx;
+            FSDataOperationBatch op_batch;  //for the ops of the RPC request
         } replica;
     };
 
@@ -47,6 +47,7 @@
 #include "server_func.h"
 #include "server_group_info.h"
 #include "server_storage.h"
+#include "dio/trunk_io_thread.h"
 #include "data_thread.h"
 #include "common_handler.h"
 #include "data_update_handler.h"
@@ -65,6 +66,22 @@ int service_handler_destroy()
     return 0;
 }
 
+static void batch_read_free_ctxs(struct fast_task_info *task)
+{
+    FSSliceOpContext *op_ctx;
+    FSSliceOpContext *end;
+
+    end = BATCH_READ_CTX.op_ctxs + BATCH_READ_CTX.alloc;
+    for (op_ctx=BATCH_READ_CTX.op_ctxs; op_ctx<end; op_ctx++) {
+        ob_index_free_slice_ptr_array(&op_ctx->slice_ptr_array);
+        fs_free_read_iovecs(op_ctx);
+    }
+
+    free(BATCH_READ_CTX.op_ctxs);
+    BATCH_READ_CTX.op_ctxs = NULL;
+    BATCH_READ_CTX.alloc = BATCH_READ_CTX.count = 0;
+}
+
 void service_task_finish_cleanup(struct fast_task_info *task)
 {
     switch (SERVER_TASK_TYPE) {
@@ -93,6 +110,10 @@ void service_task_finish_cleanup(struct fast_task_info *task)
                 SERVER_TASK_TYPE, IDEMPOTENCY_CHANNEL);
     }
 
+    if (BATCH_READ_CTX.op_ctxs != NULL) {
+        batch_read_free_ctxs(task);
+    }
+
     ((FSServerTaskArg *)task->arg)->task_version =
         __sync_add_and_fetch(&NEXT_TASK_VERSION, 1);
     sf_task_finish_clean_up(task);
@@ -261,6 +282,207 @@ static int service_deal_slice_read(struct fast_task_info *task)
     return TASK_STATUS_CONTINUE;
 }
 
+static int batch_read_check_alloc(struct fast_task_info *task,
+        const int count)
+{
+    FSSliceOpContext *op_ctxs;
+    int alloc;
+    int bytes;
+
+    if (BATCH_READ_CTX.alloc >= count) {
+        return 0;
+    }
+
+    alloc = (BATCH_READ_CTX.alloc > 0) ? BATCH_READ_CTX.alloc : 16;
+    while (alloc < count) {
+        alloc *= 2;
+    }
+
+    bytes = sizeof(FSSliceOpContext) * alloc;
+    op_ctxs = (FSSliceOpContext *)fc_malloc(bytes);
+    if (op_ctxs == NULL) {
+        return ENOMEM;
+    }
+    memset(op_ctxs, 0, bytes);
+
+    //keep the buffers of the old contexts for reusing
+    if (BATCH_READ_CTX.op_ctxs != NULL) {
+        memcpy(op_ctxs, BATCH_READ_CTX.op_ctxs, sizeof(FSSliceOpContext) *
+                BATCH_READ_CTX.alloc);
+        free(BATCH_READ_CTX.op_ctxs);
+    }
+
+    BATCH_READ_CTX.op_ctxs = op_ctxs;
+    BATCH_READ_CTX.alloc = alloc;
+    return 0;
+}
+
+static void batch_read_fill_response(struct fast_task_info *task)
+{
+    FSProtoBatchSliceReadRespBodyHeader *body_header;
+    FSProtoBatchSliceReadRespBodyPart *body_part;
+    FSSliceOpContext *op_ctx;
+    FSSliceOpContext *end;
+    char *data;
+    int read_bytes;
+
+    body_header = (FSProtoBatchSliceReadRespBodyHeader *)REQUEST.body;
+    body_part = (FSProtoBatchSliceReadRespBodyPart *)(body_header + 1);
+    data = (char *)(body_part + BATCH_READ_CTX.count);
+    end = BATCH_READ_CTX.op_ctxs + BATCH_READ_CTX.count;
+    for (op_ctx=BATCH_READ_CTX.op_ctxs; op_ctx<end; op_ctx++, body_part++) {
+        if (op_ctx->result != 0) {
+            if (op_ctx->result != ENOENT) {
+                logError("file: "__FILE__", line: %d, "
+                        "client ip: %s, batch read slice fail, "
+                        "oid: %"PRId64", block offset: %"PRId64", "
+                        "slice offset: %d, length: %d, "
+                        "errno: %d, error info: %s",
+                        __LINE__, task->client_ip,
+                        op_ctx->info.bs_key.block.oid,
+                        op_ctx->info.bs_key.block.offset,
+                        op_ctx->info.bs_key.slice.offset,
+                        op_ctx->info.bs_key.slice.length,
+                        op_ctx->result, STRERROR(op_ctx->result));
+            }
+            read_bytes = 0;
+        } else {
+            read_bytes = op_ctx->done_bytes;
+        }
+
+        //compact the data of the slices which read to their own slots
+        if (read_bytes > 0 && op_ctx->info.buff != data) {
+            memmove(data, op_ctx->info.buff, read_bytes);
+        }
+        data += read_bytes;
+
+        int2buff(op_ctx->result, body_part->result);
+        int2buff(read_bytes, body_part->read_bytes);
+    }
+
+    int2buff(BATCH_READ_CTX.count, body_header->count);
+    RESPONSE.header.cmd = FS_SERVICE_PROTO_BATCH_SLICE_READ_RESP;
+    RESPONSE.header.body_len = data - REQUEST.body;
+    RESPONSE_STATUS = 0;
+    TASK_ARG->context.response_done = true;
+    sf_nio_notify(task, SF_NIO_STAGE_CONTINUE);
+}
+
+static inline void batch_read_one_done(struct fast_task_info *task)
+{
+    if (__sync_sub_and_fetch(&BATCH_READ_CTX.waiting_count, 1) == 0) {
+        batch_read_fill_response(task);
+    }
+}
+
+static void batch_slice_read_done_notify(FSDataOperation *op)
+{
+    batch_read_one_done((struct fast_task_info *)op->arg);
+}
+
+static int service_deal_batch_slice_read(struct fast_task_info *task)
+{
+    int result;
+    int count;
+    int expect_len;
+    int64_t total_bytes;
+    FSProtoBatchSliceReadReqHeader *req_header;
+    FSSliceOpContext *op_ctx;
+    FSSliceOpContext *end;
+    char *data;
+
+    RESPONSE.header.cmd = FS_SERVICE_PROTO_BATCH_SLICE_READ_RESP;
+    if ((result=server_check_min_body_length(task,
+                    sizeof(FSProtoBatchSliceReadReqHeader) +
+                    sizeof(FSProtoBlockSlice))) != 0)
+    {
+        return result;
+    }
+
+    req_header = (FSProtoBatchSliceReadReqHeader *)REQUEST.body;
+    count = buff2int(req_header->count);
+    if (count <= 0 || count > FS_PROTO_MAX_BATCH_SLICES) {
+        RESPONSE.error.length = sprintf(RESPONSE.error.message,
+                "invalid slice count: %d, which <= 0 or > %d",
+                count, FS_PROTO_MAX_BATCH_SLICES);
+        return EINVAL;
+    }
+
+    expect_len = sizeof(FSProtoBatchSliceReadReqHeader) +
+        sizeof(FSProtoBlockSlice) * count;
+    if (REQUEST.header.body_len != expect_len) {
+        RESPONSE.error.length = sprintf(RESPONSE.error.message,
+                "request body length: %d != expect: %d, slice count: %d",
+                REQUEST.header.body_len, expect_len, count);
+        return EINVAL;
+    }
+
+    if ((result=batch_read_check_alloc(task, count)) != 0) {
+        RESPONSE.error.length = sprintf(RESPONSE.error.message,
+                "alloc %d slice op contexts fail", count);
+        return result;
+    }
+
+    //parse all slices before the request body overwritten by the data
+    total_bytes = 0;
+    end = BATCH_READ_CTX.op_ctxs + count;
+    for (op_ctx=BATCH_READ_CTX.op_ctxs; op_ctx<end; op_ctx++) {
+        if ((result=du_handler_parse_check_block_slice(task, op_ctx,
+                        req_header->slices + (op_ctx - BATCH_READ_CTX.
+                            op_ctxs), false)) != 0)
+        {
+            return result;
+        }
+
+        if (op_ctx->info.data_group_id != BATCH_READ_CTX.
+                op_ctxs[0].info.data_group_id)
+        {
+            RESPONSE.error.length = sprintf(RESPONSE.error.message,
+                    "slice index: %d, data group id: %d != the first "
+                    "slice: %d, the slices should be in one data group",
+                    (int)(op_ctx - BATCH_READ_CTX.op_ctxs),
+                    op_ctx->info.data_group_id, BATCH_READ_CTX.
+                    op_ctxs[0].info.data_group_id);
+            return EINVAL;
+        }
+        total_bytes += op_ctx->info.bs_key.slice.length;
+    }
+
+    if (sizeof(FSProtoBatchSliceReadRespBodyHeader) + count * sizeof(
+                FSProtoBatchSliceReadRespBodyPart) + total_bytes >
+            task->size - sizeof(FSProtoHeader))
+    {
+        RESPONSE.error.length = sprintf(RESPONSE.error.message,
+                "read slices count: %d, total length: %"PRId64
+                " exceeds task buffer size: %d", count, total_bytes,
+                (int)(task->size - sizeof(FSProtoHeader)));
+        return EOVERFLOW;
+    }
+
+    data = REQUEST.body + sizeof(FSProtoBatchSliceReadRespBodyHeader) +
+        count * sizeof(FSProtoBatchSliceReadRespBodyPart);
+    for (op_ctx=BATCH_READ_CTX.op_ctxs; op_ctx<end; op_ctx++) {
+        op_ctx->info.buff = data;
+        op_ctx->notify_func = batch_slice_read_done_notify;
+        op_ctx->result = 0;
+        op_ctx->done_bytes = 0;
+        data += op_ctx->info.bs_key.slice.length;
+    }
+
+    BATCH_READ_CTX.count = count;
+    BATCH_READ_CTX.waiting_count = count;
+    for (op_ctx=BATCH_READ_CTX.op_ctxs; op_ctx<end; op_ctx++) {
+        if ((result=push_to_data_thread_queue(DATA_OPERATION_SLICE_READ,
+                        DATA_SOURCE_MASTER_SERVICE, task, op_ctx)) != 0)
+        {
+            op_ctx->result = result;
+            batch_read_one_done(task);
+        }
+    }
+
+    return TASK_STATUS_CONTINUE;
+}
+
 static int service_deal_get_master(struct fast_task_info *task)
 {
     int result;
@@ -551,6 +773,63 @@ static int service_deal_disk_space_stat(struct fast_task_info *task)
     return 0;
 }
 
+//the IO stats of the classes per store path of this server
+static int service_deal_io_stat(struct fast_task_info *task)
+{
+    int result;
+    int path_index;
+    int io_class;
+    FSProtoIOStatRespBodyHeader *body_header;
+    FSProtoIOStatRespBodyPart *part_start;
+    FSProtoIOStatRespBodyPart *body_part;
+    TrunkIOClassStat stats[FS_IO_CLASS_COUNT];
+
+    if ((result=server_expect_body_length(task, 0)) != 0) {
+        return result;
+    }
+
+    if (sizeof(FSProtoIOStatRespBodyHeader) + (STORAGE_CFG.
+                max_store_path_index + 1) * FS_IO_CLASS_COUNT *
+            sizeof(FSProtoIOStatRespBodyPart) > task->size -
+            sizeof(FSProtoHeader))
+    {
+        RESPONSE.error.length = sprintf(RESPONSE.error.message,
+                "response body length exceeds task size: %d", task->size);
+        return EOVERFLOW;
+    }
+
+    body_header = (FSProtoIOStatRespBodyHeader *)REQUEST.body;
+    part_start = (FSProtoIOStatRespBodyPart *)(REQUEST.body +
+            sizeof(FSProtoIOStatRespBodyHeader));
+    body_part = part_start;
+    for (path_index=0; path_index<=STORAGE_CFG.max_store_path_index;
+            path_index++)
+    {
+        if (trunk_io_thread_get_class_stats(path_index, stats) != 0) {
+            continue;
+        }
+
+        for (io_class=0; io_class<FS_IO_CLASS_COUNT;
+                io_class++, body_part++)
+        {
+            int2buff(path_index, body_part->path_index);
+            int2buff(stats[io_class].queue_depth, body_part->queue_depth);
+            body_part->io_class = io_class;
+            long2buff(stats[io_class].total_count, body_part->total_count);
+            long2buff(stats[io_class].total_bytes, body_part->total_bytes);
+            long2buff(stats[io_class].total_latency,
+                    body_part->total_latency);
+            long2buff(stats[io_class].max_latency, body_part->max_latency);
+        }
+    }
+
+    int2buff(body_part - part_start, body_header->count);
+    RESPONSE.header.body_len = (char *)body_part - REQUEST.body;
+    RESPONSE.header.cmd = FS_SERVICE_PROTO_IO_STAT_RESP;
+    TASK_ARG->context.response_done = true;
+    return 0;
+}
+
 static int service_update_prepare_and_check(struct fast_task_info *task,
         const int resp_cmd, bool *deal_done)
 {
@@ -732,6 +1011,9 @@ int service_deal_task(struct fast_task_info *task, const int stage)
             case FS_SERVICE_PROTO_SLICE_READ_REQ:
                 result = service_deal_slice_read(task);
                 break;
+            case FS_SERVICE_PROTO_BATCH_SLICE_READ_REQ:
+                result = service_deal_batch_slice_read(task);
+                break;
             case FS_SERVICE_PROTO_GET_MASTER_REQ:
                 result = service_deal_get_master(task);
                 break;
@@ -747,6 +1029,9 @@ int service_deal_task(struct fast_task_info *task, const int stage)
             case FS_SERVICE_PROTO_DISK_SPACE_STAT_REQ:
                 result = service_deal_disk_space_stat(task);
                 break;
+            case FS_SERVICE_PROTO_IO_STAT_REQ:
+                result = service_deal_io_stat(task);
+                break;
             case SF_SERVICE_PROTO_SETUP_CHANNEL_REQ:
                 if ((result=sf_server_deal_setup_channel(task,
                                 &SERVER_TASK_TYPE, &IDEMPOTENCY_CHANNEL,
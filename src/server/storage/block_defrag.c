@@ -0,0 +1,585 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <limits.h>
+#include <unistd.h>
+#include "fastcommon/shared_func.h"
+#include "fastcommon/logger.h"
+#include "fastcommon/fast_mblock.h"
+#include "fastcommon/fc_queue.h"
+#include "fastcommon/pthread_func.h"
+#include "fastcommon/sched_thread.h"
+#include "sf/sf_global.h"
+#include "../server_global.h"
+#include "../data_thread.h"
+#include "../dio/trunk_io_thread.h"
+#include "../binlog/binlog_types.h"
+#include "../binlog/slice_binlog.h"
+#include "storage_allocator.h"
+#include "object_block_index.h"
+#include "block_defrag.h"
+
+#define BLOCK_DEFRAG_MAX_DESTS  (BLOCK_DEFRAG_MAX_RUNS * \
+        FS_MAX_SPLIT_COUNT_PER_SPACE_ALLOC)
+
+typedef struct block_defrag_node {
+    FSBlockKey bkey;
+    struct block_defrag_node *next;
+} BlockDefragNode;
+
+typedef struct block_defrag_candidate {
+    FSBlockKey bkey;
+    int slice_count;
+} BlockDefragCandidate;
+
+typedef struct block_defrag_run {
+    int start;  //the start index of the slice array
+    int count;  //the slice count of the run
+} BlockDefragRun;
+
+typedef struct block_defrag_context {
+    struct fast_mblock_man allocator;  //element: BlockDefragNode
+    struct fc_queue queue;
+    volatile int candidate_count;      //the node count in the queue
+    BlockDefragCandidate *candidates;
+
+    OBSlicePtrArray sarray;  //the slices of the current block
+    BlockDefragRun runs[BLOCK_DEFRAG_MAX_RUNS];
+    int dest_count;
+    OBSliceEntry *dests[BLOCK_DEFRAG_MAX_DESTS];
+    uint64_t sns[BLOCK_DEFRAG_MAX_DESTS];
+    char *buffer;  //the block data, indexed by the slice offset
+
+    struct {
+        int count;   //the IO in progress
+        int result;
+        pthread_lock_cond_pair_t lcp;
+    } io;
+
+    struct {
+        int64_t start_time_ms;  //the start time of current second
+        int64_t bytes;          //the rewritten bytes in current second
+    } throttle;
+
+    struct {
+        int64_t block_count;  //the defragmented block count
+        int64_t slice_count;  //the old slice count replaced
+        int64_t bytes;        //the rewritten bytes
+    } stat;
+} BlockDefragContext;
+
+static BlockDefragContext defrag_ctx;
+
+static void defrag_io_done(struct trunk_io_buffer *record, const int result)
+{
+    BlockDefragContext *ctx;
+
+    ctx = (BlockDefragContext *)record->notify.arg;
+    PTHREAD_MUTEX_LOCK(&ctx->io.lcp.lock);
+    if (result != 0) {
+        ctx->io.result = result;
+    }
+    if (--ctx->io.count == 0) {
+        pthread_cond_signal(&ctx->io.lcp.cond);
+    }
+    PTHREAD_MUTEX_UNLOCK(&ctx->io.lcp.lock);
+}
+
+static int defrag_push_io(BlockDefragContext *ctx, const int type,
+        OBSliceEntry *slice, char *buff)
+{
+    int result;
+
+    PTHREAD_MUTEX_LOCK(&ctx->io.lcp.lock);
+    ctx->io.count++;
+    PTHREAD_MUTEX_UNLOCK(&ctx->io.lcp.lock);
+
+    if ((result=io_thread_push_slice_op(type, FS_IO_CLASS_BACKGROUND,
+                    slice, buff, defrag_io_done, ctx)) != 0)
+    {
+        PTHREAD_MUTEX_LOCK(&ctx->io.lcp.lock);
+        ctx->io.count--;
+        PTHREAD_MUTEX_UNLOCK(&ctx->io.lcp.lock);
+    }
+
+    return result;
+}
+
+static int defrag_wait_io(BlockDefragContext *ctx)
+{
+    int result;
+
+    PTHREAD_MUTEX_LOCK(&ctx->io.lcp.lock);
+    while (ctx->io.count > 0) {
+        pthread_cond_wait(&ctx->io.lcp.cond, &ctx->io.lcp.lock);
+    }
+    result = ctx->io.result;
+    ctx->io.result = 0;
+    PTHREAD_MUTEX_UNLOCK(&ctx->io.lcp.lock);
+
+    return result;
+}
+
+/* limit the rewrite speed when the data threads are busy,
+   run at full speed when idle */
+static void defrag_throttle(BlockDefragContext *ctx, const int bytes)
+{
+    int64_t current_time_ms;
+    int64_t expect_time_ms;
+    int64_t elapsed_ms;
+
+    if (STORAGE_CFG.defrag_max_bytes_per_second <= 0) {
+        return;
+    }
+
+    current_time_ms = get_current_time_ms();
+    elapsed_ms = current_time_ms - ctx->throttle.start_time_ms;
+    if (elapsed_ms >= 1000 || data_thread_get_inflight_count() == 0) {
+        ctx->throttle.start_time_ms = current_time_ms;
+        ctx->throttle.bytes = bytes;
+        elapsed_ms = 0;
+    } else {
+        ctx->throttle.bytes += bytes;
+    }
+
+    expect_time_ms = ctx->throttle.bytes * 1000 /
+        STORAGE_CFG.defrag_max_bytes_per_second;
+    if (expect_time_ms > elapsed_ms) {
+        fc_sleep_ms(expect_time_ms - elapsed_ms);
+    }
+}
+
+static inline bool is_adjacent_file_slice(const OBSliceEntry *previous,
+        const OBSliceEntry *current)
+{
+    return previous->type == OB_SLICE_TYPE_FILE &&
+        current->type == OB_SLICE_TYPE_FILE &&
+        previous->ssize.offset + previous->ssize.length ==
+        current->ssize.offset;
+}
+
+//the runs of the adjacent file slices, at least 2 slices per run
+static int find_slice_runs(BlockDefragContext *ctx)
+{
+    OBSliceEntry **slices;
+    int run_count;
+    int start;
+    int i;
+
+    slices = ctx->sarray.slices;
+    run_count = 0;
+    start = 0;
+    for (i=1; i<=ctx->sarray.count; i++) {
+        if (i < ctx->sarray.count && is_adjacent_file_slice(
+                    slices[i - 1], slices[i]))
+        {
+            continue;
+        }
+
+        if (i - start >= 2) {
+            ctx->runs[run_count].start = start;
+            ctx->runs[run_count].count = i - start;
+            if (++run_count == BLOCK_DEFRAG_MAX_RUNS) {
+                break;
+            }
+        }
+        start = i;
+    }
+
+    return run_count;
+}
+
+static int read_runs(BlockDefragContext *ctx, const int run_count)
+{
+    OBSliceEntry **slice;
+    OBSliceEntry **end;
+    int result;
+    int io_result;
+    int i;
+
+    result = 0;
+    for (i=0; i<run_count && result==0; i++) {
+        slice = ctx->sarray.slices + ctx->runs[i].start;
+        end = slice + ctx->runs[i].count;
+        for (; slice<end; slice++) {
+            if ((result=defrag_push_io(ctx, FS_IO_TYPE_READ_SLICE, *slice,
+                            ctx->buffer + (*slice)->ssize.offset)) != 0)
+            {
+                break;
+            }
+        }
+    }
+
+    io_result = defrag_wait_io(ctx);
+    return (result != 0) ? result : io_result;
+}
+
+static int alloc_dest_slices(BlockDefragContext *ctx,
+        const FSBlockKey *bkey, const BlockDefragRun *run)
+{
+    FSTrunkSpaceInfo spaces[FS_MAX_SPLIT_COUNT_PER_SPACE_ALLOC];
+    OBSliceEntry *first;
+    OBSliceEntry *last;
+    OBSliceEntry *slice;
+    int offset;
+    int remain;
+    int count;
+    int result;
+    int i;
+
+    first = ctx->sarray.slices[run->start];
+    last = ctx->sarray.slices[run->start + run->count - 1];
+    offset = first->ssize.offset;
+    remain = (last->ssize.offset + last->ssize.length) - offset;
+    if ((result=storage_allocator_normal_alloc(FS_BLOCK_HASH_CODE(*bkey),
+                    remain, spaces, &count)) != 0)
+    {
+        return result;
+    }
+
+    for (i=0; i<count; i++) {
+        if ((slice=ob_index_alloc_slice(bkey)) == NULL) {
+            while (--count >= i) {
+                storage_allocator_free_space(spaces + count);
+            }
+            return ENOMEM;
+        }
+
+        slice->type = OB_SLICE_TYPE_FILE;
+        slice->read_offset = 0;
+        slice->space = spaces[i];
+        slice->ssize.offset = offset;
+        slice->ssize.length = (spaces[i].size < remain ?
+                spaces[i].size : remain);
+        ctx->dests[ctx->dest_count++] = slice;
+
+        offset += slice->ssize.length;
+        remain -= slice->ssize.length;
+    }
+
+    return 0;
+}
+
+//in reverse order for reusing the space at the trunk tail
+static void release_dest_spaces(OBSliceEntry **dests, const int count)
+{
+    OBSliceEntry **slice;
+
+    for (slice=dests + count - 1; slice>=dests; slice--) {
+        storage_allocator_free_space(&(*slice)->space);
+    }
+}
+
+static int write_runs(BlockDefragContext *ctx, const FSBlockKey *bkey,
+        const int run_count)
+{
+    int result;
+    int io_result;
+    int start;
+    int i;
+
+    result = 0;
+    for (i=0; i<run_count; i++) {
+        start = ctx->dest_count;
+        if ((result=alloc_dest_slices(ctx, bkey, ctx->runs + i)) != 0) {
+            break;
+        }
+
+        for (; start<ctx->dest_count; start++) {
+            if ((result=defrag_push_io(ctx, FS_IO_TYPE_WRITE_SLICE,
+                            ctx->dests[start], ctx->buffer +
+                            ctx->dests[start]->ssize.offset)) != 0)
+            {
+                break;
+            }
+        }
+        if (result != 0) {
+            break;
+        }
+    }
+
+    io_result = defrag_wait_io(ctx);
+    return (result != 0) ? result : io_result;
+}
+
+int block_defrag_replace_slices(const FSBlockKey *bkey,
+        const int64_t version, OBSliceEntry **dests,
+        const int count, uint64_t *sns, int *added_count)
+{
+    int result;
+
+    if ((result=ob_index_replace_block_slices(bkey, version, dests,
+                    count, sns, added_count)) != 0)
+    {
+        release_dest_spaces(dests + *added_count, count - *added_count);
+    }
+    return result;
+}
+
+/* log all the dests added to the index, return the first error */
+static int log_added_dests(BlockDefragContext *ctx,
+        const int added_count, int *bytes)
+{
+    int result;
+    int log_result;
+    int i;
+
+    result = 0;
+    for (i=0; i<added_count; i++) {
+        if ((log_result=slice_binlog_log_add_slice(ctx->dests[i],
+                        g_current_time, ctx->sns[i], 0,
+                        BINLOG_SOURCE_DEFRAG)) != 0 && result == 0)
+        {
+            result = log_result;
+        }
+        *bytes += ctx->dests[i]->ssize.length;
+    }
+
+    return result;
+}
+
+static int replace_runs(BlockDefragContext *ctx, const FSBlockKey *bkey,
+        const int64_t version, const int run_count, int *bytes)
+{
+    int added_count;
+    int log_result;
+    int result;
+    int i;
+
+    *bytes = 0;
+    if ((result=block_defrag_replace_slices(bkey, version, ctx->dests,
+                    ctx->dest_count, ctx->sns, &added_count)) != 0)
+    {
+        //the block is overwritten or deleted during the rewriting
+        if (result == EAGAIN || result == ENOENT) {
+            return 0;
+        }
+
+        //the dests added before the failure are in the index already
+        log_result = log_added_dests(ctx, added_count, bytes);
+        return (log_result != 0) ? log_result : result;
+    }
+
+    if ((result=log_added_dests(ctx, ctx->dest_count, bytes)) != 0) {
+        return result;
+    }
+
+    ctx->stat.block_count++;
+    for (i=0; i<run_count; i++) {
+        ctx->stat.slice_count += ctx->runs[i].count;
+    }
+    ctx->stat.bytes += *bytes;
+    return 0;
+}
+
+static void free_dest_slices(BlockDefragContext *ctx)
+{
+    int i;
+
+    for (i=0; i<ctx->dest_count; i++) {
+        ob_index_free_slice(ctx->dests[i]);
+    }
+    ctx->dest_count = 0;
+}
+
+static void free_block_slices(BlockDefragContext *ctx)
+{
+    int i;
+
+    for (i=0; i<ctx->sarray.count; i++) {
+        ob_index_free_slice(ctx->sarray.slices[i]);
+    }
+    ctx->sarray.count = 0;
+}
+
+static int defrag_block(BlockDefragContext *ctx, const FSBlockKey *bkey)
+{
+    int64_t version;
+    int run_count;
+    int bytes;
+    int result;
+
+    if ((result=ob_index_get_block_slices(bkey,
+                    &ctx->sarray, &version)) != 0)
+    {
+        return (result == ENOENT) ? 0 : result;
+    }
+
+    bytes = 0;
+    if ((run_count=find_slice_runs(ctx)) > 0) {
+        if ((result=read_runs(ctx, run_count)) == 0) {
+            if ((result=write_runs(ctx, bkey, run_count)) == 0) {
+                result = replace_runs(ctx, bkey, version,
+                        run_count, &bytes);
+            } else {
+                release_dest_spaces(ctx->dests, ctx->dest_count);
+            }
+        }
+        free_dest_slices(ctx);
+    }
+    free_block_slices(ctx);
+
+    if (bytes > 0) {
+        logDebug("file: "__FILE__", line: %d, "
+                "block {oid: %"PRId64", offset: %"PRId64"}, "
+                "slice runs: %d, rewritten bytes: %d, total defragmented "
+                "blocks: %"PRId64", slices: %"PRId64", bytes: %"PRId64,
+                __LINE__, bkey->oid, bkey->offset, run_count, bytes,
+                ctx->stat.block_count, ctx->stat.slice_count,
+                ctx->stat.bytes);
+        defrag_throttle(ctx, bytes);
+    }
+    return result;
+}
+
+static int compare_by_slice_count(const void *p1, const void *p2)
+{
+    return ((const BlockDefragCandidate *)p2)->slice_count -
+        ((const BlockDefragCandidate *)p1)->slice_count;
+}
+
+static int fetch_candidates(BlockDefragContext *ctx)
+{
+    BlockDefragNode *node;
+    BlockDefragNode *deleted;
+    BlockDefragCandidate *candidate;
+    int count;
+
+    count = 0;
+    node = (BlockDefragNode *)fc_queue_try_pop_all(&ctx->queue);
+    while (node != NULL) {
+        candidate = ctx->candidates + count;
+        candidate->bkey = node->bkey;
+        candidate->slice_count = ob_index_get_defrag_slice_count(&node->bkey);
+        if (candidate->slice_count >= STORAGE_CFG.defrag_min_slices) {
+            count++;
+        }
+
+        deleted = node;
+        node = node->next;
+        fast_mblock_free_object(&ctx->allocator, deleted);
+        __sync_sub_and_fetch(&ctx->candidate_count, 1);
+    }
+
+    //the block with the most slices first
+    if (count > 1) {
+        qsort(ctx->candidates, count, sizeof(BlockDefragCandidate),
+                compare_by_slice_count);
+    }
+    return count;
+}
+
+static void *block_defrag_thread_func(void *arg)
+{
+    BlockDefragContext *ctx;
+    int count;
+    int result;
+    int i;
+
+    ctx = (BlockDefragContext *)arg;
+    while (SF_G_CONTINUE_FLAG) {
+        if ((count=fetch_candidates(ctx)) == 0) {
+            sleep(1);
+            continue;
+        }
+
+        for (i=0; i<count && SF_G_CONTINUE_FLAG; i++) {
+            if ((result=defrag_block(ctx, &ctx->candidates[i].bkey)) != 0) {
+                logError("file: "__FILE__", line: %d, "
+                        "defragment block {oid: %"PRId64", offset: "
+                        "%"PRId64"} fail, errno: %d, error info: %s",
+                        __LINE__, ctx->candidates[i].bkey.oid,
+                        ctx->candidates[i].bkey.offset,
+                        result, STRERROR(result));
+                sleep(5);  //such as no space to allocate
+                break;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+int block_defrag_init()
+{
+    int result;
+    int bytes;
+
+    memset(&defrag_ctx, 0, sizeof(defrag_ctx));
+    if (STORAGE_CFG.defrag_min_slices <= 0) {
+        return 0;
+    }
+
+    if ((result=fast_mblock_init_ex1(&defrag_ctx.allocator,
+                    "defrag_candidate", sizeof(BlockDefragNode),
+                    1024, 0, NULL, NULL, true)) != 0)
+    {
+        return result;
+    }
+
+    if ((result=fc_queue_init(&defrag_ctx.queue, (long)
+                    (&((BlockDefragNode *)NULL)->next))) != 0)
+    {
+        return result;
+    }
+
+    bytes = sizeof(BlockDefragCandidate) * BLOCK_DEFRAG_MAX_CANDIDATES;
+    defrag_ctx.candidates = (BlockDefragCandidate *)fc_malloc(bytes);
+    if (defrag_ctx.candidates == NULL) {
+        return ENOMEM;
+    }
+
+    defrag_ctx.buffer = (char *)fc_malloc(FS_FILE_BLOCK_SIZE);
+    if (defrag_ctx.buffer == NULL) {
+        return ENOMEM;
+    }
+
+    return init_pthread_lock_cond_pair(&defrag_ctx.io.lcp);
+}
+
+int block_defrag_start()
+{
+    pthread_t tid;
+
+    if (STORAGE_CFG.defrag_min_slices <= 0) {
+        return 0;
+    }
+
+    return fc_create_thread(&tid, block_defrag_thread_func,
+            &defrag_ctx, SF_G_THREAD_STACK_SIZE);
+}
+
+int block_defrag_push_candidate(const FSBlockKey *bkey)
+{
+    BlockDefragNode *node;
+
+    if (__sync_add_and_fetch(&defrag_ctx.candidate_count, 1) >
+            BLOCK_DEFRAG_MAX_CANDIDATES)
+    {
+        __sync_sub_and_fetch(&defrag_ctx.candidate_count, 1);
+        return EBUSY;
+    }
+
+    if ((node=(BlockDefragNode *)fast_mblock_alloc_object(
+                    &defrag_ctx.allocator)) == NULL)
+    {
+        __sync_sub_and_fetch(&defrag_ctx.candidate_count, 1);
+        return ENOMEM;
+    }
+
+    node->bkey = *bkey;
+    fc_queue_push(&defrag_ctx.queue, node);
+    return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//block_defrag.h
+
+/* the background defragmenting of the blocks overwritten frequently:
+ *   1. the block is queued as the candidate when its slice count reaches
+ *      defrag_min_slices, the candidates with the most slices first
+ *   2. each run of the adjacent file slices is read and rewritten to
+ *      the new space as one slice, the holes and the allocated slices
+ *      are kept as they are
+ *   3. the new slices replace the old ones only when the block NOT changed
+ *      during the rewriting, and are logged to the slice binlog
+ */
+
+#ifndef _BLOCK_DEFRAG_H
+#define _BLOCK_DEFRAG_H
+
+#include "../../common/fs_types.h"
+#include "storage_types.h"
+
+//the max candidates in the queue, the more are discarded
+#define BLOCK_DEFRAG_MAX_CANDIDATES  (64 * 1024)
+
+//the max slice runs to rewrite per block once
+#define BLOCK_DEFRAG_MAX_RUNS        64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    //init the candidate queue before the slice binlog loaded
+    int block_defrag_init();
+
+    //start the defragmenting thread
+    int block_defrag_start();
+
+    /* push the block to the candidate queue, called under the bucket
+       lock of the object block index, return EBUSY when the queue full */
+    int block_defrag_push_candidate(const FSBlockKey *bkey);
+
+    /* replace the slices of the block with the rewritten dest slices,
+       the space of the dest slices NOT added to the index is given back
+       to the allocator when fail, such as EAGAIN for the block changed,
+       the added_count is the count of the dests added to the index */
+    int block_defrag_replace_slices(const FSBlockKey *bkey,
+            const int64_t version, OBSliceEntry **dests,
+            const int count, uint64_t *sns, int *added_count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
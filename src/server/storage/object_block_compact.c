@@ -0,0 +1,635 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "fastcommon/shared_func.h"
+#include "fastcommon/logger.h"
+#include "fastcommon/pthread_func.h"
+#include "object_block_compact.h"
+
+#define OBC_MIN_SEGMENT_CAPACITY  64
+#define OBC_MAX_SLICES_PER_BLOCK  65535
+
+#define OBC_BLOCK_INDEX(bkey) ((bkey)->offset / FS_FILE_BLOCK_SIZE)
+
+#define OBC_ENTRY_SLICES(entry) \
+    ((entry)->alloc == 0 ? &(entry)->one : (entry)->slices)
+
+#define OBC_SLICE_END(slice) ((int64_t)(slice)->offset + (slice)->length)
+
+static inline uint64_t obc_hash(const int64_t oid, const uint32_t block_index)
+{
+    uint64_t h;
+
+    //the finalizer of MurmurHash3
+    h = (uint64_t)oid * 0x9E3779B97F4A7C15ULL ^ block_index;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+#define OBC_GET_SEGMENT(index, h) \
+    ((index)->segments + ((h) % (index)->segment_count))
+
+#define OBC_HOME_SLOT(segment, h) \
+    ((int64_t)((h) >> 32) & ((segment)->capacity - 1))
+
+static int64_t obc_round_capacity(const int64_t capacity)
+{
+    int64_t n;
+
+    n = OBC_MIN_SEGMENT_CAPACITY;
+    while (n < capacity) {
+        n *= 2;
+    }
+    return n;
+}
+
+int obc_index_init(OBCIndex *index, const int segment_count,
+        const int64_t capacity)
+{
+    OBCSegment *segment;
+    OBCSegment *end;
+    int64_t bytes;
+    int result;
+
+    if (segment_count <= 0) {
+        logError("file: "__FILE__", line: %d, "
+                "invalid segment count: %d", __LINE__, segment_count);
+        return EINVAL;
+    }
+
+    bytes = sizeof(OBCSegment) * segment_count;
+    index->segments = (OBCSegment *)fc_malloc(bytes);
+    if (index->segments == NULL) {
+        return ENOMEM;
+    }
+    memset(index->segments, 0, bytes);
+    index->segment_count = segment_count;
+
+    end = index->segments + segment_count;
+    for (segment=index->segments; segment<end; segment++) {
+        if ((result=init_pthread_lock(&segment->lock)) != 0) {
+            return result;
+        }
+
+        segment->capacity = obc_round_capacity(capacity / segment_count);
+        bytes = sizeof(OBCBlockEntry) * segment->capacity;
+        segment->entries = (OBCBlockEntry *)fc_malloc(bytes);
+        if (segment->entries == NULL) {
+            return ENOMEM;
+        }
+        memset(segment->entries, 0, bytes);
+    }
+
+    return 0;
+}
+
+void obc_index_destroy(OBCIndex *index)
+{
+    OBCSegment *segment;
+    OBCSegment *end;
+    OBCBlockEntry *entry;
+    OBCBlockEntry *eend;
+
+    if (index->segments == NULL) {
+        return;
+    }
+
+    end = index->segments + index->segment_count;
+    for (segment=index->segments; segment<end; segment++) {
+        eend = segment->entries + segment->capacity;
+        for (entry=segment->entries; entry<eend; entry++) {
+            if (entry->oid != 0 && entry->alloc > 0) {
+                free(entry->slices);
+            }
+        }
+        free(segment->entries);
+        pthread_mutex_destroy(&segment->lock);
+    }
+
+    free(index->segments);
+    index->segments = NULL;
+    index->segment_count = 0;
+}
+
+int obc_slice_pack(OBCSlice *slice, const OBSliceType type,
+        const FSSliceSize *ssize, const int read_offset,
+        const FSTrunkSpaceInfo *space)
+{
+    if (space->id_info.id > UINT32_MAX || space->id_info.subdir >
+            UINT32_MAX || space->offset > OBC_MAX_SPACE_OFFSET ||
+            space->size > UINT32_MAX)
+    {
+        logError("file: "__FILE__", line: %d, "
+                "trunk id: %"PRId64", subdir: %"PRId64", "
+                "space offset: %"PRId64", size: %"PRId64", "
+                "out of the compact range", __LINE__,
+                space->id_info.id, space->id_info.subdir,
+                space->offset, space->size);
+        return EOVERFLOW;
+    }
+
+    slice->offset = ssize->offset;
+    slice->length = ssize->length;
+    slice->read_offset = read_offset;
+    slice->trunk_id = space->id_info.id;
+    slice->subdir = space->id_info.subdir;
+    slice->space_size = space->size;
+    slice->space_offset_low = (uint32_t)space->offset;
+    slice->space_offset_high = (uint8_t)(space->offset >> 32);
+    slice->type = type;
+    slice->path_index = space->store->index;
+    return 0;
+}
+
+static OBCBlockEntry *obc_find(OBCSegment *segment, const uint64_t h,
+        const int64_t oid, const uint32_t block_index)
+{
+    OBCBlockEntry *entry;
+    int64_t mask;
+    int64_t slot;
+
+    mask = segment->capacity - 1;
+    slot = OBC_HOME_SLOT(segment, h);
+    while (1) {
+        entry = segment->entries + slot;
+        if (entry->oid == 0) {
+            return NULL;
+        }
+        if (entry->oid == oid && entry->block_index == block_index) {
+            return entry;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+static OBCBlockEntry *obc_insert_entry(OBCSegment *segment,
+        const uint64_t h, const int64_t oid, const uint32_t block_index)
+{
+    OBCBlockEntry *entry;
+    int64_t mask;
+    int64_t slot;
+
+    mask = segment->capacity - 1;
+    slot = OBC_HOME_SLOT(segment, h);
+    while (1) {
+        entry = segment->entries + slot;
+        if (entry->oid == 0) {
+            entry->oid = oid;
+            entry->block_index = block_index;
+            entry->count = entry->alloc = 0;
+            segment->count++;
+            return entry;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+static int obc_expand(OBCSegment *segment)
+{
+    OBCBlockEntry *old_entries;
+    OBCBlockEntry *entry;
+    OBCBlockEntry *end;
+    OBCBlockEntry *dest;
+    int64_t old_capacity;
+    int64_t bytes;
+
+    old_entries = segment->entries;
+    old_capacity = segment->capacity;
+    bytes = sizeof(OBCBlockEntry) * old_capacity * 2;
+    segment->entries = (OBCBlockEntry *)fc_malloc(bytes);
+    if (segment->entries == NULL) {
+        segment->entries = old_entries;
+        return ENOMEM;
+    }
+    memset(segment->entries, 0, bytes);
+    segment->capacity = old_capacity * 2;
+    segment->count = 0;
+
+    end = old_entries + old_capacity;
+    for (entry=old_entries; entry<end; entry++) {
+        if (entry->oid != 0) {
+            dest = obc_insert_entry(segment, obc_hash(entry->oid,
+                        entry->block_index), entry->oid, entry->block_index);
+            *dest = *entry;
+        }
+    }
+
+    free(old_entries);
+    return 0;
+}
+
+static void obc_remove_entry(OBCSegment *segment, OBCBlockEntry *entry)
+{
+    int64_t mask;
+    int64_t hole;
+    int64_t slot;
+    int64_t home;
+
+    if (entry->alloc > 0) {
+        free(entry->slices);
+        segment->array_bytes -= sizeof(OBCSlice) * entry->alloc;
+    }
+
+    //backward shift deletion for linear probing
+    mask = segment->capacity - 1;
+    hole = entry - segment->entries;
+    slot = hole;
+    while (1) {
+        slot = (slot + 1) & mask;
+        if (segment->entries[slot].oid == 0) {
+            break;
+        }
+
+        home = OBC_HOME_SLOT(segment, obc_hash(segment->entries[slot].oid,
+                    segment->entries[slot].block_index));
+        if ((slot > hole && (home <= hole || home > slot)) ||
+                (slot < hole && (home <= hole && home > slot)))
+        {
+            segment->entries[hole] = segment->entries[slot];
+            hole = slot;
+        }
+    }
+
+    segment->entries[hole].oid = 0;
+    segment->count--;
+}
+
+//the first slice which end > offset
+static int obc_lower_bound(const OBCSlice *slices,
+        const int count, const int offset)
+{
+    int low;
+    int high;
+    int mid;
+
+    low = 0;
+    high = count;
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (OBC_SLICE_END(slices + mid) <= offset) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static int obc_reserve(OBCSegment *segment, OBCBlockEntry *entry,
+        const int count)
+{
+    OBCSlice *slices;
+    int alloc;
+
+    if (count > OBC_MAX_SLICES_PER_BLOCK) {
+        logError("file: "__FILE__", line: %d, "
+                "oid: %"PRId64", block index: %u, slice count: %d "
+                "exceeds %d", __LINE__, entry->oid, entry->block_index,
+                count, OBC_MAX_SLICES_PER_BLOCK);
+        return EOVERFLOW;
+    }
+
+    if (count <= 1 && entry->alloc == 0) {
+        return 0;
+    }
+    if (count <= entry->alloc) {
+        return 0;
+    }
+
+    alloc = entry->alloc > 0 ? entry->alloc : 2;
+    while (alloc < count) {
+        alloc *= 2;
+    }
+    if (alloc > OBC_MAX_SLICES_PER_BLOCK) {
+        alloc = OBC_MAX_SLICES_PER_BLOCK;
+    }
+
+    if (entry->alloc == 0) {
+        slices = (OBCSlice *)fc_malloc(sizeof(OBCSlice) * alloc);
+        if (slices == NULL) {
+            return ENOMEM;
+        }
+        if (entry->count > 0) {
+            slices[0] = entry->one;
+        }
+    } else {
+        slices = (OBCSlice *)realloc(entry->slices,
+                sizeof(OBCSlice) * alloc);
+        if (slices == NULL) {
+            logError("file: "__FILE__", line: %d, "
+                    "realloc %d bytes fail", __LINE__,
+                    (int)sizeof(OBCSlice) * alloc);
+            return ENOMEM;
+        }
+    }
+
+    segment->array_bytes += sizeof(OBCSlice) * (alloc - entry->alloc);
+    entry->slices = slices;
+    entry->alloc = alloc;
+    return 0;
+}
+
+/* remove the range [offset, end) from the slices of the entry, then
+   insert the new slice when it not NULL */
+static int obc_replace_range(OBCSegment *segment, OBCBlockEntry *entry,
+        const int offset, const int64_t end, const OBCSlice *slice,
+        int *removed)
+{
+    OBCSlice *slices;
+    OBCSlice left;
+    OBCSlice right;
+    bool has_left;
+    bool has_right;
+    int first;
+    int last;
+    int new_count;
+    int tail;
+    int pos;
+    int result;
+
+    slices = OBC_ENTRY_SLICES(entry);
+    first = obc_lower_bound(slices, entry->count, offset);
+    last = first;
+    while (last < entry->count && slices[last].offset < end) {
+        last++;
+    }
+
+    *removed = last - first;
+    if (*removed == 0 && slice == NULL) {
+        return 0;
+    }
+
+    has_left = has_right = false;
+    if (*removed > 0) {
+        if (slices[first].offset < offset) {
+            left = slices[first];
+            left.length = offset - left.offset;
+            has_left = true;
+        }
+        if (OBC_SLICE_END(slices + last - 1) > end) {
+            right = slices[last - 1];
+            right.read_offset += end - right.offset;
+            right.length = OBC_SLICE_END(slices + last - 1) - end;
+            right.offset = end;
+            has_right = true;
+        }
+    }
+
+    new_count = entry->count - *removed + (has_left ? 1 : 0) +
+        (has_right ? 1 : 0) + (slice != NULL ? 1 : 0);
+    if ((result=obc_reserve(segment, entry, new_count)) != 0) {
+        return result;
+    }
+
+    slices = OBC_ENTRY_SLICES(entry);
+    tail = entry->count - last;
+    pos = first + (has_left ? 1 : 0) + (slice != NULL ? 1 : 0) +
+        (has_right ? 1 : 0);
+    if (tail > 0 && pos != last) {
+        memmove(slices + pos, slices + last, sizeof(OBCSlice) * tail);
+    }
+
+    pos = first;
+    if (has_left) {
+        slices[pos++] = left;
+    }
+    if (slice != NULL) {
+        slices[pos++] = *slice;
+    }
+    if (has_right) {
+        slices[pos++] = right;
+    }
+
+    segment->slice_count += new_count - entry->count;
+    entry->count = new_count;
+    return 0;
+}
+
+int obc_index_add_slice(OBCIndex *index, const FSBlockKey *bkey,
+        const OBCSlice *slice)
+{
+    OBCSegment *segment;
+    OBCBlockEntry *entry;
+    uint64_t h;
+    uint32_t block_index;
+    int removed;
+    int result;
+
+    block_index = OBC_BLOCK_INDEX(bkey);
+    h = obc_hash(bkey->oid, block_index);
+    segment = OBC_GET_SEGMENT(index, h);
+    PTHREAD_MUTEX_LOCK(&segment->lock);
+    do {
+        entry = obc_find(segment, h, bkey->oid, block_index);
+        if (entry == NULL) {
+            if ((segment->count + 1) * 4 > segment->capacity * 3) {
+                if ((result=obc_expand(segment)) != 0) {
+                    break;
+                }
+            }
+            entry = obc_insert_entry(segment, h, bkey->oid, block_index);
+        }
+
+        result = obc_replace_range(segment, entry, slice->offset,
+                OBC_SLICE_END(slice), slice, &removed);
+        if (result != 0 && entry->count == 0) {
+            obc_remove_entry(segment, entry);
+        }
+    } while (0);
+    PTHREAD_MUTEX_UNLOCK(&segment->lock);
+
+    return result;
+}
+
+int obc_index_delete_slices(OBCIndex *index,
+        const FSBlockSliceKeyInfo *bs_key)
+{
+    OBCSegment *segment;
+    OBCBlockEntry *entry;
+    uint64_t h;
+    uint32_t block_index;
+    int removed;
+    int result;
+
+    block_index = OBC_BLOCK_INDEX(&bs_key->block);
+    h = obc_hash(bs_key->block.oid, block_index);
+    segment = OBC_GET_SEGMENT(index, h);
+    PTHREAD_MUTEX_LOCK(&segment->lock);
+    entry = obc_find(segment, h, bs_key->block.oid, block_index);
+    if (entry == NULL) {
+        result = ENOENT;
+    } else {
+        result = obc_replace_range(segment, entry, bs_key->slice.offset,
+                (int64_t)bs_key->slice.offset + bs_key->slice.length,
+                NULL, &removed);
+        if (result == 0) {
+            if (removed == 0) {
+                result = ENOENT;
+            } else if (entry->count == 0) {
+                obc_remove_entry(segment, entry);
+            }
+        }
+    }
+    PTHREAD_MUTEX_UNLOCK(&segment->lock);
+
+    return result;
+}
+
+int obc_index_delete_block(OBCIndex *index, const FSBlockKey *bkey)
+{
+    OBCSegment *segment;
+    OBCBlockEntry *entry;
+    uint64_t h;
+    uint32_t block_index;
+    int result;
+
+    block_index = OBC_BLOCK_INDEX(bkey);
+    h = obc_hash(bkey->oid, block_index);
+    segment = OBC_GET_SEGMENT(index, h);
+    PTHREAD_MUTEX_LOCK(&segment->lock);
+    entry = obc_find(segment, h, bkey->oid, block_index);
+    if (entry == NULL) {
+        result = ENOENT;
+    } else {
+        segment->slice_count -= entry->count;
+        obc_remove_entry(segment, entry);
+        result = 0;
+    }
+    PTHREAD_MUTEX_UNLOCK(&segment->lock);
+
+    return result;
+}
+
+static int obc_check_alloc(OBCSliceArray *sarray, const int count)
+{
+    OBCSlice *slices;
+    int alloc;
+
+    if (count <= sarray->alloc) {
+        return 0;
+    }
+
+    alloc = sarray->alloc > 0 ? sarray->alloc : 8;
+    while (alloc < count) {
+        alloc *= 2;
+    }
+    slices = (OBCSlice *)realloc(sarray->slices, sizeof(OBCSlice) * alloc);
+    if (slices == NULL) {
+        logError("file: "__FILE__", line: %d, "
+                "realloc %d bytes fail", __LINE__,
+                (int)sizeof(OBCSlice) * alloc);
+        return ENOMEM;
+    }
+
+    sarray->slices = slices;
+    sarray->alloc = alloc;
+    return 0;
+}
+
+int obc_index_get_slices(OBCIndex *index,
+        const FSBlockSliceKeyInfo *bs_key, OBCSliceArray *sarray)
+{
+    OBCSegment *segment;
+    OBCBlockEntry *entry;
+    const OBCSlice *slices;
+    OBCSlice *dest;
+    uint64_t h;
+    uint32_t block_index;
+    int64_t end;
+    int64_t slice_end;
+    int first;
+    int last;
+    int result;
+
+    sarray->count = 0;
+    end = (int64_t)bs_key->slice.offset + bs_key->slice.length;
+    block_index = OBC_BLOCK_INDEX(&bs_key->block);
+    h = obc_hash(bs_key->block.oid, block_index);
+    segment = OBC_GET_SEGMENT(index, h);
+    PTHREAD_MUTEX_LOCK(&segment->lock);
+    do {
+        entry = obc_find(segment, h, bs_key->block.oid, block_index);
+        if (entry == NULL) {
+            result = ENOENT;
+            break;
+        }
+
+        slices = OBC_ENTRY_SLICES(entry);
+        first = obc_lower_bound(slices, entry->count,
+                bs_key->slice.offset);
+        last = first;
+        while (last < entry->count && slices[last].offset < end) {
+            last++;
+        }
+        if (last == first) {
+            result = ENOENT;
+            break;
+        }
+
+        if ((result=obc_check_alloc(sarray, last - first)) != 0) {
+            break;
+        }
+
+        memcpy(sarray->slices, slices + first,
+                sizeof(OBCSlice) * (last - first));
+        sarray->count = last - first;
+    } while (0);
+    PTHREAD_MUTEX_UNLOCK(&segment->lock);
+
+    if (result != 0) {
+        return result;
+    }
+
+    //clip the first and the last slices out of the lock
+    dest = sarray->slices;
+    if (dest->offset < bs_key->slice.offset) {
+        dest->read_offset += bs_key->slice.offset - dest->offset;
+        dest->length -= bs_key->slice.offset - dest->offset;
+        dest->offset = bs_key->slice.offset;
+    }
+    dest = sarray->slices + sarray->count - 1;
+    slice_end = OBC_SLICE_END(dest);
+    if (slice_end > end) {
+        dest->length -= slice_end - end;
+    }
+
+    return 0;
+}
+
+void obc_index_get_stat(OBCIndex *index, OBCIndexStat *stat)
+{
+    OBCSegment *segment;
+    OBCSegment *end;
+
+    stat->block_count = 0;
+    stat->slice_count = 0;
+    stat->memory_bytes = sizeof(OBCSegment) * index->segment_count;
+    end = index->segments + index->segment_count;
+    for (segment=index->segments; segment<end; segment++) {
+        PTHREAD_MUTEX_LOCK(&segment->lock);
+        stat->block_count += segment->count;
+        stat->slice_count += segment->slice_count;
+        stat->memory_bytes += sizeof(OBCBlockEntry) *
+            segment->capacity + segment->array_bytes;
+        PTHREAD_MUTEX_UNLOCK(&segment->lock);
+    }
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//object_block_compact.h
+
+/* the memory compact layout of the object block index:
+ *   1. the blocks are stored in the open addressing hashtables
+ *      (linear probing) keyed by (oid, block index), the hashtable is
+ *      divided into segments and one lock per segment
+ *   2. the slices of a block are stored in a sorted array by the slice
+ *      offset instead of the skiplist, the only slice is stored inline
+ *      in the block entry
+ *   3. the slice is 32 bytes with packed 32-bit trunk id and the space
+ *      offset of 40 bits
+ * the slices are copied out when read, so no reference counter needed.
+ */
+
+#ifndef _OBJECT_BLOCK_COMPACT_H
+#define _OBJECT_BLOCK_COMPACT_H
+
+#include <pthread.h>
+#include "../../common/fs_types.h"
+#include "storage_types.h"
+
+//the max space offset of 40 bits
+#define OBC_MAX_SPACE_OFFSET  ((1LL << 40) - 1)
+
+typedef struct obc_slice {
+    uint32_t offset;       //slice offset within the block
+    uint32_t length;       //slice length
+    uint32_t read_offset;  //offset of the space start offset
+    uint32_t trunk_id;
+    uint32_t subdir;
+    uint32_t space_size;
+    uint32_t space_offset_low;
+    uint8_t space_offset_high;
+    char type;             //OBSliceType
+    uint16_t path_index;
+} OBCSlice;
+
+typedef struct obc_block_entry {
+    int64_t oid;           //0 for empty slot
+    uint32_t block_index;  //block offset / FS_FILE_BLOCK_SIZE
+    uint16_t count;        //slice count
+    uint16_t alloc;        //0 for the inline slice
+    union {
+        OBCSlice *slices;
+        OBCSlice one;
+    };
+} OBCBlockEntry;
+
+typedef struct obc_segment {
+    int64_t capacity;      //power of 2
+    int64_t count;         //block count
+    int64_t slice_count;
+    int64_t array_bytes;   //the memory of the slice arrays
+    OBCBlockEntry *entries;
+    pthread_mutex_t lock;
+} OBCSegment;
+
+typedef struct obc_index {
+    int segment_count;
+    OBCSegment *segments;
+} OBCIndex;
+
+typedef struct obc_slice_array {
+    int alloc;
+    int count;
+    OBCSlice *slices;
+} OBCSliceArray;
+
+typedef struct obc_index_stat {
+    int64_t block_count;
+    int64_t slice_count;
+    int64_t memory_bytes;
+} OBCIndexStat;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /* capacity: the init capacity of the blocks,
+       the segments expand automatically */
+    int obc_index_init(OBCIndex *index, const int segment_count,
+            const int64_t capacity);
+
+    void obc_index_destroy(OBCIndex *index);
+
+    /* pack the slice, return EOVERFLOW when the trunk id or
+       the space offset out of range */
+    int obc_slice_pack(OBCSlice *slice, const OBSliceType type,
+            const FSSliceSize *ssize, const int read_offset,
+            const FSTrunkSpaceInfo *space);
+
+    static inline int64_t obc_slice_space_offset(const OBCSlice *slice)
+    {
+        return ((int64_t)slice->space_offset_high << 32) |
+            slice->space_offset_low;
+    }
+
+    //add the slice and overwrite the overlapped slices
+    int obc_index_add_slice(OBCIndex *index, const FSBlockKey *bkey,
+            const OBCSlice *slice);
+
+    //return ENOENT when no slice deleted
+    int obc_index_delete_slices(OBCIndex *index,
+            const FSBlockSliceKeyInfo *bs_key);
+
+    //return ENOENT when the block not exist
+    int obc_index_delete_block(OBCIndex *index, const FSBlockKey *bkey);
+
+    /* copy the slices within the range to the array,
+       return ENOENT when no slice found */
+    int obc_index_get_slices(OBCIndex *index,
+            const FSBlockSliceKeyInfo *bs_key, OBCSliceArray *sarray);
+
+    void obc_index_get_stat(OBCIndex *index, OBCIndexStat *stat);
+
+    static inline void obc_index_init_slice_array(OBCSliceArray *sarray)
+    {
+        sarray->slices = NULL;
+        sarray->alloc = sarray->count = 0;
+    }
+
+    static inline void obc_index_free_slice_array(OBCSliceArray *sarray)
+    {
+        if (sarray->slices != NULL) {
+            free(sarray->slices);
+            sarray->slices = NULL;
+            sarray->alloc = sarray->count = 0;
+        }
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -18,10 +18,12 @@
 #include "fastcommon/shared_func.h"
 #include "fastcommon/logger.h"
 #include "fastcommon/uniq_skiplist.h"
+#include "fastcommon/sched_thread.h"
 #include "sf/sf_global.h"
 #include "../server_global.h"
 #include "../binlog/slice_binlog.h"
 #include "storage_allocator.h"
+#include "block_defrag.h"
 #include "object_block_index.h"
 
 #define SLICE_ARRAY_FIXED_COUNT  64
@@ -40,6 +42,9 @@ typedef struct {
 
 static OBSharedContextArray ob_shared_ctx_array = {0, NULL};
 
+//the high 32 bits of the block version, distinct for the recreated block
+static volatile int64_t ob_entry_generation = 0;
+
 OBHashtable g_ob_hashtable = {0, 0, NULL};
 
 #define OB_INDEX_SET_HASHTABLE_CTX(htable, bkey) \
@@ -135,11 +140,18 @@ static OBEntry *get_ob_entry_ex(OBSharedContext *ctx, OBEntry **bucket,
     }
 
     ob->bkey = *bkey;
+    ob->snapshot = NULL;
+    ob->version = __sync_add_and_fetch(&ob_entry_generation, 1) << 32;
+    ob->digest = OB_BLOCK_DIGEST_NONE;
+    ob->slice_count = 0;
+    ob->defrag_queued = false;
     if (*pprev == NULL) {
         ob->next = *bucket;
+        __sync_synchronize();  //for the lock free readers
         *bucket = ob;
     } else {
         ob->next = (*pprev)->next;
+        __sync_synchronize();  //for the lock free readers
         (*pprev)->next = ob;
     }
 
@@ -205,6 +217,16 @@ void ob_index_free_slice(OBSliceEntry *slice)
     }
 }
 
+static void slice_release_func(void *ptr)
+{
+    ob_index_free_slice((OBSliceEntry *)ptr);
+}
+
+static void slice_snapshot_free_func(void *ptr)
+{
+    free(ptr);
+}
+
 static int slice_compare(const void *p1, const void *p2)
 {
     return ((OBSliceEntry *)p1)->ssize.offset -
@@ -273,6 +295,9 @@ static int init_ob_shared_ctx_array()
             return result;
         }
 
+        ctx->retired.alloc = ctx->retired.count = 0;
+        ctx->retired.reclaim_count = 0;
+        ctx->retired.entries = NULL;
         if ((result=init_pthread_lock(&ctx->lock)) != 0) {
             logError("file: "__FILE__", line: %d, "
                     "init_pthread_lock fail, errno: %d, error info: %s",
@@ -298,6 +323,7 @@ int ob_index_init_htable_ex(OBHashtable *htable, const int64_t capacity,
     memset(htable->buckets, 0, bytes);
 
     htable->need_lock = need_lock;
+    htable->lockfree_read = false;
     htable->modify_sallocator = modify_sallocator;
     htable->modify_used_space = false;
     return 0;
@@ -323,6 +349,10 @@ void ob_index_destroy_htable(OBHashtable *htable)
 
         ob = *bucket;
         do {
+            if (ob->snapshot != NULL) {
+                free(ob->snapshot);
+                ob->snapshot = NULL;
+            }
             uniq_skiplist_free(ob->slices);
 
             deleted = ob;
@@ -344,22 +374,98 @@ int ob_index_init()
         return result;
     }
 
-    return ob_index_init_htable_ex(&g_ob_hashtable, STORAGE_CFG.
-            object_block.hashtable_capacity, true, true);
+    if ((result=ob_index_init_htable_ex(&g_ob_hashtable, STORAGE_CFG.
+                    object_block.hashtable_capacity, true, true)) != 0)
+    {
+        return result;
+    }
+
+    if (STORAGE_CFG.object_block.lockfree_read) {
+        if ((result=ob_rcu_init()) != 0) {
+            return result;
+        }
+        g_ob_hashtable.lockfree_read = true;
+    }
+    return 0;
 }
 
 void ob_index_destroy()
 {
 }
 
+static int rcu_reclaim_task_func(void *args)
+{
+    OBSharedContext *ctx;
+    OBSharedContext *end;
+
+    end = ob_shared_ctx_array.contexts + ob_shared_ctx_array.count;
+    for (ctx=ob_shared_ctx_array.contexts; ctx<end; ctx++) {
+        //check without the lock, the retired count is only a hint
+        if (ctx->retired.count == 0) {
+            continue;
+        }
+
+        PTHREAD_MUTEX_LOCK(&ctx->lock);
+        ob_rcu_reclaim(&ctx->retired);
+        PTHREAD_MUTEX_UNLOCK(&ctx->lock);
+    }
+
+    return 0;
+}
+
+int ob_index_setup_rcu_reclaim_task()
+{
+    ScheduleEntry schedule_entry;
+    ScheduleArray schedule_array;
+
+    if (!g_ob_hashtable.lockfree_read) {
+        return 0;
+    }
+
+    INIT_SCHEDULE_ENTRY(schedule_entry, sched_generate_next_id(),
+            0, 0, 0, OB_RCU_RECLAIM_INTERVAL, rcu_reclaim_task_func, NULL);
+
+    schedule_array.count = 1;
+    schedule_array.entries = &schedule_entry;
+    return sched_add_entries(&schedule_array);
+}
+
+/* the writer discards the published snapshot and the cached digest
+   under the lock, the next locked reader builds the snapshot again */
+static inline void invalidate_slice_snapshot(OBSharedContext *ctx,
+        OBEntry *ob)
+{
+    OBSliceSnapshot *snapshot;
+
+    ob->version++;
+    ob->digest = OB_BLOCK_DIGEST_NONE;
+    if ((snapshot=ob->snapshot) != NULL) {
+        ob->snapshot = NULL;
+        ob_rcu_retire(&ctx->retired, snapshot, slice_snapshot_free_func);
+    }
+}
+
+static inline void retire_slice(OBSharedContext *ctx, OBSliceEntry *slice)
+{
+    /* the lock free readers maybe accessing the slice by the old
+       snapshot, so hold the reference until they left */
+    __sync_add_and_fetch(&slice->ref_count, 1);
+    ob_rcu_retire(&ctx->retired, slice, slice_release_func);
+}
+
 static inline int do_delete_slice(OBHashtable *htable,
-        OBEntry *ob, OBSliceEntry *slice)
+        OBSharedContext *ctx, OBEntry *ob, OBSliceEntry *slice)
 {
     int result;
 
+    invalidate_slice_snapshot(ctx, ob);
+    if (htable->lockfree_read) {
+        retire_slice(ctx, slice);
+    }
     if ((result=uniq_skiplist_delete(ob->slices, slice)) != 0) {
         return result;
     }
+    ob->slice_count--;
     if (htable->modify_sallocator) {
         return storage_allocator_delete_slice(slice,
                 htable->modify_used_space);
@@ -369,13 +475,20 @@ static inline int do_delete_slice(OBHashtable *htable,
 }
 
 static inline int do_add_slice(OBHashtable *htable,
-        OBEntry *ob, OBSliceEntry *slice)
+        OBSharedContext *ctx, OBEntry *ob, OBSliceEntry *slice)
 {
     int result;
 
+    invalidate_slice_snapshot(ctx, ob);
     if ((result=uniq_skiplist_insert(ob->slices, slice)) != 0) {
         return result;
     }
+    if (++ob->slice_count >= STORAGE_CFG.defrag_min_slices &&
+            STORAGE_CFG.defrag_min_slices > 0 && !ob->defrag_queued &&
+            htable == &g_ob_hashtable)
+    {
+        ob->defrag_queued = (block_defrag_push_candidate(&ob->bkey) == 0);
+    }
     if (htable->modify_sallocator) {
         return storage_allocator_add_slice(slice, htable->modify_used_space);
     } else {
@@ -485,7 +598,7 @@ static int add_slice(OBHashtable *htable, OBSharedContext *ctx,
         previous = UNIQ_SKIPLIST_LEVEL0_TAIL_NODE(ob->slices);
         if (previous == ob->slices->top) {
             *inc_alloc += slice->ssize.length;
-            return do_add_slice(htable, ob, slice);
+            return do_add_slice(htable, ctx, ob, slice);
         }
     } else {
         previous = UNIQ_SKIPLIST_LEVEL0_PREV_NODE(node);
@@ -563,16 +676,16 @@ static int add_slice(OBHashtable *htable, OBSharedContext *ctx,
     }
 
     for (i=0; i<del_slice_array.count; i++) {
-        do_delete_slice(htable, ob, del_slice_array.slices[i]);
+        do_delete_slice(htable, ctx, ob, del_slice_array.slices[i]);
     }
     FREE_SLICE_PTR_ARRAY(del_slice_array);
 
     for (i=0; i<add_slice_array.count; i++) {
-        do_add_slice(htable, ob, add_slice_array.slices[i]);
+        do_add_slice(htable, ctx, ob, add_slice_array.slices[i]);
     }
     FREE_SLICE_PTR_ARRAY(add_slice_array);
 
-    return do_add_slice(htable, ob, slice);
+    return do_add_slice(htable, ctx, ob, slice);
 }
 
 int ob_index_add_slice_ex(OBHashtable *htable, OBSliceEntry *slice,
@@ -614,6 +727,96 @@ int ob_index_add_slice_by_binlog(OBSliceEntry *slice)
     return result;
 }
 
+static inline bool is_same_slice(const OBSliceEntry *slice1,
+        const OBSliceEntry *slice2)
+{
+    return (slice1->ssize.offset == slice2->ssize.offset &&
+            slice1->ssize.length == slice2->ssize.length &&
+            slice1->read_offset == slice2->read_offset &&
+            slice1->space.store == slice2->space.store &&
+            slice1->space.id_info.id == slice2->space.id_info.id &&
+            slice1->space.offset == slice2->space.offset);
+}
+
+int ob_index_replace_slice(const OBSliceEntry *src,
+        OBSliceEntry **dests, const int count, uint64_t *sns)
+{
+    OBEntry *ob;
+    OBSliceEntry *slice;
+    int result;
+    int i;
+
+    OB_INDEX_SET_BUCKET_AND_CTX(&g_ob_hashtable, src->ob->bkey);
+    PTHREAD_MUTEX_LOCK(&ctx->lock);
+    do {
+        ob = get_ob_entry(ctx, bucket, &src->ob->bkey, false);
+        if (ob == NULL || ob != src->ob || ob != dests[0]->ob) {
+            result = ENOENT;
+            break;
+        }
+
+        /* the source slice maybe overwritten or deleted */
+        slice = (OBSliceEntry *)uniq_skiplist_find(ob->slices, (void *)src);
+        if (slice == NULL || !is_same_slice(slice, src)) {
+            result = ENOENT;
+            break;
+        }
+
+        do_delete_slice(&g_ob_hashtable, ctx, ob, slice);
+        for (i=0; i<count; i++) {
+            do_add_slice(&g_ob_hashtable, ctx, ob, dests[i]);
+            __sync_add_and_fetch(&dests[i]->ref_count, 1);
+            sns[i] = __sync_add_and_fetch(&SLICE_BINLOG_SN, 1);
+        }
+        result = 0;
+    } while (0);
+    PTHREAD_MUTEX_UNLOCK(&ctx->lock);
+
+    return result;
+}
+
+int ob_index_replace_block_slices(const FSBlockKey *bkey,
+        const int64_t version, OBSliceEntry **dests,
+        const int count, uint64_t *sns, int *added_count)
+{
+    OBEntry *ob;
+    int result;
+    int inc_alloc;
+    int i;
+    OB_INDEX_SET_BUCKET_AND_CTX(&g_ob_hashtable, *bkey);
+
+    i = 0;
+    PTHREAD_MUTEX_LOCK(&ctx->lock);
+    do {
+        ob = get_ob_entry(ctx, bucket, bkey, false);
+        if (ob == NULL || ob != dests[0]->ob) {
+            result = ENOENT;
+            break;
+        }
+
+        /* the slices maybe overwritten or deleted */
+        if (ob->version != version) {
+            result = EAGAIN;
+            break;
+        }
+
+        result = 0;
+        for (i=0; i<count; i++) {
+            if ((result=add_slice(&g_ob_hashtable, ctx, ob,
+                            dests[i], &inc_alloc)) != 0)
+            {
+                break;
+            }
+            __sync_add_and_fetch(&dests[i]->ref_count, 1);
+            sns[i] = __sync_add_and_fetch(&SLICE_BINLOG_SN, 1);
+        }
+    } while (0);
+    PTHREAD_MUTEX_UNLOCK(&ctx->lock);
+
+    *added_count = i;
+    return result;
+}
+
 static int delete_slices(OBHashtable *htable, OBSharedContext *ctx, OBEntry *ob,
         const FSBlockSliceKeyInfo *bs_key, int *count, int *dec_alloc)
 {
@@ -710,12 +913,12 @@ static int delete_slices(OBHashtable *htable, OBSharedContext *ctx, OBEntry *ob,
 
     *count = del_slice_array.count;
     for (i=0; i<del_slice_array.count; i++) {
-        do_delete_slice(htable, ob, del_slice_array.slices[i]);
+        do_delete_slice(htable, ctx, ob, del_slice_array.slices[i]);
     }
     FREE_SLICE_PTR_ARRAY(del_slice_array);
 
     for (i=0; i<add_slice_array.count; i++) {
-        do_add_slice(htable, ob, add_slice_array.slices[i]);
+        do_add_slice(htable, ctx, ob, add_slice_array.slices[i]);
     }
     FREE_SLICE_PTR_ARRAY(add_slice_array);
 
@@ -762,8 +965,12 @@ int ob_index_delete_block_ex(OBHashtable *htable, const FSBlockKey *bkey,
     OB_INDEX_SHARED_CTX_LOCK(htable, ctx);
     ob = get_ob_entry_ex(ctx, bucket, bkey, false, &previous);
     if (ob != NULL) {
+        invalidate_slice_snapshot(ctx, ob);
         uniq_skiplist_iterator(ob->slices, &it);
         while ((slice=(OBSliceEntry *)uniq_skiplist_next(&it)) != NULL) {
+            if (htable->lockfree_read) {
+                retire_slice(ctx, slice);
+            }
             *dec_alloc += slice->ssize.length;
             if (htable->modify_sallocator) {
                 storage_allocator_delete_slice(slice,
@@ -791,6 +998,75 @@ int ob_index_delete_block_ex(OBHashtable *htable, const FSBlockKey *bkey,
     return result;
 }
 
+int ob_index_walk_bucket(OBHashtable *htable, const int64_t bucket_index,
+        ob_index_walk_slice_func walk, void *arg, int *ob_count)
+{
+    OBEntry **bucket;
+    OBEntry *ob;
+    OBSliceEntry *slice;
+    OBSharedContext *ctx;
+    UniqSkiplistIterator it;
+    int result;
+
+    *ob_count = 0;
+    bucket = htable->buckets + bucket_index;
+    if (*bucket == NULL) {  //fast path without lock
+        return 0;
+    }
+
+    ctx = ob_shared_ctx_array.contexts + bucket_index %
+        ob_shared_ctx_array.count;
+    result = 0;
+    OB_INDEX_SHARED_CTX_LOCK(htable, ctx);
+    for (ob=*bucket; ob!=NULL && result==0; ob=ob->next) {
+        (*ob_count)++;
+        uniq_skiplist_iterator(ob->slices, &it);
+        while ((slice=(OBSliceEntry *)uniq_skiplist_next(&it)) != NULL) {
+            if ((result=walk(arg, slice)) != 0) {
+                break;
+            }
+        }
+    }
+    OB_INDEX_SHARED_CTX_UNLOCK(htable, ctx);
+
+    return result;
+}
+
+int ob_index_get_block_digest_ex(OBHashtable *htable,
+        const FSBlockKey *bkey, int64_t *version, int64_t *digest)
+{
+    OBEntry *ob;
+    int result;
+    OB_INDEX_SET_BUCKET_AND_CTX(htable, *bkey);
+
+    OB_INDEX_SHARED_CTX_LOCK(htable, ctx);
+    ob = get_ob_entry(ctx, bucket, bkey, false);
+    if (ob == NULL) {
+        result = ENOENT;
+    } else {
+        *version = ob->version;
+        *digest = ob->digest;
+        result = 0;
+    }
+    OB_INDEX_SHARED_CTX_UNLOCK(htable, ctx);
+
+    return result;
+}
+
+void ob_index_set_block_digest_ex(OBHashtable *htable,
+        const FSBlockKey *bkey, const int64_t version, const int64_t digest)
+{
+    OBEntry *ob;
+    OB_INDEX_SET_BUCKET_AND_CTX(htable, *bkey);
+
+    OB_INDEX_SHARED_CTX_LOCK(htable, ctx);
+    ob = get_ob_entry(ctx, bucket, bkey, false);
+    if (ob != NULL && ob->version == version) {
+        ob->digest = digest;
+    }
+    OB_INDEX_SHARED_CTX_UNLOCK(htable, ctx);
+}
+
 static int add_to_slice_ptr_array(OBSlicePtrArray *array,
         OBSliceEntry *slice)
 {
@@ -993,16 +1269,209 @@ static void free_slices(OBSlicePtrArray *sarray)
     sarray->count = 0;
 }
 
+static OBSliceSnapshot *build_slice_snapshot(OBEntry *ob)
+{
+    OBSliceSnapshot *snapshot;
+    OBSliceEntry *slice;
+    UniqSkiplistIterator it;
+    int count;
+
+    count = 0;
+    uniq_skiplist_iterator(ob->slices, &it);
+    while (uniq_skiplist_next(&it) != NULL) {
+        count++;
+    }
+
+    snapshot = (OBSliceSnapshot *)fc_malloc(sizeof(OBSliceSnapshot) +
+            sizeof(OBSliceEntry *) * count);
+    if (snapshot == NULL) {
+        return NULL;
+    }
+
+    snapshot->count = 0;
+    uniq_skiplist_iterator(ob->slices, &it);
+    while ((slice=(OBSliceEntry *)uniq_skiplist_next(&it)) != NULL) {
+        snapshot->slices[snapshot->count++] = slice;
+    }
+
+    return snapshot;
+}
+
+static inline void publish_slice_snapshot(OBEntry *ob)
+{
+    OBSliceSnapshot *snapshot;
+
+    if ((snapshot=build_slice_snapshot(ob)) != NULL) {
+        //the snapshot MUST be filled before visible to the readers
+        __sync_synchronize();
+        ob->snapshot = snapshot;
+    }
+}
+
+static OBEntry *get_ob_entry_lockfree(OBEntry **bucket,
+        const FSBlockKey *bkey)
+{
+    OBEntry *ob;
+    int cmpr;
+
+    ob = *((OBEntry *volatile *)bucket);
+    while (ob != NULL) {
+        cmpr = compare_block_key(bkey, &ob->bkey);
+        if (cmpr == 0) {
+            return ob;
+        } else if (cmpr < 0) {
+            break;
+        }
+        ob = ob->next;
+    }
+
+    return NULL;
+}
+
+/* called in the read side critical section, the slices of the snapshot
+   are alive until the reader leaves */
+static int get_slices_by_snapshot(OBSharedContext *ctx,
+        const OBSliceSnapshot *snapshot,
+        const FSBlockSliceKeyInfo *bs_key,
+        OBSlicePtrArray *sarray)
+{
+    OBSliceEntry *curr_slice;
+    int low;
+    int high;
+    int mid;
+    int slice_end;
+    int curr_end;
+    int offset;
+    int result;
+
+    //the first slice which end > the offset
+    low = 0;
+    high = snapshot->count;
+    while (low < high) {
+        mid = (low + high) / 2;
+        curr_slice = snapshot->slices[mid];
+        if (curr_slice->ssize.offset + curr_slice->ssize.length <=
+                bs_key->slice.offset)
+        {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    slice_end = bs_key->slice.offset + bs_key->slice.length;
+    for (; low < snapshot->count; low++) {
+        curr_slice = snapshot->slices[low];
+        if (slice_end <= curr_slice->ssize.offset) {  //not overlap
+            break;
+        }
+
+        curr_end = curr_slice->ssize.offset + curr_slice->ssize.length;
+        if (curr_slice->ssize.offset < bs_key->slice.offset ||
+                curr_end > slice_end)
+        {
+            offset = FC_MAX(curr_slice->ssize.offset, bs_key->slice.offset);
+            if ((result=dup_slice_to_array(ctx, curr_slice, offset,
+                            FC_MIN(curr_end, slice_end) - offset,
+                            sarray)) != 0)
+            {
+                return result;
+            }
+        } else {
+            __sync_add_and_fetch(&curr_slice->ref_count, 1);
+            if ((result=add_to_slice_ptr_array(sarray, curr_slice)) != 0) {
+                return result;
+            }
+        }
+    }
+
+    return sarray->count > 0 ? 0 : ENOENT;
+}
+
+int ob_index_get_defrag_slice_count(const FSBlockKey *bkey)
+{
+    OBEntry *ob;
+    int slice_count;
+    OB_INDEX_SET_BUCKET_AND_CTX(&g_ob_hashtable, *bkey);
+
+    PTHREAD_MUTEX_LOCK(&ctx->lock);
+    ob = get_ob_entry(ctx, bucket, bkey, false);
+    if (ob == NULL) {
+        slice_count = 0;
+    } else {
+        ob->defrag_queued = false;
+        slice_count = ob->slice_count;
+    }
+    PTHREAD_MUTEX_UNLOCK(&ctx->lock);
+
+    return slice_count;
+}
+
+int ob_index_get_block_slices(const FSBlockKey *bkey,
+        OBSlicePtrArray *sarray, int64_t *version)
+{
+    OBEntry *ob;
+    OBSliceEntry *slice;
+    UniqSkiplistIterator it;
+    int result;
+    OB_INDEX_SET_BUCKET_AND_CTX(&g_ob_hashtable, *bkey);
+
+    sarray->count = 0;
+    PTHREAD_MUTEX_LOCK(&ctx->lock);
+    ob = get_ob_entry(ctx, bucket, bkey, false);
+    if (ob == NULL) {
+        result = ENOENT;
+    } else {
+        result = 0;
+        *version = ob->version;
+        uniq_skiplist_iterator(ob->slices, &it);
+        while ((slice=(OBSliceEntry *)uniq_skiplist_next(&it)) != NULL) {
+            if ((result=add_to_slice_ptr_array(sarray, slice)) != 0) {
+                break;
+            }
+            __sync_add_and_fetch(&slice->ref_count, 1);
+        }
+    }
+    PTHREAD_MUTEX_UNLOCK(&ctx->lock);
+
+    if (result != 0 && sarray->count > 0) {
+        free_slices(sarray);
+    }
+    return result;
+}
+
 int ob_index_get_slices_ex(OBHashtable *htable,
         const FSBlockSliceKeyInfo *bs_key,
         OBSlicePtrArray *sarray)
 {
     OBEntry *ob;
+    OBSliceSnapshot *snapshot;
+    OBRCUReader *reader;
     int result;
 
     OB_INDEX_SET_BUCKET_AND_CTX(htable, bs_key->block);
     sarray->count = 0;
 
+    if (htable->lockfree_read && (reader=ob_rcu_get_reader()) != NULL) {
+        ob_rcu_read_lock(reader);
+        ob = get_ob_entry_lockfree(bucket, &bs_key->block);
+        if (ob == NULL) {
+            result = ENOENT;
+        } else if ((snapshot=ob->snapshot) != NULL) {
+            result = get_slices_by_snapshot(ctx, snapshot, bs_key, sarray);
+        } else {
+            result = EAGAIN;  //the snapshot is not built
+        }
+        ob_rcu_read_unlock(reader);
+
+        if (result != EAGAIN) {
+            if (result != 0 && sarray->count > 0) {
+                free_slices(sarray);
+            }
+            return result;
+        }
+    }
+
     /*
     logInfo("file: "__FILE__", line: %d, func: %s, "
             "block key: %"PRId64", offset: %"PRId64,
@@ -1015,6 +1484,9 @@ int ob_index_get_slices_ex(OBHashtable *htable,
         result = ENOENT;
     } else {
         result = get_slices(ctx, ob, bs_key, sarray);
+        if (htable->lockfree_read && ob->snapshot == NULL) {
+            publish_slice_snapshot(ob);
+        }
     }
     OB_INDEX_SHARED_CTX_UNLOCK(htable, ctx);
 
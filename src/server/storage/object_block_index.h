@@ -19,6 +19,11 @@
 
 #include "../server_types.h"
 
+#define OB_BLOCK_DIGEST_NONE  -1
+
+//the callback for walking the slices, called under the bucket lock
+typedef int (*ob_index_walk_slice_func)(void *arg, const OBSliceEntry *slice);
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -40,6 +45,12 @@ extern "C" {
 #define ob_index_alloc_slice(bkey) \
     ob_index_alloc_slice_ex(&g_ob_hashtable, bkey, 1)
 
+#define ob_index_get_block_digest(bkey, version, digest) \
+    ob_index_get_block_digest_ex(&g_ob_hashtable, bkey, version, digest)
+
+#define ob_index_set_block_digest(bkey, version, digest) \
+    ob_index_set_block_digest_ex(&g_ob_hashtable, bkey, version, digest)
+
 #define ob_index_init_htable(ht) \
     ob_index_init_htable_ex(ht, STORAGE_CFG.object_block.hashtable_capacity, \
             false, false)
@@ -47,6 +58,9 @@ extern "C" {
     int ob_index_init();
     void ob_index_destroy();
 
+    //reclaim the retired objects of the lock free read periodically
+    int ob_index_setup_rcu_reclaim_task();
+
     int ob_index_init_htable_ex(OBHashtable *htable, const int64_t capacity,
         const bool need_lock, const bool modify_sallocator);
     void ob_index_destroy_htable(OBHashtable *htable);
@@ -91,20 +105,66 @@ extern "C" {
 
     int ob_index_add_slice_by_binlog(OBSliceEntry *slice);
 
+    /* replace the source slice with the dest slices which copied from it
+       (for trunk migrating and reclaiming), return ENOENT when the
+       source slice NOT exist (overwritten or deleted) */
+    int ob_index_replace_slice(const OBSliceEntry *src,
+            OBSliceEntry **dests, const int count, uint64_t *sns);
+
+    /* clear the defrag queued flag of the block and return
+       its slice count, 0 for the block NOT exist */
+    int ob_index_get_defrag_slice_count(const FSBlockKey *bkey);
+
+    //get all slices of the block and the block version
+    int ob_index_get_block_slices(const FSBlockKey *bkey,
+            OBSlicePtrArray *sarray, int64_t *version);
+
+    /* replace the slices of the block with the dest slices which rewritten
+       from them (for block defragmenting), return EAGAIN when the block
+       changed after the version got, the added_count is the count of
+       the dest slices added to the index (less than count when fail) */
+    int ob_index_replace_block_slices(const FSBlockKey *bkey,
+            const int64_t version, OBSliceEntry **dests,
+            const int count, uint64_t *sns, int *added_count);
+
+    /* the slices maybe deleted already when the binlog replayed on
+       the snapshot or replayed again, so ENOENT is ignored */
     static inline int ob_index_delete_slices_by_binlog(
             const FSBlockSliceKeyInfo *bs_key)
     {
         int dec_alloc;
-        return ob_index_delete_slices(bs_key, NULL, &dec_alloc);
+        int result;
+
+        result = ob_index_delete_slices(bs_key, NULL, &dec_alloc);
+        return (result == ENOENT) ? 0 : result;
     }
 
     static inline int ob_index_delete_block_by_binlog(
             const FSBlockKey *bkey)
     {
         int dec_alloc;
-        return ob_index_delete_block(bkey, NULL, &dec_alloc);
+        int result;
+
+        result = ob_index_delete_block(bkey, NULL, &dec_alloc);
+        return (result == ENOENT) ? 0 : result;
     }
 
+    /* walk the slices of the bucket, the walk function should NOT block
+       because it is called under the lock */
+    int ob_index_walk_bucket(OBHashtable *htable, const int64_t bucket_index,
+            ob_index_walk_slice_func walk, void *arg, int *ob_count);
+
+    /* get the version and the cached data digest of the block,
+       the digest is OB_BLOCK_DIGEST_NONE when not cached */
+    int ob_index_get_block_digest_ex(OBHashtable *htable,
+            const FSBlockKey *bkey, int64_t *version, int64_t *digest);
+
+    /* cache the data digest computed by the caller, ignored when
+       the block changed after the version got */
+    void ob_index_set_block_digest_ex(OBHashtable *htable,
+            const FSBlockKey *bkey, const int64_t version,
+            const int64_t digest);
+
     static inline void ob_index_enable_modify_used_space()
     {
         g_ob_hashtable.modify_used_space = true;
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include "fastcommon/shared_func.h"
+#include "fastcommon/logger.h"
+#include "object_block_rcu.h"
+
+OBRCUContext g_ob_rcu_context = {1, 0, NULL};
+
+static __thread OBRCUReader *rcu_thread_reader = NULL;
+static __thread bool rcu_thread_no_reader = false;
+
+int ob_rcu_init()
+{
+    int bytes;
+
+    if (g_ob_rcu_context.readers != NULL) {
+        return 0;
+    }
+
+    bytes = sizeof(OBRCUReader) * OB_RCU_MAX_READERS;
+    g_ob_rcu_context.readers = (OBRCUReader *)fc_malloc(bytes);
+    if (g_ob_rcu_context.readers == NULL) {
+        return ENOMEM;
+    }
+    memset(g_ob_rcu_context.readers, 0, bytes);
+    return 0;
+}
+
+OBRCUReader *ob_rcu_get_reader()
+{
+    int index;
+
+    if (rcu_thread_reader != NULL) {
+        return rcu_thread_reader;
+    }
+    if (rcu_thread_no_reader || g_ob_rcu_context.readers == NULL) {
+        return NULL;
+    }
+
+    index = __sync_fetch_and_add(&g_ob_rcu_context.reader_count, 1);
+    if (index >= OB_RCU_MAX_READERS) {
+        rcu_thread_no_reader = true;
+        logWarning("file: "__FILE__", line: %d, "
+                "the reader slots are exhausted, max: %d, "
+                "the thread reads with the lock", __LINE__,
+                OB_RCU_MAX_READERS);
+        return NULL;
+    }
+
+    rcu_thread_reader = g_ob_rcu_context.readers + index;
+    return rcu_thread_reader;
+}
+
+//the min epoch of the readers in the critical section
+static int64_t get_min_reader_epoch(const int64_t current)
+{
+    OBRCUReader *reader;
+    OBRCUReader *end;
+    int64_t epoch;
+    int64_t min_epoch;
+    int count;
+
+    count = FC_MIN(g_ob_rcu_context.reader_count, OB_RCU_MAX_READERS);
+    min_epoch = current;
+    end = g_ob_rcu_context.readers + count;
+    for (reader=g_ob_rcu_context.readers; reader<end; reader++) {
+        epoch = reader->epoch;
+        if (epoch != 0 && epoch < min_epoch) {
+            min_epoch = epoch;
+        }
+    }
+
+    return min_epoch;
+}
+
+void ob_rcu_synchronize()
+{
+    int64_t epoch;
+
+    epoch = __sync_add_and_fetch(&g_ob_rcu_context.epoch, 1);
+    __sync_synchronize();
+    while (get_min_reader_epoch(epoch) < epoch) {
+        sched_yield();
+    }
+}
+
+int ob_rcu_retire(OBRCURetiredArray *array, void *ptr,
+        ob_rcu_free_func free_func)
+{
+    OBRCURetiredEntry *entries;
+    int alloc;
+
+    if (array->count >= array->alloc) {
+        alloc = array->alloc > 0 ? array->alloc * 2 :
+            2 * OB_RCU_RECLAIM_THRESHOLD;
+        entries = (OBRCURetiredEntry *)realloc(array->entries,
+                sizeof(OBRCURetiredEntry) * alloc);
+        if (entries == NULL) {
+            logError("file: "__FILE__", line: %d, "
+                    "realloc %d bytes fail", __LINE__, (int)
+                    sizeof(OBRCURetiredEntry) * alloc);
+
+            //free it after the readers left
+            ob_rcu_synchronize();
+            free_func(ptr);
+            return 0;
+        }
+
+        array->entries = entries;
+        array->alloc = alloc;
+    }
+
+    __sync_synchronize();
+    array->entries[array->count].epoch = g_ob_rcu_context.epoch;
+    array->entries[array->count].ptr = ptr;
+    array->entries[array->count].free_func = free_func;
+    array->count++;
+
+    if (array->count >= (array->reclaim_count > 0 ?
+                array->reclaim_count : OB_RCU_RECLAIM_THRESHOLD))
+    {
+        ob_rcu_reclaim(array);
+    }
+    return 0;
+}
+
+void ob_rcu_reclaim(OBRCURetiredArray *array)
+{
+    OBRCURetiredEntry *entry;
+    OBRCURetiredEntry *end;
+    int64_t min_epoch;
+    int remain;
+
+    if (array->count == 0) {
+        return;
+    }
+
+    /* the readers entered after advancing can NOT
+       access the objects retired before */
+    min_epoch = get_min_reader_epoch(__sync_add_and_fetch(
+                &g_ob_rcu_context.epoch, 1));
+
+    //the entries are in the order of the epoch
+    end = array->entries + array->count;
+    for (entry=array->entries; entry<end; entry++) {
+        if (entry->epoch >= min_epoch) {
+            break;
+        }
+        entry->free_func(entry->ptr);
+    }
+
+    remain = end - entry;
+    if (remain > 0 && entry > array->entries) {
+        memmove(array->entries, entry, sizeof(OBRCURetiredEntry) * remain);
+    }
+    array->count = remain;
+
+    //avoid reclaiming on every retire when the readers are slow
+    array->reclaim_count = FC_MAX(OB_RCU_RECLAIM_THRESHOLD, 2 * remain);
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//object_block_rcu.h
+
+/* the epoch based reclamation for the lock free read of the object
+ * block index:
+ *   1. the reader records the global epoch in its own slot when entering
+ *      the read side critical section and clears it when leaving
+ *   2. the writer unlinks the object under the lock, then retires it with
+ *      the current global epoch
+ *   3. the retired object is freed after all the readers in the critical
+ *      section entered after the epoch of the object
+ */
+
+#ifndef _OBJECT_BLOCK_RCU_H
+#define _OBJECT_BLOCK_RCU_H
+
+#include "fastcommon/common_define.h"
+
+//the max threads for the lock free read, others read with the lock
+#define OB_RCU_MAX_READERS        1024
+
+//reclaim the retired objects when the count reaches this threshold
+#define OB_RCU_RECLAIM_THRESHOLD    64
+
+/* the interval in seconds to reclaim the retired objects by the timer,
+   for the objects retired when the writes become idle */
+#define OB_RCU_RECLAIM_INTERVAL      1
+
+typedef void (*ob_rcu_free_func)(void *ptr);
+
+typedef struct ob_rcu_reader {
+    volatile int64_t epoch;  //0 for not in the critical section
+    char padding[64 - sizeof(int64_t)];  //avoid false sharing
+} OBRCUReader;
+
+typedef struct ob_rcu_retired_entry {
+    int64_t epoch;
+    void *ptr;
+    ob_rcu_free_func free_func;
+} OBRCURetiredEntry;
+
+//protected by the lock of the writer
+typedef struct ob_rcu_retired_array {
+    int alloc;
+    int count;
+    int reclaim_count;  //reclaim when the count reaches it, 0 for default
+    OBRCURetiredEntry *entries;
+} OBRCURetiredArray;
+
+typedef struct ob_rcu_context {
+    volatile int64_t epoch;
+    volatile int reader_count;
+    OBRCUReader *readers;
+} OBRCUContext;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    extern OBRCUContext g_ob_rcu_context;
+
+    int ob_rcu_init();
+
+    /* get the reader slot of the current thread,
+       return NULL when the slots are exhausted */
+    OBRCUReader *ob_rcu_get_reader();
+
+    static inline void ob_rcu_read_lock(OBRCUReader *reader)
+    {
+        reader->epoch = g_ob_rcu_context.epoch;
+        //the store of the epoch MUST be visible before the loads
+        __sync_synchronize();
+    }
+
+    static inline void ob_rcu_read_unlock(OBRCUReader *reader)
+    {
+        __sync_synchronize();
+        reader->epoch = 0;
+    }
+
+    /* retire the object which unlinked by the writer, the caller should
+       hold the lock which protects the array */
+    int ob_rcu_retire(OBRCURetiredArray *array, void *ptr,
+            ob_rcu_free_func free_func);
+
+    //free the retired objects which no reader can access
+    void ob_rcu_reclaim(OBRCURetiredArray *array);
+
+    //wait for the readers in the critical section to leave
+    void ob_rcu_synchronize();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
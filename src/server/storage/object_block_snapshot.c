@@ -0,0 +1,580 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "fastcommon/shared_func.h"
+#include "fastcommon/logger.h"
+#include "fastcommon/sched_thread.h"
+#include "fastcommon/pthread_func.h"
+#include "sf/sf_global.h"
+#include "../../common/fs_func.h"
+#include "../server_global.h"
+#include "../binlog/slice_binlog.h"
+#include "../binlog/slice_binlog_bin.h"
+#include "storage_allocator.h"
+#include "object_block_index.h"
+#include "object_block_snapshot.h"
+
+//flush to the file when the buffer reach this count
+#define OB_SNAPSHOT_FLUSH_RECORDS  (64 * 1024)
+
+#define OB_SNAPSHOT_HEADER_CRC_FIELD_OFFSET \
+    ((long)&((OBSnapshotHeader *)0)->header_crc32c)
+
+typedef struct {
+    OBSnapshotRecord *records;
+    int alloc;
+    int count;
+} OBSnapshotBuffer;
+
+typedef struct {
+    char filename[PATH_MAX];
+    char tmp_filename[PATH_MAX];
+    int fd;
+    uint32_t crc32c;
+    int64_t ob_count;
+    int64_t slice_count;
+    OBSnapshotBuffer buffer;
+} OBSnapshotWriter;
+
+static struct {
+    pthread_t tid;
+    SFBinlogFilePosition last_position;  //of the last snapshot
+} ob_snapshot_ctx;
+
+static inline void get_snapshot_filename(char *filename, const int size)
+{
+    snprintf(filename, size, "%s/%s/%s", DATA_PATH_STR,
+            FS_SLICE_BINLOG_SUBDIR_NAME, OB_SNAPSHOT_FILENAME);
+}
+
+static int check_snapshot(const char *filename, const char *buff,
+        const int64_t file_size)
+{
+    const OBSnapshotHeader *header;
+    uint32_t crc32c;
+    int64_t body_size;
+
+    if (file_size < sizeof(OBSnapshotHeader)) {
+        logError("file: "__FILE__", line: %d, "
+                "snapshot file: %s, file size: %"PRId64" is too small",
+                __LINE__, filename, file_size);
+        return EINVAL;
+    }
+
+    header = (const OBSnapshotHeader *)buff;
+    if (memcmp(header->magic, OB_SNAPSHOT_MAGIC,
+                sizeof(header->magic)) != 0)
+    {
+        logError("file: "__FILE__", line: %d, "
+                "snapshot file: %s, invalid magic",
+                __LINE__, filename);
+        return EINVAL;
+    }
+
+    crc32c = slice_bin_crc32c(0, header,
+            OB_SNAPSHOT_HEADER_CRC_FIELD_OFFSET);
+    if (header->header_crc32c != crc32c) {
+        logError("file: "__FILE__", line: %d, "
+                "snapshot file: %s, header crc32c: %08x != expect: %08x",
+                __LINE__, filename, header->header_crc32c, crc32c);
+        return EINVAL;
+    }
+
+    if (header->version != OB_SNAPSHOT_VERSION || header->record_size !=
+            sizeof(OBSnapshotRecord))
+    {
+        logError("file: "__FILE__", line: %d, "
+                "snapshot file: %s, unsupported version: %d "
+                "or record size: %d", __LINE__, filename,
+                header->version, header->record_size);
+        return EINVAL;
+    }
+
+    body_size = file_size - sizeof(OBSnapshotHeader);
+    if (body_size != header->slice_count * sizeof(OBSnapshotRecord)) {
+        logError("file: "__FILE__", line: %d, "
+                "snapshot file: %s, body size: %"PRId64" != expect: "
+                "%"PRId64, __LINE__, filename, body_size,
+                (int64_t)(header->slice_count * sizeof(OBSnapshotRecord)));
+        return EINVAL;
+    }
+
+    crc32c = slice_bin_crc32c(0, header + 1, body_size);
+    if (header->body_crc32c != crc32c) {
+        logError("file: "__FILE__", line: %d, "
+                "snapshot file: %s, body crc32c: %08x != expect: %08x",
+                __LINE__, filename, header->body_crc32c, crc32c);
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+static int load_record(const OBSnapshotRecord *record)
+{
+    FSBlockKey bkey;
+    OBSliceEntry *slice;
+
+    if (record->path_index < 0 || record->path_index >
+            STORAGE_CFG.max_store_path_index ||
+            PATHS_BY_INDEX_PPTR[record->path_index] == NULL)
+    {
+        logError("file: "__FILE__", line: %d, "
+                "path_index: %d not exist", __LINE__,
+                record->path_index);
+        return ENOENT;
+    }
+
+    /* the trunk is deleted after its slices migrated to another trunk */
+    if (!storage_allocator_trunk_exists(record->path_index,
+                record->trunk_id))
+    {
+        return 0;
+    }
+
+    bkey.oid = record->oid;
+    bkey.offset = record->block_offset;
+    fs_calc_block_hashcode(&bkey);
+    if ((slice=ob_index_alloc_slice(&bkey)) == NULL) {
+        return ENOMEM;
+    }
+
+    slice->type = record->type;
+    slice->read_offset = record->read_offset;
+    slice->ssize.offset = record->slice_offset;
+    slice->ssize.length = record->slice_length;
+    slice->space.store = &PATHS_BY_INDEX_PPTR[record->path_index]->store;
+    slice->space.id_info.id = record->trunk_id;
+    slice->space.id_info.subdir = record->subdir;
+    slice->space.offset = record->space_offset;
+    slice->space.size = record->space_size;
+    return ob_index_add_slice_by_binlog(slice);
+}
+
+int ob_snapshot_load(SFBinlogFilePosition *position)
+{
+    char filename[PATH_MAX];
+    struct stat stbuf;
+    const OBSnapshotHeader *header;
+    const OBSnapshotRecord *record;
+    const OBSnapshotRecord *end;
+    char *buff;
+    int64_t start_time;
+    int fd;
+    int result;
+
+    start_time = get_current_time_ms();
+    get_snapshot_filename(filename, sizeof(filename));
+    if ((fd=open(filename, O_RDONLY)) < 0) {
+        result = errno != 0 ? errno : EACCES;
+        if (result == ENOENT) {
+            return result;
+        }
+        logError("file: "__FILE__", line: %d, "
+                "open file \"%s\" fail, "
+                "errno: %d, error info: %s",
+                __LINE__, filename, result, STRERROR(result));
+        return result;
+    }
+
+    if (fstat(fd, &stbuf) != 0) {
+        result = errno != 0 ? errno : EACCES;
+        logError("file: "__FILE__", line: %d, "
+                "stat file \"%s\" fail, "
+                "errno: %d, error info: %s",
+                __LINE__, filename, result, STRERROR(result));
+        close(fd);
+        return result;
+    }
+
+    if (stbuf.st_size < sizeof(OBSnapshotHeader)) {
+        close(fd);
+        return check_snapshot(filename, NULL, stbuf.st_size);
+    }
+
+    buff = (char *)mmap(NULL, stbuf.st_size, PROT_READ,
+            MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (buff == MAP_FAILED) {
+        result = errno != 0 ? errno : ENOMEM;
+        logError("file: "__FILE__", line: %d, "
+                "mmap file \"%s\" fail, "
+                "errno: %d, error info: %s",
+                __LINE__, filename, result, STRERROR(result));
+        return result;
+    }
+    madvise(buff, stbuf.st_size, MADV_SEQUENTIAL);
+
+    /* check the whole file before loading, so the caller can
+       fallback to replay the slice binlog from the start */
+    if ((result=check_snapshot(filename, buff, stbuf.st_size)) != 0) {
+        munmap(buff, stbuf.st_size);
+        return result;
+    }
+
+    header = (const OBSnapshotHeader *)buff;
+    record = (const OBSnapshotRecord *)(header + 1);
+    end = record + header->slice_count;
+    for (; record<end; record++) {
+        if ((result=load_record(record)) != 0) {
+            logError("file: "__FILE__", line: %d, "
+                    "snapshot file: %s, record index: %"PRId64", "
+                    "add to index fail, errno: %d", __LINE__, filename,
+                    (int64_t)(record - (const OBSnapshotRecord *)
+                        (header + 1)), result);
+            munmap(buff, stbuf.st_size);
+            return result;
+        }
+    }
+
+    position->index = header->binlog_index;
+    position->offset = header->binlog_offset;
+    ob_snapshot_ctx.last_position = *position;
+    logInfo("file: "__FILE__", line: %d, "
+            "load snapshot file %s done, object block count: %"PRId64", "
+            "slice count: %"PRId64", slice binlog position: "
+            "{index: %d, offset: %"PRId64"}, time used: %"PRId64" ms",
+            __LINE__, filename, header->ob_count, header->slice_count,
+            position->index, position->offset,
+            get_current_time_ms() - start_time);
+
+    munmap(buff, stbuf.st_size);
+    return 0;
+}
+
+static int walk_slice(void *arg, const OBSliceEntry *slice)
+{
+    OBSnapshotBuffer *buffer;
+    OBSnapshotRecord *record;
+    OBSnapshotRecord *records;
+    int alloc;
+
+    buffer = (OBSnapshotBuffer *)arg;
+    if (buffer->count == buffer->alloc) {
+        alloc = buffer->alloc * 2;
+        records = (OBSnapshotRecord *)fc_malloc(
+                sizeof(OBSnapshotRecord) * alloc);
+        if (records == NULL) {
+            return ENOMEM;
+        }
+        memcpy(records, buffer->records, sizeof(OBSnapshotRecord) *
+                buffer->count);
+        free(buffer->records);
+        buffer->records = records;
+        buffer->alloc = alloc;
+    }
+
+    record = buffer->records + buffer->count++;
+    record->oid = slice->ob->bkey.oid;
+    record->block_offset = slice->ob->bkey.offset;
+    record->trunk_id = slice->space.id_info.id;
+    record->space_offset = slice->space.offset;
+    record->space_size = slice->space.size;
+    record->subdir = slice->space.id_info.subdir;
+    record->slice_offset = slice->ssize.offset;
+    record->slice_length = slice->ssize.length;
+    record->read_offset = slice->read_offset;
+    record->path_index = slice->space.store->index;
+    record->type = slice->type;
+    record->padding = 0;
+    return 0;
+}
+
+static int flush_records(OBSnapshotWriter *writer)
+{
+    int bytes;
+    int result;
+
+    if (writer->buffer.count == 0) {
+        return 0;
+    }
+
+    bytes = sizeof(OBSnapshotRecord) * writer->buffer.count;
+    writer->crc32c = slice_bin_crc32c(writer->crc32c,
+            writer->buffer.records, bytes);
+    if (fc_safe_write(writer->fd, (const char *)writer->buffer.records,
+                bytes) != bytes)
+    {
+        result = errno != 0 ? errno : EIO;
+        logError("file: "__FILE__", line: %d, "
+                "write to file \"%s\" fail, "
+                "errno: %d, error info: %s", __LINE__,
+                writer->tmp_filename, result, STRERROR(result));
+        return result;
+    }
+
+    writer->slice_count += writer->buffer.count;
+    writer->buffer.count = 0;
+    return 0;
+}
+
+static int dump_index(OBSnapshotWriter *writer)
+{
+    int64_t bucket_index;
+    int ob_count;
+    int result;
+
+    for (bucket_index=0; bucket_index<g_ob_hashtable.capacity;
+            bucket_index++)
+    {
+        if ((result=ob_index_walk_bucket(&g_ob_hashtable, bucket_index,
+                        walk_slice, &writer->buffer, &ob_count)) != 0)
+        {
+            return result;
+        }
+        writer->ob_count += ob_count;
+
+        if (writer->buffer.count >= OB_SNAPSHOT_FLUSH_RECORDS) {
+            if ((result=flush_records(writer)) != 0) {
+                return result;
+            }
+            if (!SF_G_CONTINUE_FLAG) {
+                return EINTR;
+            }
+        }
+    }
+
+    return flush_records(writer);
+}
+
+static int write_header(OBSnapshotWriter *writer,
+        const SFBinlogFilePosition *position, const int64_t sn)
+{
+    OBSnapshotHeader header;
+    int result;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, OB_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = OB_SNAPSHOT_VERSION;
+    header.record_size = sizeof(OBSnapshotRecord);
+    header.binlog_index = position->index;
+    header.binlog_offset = position->offset;
+    header.binlog_sn = sn;
+    header.create_time = g_current_time;
+    header.ob_count = writer->ob_count;
+    header.slice_count = writer->slice_count;
+    header.body_crc32c = writer->crc32c;
+    header.header_crc32c = slice_bin_crc32c(0, &header,
+            OB_SNAPSHOT_HEADER_CRC_FIELD_OFFSET);
+
+    if (pwrite(writer->fd, &header, sizeof(header), 0) != sizeof(header) ||
+            fsync(writer->fd) != 0)
+    {
+        result = errno != 0 ? errno : EIO;
+        logError("file: "__FILE__", line: %d, "
+                "write to file \"%s\" fail, "
+                "errno: %d, error info: %s", __LINE__,
+                writer->tmp_filename, result, STRERROR(result));
+        return result;
+    }
+
+    return 0;
+}
+
+//make the rename durable before the binlogs removed
+static int fsync_snapshot_path()
+{
+    char path[PATH_MAX];
+    int fd;
+    int result;
+
+    snprintf(path, sizeof(path), "%s/%s", DATA_PATH_STR,
+            FS_SLICE_BINLOG_SUBDIR_NAME);
+    if ((fd=open(path, O_RDONLY)) < 0) {
+        result = errno != 0 ? errno : EACCES;
+        logError("file: "__FILE__", line: %d, "
+                "open path \"%s\" fail, "
+                "errno: %d, error info: %s", __LINE__,
+                path, result, STRERROR(result));
+        return result;
+    }
+
+    if (fsync(fd) != 0) {
+        result = errno != 0 ? errno : EIO;
+        logError("file: "__FILE__", line: %d, "
+                "fsync path \"%s\" fail, "
+                "errno: %d, error info: %s", __LINE__,
+                path, result, STRERROR(result));
+    } else {
+        result = 0;
+    }
+
+    close(fd);
+    return result;
+}
+
+static int do_save(OBSnapshotWriter *writer,
+        const SFBinlogFilePosition *position, const int64_t sn)
+{
+    OBSnapshotHeader header;
+    int result;
+
+    if ((writer->fd=open(writer->tmp_filename, O_WRONLY |
+                    O_CREAT | O_TRUNC, 0644)) < 0)
+    {
+        result = errno != 0 ? errno : EACCES;
+        logError("file: "__FILE__", line: %d, "
+                "open file \"%s\" fail, "
+                "errno: %d, error info: %s", __LINE__,
+                writer->tmp_filename, result, STRERROR(result));
+        return result;
+    }
+
+    //placeholder, rewrite after the records written
+    memset(&header, 0, sizeof(header));
+    if (fc_safe_write(writer->fd, (const char *)&header,
+                sizeof(header)) != sizeof(header))
+    {
+        result = errno != 0 ? errno : EIO;
+        logError("file: "__FILE__", line: %d, "
+                "write to file \"%s\" fail, "
+                "errno: %d, error info: %s", __LINE__,
+                writer->tmp_filename, result, STRERROR(result));
+    } else if ((result=dump_index(writer)) == 0) {
+        result = write_header(writer, position, sn);
+    }
+
+    close(writer->fd);
+    if (result != 0) {
+        return result;
+    }
+
+    if (rename(writer->tmp_filename, writer->filename) != 0) {
+        result = errno != 0 ? errno : EPERM;
+        logError("file: "__FILE__", line: %d, "
+                "rename file \"%s\" to \"%s\" fail, "
+                "errno: %d, error info: %s", __LINE__,
+                writer->tmp_filename, writer->filename,
+                result, STRERROR(result));
+        return result;
+    }
+
+    return fsync_snapshot_path();
+}
+
+int ob_snapshot_save()
+{
+    OBSnapshotWriter writer;
+    SFBinlogFilePosition position;
+    int64_t start_time;
+    int64_t sn;
+    int result;
+
+    /* MUST get the binlog position before dumping, the slices changed
+       during dumping are replayed from this position */
+    sn = __sync_add_and_fetch(&SLICE_BINLOG_SN, 0);
+    if ((result=slice_binlog_get_current_position(&position)) != 0) {
+        return result;
+    }
+    if (position.index == ob_snapshot_ctx.last_position.index &&
+            position.offset == ob_snapshot_ctx.last_position.offset)
+    {
+        return 0;  //no change
+    }
+
+    start_time = get_current_time_ms();
+    memset(&writer, 0, sizeof(writer));
+    get_snapshot_filename(writer.filename, sizeof(writer.filename));
+    snprintf(writer.tmp_filename, sizeof(writer.tmp_filename),
+            "%s.tmp", writer.filename);
+    writer.buffer.alloc = OB_SNAPSHOT_FLUSH_RECORDS * 2;
+    writer.buffer.records = (OBSnapshotRecord *)fc_malloc(
+            sizeof(OBSnapshotRecord) * writer.buffer.alloc);
+    if (writer.buffer.records == NULL) {
+        return ENOMEM;
+    }
+
+    result = do_save(&writer, &position, sn);
+    free(writer.buffer.records);
+    if (result != 0) {
+        unlink(writer.tmp_filename);
+        return result;
+    }
+
+    ob_snapshot_ctx.last_position = position;
+    logInfo("file: "__FILE__", line: %d, "
+            "save snapshot file %s done, object block count: %"PRId64", "
+            "slice count: %"PRId64", slice binlog position: "
+            "{index: %d, offset: %"PRId64"}, time used: %"PRId64" ms",
+            __LINE__, writer.filename, writer.ob_count, writer.slice_count,
+            position.index, position.offset,
+            get_current_time_ms() - start_time);
+
+    if (STORAGE_CFG.object_block.snapshot_remove_binlogs) {
+        slice_binlog_remove_files_before(position.index);
+    }
+    return 0;
+}
+
+int ob_snapshot_remove()
+{
+    char filename[PATH_MAX];
+    int result;
+
+    get_snapshot_filename(filename, sizeof(filename));
+    if (unlink(filename) != 0) {
+        result = errno != 0 ? errno : EPERM;
+        if (result == ENOENT) {
+            return 0;
+        }
+        logError("file: "__FILE__", line: %d, "
+                "unlink file \"%s\" fail, "
+                "errno: %d, error info: %s",
+                __LINE__, filename, result, STRERROR(result));
+        return result;
+    }
+
+    logInfo("file: "__FILE__", line: %d, "
+            "snapshot file %s removed", __LINE__, filename);
+    return 0;
+}
+
+static void *ob_snapshot_thread_func(void *arg)
+{
+    time_t next_time;
+
+    next_time = g_current_time + STORAGE_CFG.object_block.snapshot_interval;
+    while (SF_G_CONTINUE_FLAG) {
+        if (g_current_time < next_time) {
+            sleep(1);
+            continue;
+        }
+
+        if (ob_snapshot_save() != 0) {
+            //retry later
+            next_time = g_current_time + 60;
+        } else {
+            next_time = g_current_time +
+                STORAGE_CFG.object_block.snapshot_interval;
+        }
+    }
+
+    return NULL;
+}
+
+int ob_snapshot_init()
+{
+    if (STORAGE_CFG.object_block.snapshot_interval <= 0) {
+        return 0;
+    }
+
+    return fc_create_thread(&ob_snapshot_ctx.tid, ob_snapshot_thread_func,
+            NULL, SF_G_THREAD_STACK_SIZE);
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//object_block_snapshot.h
+
+/* the snapshot of the object block index for fast startup
+ *
+ * the snapshot is saved without blocking the writers: the slice binlog
+ * position is fetched first, then the buckets are dumped one by one under
+ * the bucket lock. the slices changed during dumping are also in the slice
+ * binlog after the position, and the replaying of the slice binlog is
+ * idempotent, so loading the snapshot then replaying the binlog from the
+ * position rebuilds the same index.
+ *
+ * the file is the header followed by the fixed size records in host byte
+ * order, so the loader can mmap it and access the records directly.
+ */
+
+#ifndef _OBJECT_BLOCK_SNAPSHOT_H
+#define _OBJECT_BLOCK_SNAPSHOT_H
+
+#include "sf/sf_binlog_writer.h"
+#include "../server_types.h"
+
+#define OB_SNAPSHOT_FILENAME       "index.snapshot"
+#define OB_SNAPSHOT_MAGIC          "FSOBSNAP"
+#define OB_SNAPSHOT_VERSION        1
+
+typedef struct ob_snapshot_header {
+    char magic[8];
+    int version;
+    int record_size;
+    int64_t binlog_index;    //the slice binlog position to replay from
+    int64_t binlog_offset;
+    int64_t binlog_sn;       //the slice binlog sn when saving
+    int64_t create_time;
+    int64_t ob_count;
+    int64_t slice_count;
+    uint32_t body_crc32c;    //of the records
+    uint32_t header_crc32c;  //of the fields above
+} OBSnapshotHeader;
+
+typedef struct ob_snapshot_record {
+    int64_t oid;
+    int64_t block_offset;
+    int64_t trunk_id;
+    int64_t space_offset;
+    uint32_t space_size;
+    uint32_t subdir;
+    int32_t slice_offset;
+    int32_t slice_length;
+    int32_t read_offset;
+    int16_t path_index;
+    char type;
+    char padding;
+} OBSnapshotRecord;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /* load the snapshot to the object block index
+       return ENOENT when the snapshot not exist */
+    int ob_snapshot_load(SFBinlogFilePosition *position);
+
+    //start the thread to save the snapshot periodically
+    int ob_snapshot_init();
+
+    //save the snapshot, called by the snapshot thread
+    int ob_snapshot_save();
+
+    //remove the snapshot when the slice binlog rewritten
+    int ob_snapshot_remove();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
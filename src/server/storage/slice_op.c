@@ -44,6 +44,24 @@
         } \
     } while (0)
 
+//the IO class for the scheduling of the trunk IO threads
+static inline int get_io_class(FSSliceOpContext *op_ctx, const bool is_read)
+{
+    if (op_ctx->data_op == NULL) {
+        return FS_IO_CLASS_BACKGROUND;
+    }
+
+    switch (op_ctx->data_op->source) {
+        case DATA_SOURCE_SLAVE_REPLICA:
+            return FS_IO_CLASS_REPLICATION;
+        case DATA_SOURCE_SLAVE_RECOVERY:
+            return FS_IO_CLASS_RECOVERY;
+        default:
+            return is_read ? FS_IO_CLASS_CLIENT_READ :
+                FS_IO_CLASS_CLIENT_WRITE;
+    }
+}
+
 static int realloc_slice_sn_pairs(FSSliceSNPairArray *parray,
         const int capacity)
 {
@@ -196,7 +214,7 @@ static void slice_write_done(struct trunk_io_buffer *record, const int result)
 
     if (__sync_sub_and_fetch(&op_ctx->counter, 1) == 0) {
         slice_write_finish(op_ctx);
-        data_thread_notify(op_ctx->data_thread_ctx);
+        data_thread_notify(op_ctx);
     }
 }
 
@@ -308,8 +326,9 @@ int fs_slice_write_ex(FSSliceOpContext *op_ctx, const bool reclaim_alloc)
     op_ctx->counter = op_ctx->update.sarray.count;
     if (op_ctx->update.sarray.count == 1) {
         result = io_thread_push_slice_op(FS_IO_TYPE_WRITE_SLICE,
-                            op_ctx->update.sarray.slice_sn_pairs[0].slice,
-                            op_ctx->info.buff, slice_write_done, op_ctx);
+                get_io_class(op_ctx, false), op_ctx->update.sarray.
+                slice_sn_pairs[0].slice, op_ctx->info.buff,
+                slice_write_done, op_ctx);
     } else {
         int length;
         char *ps;
@@ -322,8 +341,8 @@ int fs_slice_write_ex(FSSliceOpContext *op_ctx, const bool reclaim_alloc)
         {
             length = slice_sn_pair->slice->ssize.length;
             if ((result=io_thread_push_slice_op(FS_IO_TYPE_WRITE_SLICE,
-                            slice_sn_pair->slice, ps, slice_write_done,
-                            op_ctx)) != 0)
+                            get_io_class(op_ctx, false), slice_sn_pair->
+                            slice, ps, slice_write_done, op_ctx)) != 0)
             {
                 break;
             }
@@ -334,6 +353,197 @@ int fs_slice_write_ex(FSSliceOpContext *op_ctx, const bool reclaim_alloc)
     return result;
 }
 
+static void merged_write_finish(FSSliceWriteMerger *merger)
+{
+    FSSliceOpContext *op_ctx;
+    int i;
+
+    for (i=0; i<merger->slice_count; i++) {
+        ob_index_free_slice(merger->slices[i]);
+    }
+
+    //add to the index and set the data versions in the write order
+    for (i=0; i<merger->count; i++) {
+        op_ctx = merger->op_ctxs[i];
+        op_ctx->result = merger->result;
+        if (op_ctx->result == 0) {
+            op_ctx->done_bytes = op_ctx->info.bs_key.slice.length;
+        }
+        slice_write_finish(op_ctx);
+    }
+
+    for (i=0; i<merger->count; i++) {
+        data_thread_notify(merger->op_ctxs[i]);
+    }
+    fast_mblock_free_object(merger->allocator, merger);
+}
+
+static void merged_write_done(struct trunk_io_buffer *record,
+        const int result)
+{
+    FSSliceWriteMerger *merger;
+
+    merger = (FSSliceWriteMerger *)record->notify.arg;
+    if (result != 0) {
+        __sync_bool_compare_and_swap(&merger->result, 0, result);
+    }
+
+    if (__sync_sub_and_fetch(&merger->counter, 1) == 0) {
+        merged_write_finish(merger);
+    }
+}
+
+static void free_merged_slices(FSSliceWriteMerger *merger)
+{
+    int i;
+
+    for (i=0; i<merger->count; i++) {
+        free_slice_array(&merger->op_ctxs[i]->update.sarray);
+    }
+    for (i=0; i<merger->slice_count; i++) {
+        ob_index_free_slice(merger->slices[i]);
+    }
+    merger->slice_count = 0;
+}
+
+/* split the write range to the parts of the merged spaces, the space
+   padding after the merged data belongs to the last part of the space */
+static int alloc_merged_slices(FSSliceWriteMerger *merger,
+        FSSliceOpContext *op_ctx, const FSTrunkSpaceInfo *spaces,
+        const int *space_lengths, const int space_count)
+{
+    FSTrunkSpaceInfo space;
+    OBSliceEntry *slice;
+    int space_start;
+    int start;
+    int end;
+    int part_start;
+    int part_end;
+    int i;
+
+    start = op_ctx->info.bs_key.slice.offset -
+        merger->bs_key.slice.offset;
+    end = start + op_ctx->info.bs_key.slice.length;
+    space_start = 0;
+    for (i=0; i<space_count; i++) {
+        part_start = FC_MAX(start, space_start);
+        part_end = FC_MIN(end, space_start + space_lengths[i]);
+        if (part_start < part_end) {
+            space = spaces[i];
+            space.offset += part_start - space_start;
+            if (part_end == space_start + space_lengths[i]) {
+                space.size -= part_start - space_start;
+            } else {
+                space.size = part_end - part_start;
+            }
+
+            slice = alloc_init_slice(&merger->bs_key.block, &space,
+                    OB_SLICE_TYPE_FILE, merger->bs_key.slice.offset +
+                    part_start, part_end - part_start);
+            if (slice == NULL) {
+                return ENOMEM;
+            }
+            op_ctx->update.sarray.slice_sn_pairs[op_ctx->
+                update.sarray.count++].slice = slice;
+        }
+        space_start += space_lengths[i];
+    }
+
+    return 0;
+}
+
+int fs_slice_write_merged(FSSliceWriteMerger *merger)
+{
+    FSTrunkSpaceInfo spaces[FS_MAX_SPLIT_COUNT_PER_SPACE_ALLOC];
+    int space_lengths[FS_MAX_SPLIT_COUNT_PER_SPACE_ALLOC];
+    FSSliceOpContext *op_ctx;
+    OBSliceEntry *slice;
+    int space_count;
+    int offset;
+    int remain;
+    int io_class;
+    int result;
+    int i;
+
+    if ((result=storage_allocator_normal_alloc(FS_BLOCK_HASH_CODE(
+                        merger->bs_key.block), merger->bs_key.slice.length,
+                    spaces, &space_count)) != 0)
+    {
+        return result;
+    }
+
+    merger->slice_count = 0;
+    offset = merger->bs_key.slice.offset;
+    remain = merger->bs_key.slice.length;
+    for (i=0; i<space_count; i++) {
+        space_lengths[i] = (spaces[i].size < remain ?
+                spaces[i].size : remain);
+        if ((slice=alloc_init_slice(&merger->bs_key.block, spaces + i,
+                        OB_SLICE_TYPE_FILE, offset, space_lengths[i])) == NULL)
+        {
+            result = ENOMEM;
+            break;
+        }
+        merger->slices[merger->slice_count++] = slice;
+        offset += space_lengths[i];
+        remain -= space_lengths[i];
+    }
+
+    for (i=0; i<merger->count; i++) {
+        op_ctx = merger->op_ctxs[i];
+        op_ctx->result = 0;
+        op_ctx->done_bytes = 0;
+        op_ctx->update.space_changed = 0;
+        op_ctx->update.sarray.count = 0;
+        if (result == 0) {
+            result = alloc_merged_slices(merger, op_ctx, spaces,
+                    space_lengths, space_count);
+        }
+    }
+
+    if (result != 0) {
+        free_merged_slices(merger);
+        return result;
+    }
+
+    for (i=0; i<merger->count; i++) {
+        op_ctx = merger->op_ctxs[i];
+        memcpy(merger->buff + (op_ctx->info.bs_key.slice.offset -
+                    merger->bs_key.slice.offset), op_ctx->info.buff,
+                op_ctx->info.bs_key.slice.length);
+    }
+
+    merger->result = 0;
+    merger->counter = merger->slice_count;
+    io_class = get_io_class(merger->op_ctxs[0], false);
+    for (i=0; i<merger->slice_count; i++) {
+        if ((result=io_thread_push_slice_op(FS_IO_TYPE_WRITE_SLICE,
+                        io_class, merger->slices[i], merger->buff + (merger->
+                            slices[i]->ssize.offset - merger->bs_key.
+                            slice.offset), merged_write_done, merger)) != 0)
+        {
+            break;
+        }
+    }
+
+    if (i < merger->slice_count) {
+        if (i == 0) {
+            free_merged_slices(merger);
+            return result;
+        }
+
+        //the writes pushed finish the merger with the error
+        __sync_bool_compare_and_swap(&merger->result, 0, result);
+        if (__sync_sub_and_fetch(&merger->counter,
+                    merger->slice_count - i) == 0)
+        {
+            merged_write_finish(merger);
+        }
+    }
+
+    return 0;
+}
+
 static int get_slice_index_holes(const FSBlockSliceKeyInfo *bs_key,
         OBSlicePtrArray *sarray, FSSliceSize *ssizes,
         const int max_size, int *count)
@@ -547,11 +757,18 @@ int fs_log_slice_allocate(FSSliceOpContext *op_ctx)
     return 0;
 }
 
+static inline void read_done_release(FSSliceOpContext *op_ctx)
+{
+    if (__sync_sub_and_fetch(&op_ctx->counter, 1) == 0) {
+        data_thread_notify(op_ctx);
+    }
+}
+
 static void do_read_done(OBSliceEntry *slice, FSSliceOpContext *op_ctx,
         const int result)
 {
     if (result == 0) {
-        op_ctx->done_bytes += slice->ssize.length;
+        __sync_add_and_fetch(&op_ctx->done_bytes, slice->ssize.length);
     } else {
         op_ctx->result = result;
     }
@@ -563,9 +780,7 @@ static void do_read_done(OBSliceEntry *slice, FSSliceOpContext *op_ctx,
             */
 
     ob_index_free_slice(slice);
-    if (__sync_sub_and_fetch(&op_ctx->counter, 1) == 0) {
-        data_thread_notify(op_ctx->data_thread_ctx);
-    }
+    read_done_release(op_ctx);
 }
 
 static void slice_read_done(struct trunk_io_buffer *record, const int result)
@@ -573,13 +788,204 @@ static void slice_read_done(struct trunk_io_buffer *record, const int result)
     do_read_done(record->slice, (FSSliceOpContext *)record->notify.arg, result);
 }
 
+static void merged_read_done(struct trunk_io_buffer *record, const int result)
+{
+    FSSliceOpContext *op_ctx;
+    OBSliceEntry **pp;
+    OBSliceEntry **end;
+    int bytes;
+
+    op_ctx = (FSSliceOpContext *)record->notify.arg;
+    bytes = 0;
+    end = record->merged.slices + record->merged.count;
+    for (pp=record->merged.slices; pp<end; pp++) {
+        bytes += (*pp)->ssize.length;
+        ob_index_free_slice(*pp);
+    }
+
+    if (result == 0) {
+        __sync_add_and_fetch(&op_ctx->done_bytes, bytes);
+    } else {
+        op_ctx->result = result;
+    }
+    read_done_release(op_ctx);
+}
+
+#define SLICE_READ_POS(slice) ((slice)->space.offset + (slice)->read_offset)
+
+//the max iovecs of a merged read, including the gaps
+#define READ_MERGE_MAX_IOVECS  256
+
+static int compare_slice_by_space(const OBSliceEntry **s1,
+        const OBSliceEntry **s2)
+{
+    int sub;
+
+    if ((sub=(*s1)->space.store->index - (*s2)->space.store->index) != 0) {
+        return sub;
+    }
+    if ((sub=fc_compare_int64((*s1)->space.id_info.id,
+                    (*s2)->space.id_info.id)) != 0)
+    {
+        return sub;
+    }
+    return fc_compare_int64(SLICE_READ_POS(*s1), SLICE_READ_POS(*s2));
+}
+
+static int check_alloc_read_iovecs(FSSliceOpContext *op_ctx, const int count)
+{
+    struct iovec *iovs;
+    int alloc;
+
+    if (op_ctx->read_iovecs.alloc >= count) {
+        return 0;
+    }
+
+    alloc = (op_ctx->read_iovecs.alloc > 0) ?
+        op_ctx->read_iovecs.alloc : 64;
+    while (alloc < count) {
+        alloc *= 2;
+    }
+    iovs = (struct iovec *)fc_malloc(sizeof(struct iovec) * alloc);
+    if (iovs == NULL) {
+        return ENOMEM;
+    }
+
+    if (op_ctx->read_iovecs.iovs != NULL) {
+        free(op_ctx->read_iovecs.iovs);
+    }
+    op_ctx->read_iovecs.iovs = iovs;
+    op_ctx->read_iovecs.alloc = alloc;
+    return 0;
+}
+
+static inline bool can_merge_slice(const OBSliceEntry *first,
+        const OBSliceEntry *slice, const int64_t read_end,
+        const int iovcnt)
+{
+    int64_t gap;
+
+    if (!(slice->space.store == first->space.store &&
+                slice->space.id_info.id == first->space.id_info.id))
+    {
+        return false;
+    }
+
+    gap = SLICE_READ_POS(slice) - read_end;
+    return (gap >= 0 && gap <= STORAGE_CFG.read_merge_max_gap &&
+            iovcnt + 2 <= READ_MERGE_MAX_IOVECS &&
+            (SLICE_READ_POS(slice) + slice->ssize.length) -
+            SLICE_READ_POS(first) <= FS_FILE_BLOCK_SIZE);
+}
+
+/* the slices are sorted by the trunk space, the slices near each other in
+   a trunk file are read by one preadv, scattered to the read buffer */
+static int push_merged_reads(FSSliceOpContext *op_ctx,
+        OBSliceEntry **slices, const int count)
+{
+    OBSliceEntry **start;
+    OBSliceEntry **pp;
+    OBSliceEntry **end;
+    struct iovec *first_iov;
+    struct iovec *iov;
+    int64_t read_end;
+    int64_t gap;
+    int io_class;
+    int result;
+
+    if ((result=check_alloc_read_iovecs(op_ctx, 2 * count)) != 0) {
+        return result;
+    }
+
+    qsort(slices, count, sizeof(OBSliceEntry *), (int (*)(const void *,
+                    const void *))compare_slice_by_space);
+
+    io_class = get_io_class(op_ctx, true);
+    iov = op_ctx->read_iovecs.iovs;
+    end = slices + count;
+    for (start=slices; start<end; start=pp) {
+        first_iov = iov;
+        iov->iov_base = op_ctx->info.buff + ((*start)->ssize.offset -
+                op_ctx->info.bs_key.slice.offset);
+        iov->iov_len = (*start)->ssize.length;
+        iov++;
+
+        read_end = SLICE_READ_POS(*start) + (*start)->ssize.length;
+        for (pp=start + 1; pp<end; pp++) {
+            if (!can_merge_slice(*start, *pp, read_end, iov - first_iov)) {
+                break;
+            }
+
+            if ((gap=SLICE_READ_POS(*pp) - read_end) > 0) {
+                iov->iov_base = g_trunk_io_gap_buffer;
+                iov->iov_len = gap;
+                iov++;
+            }
+            iov->iov_base = op_ctx->info.buff + ((*pp)->ssize.offset -
+                    op_ctx->info.bs_key.slice.offset);
+            iov->iov_len = (*pp)->ssize.length;
+            iov++;
+            read_end = SLICE_READ_POS(*pp) + (*pp)->ssize.length;
+        }
+
+        __sync_add_and_fetch(&op_ctx->counter, 1);
+        if (pp - start == 1) {
+            result = io_thread_push_slice_op(FS_IO_TYPE_READ_SLICE,
+                    io_class, *start, first_iov->iov_base,
+                    slice_read_done, op_ctx);
+        } else {
+            result = io_thread_push_merged_read(io_class, start, pp - start,
+                    first_iov, iov - first_iov, read_end -
+                    SLICE_READ_POS(*start), merged_read_done, op_ctx);
+        }
+
+        if (result != 0) {
+            __sync_sub_and_fetch(&op_ctx->counter, 1);
+            for (pp=start; pp<end; pp++) {
+                ob_index_free_slice(*pp);
+            }
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+static int push_slice_reads(FSSliceOpContext *op_ctx,
+        OBSliceEntry **slices, const int count)
+{
+    OBSliceEntry **pp;
+    OBSliceEntry **end;
+    int result;
+
+    end = slices + count;
+    for (pp=slices; pp<end; pp++) {
+        __sync_add_and_fetch(&op_ctx->counter, 1);
+        if ((result=io_thread_push_slice_op(FS_IO_TYPE_READ_SLICE,
+                        get_io_class(op_ctx, true), *pp,
+                        op_ctx->info.buff + ((*pp)->ssize.offset -
+                            op_ctx->info.bs_key.slice.offset),
+                        slice_read_done, op_ctx)) != 0)
+        {
+            __sync_sub_and_fetch(&op_ctx->counter, 1);
+            for (; pp<end; pp++) {
+                ob_index_free_slice(*pp);
+            }
+            return result;
+        }
+    }
+
+    return 0;
+}
+
 int fs_slice_read(FSSliceOpContext *op_ctx)
 {
     int result;
     int offset;
     int hole_len;
-    FSSliceSize ssize;
+    int file_count;
     char *ps;
+    OBSliceEntry **slices;
     OBSliceEntry **pp;
     OBSliceEntry **end;
 
@@ -596,43 +1002,49 @@ int fs_slice_read(FSSliceOpContext *op_ctx)
             op_ctx->info.bs_key.slice.length);
             */
 
+    /* fill the holes and the allocated slices first, and the file slices
+       are moved to the front of the array to read */
     op_ctx->done_bytes = 0;
-    op_ctx->counter = op_ctx->slice_ptr_array.count;
+    file_count = 0;
+    slices = op_ctx->slice_ptr_array.slices;
     ps = op_ctx->info.buff;
     offset = op_ctx->info.bs_key.slice.offset;
-    end = op_ctx->slice_ptr_array.slices + op_ctx->slice_ptr_array.count;
-    for (pp=op_ctx->slice_ptr_array.slices; pp<end; pp++) {
+    end = slices + op_ctx->slice_ptr_array.count;
+    for (pp=slices; pp<end; pp++) {
         hole_len = (*pp)->ssize.offset - offset;
         if (hole_len > 0) {
             memset(ps, 0, hole_len);
             ps += hole_len;
             op_ctx->done_bytes += hole_len;
-
-            /*
-            logInfo("slice %d. type: %c (0x%02x), ref_count: %d, "
-                    "slice offset: %d, length: %d, total offset: %d, hole_len: %d",
-                    (int)(pp - op_ctx->slice_ptr_array.slices), (*pp)->type,
-                    (*pp)->type, __sync_add_and_fetch(&(*pp)->ref_count, 0),
-                    (*pp)->ssize.offset, (*pp)->ssize.length, offset, hole_len);
-                    */
         }
 
-        ssize = (*pp)->ssize;
+        ps += (*pp)->ssize.length;
+        offset = (*pp)->ssize.offset + (*pp)->ssize.length;
         if ((*pp)->type == OB_SLICE_TYPE_ALLOC) {
-            memset(ps, 0, (*pp)->ssize.length);
-            do_read_done(*pp, op_ctx, 0);
-        } else if ((result=io_thread_push_slice_op(FS_IO_TYPE_READ_SLICE,
-                        *pp, ps, slice_read_done, op_ctx)) != 0)
-        {
+            memset(ps - (*pp)->ssize.length, 0, (*pp)->ssize.length);
+            op_ctx->done_bytes += (*pp)->ssize.length;
             ob_index_free_slice(*pp);
-            break;
+        } else {
+            slices[file_count++] = *pp;
         }
+    }
 
-        ps += ssize.length;
-        offset = ssize.offset + ssize.length;
+    //the guard released after all reads pushed
+    op_ctx->result = 0;
+    op_ctx->counter = 1;
+    if (file_count > 1 && STORAGE_CFG.read_merge_max_gap >= 0) {
+        result = push_merged_reads(op_ctx, slices, file_count);
+    } else {
+        result = push_slice_reads(op_ctx, slices, file_count);
     }
 
-    return result;
+    /* the reads pushed before the fail are in flight, so the error is
+       reported once by the last completion after all of them done */
+    if (result != 0) {
+        op_ctx->result = result;
+    }
+    read_done_release(op_ctx);
+    return 0;
 }
 
 int fs_delete_slices(FSSliceOpContext *op_ctx)
@@ -17,10 +17,28 @@
 #ifndef _SLICE_OP_H
 #define _SLICE_OP_H
 
+#include "fastcommon/fast_mblock.h"
 #include "../../common/fs_types.h"
 #include "object_block_index.h"
 #include "storage_config.h"
 
+//the max adjacent writes merged as one disk write
+#define FS_SLICE_WRITE_MERGE_MAX_OPS  64
+
+/* the adjacent writes of the same block which share one space
+   allocation and one disk write */
+typedef struct fs_slice_write_merger {
+    int count;
+    FSSliceOpContext *op_ctxs[FS_SLICE_WRITE_MERGE_MAX_OPS];  //by offset
+    FSBlockSliceKeyInfo bs_key;  //the merged range
+    volatile int counter;  //the IO in progress
+    volatile int result;
+    int slice_count;
+    OBSliceEntry *slices[FS_MAX_SPLIT_COUNT_PER_SPACE_ALLOC]; //for IO only
+    struct fast_mblock_man *allocator;  //the merger is freed after done
+    char *buff;  //the merged data
+} FSSliceWriteMerger;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -45,6 +63,15 @@ extern "C" {
         }
     }
 
+    static inline void fs_free_read_iovecs(FSSliceOpContext *op_ctx)
+    {
+        if (op_ctx->read_iovecs.iovs != NULL) {
+            free(op_ctx->read_iovecs.iovs);
+            op_ctx->read_iovecs.iovs = NULL;
+            op_ctx->read_iovecs.alloc = 0;
+        }
+    }
+
     int fs_slice_write_ex(FSSliceOpContext *op_ctx, const bool reclaim_alloc);
 
     static inline int fs_slice_write(FSSliceOpContext *op_ctx)
@@ -53,6 +80,11 @@ extern "C" {
         return fs_slice_write_ex(op_ctx, reclaim_alloc);
     }
 
+    /* write the data of the adjacent writes to one allocated space,
+       the slices of each write are the parts of the space, and the
+       writes are finished in order when the disk write done */
+    int fs_slice_write_merged(FSSliceWriteMerger *merger);
+
     int fs_slice_allocate(FSSliceOpContext *op_ctx);
 
     int fs_slice_read(FSSliceOpContext *op_ctx);
@@ -83,6 +83,13 @@ extern "C" {
                 allocators[path_index], id_info->id);
     }
 
+    static inline bool storage_allocator_trunk_exists(const int path_index,
+            const int64_t trunk_id)
+    {
+        return trunk_allocator_exists(g_allocator_mgr->allocator_ptr_array.
+                allocators[path_index], trunk_id);
+    }
+
     static inline int storage_allocator_normal_alloc(const uint32_t blk_hc,
             const int size, FSTrunkSpaceInfo *space_info, int *count)
     {
@@ -113,6 +120,23 @@ extern "C" {
                 size, space_info, count);
     }
 
+    //for migrating the slices from the write cache to the store paths
+    static inline int storage_allocator_store_path_alloc(
+            const uint32_t blk_hc, const int size,
+            FSTrunkSpaceInfo *space_info, int *count)
+    {
+        FSTrunkAllocator **allocator;
+
+        if (g_allocator_mgr->store_path.avail.count == 0) {
+            return ENOENT;
+        }
+
+        allocator = g_allocator_mgr->store_path.avail.allocators +
+            blk_hc % g_allocator_mgr->store_path.avail.count;
+        return trunk_allocator_normal_alloc(*allocator, blk_hc,
+                size, space_info, count);
+    }
+
     static inline int storage_allocator_add_slice(OBSliceEntry *slice,
             const bool modify_used_space)
     {
@@ -141,6 +165,14 @@ extern "C" {
         return trunk_allocator_delete_slice(allocator, slice);
     }
 
+    //give back the space of the slice which NOT added to the index
+    static inline int storage_allocator_free_space(
+            const FSTrunkSpaceInfo *space)
+    {
+        return trunk_allocator_free(g_allocator_mgr->allocator_ptr_array.
+                allocators[space->store->index], space);
+    }
+
 #ifdef __cplusplus
 }
 #endif
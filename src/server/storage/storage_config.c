@@ -65,6 +65,77 @@ static int ini_get_ratio_value(const char *storage_filename,
     return 0;
 }
 
+static int ini_get_io_engine(const char *storage_filename,
+        IniContext *ini_context, const char *section_name,
+        int *io_engine, const int default_value)
+{
+    char *value;
+
+    value = iniGetStrValue(section_name, "io_engine", ini_context);
+    if (value == NULL || *value == '\0') {
+        *io_engine = default_value;
+    } else if (strcasecmp(value, "thread") == 0) {
+        *io_engine = FS_IO_ENGINE_THREAD;
+    } else if (strcasecmp(value, "io_uring") == 0) {
+        *io_engine = FS_IO_ENGINE_IO_URING;
+    } else {
+        logError("file: "__FILE__", line: %d, "
+                "config file: %s, item: io_engine, value: %s is invalid, "
+                "expect: thread or io_uring", __LINE__,
+                storage_filename, value);
+        return EINVAL;
+    }
+
+#ifndef OS_HAVE_IO_URING
+    if (*io_engine == FS_IO_ENGINE_IO_URING) {
+        logWarning("file: "__FILE__", line: %d, "
+                "config file: %s, io_uring NOT supported by this build, "
+                "fallback to thread io engine", __LINE__, storage_filename);
+        *io_engine = FS_IO_ENGINE_THREAD;
+    }
+#endif
+
+    return 0;
+}
+
+static int ini_get_durability(const char *storage_filename,
+        IniContext *ini_context, const char *section_name,
+        FSDurabilityConfig *durability, const FSDurabilityConfig *def)
+{
+    char *value;
+
+    value = iniGetStrValue(section_name, "durability_mode", ini_context);
+    if (value == NULL || *value == '\0') {
+        durability->mode = def->mode;
+    } else if (strcasecmp(value, "none") == 0) {
+        durability->mode = FS_DURABILITY_MODE_NONE;
+    } else if (strcasecmp(value, "periodic") == 0) {
+        durability->mode = FS_DURABILITY_MODE_PERIODIC;
+    } else if (strcasecmp(value, "group_commit") == 0) {
+        durability->mode = FS_DURABILITY_MODE_GROUP_COMMIT;
+    } else {
+        logError("file: "__FILE__", line: %d, "
+                "config file: %s, item: durability_mode, value: %s "
+                "is invalid, expect: none, periodic or group_commit",
+                __LINE__, storage_filename, value);
+        return EINVAL;
+    }
+
+    durability->fsync_interval = iniGetIntValue(section_name,
+            "fsync_interval", ini_context, def->fsync_interval);
+    if (durability->fsync_interval <= 0) {
+        durability->fsync_interval = FS_DEFAULT_FSYNC_INTERVAL;
+    }
+
+    durability->group_window = iniGetIntValue(section_name,
+            "fsync_group_window", ini_context, def->group_window);
+    if (durability->group_window < 0) {
+        durability->group_window = 0;
+    }
+
+    return 0;
+}
+
 static int load_one_path(FSStorageConfig *storage_cfg,
         const char *storage_filename, IniContext *ini_context,
         const char *section_name, string_t *path)
@@ -166,6 +237,28 @@ int storage_config_calc_path_avail_space(FSStoragePathInfo *path_info)
     return 0;
 }
 
+double storage_config_calc_path_usage(FSStoragePathInfo *path_info)
+{
+    int64_t disk_avail;
+    int64_t total;
+    int64_t used;
+
+    storage_config_calc_path_avail_space(path_info);
+    disk_avail = path_info->space_stat.avail - path_info->reserved_space.value;
+    if (disk_avail < 0) {
+        disk_avail = 0;
+    }
+
+    total = path_info->trunk_stat.total + disk_avail;
+    if (total <= 0) {
+        return 0.00;
+    }
+
+    //the allocated space of the trunks including the garbage space
+    used = path_info->trunk_stat.total - path_info->trunk_stat.avail;
+    return (double)used / (double)total;
+}
+
 void storage_config_stat_path_spaces(FSClusterServerSpaceStat *ss)
 {
     FSStoragePathInfo **pp;
@@ -268,6 +361,26 @@ static int load_paths(FSStorageConfig *storage_cfg,
             parray->paths[i].prealloc_trunks = 2;
         }
 
+        if ((result=ini_get_io_engine(storage_filename, ini_context,
+                        section_name, &parray->paths[i].io_engine,
+                        storage_cfg->io_engine)) != 0)
+        {
+            return result;
+        }
+
+        parray->paths[i].direct_io = iniGetBoolValue(section_name,
+                "direct_io", ini_context, storage_cfg->direct_io);
+
+        parray->paths[i].rotational = iniGetBoolValue(section_name,
+                "rotational", ini_context, storage_cfg->rotational);
+
+        if ((result=ini_get_durability(storage_filename, ini_context,
+                        section_name, &parray->paths[i].durability,
+                        &storage_cfg->durability)) != 0)
+        {
+            return result;
+        }
+
         if ((result=ini_get_ratio_value(storage_filename, ini_context,
                         section_name, "reserved_space",
                         &parray->paths[i].reserved_space.ratio,
@@ -293,7 +406,12 @@ static int load_global_items(FSStorageConfig *storage_cfg,
     int result;
     char *tf_size;
     char *discard_size;
+    char *reclaim_speed;
+    char *defrag_speed;
+    char *merge_gap;
+    FSDurabilityConfig durability;
     int64_t trunk_file_size;
+    int64_t read_merge_max_gap;
     int64_t discard_remain_space_size;
 
     storage_cfg->fd_cache_capacity_per_read_thread = iniGetIntValue(NULL,
@@ -302,6 +420,50 @@ static int load_global_items(FSStorageConfig *storage_cfg,
         storage_cfg->fd_cache_capacity_per_read_thread = 256;
     }
 
+    if ((result=ini_get_io_engine(storage_filename, ini_context, NULL,
+                    &storage_cfg->io_engine, FS_IO_ENGINE_THREAD)) != 0)
+    {
+        return result;
+    }
+
+    storage_cfg->direct_io = iniGetBoolValue(NULL,
+            "direct_io", ini_context, false);
+
+    storage_cfg->rotational = iniGetBoolValue(NULL,
+            "rotational", ini_context, false);
+
+    durability.mode = FS_DURABILITY_MODE_NONE;
+    durability.fsync_interval = FS_DEFAULT_FSYNC_INTERVAL;
+    durability.group_window = FS_DEFAULT_FSYNC_GROUP_WINDOW;
+    if ((result=ini_get_durability(storage_filename, ini_context, NULL,
+                    &storage_cfg->durability, &durability)) != 0)
+    {
+        return result;
+    }
+
+    storage_cfg->io_uring_queue_depth = iniGetIntValue(NULL,
+            "io_uring_queue_depth", ini_context, 256);
+    if (storage_cfg->io_uring_queue_depth <= 0) {
+        storage_cfg->io_uring_queue_depth = 256;
+    }
+
+    merge_gap = iniGetStrValue(NULL, "read_merge_max_gap", ini_context);
+    if (merge_gap == NULL || *merge_gap == '\0') {
+        read_merge_max_gap = FS_DEFAULT_READ_MERGE_MAX_GAP;
+    } else if ((result=parse_bytes(merge_gap, 1,
+                    &read_merge_max_gap)) != 0)
+    {
+        return result;
+    } else if (read_merge_max_gap < 0) {
+        read_merge_max_gap = -1;
+    } else if (read_merge_max_gap > FS_READ_MERGE_MAX_GAP_LIMIT) {
+        logWarning("file: "__FILE__", line: %d, "
+                "read_merge_max_gap: %"PRId64" is too large, set to %d",
+                __LINE__, read_merge_max_gap, FS_READ_MERGE_MAX_GAP_LIMIT);
+        read_merge_max_gap = FS_READ_MERGE_MAX_GAP_LIMIT;
+    }
+    storage_cfg->read_merge_max_gap = read_merge_max_gap;
+
     storage_cfg->object_block.hashtable_capacity = iniGetInt64Value(NULL,
             "object_block_hashtable_capacity", ini_context, 1403641);
     if (storage_cfg->object_block.hashtable_capacity <= 0) {
@@ -324,6 +486,16 @@ static int load_global_items(FSStorageConfig *storage_cfg,
         storage_cfg->object_block.shared_locks_count = 163;
     }
 
+    storage_cfg->object_block.snapshot_interval = iniGetIntValue(NULL,
+            "object_block_snapshot_interval", ini_context, 3600);
+    if (storage_cfg->object_block.snapshot_interval < 0) {
+        storage_cfg->object_block.snapshot_interval = 0;
+    }
+    storage_cfg->object_block.snapshot_remove_binlogs = iniGetBoolValue(NULL,
+            "object_block_snapshot_remove_binlogs", ini_context, false);
+    storage_cfg->object_block.lockfree_read = iniGetBoolValue(NULL,
+            "object_block_lockfree_read", ini_context, true);
+
     storage_cfg->write_threads_per_disk = iniGetIntValue(NULL,
             "write_threads_per_disk", ini_context, 1);
     if (storage_cfg->write_threads_per_disk <= 0) {
@@ -376,6 +548,10 @@ static int load_global_items(FSStorageConfig *storage_cfg,
         storage_cfg->trunk_file_size = FS_TRUNK_FILE_MAX_SIZE;
     }
 
+    //the trunk space MUST be aligned for direct IO
+    storage_cfg->trunk_file_size = FS_DIRECT_IO_ALIGN_DOWN(
+            storage_cfg->trunk_file_size);
+
     discard_size = iniGetStrValue(NULL, "discard_remain_space_size",
             ini_context);
     if (discard_size == NULL || *discard_size == '\0') {
@@ -442,6 +618,94 @@ static int load_global_items(FSStorageConfig *storage_cfg,
         return result;
     }
 
+    reclaim_speed = iniGetStrValue(NULL, "reclaim_max_bytes_per_second",
+            ini_context);
+    if (reclaim_speed == NULL || *reclaim_speed == '\0') {
+        storage_cfg->reclaim_max_bytes_per_second =
+            FS_DEFAULT_RECLAIM_MAX_BYTES_PER_SECOND;
+    } else if ((result=parse_bytes(reclaim_speed, 1, &storage_cfg->
+                    reclaim_max_bytes_per_second)) != 0)
+    {
+        return result;
+    } else if (storage_cfg->reclaim_max_bytes_per_second < 0) {
+        storage_cfg->reclaim_max_bytes_per_second = 0;
+    }
+
+    storage_cfg->defrag_min_slices = iniGetIntValue(NULL,
+            "defrag_min_slices", ini_context,
+            FS_DEFAULT_DEFRAG_MIN_SLICES);
+    if (storage_cfg->defrag_min_slices < 0) {
+        storage_cfg->defrag_min_slices = 0;
+    } else if (storage_cfg->defrag_min_slices == 1) {
+        storage_cfg->defrag_min_slices = 2;
+    }
+
+    defrag_speed = iniGetStrValue(NULL, "defrag_max_bytes_per_second",
+            ini_context);
+    if (defrag_speed == NULL || *defrag_speed == '\0') {
+        storage_cfg->defrag_max_bytes_per_second =
+            FS_DEFAULT_DEFRAG_MAX_BYTES_PER_SECOND;
+    } else if ((result=parse_bytes(defrag_speed, 1, &storage_cfg->
+                    defrag_max_bytes_per_second)) != 0)
+    {
+        return result;
+    } else if (storage_cfg->defrag_max_bytes_per_second < 0) {
+        storage_cfg->defrag_max_bytes_per_second = 0;
+    }
+
+    return 0;
+}
+
+static int load_io_classes(FSStorageConfig *storage_cfg,
+        const char *storage_filename, IniContext *ini_context)
+{
+    const FSIOClassConfig defaults[FS_IO_CLASS_COUNT] = {
+        {8, 100, 0},  //client read
+        {8, 200, 0},  //client write
+        {4, 200, 0},  //replication
+        {2, 0, 0},    //recovery
+        {1, 0, 0}     //background
+    };
+    char section_name[64];
+    char *speed;
+    FSIOClassConfig *io_class;
+    int result;
+    int i;
+
+    for (i=0; i<FS_IO_CLASS_COUNT; i++) {
+        io_class = storage_cfg->io_classes + i;
+        sprintf(section_name, "io-class-%s",
+                storage_config_io_class_caption(i));
+        io_class->weight = iniGetIntValue(section_name, "weight",
+                ini_context, defaults[i].weight);
+        if (io_class->weight <= 0) {
+            io_class->weight = 1;
+        }
+
+        io_class->deadline = iniGetIntValue(section_name, "deadline",
+                ini_context, defaults[i].deadline);
+        if (io_class->deadline < 0) {
+            io_class->deadline = 0;
+        }
+
+        speed = iniGetStrValue(section_name, "max_bytes_per_second",
+                ini_context);
+        if (speed == NULL || *speed == '\0') {
+            io_class->max_bytes_per_second =
+                defaults[i].max_bytes_per_second;
+        } else if ((result=parse_bytes(speed, 1, &io_class->
+                        max_bytes_per_second)) != 0)
+        {
+            logError("file: "__FILE__", line: %d, "
+                    "config file: %s, section: %s, item: "
+                    "max_bytes_per_second, value: %s is invalid",
+                    __LINE__, storage_filename, section_name, speed);
+            return result;
+        } else if (io_class->max_bytes_per_second < 0) {
+            io_class->max_bytes_per_second = 0;
+        }
+    }
+
     return 0;
 }
 
@@ -454,6 +718,12 @@ static int load_from_config_file(FSStorageConfig *storage_cfg,
     {
         return result;
     }
+
+    if ((result=load_io_classes(storage_cfg, storage_filename,
+                    ini_context)) != 0)
+    {
+        return result;
+    }
   
     if ((result=load_paths(storage_cfg, storage_filename, ini_context,
                     "store-path", "store_path_count",
@@ -615,23 +885,53 @@ static void log_paths(FSStoragePathArray *parray, const char *caption)
     for (p=parray->paths; p<end; p++) {
         logInfo("  path %d: %s, index: %d, write_threads: %d, "
                 "read_threads: %d, prealloc_trunks: %d, "
+                "io_engine: %s, direct_io: %d, rotational: %d, "
+                "durability_mode: %s, fsync_interval: %d ms, "
+                "fsync_group_window: %d ms, "
                 "reserved_space_ratio: %.2f%%, "
                 "avail_space: %"PRId64", reserved_space: %"PRId64,
                 (int)(p - parray->paths + 1), p->store.path.str,
                 p->store.index, p->write_thread_count,
                 p->read_thread_count, p->prealloc_trunks,
+                storage_config_io_engine_caption(p->io_engine),
+                p->direct_io, p->rotational,
+                storage_config_durability_mode_caption(
+                    p->durability.mode), p->durability.fsync_interval,
+                p->durability.group_window,
                 p->reserved_space.ratio * 100.00,
                 p->space_stat.avail, p->reserved_space.value);
     }
 }
 
+static void log_io_classes(FSStorageConfig *storage_cfg)
+{
+    FSIOClassConfig *io_class;
+    int i;
+
+    for (i=0; i<FS_IO_CLASS_COUNT; i++) {
+        io_class = storage_cfg->io_classes + i;
+        logInfo("  io class %s: weight: %d, deadline: %d ms, "
+                "max_bytes_per_second: %"PRId64" MB",
+                storage_config_io_class_caption(i), io_class->weight,
+                io_class->deadline, io_class->max_bytes_per_second /
+                (1024 * 1024));
+    }
+}
+
 void storage_config_to_log(FSStorageConfig *storage_cfg)
 {
     logInfo("storage config, write_threads_per_disk: %d, "
             "read_threads_per_disk: %d, "
             "fd_cache_capacity_per_read_thread: %d, "
+            "io_engine: %s, io_uring_queue_depth: %d, direct_io: %d, "
+            "rotational: %d, durability_mode: %s, fsync_interval: %d ms, "
+            "fsync_group_window: %d ms, "
+            "read_merge_max_gap: %d, "
             "object_block_hashtable_capacity: %"PRId64", "
             "object_block_shared_locks_count: %d, "
+            "object_block_snapshot_interval: %d s, "
+            "object_block_snapshot_remove_binlogs: %d, "
+            "object_block_lockfree_read: %d, "
             "prealloc_trunks_per_writer: %d, "
             "prealloc_trunk_threads: %d, "
             "reserved_space_per_disk: %.2f%%, "
@@ -639,12 +939,27 @@ void storage_config_to_log(FSStorageConfig *storage_cfg)
             "max_trunk_files_per_subdir: %d, "
             "discard_remain_space_size: %d, "
             "write_cache_to_hd: { on_usage: %.2f%%, start_time: %02d:%02d, "
-            "end_time: %02d:%02d }, reclaim_trunks_on_usage: %.2f%%",
+            "end_time: %02d:%02d }, reclaim_trunks_on_usage: %.2f%%, "
+            "reclaim_max_bytes_per_second: %"PRId64" MB, "
+            "defrag_min_slices: %d, "
+            "defrag_max_bytes_per_second: %"PRId64" MB",
             storage_cfg->write_threads_per_disk,
             storage_cfg->read_threads_per_disk,
             storage_cfg->fd_cache_capacity_per_read_thread,
+            storage_config_io_engine_caption(storage_cfg->io_engine),
+            storage_cfg->io_uring_queue_depth,
+            storage_cfg->direct_io,
+            storage_cfg->rotational,
+            storage_config_durability_mode_caption(
+                storage_cfg->durability.mode),
+            storage_cfg->durability.fsync_interval,
+            storage_cfg->durability.group_window,
+            storage_cfg->read_merge_max_gap,
             storage_cfg->object_block.hashtable_capacity,
             storage_cfg->object_block.shared_locks_count,
+            storage_cfg->object_block.snapshot_interval,
+            storage_cfg->object_block.snapshot_remove_binlogs,
+            storage_cfg->object_block.lockfree_read,
             storage_cfg->prealloc_trunks_per_writer,
             storage_cfg->prealloc_trunk_threads,
             storage_cfg->reserved_space_per_disk * 100.00,
@@ -656,8 +971,12 @@ void storage_config_to_log(FSStorageConfig *storage_cfg)
             storage_cfg->write_cache_to_hd.start_time.minute,
             storage_cfg->write_cache_to_hd.end_time.hour,
             storage_cfg->write_cache_to_hd.end_time.minute,
-            storage_cfg->reclaim_trunks_on_usage * 100.00);
+            storage_cfg->reclaim_trunks_on_usage * 100.00,
+            storage_cfg->reclaim_max_bytes_per_second / (1024 * 1024),
+            storage_cfg->defrag_min_slices,
+            storage_cfg->defrag_max_bytes_per_second / (1024 * 1024));
 
+    log_io_classes(storage_cfg);
     log_paths(&storage_cfg->write_cache, "write cache paths");
     log_paths(&storage_cfg->store_path, "store paths");
 }
@@ -20,17 +20,48 @@
 #include "../../common/fs_types.h"
 #include "../server_types.h"
 
+#define FS_IO_ENGINE_THREAD    't'  //blocking pread / pwrite
+#define FS_IO_ENGINE_IO_URING  'u'  //Linux io_uring with batched submission
+
+#define FS_DURABILITY_MODE_NONE          'n'  //never sync, depend on the OS
+#define FS_DURABILITY_MODE_PERIODIC      'p'  //fdatasync per interval
+#define FS_DURABILITY_MODE_GROUP_COMMIT  'g'  //fdatasync before the notify
+
+//the IO classes for the scheduling of the trunk IO threads
+#define FS_IO_CLASS_CLIENT_READ    0
+#define FS_IO_CLASS_CLIENT_WRITE   1
+#define FS_IO_CLASS_REPLICATION    2
+#define FS_IO_CLASS_RECOVERY       3
+#define FS_IO_CLASS_BACKGROUND     4  //trunk reclaim, migrate and defrag
+#define FS_IO_CLASS_COUNT          5
+
 typedef struct {
     volatile int64_t total;
     volatile int64_t avail;  //current available space
     volatile int64_t used;
 } FSTrunkSpaceStat;
 
+typedef struct {
+    int mode;
+    int fsync_interval;  //in ms, for periodic mode
+    int group_window;    //in ms, for group commit mode, 0 for no wait
+} FSDurabilityConfig;
+
+typedef struct {
+    int weight;     //the share of the disk when the classes compete
+    int deadline;   //in ms, dispatched first when expired, 0 for none
+    int64_t max_bytes_per_second;  //per store path, 0 for no limit
+} FSIOClassConfig;
+
 typedef struct {
     FSStorePath store;
     int write_thread_count;
     int read_thread_count;
     int prealloc_trunks;
+    int io_engine;
+    bool direct_io;   //open trunk files with O_DIRECT
+    bool rotational;  //sort the queued IOs by the offset as an elevator
+    FSDurabilityConfig durability;
     struct {
         int64_t value;
         double ratio;
@@ -76,11 +107,24 @@ typedef struct {
     int prealloc_trunks_per_writer;
     int prealloc_trunk_threads;
     int fd_cache_capacity_per_read_thread;
+    int io_engine;
+    int io_uring_queue_depth;
+    int read_merge_max_gap;  //-1 for never merge the slice reads
+    bool direct_io;
+    bool rotational;
+    FSDurabilityConfig durability;  //for the trunk files and the binlogs
+    FSIOClassConfig io_classes[FS_IO_CLASS_COUNT];
     struct {
         int shared_locks_count;
         int64_t hashtable_capacity;
+        int snapshot_interval;   //in seconds, 0 for disabled
+        bool snapshot_remove_binlogs; //remove the slice binlogs before it
+        bool lockfree_read;  //read the slices without the lock
     } object_block;
     double reclaim_trunks_on_usage;
+    int64_t reclaim_max_bytes_per_second;  //0 for no limit
+    int defrag_min_slices;  //0 for disable the block defragmenting
+    int64_t defrag_max_bytes_per_second;   //0 for no limit
 } FSStorageConfig;
 
 #ifdef __cplusplus
@@ -92,10 +136,59 @@ extern "C" {
 
     int storage_config_calc_path_avail_space(FSStoragePathInfo *path_info);
 
+    double storage_config_calc_path_usage(FSStoragePathInfo *path_info);
+
     void storage_config_stat_path_spaces(FSClusterServerSpaceStat *ss);
 
     void storage_config_to_log(FSStorageConfig *storage_cfg);
 
+    static inline const char *storage_config_io_engine_caption(
+            const int io_engine)
+    {
+        switch (io_engine) {
+            case FS_IO_ENGINE_THREAD:
+                return "thread";
+            case FS_IO_ENGINE_IO_URING:
+                return "io_uring";
+            default:
+                return "unkown";
+        }
+    }
+
+    static inline const char *storage_config_io_class_caption(
+            const int io_class)
+    {
+        switch (io_class) {
+            case FS_IO_CLASS_CLIENT_READ:
+                return "client-read";
+            case FS_IO_CLASS_CLIENT_WRITE:
+                return "client-write";
+            case FS_IO_CLASS_REPLICATION:
+                return "replication";
+            case FS_IO_CLASS_RECOVERY:
+                return "recovery";
+            case FS_IO_CLASS_BACKGROUND:
+                return "background";
+            default:
+                return "unkown";
+        }
+    }
+
+    static inline const char *storage_config_durability_mode_caption(
+            const int mode)
+    {
+        switch (mode) {
+            case FS_DURABILITY_MODE_NONE:
+                return "none";
+            case FS_DURABILITY_MODE_PERIODIC:
+                return "periodic";
+            case FS_DURABILITY_MODE_GROUP_COMMIT:
+                return "group_commit";
+            default:
+                return "unkown";
+        }
+    }
+
 #ifdef __cplusplus
 }
 #endif
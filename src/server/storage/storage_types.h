@@ -17,14 +17,23 @@
 #ifndef _STORAGE_TYPES_H
 #define _STORAGE_TYPES_H
 
+#include <sys/uio.h>
 #include "fastcommon/fc_list.h"
 #include "fastcommon/shared_buffer.h"
 #include "fastcommon/uniq_skiplist.h"
 #include "../../common/fs_types.h"
+#include "object_block_rcu.h"
 
 #define FS_MAX_SPLIT_COUNT_PER_SPACE_ALLOC   2
 #define FS_SLICE_SN_PARRAY_INIT_ALLOC_COUNT  4
 
+#define FS_DIRECT_IO_ALIGN_SIZE   4096
+#define FS_DIRECT_IO_ALIGN_UP(n)   (((n) + FS_DIRECT_IO_ALIGN_SIZE - 1) & \
+        (~((int64_t)FS_DIRECT_IO_ALIGN_SIZE - 1)))
+#define FS_DIRECT_IO_ALIGN_DOWN(n) ((n) & \
+        (~((int64_t)FS_DIRECT_IO_ALIGN_SIZE - 1)))
+#define FS_DIRECT_IO_IS_ALIGNED(n) (((n) & (FS_DIRECT_IO_ALIGN_SIZE - 1)) == 0)
+
 struct ob_slice_entry;
 struct fs_data_operation;
 
@@ -67,13 +76,25 @@ typedef struct {
     UniqSkiplistFactory factory;
     struct fast_mblock_man ob_allocator;    //for ob_entry
     struct fast_mblock_man slice_allocator; //for slice_entry
+    OBRCURetiredArray retired;  //the slices and snapshots to free
     pthread_mutex_t lock;
 } OBSharedContext;
 
+struct ob_slice_entry;
+typedef struct ob_slice_snapshot {
+    int count;
+    struct ob_slice_entry *slices[0];  //sorted by the slice offset
+} OBSliceSnapshot;
+
 typedef struct ob_entry {
     FSBlockKey bkey;
     UniqSkiplist *slices;  //the element is OBSliceEntry
-    struct ob_entry *next; //for hashtable
+    OBSliceSnapshot *volatile snapshot;  //for the lock free read
+    int64_t version;  //changed when the slices changed
+    int64_t digest;   //the cached data digest of the version, -1 for none
+    int slice_count;  //the fragment count for the defragmenting
+    bool defrag_queued;  //if in the defrag candidate queue
+    struct ob_entry *volatile next; //for hashtable
 } OBEntry;
 
 typedef struct {
@@ -81,6 +102,7 @@ typedef struct {
     int64_t capacity;
     OBEntry **buckets;
     bool need_lock;
+    bool lockfree_read;     //read the slice snapshot without the lock
     bool modify_sallocator; //if modify storage allocator
     bool modify_used_space; //if modify used space
 } OBHashtable;
@@ -106,6 +128,7 @@ struct fs_data_thread_context;
 typedef struct fs_slice_op_context {
     fs_data_op_notify_func notify_func;
     struct fs_data_thread_context *data_thread_ctx;  //for signal data thread
+    struct fs_data_operation *data_op;  //the data operation in flight
     volatile short counter;
     short result;
     int done_bytes;
@@ -132,6 +155,11 @@ typedef struct fs_slice_op_context {
 
     struct ob_slice_ptr_array slice_ptr_array;
 
+    struct {
+        int alloc;
+        struct iovec *iovs;  //the slices and the gaps of the merged reads
+    } read_iovecs;
+
 } FSSliceOpContext;
 
 typedef struct fs_slice_op_buffer_context {
@@ -186,6 +186,19 @@ int trunk_allocator_delete(FSTrunkAllocator *allocator, const int64_t id)
     return result;
 }
 
+bool trunk_allocator_exists(FSTrunkAllocator *allocator, const int64_t id)
+{
+    FSTrunkFileInfo target;
+    bool exists;
+
+    target.id_info.id = id;
+    PTHREAD_MUTEX_LOCK(&allocator->lcp.lock);
+    exists = (uniq_skiplist_find(allocator->sl_trunks, &target) != NULL);
+    PTHREAD_MUTEX_UNLOCK(&allocator->lcp.lock);
+
+    return exists;
+}
+
 #define TRUNK_ALLOC_SPACE(allocator, trunk_info, space_info, alloc_size) \
     do { \
         space_info->store = &allocator->path_info->store; \
@@ -305,6 +318,27 @@ void trunk_allocator_array_to_freelists(FSTrunkAllocator *allocator,
     }
 }
 
+/* the trunk written without direct IO before maybe NOT aligned */
+static inline void align_trunk_free_start(FSTrunkAllocator *allocator,
+        FSTrunkFileInfo *trunk_info)
+{
+    int64_t aligned_start;
+
+    if (!allocator->path_info->direct_io || FS_DIRECT_IO_IS_ALIGNED(
+                trunk_info->free_start))
+    {
+        return;
+    }
+
+    aligned_start = FS_DIRECT_IO_ALIGN_UP(trunk_info->free_start);
+    if (aligned_start > trunk_info->size) {
+        aligned_start = trunk_info->size;
+    }
+    __sync_sub_and_fetch(&allocator->path_info->trunk_stat.avail,
+            aligned_start - trunk_info->free_start);
+    trunk_info->free_start = aligned_start;
+}
+
 static int alloc_space(FSTrunkAllocator *allocator, FSTrunkFreelist *freelist,
         const uint32_t blk_hc, const int size, FSTrunkSpaceInfo *spaces,
         int *count, const bool blocked)
@@ -315,13 +349,18 @@ static int alloc_space(FSTrunkAllocator *allocator, FSTrunkFreelist *freelist,
     FSTrunkSpaceInfo *space_info;
     FSTrunkFileInfo *trunk_info;
 
-    aligned_size = MEM_ALIGN(size);
+    if (allocator->path_info->direct_io) {
+        aligned_size = FS_DIRECT_IO_ALIGN_UP(size);
+    } else {
+        aligned_size = MEM_ALIGN(size);
+    }
     space_info = spaces;
 
     PTHREAD_MUTEX_LOCK(&allocator->lcp.lock);
     do {
         if (freelist->head != NULL) {
             trunk_info = freelist->head->trunk_info;
+            align_trunk_free_start(allocator, trunk_info);
             remain_bytes = FS_TRUNK_AVAIL_SPACE(trunk_info);
             if (remain_bytes < aligned_size) {
                 if (!blocked && freelist->count <= 1) {
@@ -339,11 +378,12 @@ static int alloc_space(FSTrunkAllocator *allocator, FSTrunkFreelist *freelist,
                 assert(remain_bytes > 0);
                 */
 
-                TRUNK_ALLOC_SPACE(allocator, trunk_info,
-                        space_info, remain_bytes);
-                space_info++;
-
-                aligned_size -= remain_bytes;
+                if (remain_bytes > 0) {
+                    TRUNK_ALLOC_SPACE(allocator, trunk_info,
+                            space_info, remain_bytes);
+                    space_info++;
+                    aligned_size -= remain_bytes;
+                }
                 remove_trunk_from_freelist(allocator, freelist);
             }
         }
@@ -362,6 +402,7 @@ static int alloc_space(FSTrunkAllocator *allocator, FSTrunkFreelist *freelist,
         }
 
         trunk_info = freelist->head->trunk_info;
+        align_trunk_free_start(allocator, trunk_info);
         TRUNK_ALLOC_SPACE(allocator, trunk_info, space_info, aligned_size);
         space_info++;
         if (FS_TRUNK_AVAIL_SPACE(trunk_info) <
@@ -496,6 +537,79 @@ const FSTrunkInfoPtrArray *trunk_allocator_free_size_top_n(
     return &allocator->priority_array;
 }
 
+static int compare_garbage_space(const void *p1, const void *p2)
+{
+    return fc_compare_int64(FS_TRUNK_GARBAGE_SPACE(
+                *((FSTrunkFileInfo **)p1)), FS_TRUNK_GARBAGE_SPACE(
+                *((FSTrunkFileInfo **)p2)));
+}
+
+const FSTrunkInfoPtrArray *trunk_allocator_avail_space_top_n(
+            FSTrunkAllocator *allocator, const int count)
+{
+    UniqSkiplistIterator it;
+    FSTrunkFileInfo *trunk_info;
+    FSTrunkFileInfo **pp;
+    FSTrunkFileInfo **end;
+    int64_t garbage_size;
+
+    PTHREAD_MUTEX_LOCK(&allocator->lcp.lock);
+    allocator->priority_array.count = 0;
+    if (check_alloc_trunk_ptr_array(&allocator->priority_array, count) != 0) {
+        PTHREAD_MUTEX_UNLOCK(&allocator->lcp.lock);
+        return &allocator->priority_array;
+    }
+
+    end = allocator->priority_array.trunks + count;
+    uniq_skiplist_iterator(allocator->sl_trunks, &it);
+    while ((trunk_info=uniq_skiplist_next(&it)) != NULL) {
+        if (trunk_info->status != FS_TRUNK_STATUS_NONE) {
+            continue;
+        }
+
+        garbage_size = FS_TRUNK_GARBAGE_SPACE(trunk_info);
+        if (garbage_size < FS_FILE_BLOCK_SIZE) {
+            continue;
+        }
+
+        if (allocator->priority_array.count < count) {
+            allocator->priority_array.trunks[allocator->
+                priority_array.count++] = trunk_info;
+            if (allocator->priority_array.count == count) {
+                qsort(allocator->priority_array.trunks, count,
+                        sizeof(FSTrunkFileInfo *), compare_garbage_space);
+            }
+            continue;
+        } else if (garbage_size <= FS_TRUNK_GARBAGE_SPACE(
+                    allocator->priority_array.trunks[0]))
+        {
+            continue;
+        }
+
+        pp = allocator->priority_array.trunks + 1;
+        while ((pp < end) && (garbage_size > FS_TRUNK_GARBAGE_SPACE(*pp))) {
+            *(pp - 1) = *pp;
+            pp++;
+        }
+        *(pp - 1) = trunk_info;
+    }
+
+    if (allocator->priority_array.count < count) {
+        qsort(allocator->priority_array.trunks, allocator->
+                priority_array.count, sizeof(FSTrunkFileInfo *),
+                compare_garbage_space);
+    }
+
+    //order by garbage space asc
+    end = allocator->priority_array.trunks + allocator->priority_array.count;
+    for (pp=allocator->priority_array.trunks; pp<end; pp++) {
+        (*pp)->status = FS_TRUNK_STATUS_RECLAIMING;
+    }
+    PTHREAD_MUTEX_UNLOCK(&allocator->lcp.lock);
+
+    return &allocator->priority_array;
+}
+
 int trunk_allocator_add_slice(FSTrunkAllocator *allocator, OBSliceEntry *slice)
 {
     int result;
@@ -554,6 +668,106 @@ int trunk_allocator_delete_slice(FSTrunkAllocator *allocator,
     return result;
 }
 
+int trunk_allocator_free(FSTrunkAllocator *allocator,
+        const FSTrunkSpaceInfo *space)
+{
+    int result;
+    FSTrunkFileInfo target;
+    FSTrunkFileInfo *trunk_info;
+
+    target.id_info.id = space->id_info.id;
+    PTHREAD_MUTEX_LOCK(&allocator->lcp.lock);
+    if ((trunk_info=(FSTrunkFileInfo *)uniq_skiplist_find(
+                    allocator->sl_trunks, &target)) == NULL)
+    {
+        logError("file: "__FILE__", line: %d, "
+                "trunk id: %"PRId64" not exist",
+                __LINE__, space->id_info.id);
+        result = ENOENT;
+    } else {
+        /* the last allocated space of the trunk in the freelist is
+           reused at once, the others become the garbage space of the
+           trunk (NOT counted in the used bytes) for the trunk reclaiming */
+        if (trunk_info->status == FS_TRUNK_STATUS_ALLOCING &&
+                space->offset + space->size == trunk_info->free_start)
+        {
+            trunk_info->free_start = space->offset;
+            __sync_add_and_fetch(&allocator->path_info->
+                    trunk_stat.avail, space->size);
+        }
+        result = 0;
+    }
+    PTHREAD_MUTEX_UNLOCK(&allocator->lcp.lock);
+
+    return result;
+}
+
+FSTrunkFileInfo *trunk_allocator_get_migrate_trunk(
+        FSTrunkAllocator *allocator)
+{
+    UniqSkiplistIterator it;
+    FSTrunkFileInfo *trunk_info;
+
+    PTHREAD_MUTEX_LOCK(&allocator->lcp.lock);
+    uniq_skiplist_iterator(allocator->sl_trunks, &it);
+    while ((trunk_info=uniq_skiplist_next(&it)) != NULL) {
+        if (trunk_info->status == FS_TRUNK_STATUS_NONE) {
+            trunk_info->status = FS_TRUNK_STATUS_MIGRATING;
+            break;
+        }
+    }
+    PTHREAD_MUTEX_UNLOCK(&allocator->lcp.lock);
+
+    return trunk_info;
+}
+
+void trunk_allocator_set_trunk_status(FSTrunkAllocator *allocator,
+        FSTrunkFileInfo *trunk_info, const int status)
+{
+    PTHREAD_MUTEX_LOCK(&allocator->lcp.lock);
+    trunk_info->status = status;
+    PTHREAD_MUTEX_UNLOCK(&allocator->lcp.lock);
+}
+
+int trunk_allocator_dup_trunk_slices(FSTrunkAllocator *allocator,
+        FSTrunkFileInfo *trunk_info, FSTrunkSliceArray *array)
+{
+    OBSliceEntry *slice;
+    OBSliceEntry *slices;
+    int alloc;
+    int result;
+
+    result = 0;
+    array->count = 0;
+    PTHREAD_MUTEX_LOCK(&allocator->lcp.lock);
+    do {
+        if (array->alloc < trunk_info->used.count) {
+            alloc = (array->alloc == 0) ? 256 : array->alloc;
+            while (alloc < trunk_info->used.count) {
+                alloc *= 2;
+            }
+            slices = (OBSliceEntry *)fc_malloc(sizeof(OBSliceEntry) * alloc);
+            if (slices == NULL) {
+                result = ENOMEM;
+                break;
+            }
+
+            if (array->slices != NULL) {
+                free(array->slices);
+            }
+            array->slices = slices;
+            array->alloc = alloc;
+        }
+
+        fc_list_for_each_entry(slice, &trunk_info->used.slice_head, dlink) {
+            array->slices[array->count++] = *slice;
+        }
+    } while (0);
+    PTHREAD_MUTEX_UNLOCK(&allocator->lcp.lock);
+
+    return result;
+}
+
 void trunk_allocator_trunk_stat(FSTrunkAllocator *allocator,
         FSTrunkSpaceStat *stat)
 {
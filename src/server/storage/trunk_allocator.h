@@ -30,8 +30,10 @@
 #define FS_TRUNK_STATUS_NONE        0
 #define FS_TRUNK_STATUS_ALLOCING    1
 #define FS_TRUNK_STATUS_RECLAIMING  2
+#define FS_TRUNK_STATUS_MIGRATING   3
 
 #define FS_TRUNK_AVAIL_SPACE(trunk) ((trunk)->size - (trunk)->free_start)
+#define FS_TRUNK_GARBAGE_SPACE(trunk) ((trunk)->free_start - (trunk)->used.bytes)
 
 typedef struct {
     FSTrunkIdInfo id_info;
@@ -68,6 +70,12 @@ typedef struct {
     FSTrunkFileInfo **trunks;
 } FSTrunkInfoPtrArray;
 
+typedef struct {
+    int alloc;
+    int count;
+    OBSliceEntry *slices;  //the copy of the slice entries
+} FSTrunkSliceArray;
+
 typedef struct {
     FSStoragePathInfo *path_info;
     UniqSkiplist *sl_trunks;   //all trunks order by id
@@ -89,6 +97,8 @@ extern "C" {
 
     int trunk_allocator_delete(FSTrunkAllocator *allocator, const int64_t id);
 
+    bool trunk_allocator_exists(FSTrunkAllocator *allocator, const int64_t id);
+
     int trunk_allocator_normal_alloc(FSTrunkAllocator *allocator,
             const uint32_t blk_hc, const int size,
             FSTrunkSpaceInfo *spaces, int *count);
@@ -97,8 +107,10 @@ extern "C" {
             const uint32_t blk_hc, const int size,
             FSTrunkSpaceInfo *spaces, int *count);
 
+    /* give back the space allocated but NOT added as a slice,
+       such as the write fail or the slice replacing fail */
     int trunk_allocator_free(FSTrunkAllocator *allocator,
-            const int id, const int size);
+            const FSTrunkSpaceInfo *space);
 
     int trunk_allocator_add_slice(FSTrunkAllocator *allocator,
             OBSliceEntry *slice);
@@ -118,10 +130,22 @@ extern "C" {
     const FSTrunkInfoPtrArray *trunk_allocator_free_size_top_n(
             FSTrunkAllocator *allocator, const int count);
 
-    //to reclaim trunk space
+    /* to reclaim trunk space, the trunks with the most garbage space
+       are selected and their status are set to reclaiming */
     const FSTrunkInfoPtrArray *trunk_allocator_avail_space_top_n(
             FSTrunkAllocator *allocator, const int count);
 
+    //get the oldest trunk which NOT in freelist and set status to migrating
+    FSTrunkFileInfo *trunk_allocator_get_migrate_trunk(
+            FSTrunkAllocator *allocator);
+
+    void trunk_allocator_set_trunk_status(FSTrunkAllocator *allocator,
+            FSTrunkFileInfo *trunk_info, const int status);
+
+    //copy the live slices of the trunk
+    int trunk_allocator_dup_trunk_slices(FSTrunkAllocator *allocator,
+            FSTrunkFileInfo *trunk_info, FSTrunkSliceArray *array);
+
     void trunk_allocator_trunk_stat(FSTrunkAllocator *allocator,
             FSTrunkSpaceStat *stat);
 
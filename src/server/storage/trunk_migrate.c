@@ -0,0 +1,628 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "fastcommon/shared_func.h"
+#include "fastcommon/logger.h"
+#include "fastcommon/sched_thread.h"
+#include "sf/sf_global.h"
+#include "../server_global.h"
+#include "../dio/trunk_io_thread.h"
+#include "../binlog/binlog_types.h"
+#include "../binlog/slice_binlog.h"
+#include "storage_allocator.h"
+#include "trunk_migrate.h"
+
+//migrate regardless of the time window when the write cache is almost full
+#define TRUNK_MIGRATE_FORCE_ON_USAGE   0.95
+
+typedef struct trunk_migrate_thread_context {
+    FSTrunkAllocator *allocator;  //the allocator of the write cache path
+    TrunkMoveContext move_ctx;
+} TrunkMigrateThreadContext;
+
+static TrunkMigrateThreadContext *migrate_thread_contexts = NULL;
+static int migrate_thread_count = 0;
+
+static void move_io_done(struct trunk_io_buffer *record, const int result)
+{
+    TrunkMoveContext *ctx;
+
+    ctx = (TrunkMoveContext *)record->notify.arg;
+    PTHREAD_MUTEX_LOCK(&ctx->io.lcp.lock);
+    if (result != 0) {
+        ctx->io.result = result;
+    }
+    if (--ctx->io.count == 0) {
+        pthread_cond_signal(&ctx->io.lcp.cond);
+    }
+    PTHREAD_MUTEX_UNLOCK(&ctx->io.lcp.lock);
+}
+
+static int move_push_io(TrunkMoveContext *ctx, const int type,
+        OBSliceEntry *slice, char *buff)
+{
+    int result;
+
+    PTHREAD_MUTEX_LOCK(&ctx->io.lcp.lock);
+    ctx->io.count++;
+    PTHREAD_MUTEX_UNLOCK(&ctx->io.lcp.lock);
+
+    if ((result=io_thread_push_slice_op(type, FS_IO_CLASS_BACKGROUND,
+                    slice, buff, move_io_done, ctx)) != 0)
+    {
+        PTHREAD_MUTEX_LOCK(&ctx->io.lcp.lock);
+        ctx->io.count--;
+        PTHREAD_MUTEX_UNLOCK(&ctx->io.lcp.lock);
+    }
+
+    return result;
+}
+
+static int move_wait_io(TrunkMoveContext *ctx)
+{
+    int result;
+
+    PTHREAD_MUTEX_LOCK(&ctx->io.lcp.lock);
+    while (ctx->io.count > 0) {
+        pthread_cond_wait(&ctx->io.lcp.cond, &ctx->io.lcp.lock);
+    }
+    result = ctx->io.result;
+    ctx->io.result = 0;
+    PTHREAD_MUTEX_UNLOCK(&ctx->io.lcp.lock);
+
+    return result;
+}
+
+int trunk_move_init_context(TrunkMoveContext *ctx, const int source,
+        trunk_move_alloc_func alloc_func, void *alloc_arg)
+{
+    int result;
+    int bytes;
+
+    memset(ctx, 0, sizeof(TrunkMoveContext));
+    ctx->source = source;
+    ctx->alloc.func = alloc_func;
+    ctx->alloc.arg = alloc_arg;
+
+    bytes = sizeof(TrunkMoveEntry) * TRUNK_MOVE_BATCH_SLICES;
+    ctx->entries = (TrunkMoveEntry *)fc_malloc(bytes);
+    if (ctx->entries == NULL) {
+        return ENOMEM;
+    }
+    memset(ctx->entries, 0, bytes);
+
+    ctx->buffer = (char *)fc_malloc(TRUNK_MOVE_BUFFER_SIZE);
+    if (ctx->buffer == NULL) {
+        return ENOMEM;
+    }
+
+    if ((result=init_pthread_lock_cond_pair(&ctx->io.lcp)) != 0) {
+        return result;
+    }
+
+    return fast_mblock_init_ex1(&ctx->delay_deletes.allocator,
+            "trunk_delay_delete", sizeof(TrunkDelayDeleteNode),
+            256, 0, NULL, NULL, false);
+}
+
+static int compare_by_space_offset(const void *p1, const void *p2)
+{
+    const OBSliceEntry *s1;
+    const OBSliceEntry *s2;
+
+    s1 = (const OBSliceEntry *)p1;
+    s2 = (const OBSliceEntry *)p2;
+    return fc_compare_int64(s1->space.offset + s1->read_offset,
+            s2->space.offset + s2->read_offset);
+}
+
+static void free_dest_slices(TrunkMoveContext *ctx, const int count)
+{
+    TrunkMoveEntry *entry;
+    TrunkMoveEntry *end;
+    int i;
+
+    end = ctx->entries + count;
+    for (entry=ctx->entries; entry<end; entry++) {
+        for (i=0; i<entry->count; i++) {
+            ob_index_free_slice(entry->dests[i]);
+        }
+        entry->count = 0;
+    }
+}
+
+//in reverse order for reusing the space at the trunk tail
+static void release_dest_spaces(OBSliceEntry **dests, const int count)
+{
+    OBSliceEntry **slice;
+
+    for (slice=dests + count - 1; slice>=dests; slice--) {
+        storage_allocator_free_space(&(*slice)->space);
+    }
+}
+
+static void release_batch_spaces(TrunkMoveContext *ctx, const int count)
+{
+    TrunkMoveEntry *entry;
+
+    for (entry=ctx->entries + count - 1; entry>=ctx->entries; entry--) {
+        release_dest_spaces(entry->dests, entry->count);
+    }
+}
+
+static int alloc_dest_slices(TrunkMoveContext *ctx, TrunkMoveEntry *entry)
+{
+    FSTrunkSpaceInfo spaces[FS_MAX_SPLIT_COUNT_PER_SPACE_ALLOC];
+    OBSliceEntry *slice;
+    int offset;
+    int remain;
+    int count;
+    int result;
+    int i;
+
+    if ((result=ctx->alloc.func(ctx->alloc.arg, FS_BLOCK_HASH_CODE(
+                        entry->src->ob->bkey), entry->src->ssize.length,
+                    spaces, &count)) != 0)
+    {
+        return result;
+    }
+
+    offset = entry->src->ssize.offset;
+    remain = entry->src->ssize.length;
+    for (i=0; i<count; i++) {
+        if ((slice=ob_index_alloc_slice(&entry->src->ob->bkey)) == NULL) {
+            /* the spaces of the dests allocated are released by
+               the caller after these spaces */
+            while (--count >= i) {
+                storage_allocator_free_space(spaces + count);
+            }
+            return ENOMEM;
+        }
+
+        slice->type = entry->src->type;
+        slice->read_offset = 0;
+        slice->space = spaces[i];
+        slice->ssize.offset = offset;
+        slice->ssize.length = (spaces[i].size < remain ?
+                spaces[i].size : remain);
+        entry->dests[entry->count++] = slice;
+
+        offset += slice->ssize.length;
+        remain -= slice->ssize.length;
+    }
+
+    return 0;
+}
+
+static int read_batch(TrunkMoveContext *ctx, const int count)
+{
+    TrunkMoveEntry *entry;
+    TrunkMoveEntry *end;
+    int result;
+    int io_result;
+
+    result = 0;
+    end = ctx->entries + count;
+    for (entry=ctx->entries; entry<end; entry++) {
+        if (entry->src->type != OB_SLICE_TYPE_FILE) {
+            continue;
+        }
+
+        if ((result=move_push_io(ctx, FS_IO_TYPE_READ_SLICE,
+                        entry->src, entry->buff)) != 0)
+        {
+            break;
+        }
+    }
+
+    io_result = move_wait_io(ctx);
+    return (result != 0) ? result : io_result;
+}
+
+static int write_batch(TrunkMoveContext *ctx, const int count)
+{
+    TrunkMoveEntry *entry;
+    TrunkMoveEntry *end;
+    char *buff;
+    int result;
+    int io_result;
+    int i;
+
+    result = 0;
+    end = ctx->entries + count;
+    for (entry=ctx->entries; entry<end; entry++) {
+        if ((result=alloc_dest_slices(ctx, entry)) != 0) {
+            break;
+        }
+
+        //the allocate slice only has space without data
+        if (entry->src->type != OB_SLICE_TYPE_FILE) {
+            continue;
+        }
+
+        buff = entry->buff;
+        for (i=0; i<entry->count; i++) {
+            if ((result=move_push_io(ctx, FS_IO_TYPE_WRITE_SLICE,
+                            entry->dests[i], buff)) != 0)
+            {
+                break;
+            }
+            buff += entry->dests[i]->ssize.length;
+        }
+        if (result != 0) {
+            break;
+        }
+    }
+
+    io_result = move_wait_io(ctx);
+    return (result != 0) ? result : io_result;
+}
+
+int trunk_move_replace_slice(const OBSliceEntry *src,
+        OBSliceEntry **dests, const int count, uint64_t *sns)
+{
+    int result;
+
+    if ((result=ob_index_replace_slice(src, dests, count, sns)) != 0) {
+        release_dest_spaces(dests, count);
+    }
+    return result;
+}
+
+static int replace_batch(TrunkMoveContext *ctx, const int count)
+{
+    TrunkMoveEntry *entry;
+    TrunkMoveEntry *end;
+    int result;
+    int log_result;
+    int i;
+
+    result = 0;
+    end = ctx->entries + count;
+    for (entry=ctx->entries; entry<end; entry++) {
+        if (trunk_move_replace_slice(entry->src, entry->dests,
+                    entry->count, entry->sns) != 0)
+        {
+            //the source slice is overwritten or deleted
+            continue;
+        }
+
+        /* the dests are in the index already, log all of them
+           and return the first error */
+        for (i=0; i<entry->count; i++) {
+            if ((log_result=slice_binlog_log_add_slice(entry->dests[i],
+                            g_current_time, entry->sns[i], 0,
+                            ctx->source)) != 0 && result == 0)
+            {
+                result = log_result;
+            }
+        }
+
+        ctx->stat.slice_count++;
+        ctx->stat.bytes += entry->src->ssize.length;
+    }
+
+    free_dest_slices(ctx, count);
+    return result;
+}
+
+static int move_batch(TrunkMoveContext *ctx, const int count)
+{
+    int result;
+
+    if ((result=read_batch(ctx, count)) != 0) {
+        return result;
+    }
+
+    if ((result=write_batch(ctx, count)) != 0) {
+        release_batch_spaces(ctx, count);
+        free_dest_slices(ctx, count);
+        return result;
+    }
+
+    return replace_batch(ctx, count);
+}
+
+int trunk_move_slices(TrunkMoveContext *ctx, FSTrunkAllocator
+        *allocator, FSTrunkFileInfo *trunk_info)
+{
+    OBSliceEntry *slice;
+    OBSliceEntry *end;
+    TrunkMoveEntry *entry;
+    char *buff;
+    int count;
+    int result;
+
+    if ((result=trunk_allocator_dup_trunk_slices(allocator,
+                    trunk_info, &ctx->slice_array)) != 0)
+    {
+        return result;
+    }
+
+    //for sequential reading
+    qsort(ctx->slice_array.slices, ctx->slice_array.count,
+            sizeof(OBSliceEntry), compare_by_space_offset);
+
+    result = 0;
+    slice = ctx->slice_array.slices;
+    end = ctx->slice_array.slices + ctx->slice_array.count;
+    while (slice < end && SF_G_CONTINUE_FLAG) {
+        count = 0;
+        buff = ctx->buffer;
+        while (slice < end && count < TRUNK_MOVE_BATCH_SLICES) {
+            if (slice->type == OB_SLICE_TYPE_FILE) {
+                if ((buff - ctx->buffer) + slice->ssize.length >
+                        TRUNK_MOVE_BUFFER_SIZE)
+                {
+                    break;
+                }
+            }
+
+            entry = ctx->entries + count++;
+            entry->src = slice;
+            entry->buff = buff;
+            entry->count = 0;
+            if (slice->type == OB_SLICE_TYPE_FILE) {
+                buff += slice->ssize.length;
+            }
+            slice++;
+        }
+
+        if ((result=move_batch(ctx, count)) != 0) {
+            logError("file: "__FILE__", line: %d, "
+                    "path: %s, move slices of trunk id: %"PRId64" fail, "
+                    "errno: %d, error info: %s", __LINE__,
+                    allocator->path_info->store.path.str,
+                    trunk_info->id_info.id, result, STRERROR(result));
+            break;
+        }
+
+        if (ctx->batch_done.func != NULL) {
+            ctx->batch_done.func(ctx->batch_done.arg, buff - ctx->buffer);
+        }
+    }
+
+    return result;
+}
+
+static void delete_trunk_done(struct trunk_io_buffer *record,
+        const int result)
+{
+    FSStoragePathInfo *path_info;
+    time_t last_stat_time;
+
+    if (result != 0) {
+        return;
+    }
+
+    path_info = STORAGE_CFG.paths_by_index.paths[record->space.store->index];
+    storage_allocator_delete_trunk(record->space.store->index,
+            &record->space.id_info);
+    __sync_sub_and_fetch(&path_info->trunk_stat.total, record->space.size);
+
+    //trigger avail space stat
+    last_stat_time = __sync_add_and_fetch(&path_info->
+            space_stat.last_stat_time, 0);
+    __sync_bool_compare_and_swap(&path_info->space_stat.
+            last_stat_time, last_stat_time, 0);
+}
+
+int trunk_move_delete_trunk(TrunkMoveContext *ctx, FSTrunkAllocator
+        *allocator, FSTrunkFileInfo *trunk_info)
+{
+    TrunkDelayDeleteNode *node;
+    int used_count;
+
+    PTHREAD_MUTEX_LOCK(&allocator->lcp.lock);
+    used_count = trunk_info->used.count;
+    PTHREAD_MUTEX_UNLOCK(&allocator->lcp.lock);
+    if (used_count > 0) {
+        return EBUSY;
+    }
+
+    node = (TrunkDelayDeleteNode *)fast_mblock_alloc_object(
+            &ctx->delay_deletes.allocator);
+    if (node == NULL) {
+        return ENOMEM;
+    }
+
+    node->space.store = &allocator->path_info->store;
+    node->space.id_info = trunk_info->id_info;
+    node->space.offset = 0;
+    node->space.size = trunk_info->size;
+    node->delete_time = g_current_time + TRUNK_MOVE_DELETE_DELAY_SECONDS;
+    node->next = NULL;
+    if (ctx->delay_deletes.tail == NULL) {
+        ctx->delay_deletes.head = node;
+    } else {
+        ctx->delay_deletes.tail->next = node;
+    }
+    ctx->delay_deletes.tail = node;
+
+    return 0;
+}
+
+void trunk_move_deal_delay_deletes(TrunkMoveContext *ctx)
+{
+    TrunkDelayDeleteNode *node;
+    int result;
+
+    while (ctx->delay_deletes.head != NULL && ctx->delay_deletes.
+            head->delete_time <= g_current_time)
+    {
+        node = ctx->delay_deletes.head;
+        ctx->delay_deletes.head = node->next;
+        if (ctx->delay_deletes.head == NULL) {
+            ctx->delay_deletes.tail = NULL;
+        }
+
+        if ((result=io_thread_push_trunk_op(FS_IO_TYPE_DELETE_TRUNK,
+                        FS_IO_CLASS_BACKGROUND, &node->space,
+                        delete_trunk_done, NULL)) != 0)
+        {
+            logError("file: "__FILE__", line: %d, "
+                    "path: %s, delete trunk id: %"PRId64" fail, "
+                    "errno: %d, error info: %s", __LINE__,
+                    node->space.store->path.str, node->space.id_info.id,
+                    result, STRERROR(result));
+        } else {
+            ctx->stat.trunk_count++;
+        }
+        fast_mblock_free_object(&ctx->delay_deletes.allocator, node);
+    }
+}
+
+static int migrate_alloc(void *arg, const uint32_t blk_hc,
+        const int size, FSTrunkSpaceInfo *spaces, int *count)
+{
+    return storage_allocator_store_path_alloc(blk_hc, size, spaces, count);
+}
+
+static bool in_migrate_time_window()
+{
+    struct tm tm_current;
+    time_t current_time;
+    int current;
+    int start;
+    int end;
+
+    current_time = g_current_time;
+    localtime_r(&current_time, &tm_current);
+    current = tm_current.tm_hour * 60 + tm_current.tm_min;
+    start = STORAGE_CFG.write_cache_to_hd.start_time.hour * 60 +
+        STORAGE_CFG.write_cache_to_hd.start_time.minute;
+    end = STORAGE_CFG.write_cache_to_hd.end_time.hour * 60 +
+        STORAGE_CFG.write_cache_to_hd.end_time.minute;
+    if (start <= end) {
+        return (current >= start && current <= end);
+    } else {  //across midnight
+        return (current >= start || current <= end);
+    }
+}
+
+static bool need_migrate(TrunkMigrateThreadContext *ctx)
+{
+    double usage;
+
+    usage = storage_config_calc_path_usage(ctx->allocator->path_info);
+    if (usage >= TRUNK_MIGRATE_FORCE_ON_USAGE) {
+        return true;
+    }
+
+    return (usage > STORAGE_CFG.write_cache_to_hd.on_usage &&
+            in_migrate_time_window());
+}
+
+static int migrate_trunk(TrunkMigrateThreadContext *ctx,
+        FSTrunkFileInfo *trunk_info)
+{
+    int64_t start_time;
+    int64_t old_bytes;
+    int result;
+
+    start_time = get_current_time_ms();
+    old_bytes = ctx->move_ctx.stat.bytes;
+    if ((result=trunk_move_slices(&ctx->move_ctx, ctx->allocator,
+                    trunk_info)) == 0)
+    {
+        result = trunk_move_delete_trunk(&ctx->move_ctx,
+                ctx->allocator, trunk_info);
+    }
+
+    if (result != 0) {
+        trunk_allocator_set_trunk_status(ctx->allocator,
+                trunk_info, FS_TRUNK_STATUS_NONE);
+        return result;
+    }
+
+    logDebug("file: "__FILE__", line: %d, "
+            "write cache path: %s, migrate trunk id: %"PRId64", "
+            "bytes: %"PRId64", time used: %"PRId64" ms", __LINE__,
+            ctx->allocator->path_info->store.path.str,
+            trunk_info->id_info.id, ctx->move_ctx.stat.bytes - old_bytes,
+            get_current_time_ms() - start_time);
+    return 0;
+}
+
+static void *trunk_migrate_thread_func(void *arg)
+{
+    TrunkMigrateThreadContext *ctx;
+    FSTrunkFileInfo *trunk_info;
+
+    ctx = (TrunkMigrateThreadContext *)arg;
+    while (SF_G_CONTINUE_FLAG) {
+        trunk_move_deal_delay_deletes(&ctx->move_ctx);
+        if (!need_migrate(ctx)) {
+            sleep(1);
+            continue;
+        }
+
+        //the oldest trunk which NOT in the freelist is full or cold
+        if ((trunk_info=trunk_allocator_get_migrate_trunk(
+                        ctx->allocator)) == NULL)
+        {
+            sleep(1);
+            continue;
+        }
+
+        if (migrate_trunk(ctx, trunk_info) != 0) {
+            sleep(5);
+        }
+    }
+
+    return NULL;
+}
+
+int trunk_migrate_init()
+{
+    int result;
+    int bytes;
+    TrunkMigrateThreadContext *ctx;
+    TrunkMigrateThreadContext *end;
+
+    if (g_allocator_mgr->write_cache.all.count == 0 ||
+            g_allocator_mgr->store_path.all.count == 0)
+    {
+        return 0;
+    }
+
+    migrate_thread_count = g_allocator_mgr->write_cache.all.count;
+    bytes = sizeof(TrunkMigrateThreadContext) * migrate_thread_count;
+    migrate_thread_contexts = (TrunkMigrateThreadContext *)fc_malloc(bytes);
+    if (migrate_thread_contexts == NULL) {
+        return ENOMEM;
+    }
+    memset(migrate_thread_contexts, 0, bytes);
+
+    end = migrate_thread_contexts + migrate_thread_count;
+    for (ctx=migrate_thread_contexts; ctx<end; ctx++) {
+        ctx->allocator = g_allocator_mgr->write_cache.all.allocators +
+            (ctx - migrate_thread_contexts);
+        if ((result=trunk_move_init_context(&ctx->move_ctx,
+                        BINLOG_SOURCE_MIGRATE, migrate_alloc, NULL)) != 0)
+        {
+            return result;
+        }
+    }
+
+    return create_work_threads_ex(&migrate_thread_count,
+            trunk_migrate_thread_func, migrate_thread_contexts,
+            sizeof(TrunkMigrateThreadContext), NULL,
+            SF_G_THREAD_STACK_SIZE);
+}
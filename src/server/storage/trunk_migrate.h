@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//trunk_migrate.h
+
+#ifndef _TRUNK_MIGRATE_H
+#define _TRUNK_MIGRATE_H
+
+#include "fastcommon/fast_mblock.h"
+#include "fastcommon/pthread_func.h"
+#include "../../common/fs_types.h"
+#include "storage_config.h"
+#include "trunk_allocator.h"
+
+#define TRUNK_MOVE_BATCH_SLICES     256
+#define TRUNK_MOVE_BUFFER_SIZE      (2 * FS_FILE_BLOCK_SIZE)
+
+//delay delete the trunk file for the reading slices of the old space
+#define TRUNK_MOVE_DELETE_DELAY_SECONDS  30
+
+//the allocate function for the new space of the slices
+typedef int (*trunk_move_alloc_func)(void *arg, const uint32_t blk_hc,
+        const int size, FSTrunkSpaceInfo *spaces, int *count);
+
+//called after each batch moved, such as for rate limiting
+typedef void (*trunk_move_batch_done_func)(void *arg, const int bytes);
+
+typedef struct trunk_move_entry {
+    OBSliceEntry *src;  //point to the slice copy
+    char *buff;         //the slice data
+    int count;          //the dest slice count
+    OBSliceEntry *dests[FS_MAX_SPLIT_COUNT_PER_SPACE_ALLOC];
+    uint64_t sns[FS_MAX_SPLIT_COUNT_PER_SPACE_ALLOC];
+} TrunkMoveEntry;
+
+typedef struct trunk_delay_delete_node {
+    FSTrunkSpaceInfo space;
+    time_t delete_time;
+    struct trunk_delay_delete_node *next;
+} TrunkDelayDeleteNode;
+
+typedef struct trunk_move_context {
+    int source;   //for slice binlog
+    struct {
+        trunk_move_alloc_func func;
+        void *arg;
+    } alloc;
+
+    struct {
+        trunk_move_batch_done_func func;
+        void *arg;
+    } batch_done;
+
+    FSTrunkSliceArray slice_array;
+    TrunkMoveEntry *entries;
+    char *buffer;
+
+    struct {
+        int count;   //the IO in progress
+        int result;
+        pthread_lock_cond_pair_t lcp;
+    } io;
+
+    struct {
+        TrunkDelayDeleteNode *head;
+        TrunkDelayDeleteNode *tail;
+        struct fast_mblock_man allocator;
+    } delay_deletes;
+
+    struct {
+        int64_t slice_count;  //the moved slice count
+        int64_t bytes;        //the moved bytes
+        int64_t trunk_count;  //the deleted trunk count
+    } stat;
+} TrunkMoveContext;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    int trunk_migrate_init();
+
+    int trunk_move_init_context(TrunkMoveContext *ctx, const int source,
+            trunk_move_alloc_func alloc_func, void *alloc_arg);
+
+    /* move the live slices of the trunk to the new spaces
+       which allocated by the alloc function */
+    int trunk_move_slices(TrunkMoveContext *ctx, FSTrunkAllocator
+            *allocator, FSTrunkFileInfo *trunk_info);
+
+    /* replace the source slice with the dest slices copied from it,
+       the spaces of the dests are released when fail, return ENOENT
+       when the source slice is overwritten or deleted */
+    int trunk_move_replace_slice(const OBSliceEntry *src,
+            OBSliceEntry **dests, const int count, uint64_t *sns);
+
+    /* delete the trunk when it is empty after the slices moved,
+       return EBUSY when the trunk is NOT empty */
+    int trunk_move_delete_trunk(TrunkMoveContext *ctx, FSTrunkAllocator
+            *allocator, FSTrunkFileInfo *trunk_info);
+
+    //delete the trunk files which the delay time expired
+    void trunk_move_deal_delay_deletes(TrunkMoveContext *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -151,8 +151,9 @@ static int trunk_prealloc_deal_task(TrunkPreallocTask *task)
     space.offset = 0;
     space.size = STORAGE_CFG.trunk_file_size;
 
-    return io_thread_push_trunk_op(FS_IO_TYPE_CREATE_TRUNK, &space,
-            create_trunk_done, task);
+    //the client writes wait for the trunk space
+    return io_thread_push_trunk_op(FS_IO_TYPE_CREATE_TRUNK,
+            FS_IO_CLASS_CLIENT_WRITE, &space, create_trunk_done, task);
 }
 
 static void *trunk_prealloc_thread_func(void *arg)
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "fastcommon/shared_func.h"
+#include "fastcommon/logger.h"
+#include "fastcommon/sched_thread.h"
+#include "sf/sf_global.h"
+#include "../server_global.h"
+#include "../data_thread.h"
+#include "../binlog/binlog_types.h"
+#include "storage_allocator.h"
+#include "trunk_migrate.h"
+#include "trunk_reclaim.h"
+
+typedef struct trunk_reclaim_thread_context {
+    FSTrunkAllocator *allocator;  //the allocator of the store path
+    TrunkMoveContext move_ctx;
+    FSTrunkFileInfo *trunks[TRUNK_RECLAIM_SELECT_COUNT];
+
+    struct {
+        int64_t start_time_ms;  //the start time of current second
+        int64_t bytes;          //the moved bytes in current second
+    } throttle;
+
+    struct {
+        int64_t reclaimed_bytes;
+        int64_t time_used_ms;
+    } stat;
+} TrunkReclaimThreadContext;
+
+static TrunkReclaimThreadContext *reclaim_thread_contexts = NULL;
+static int reclaim_thread_count = 0;
+
+static int reclaim_alloc(void *arg, const uint32_t blk_hc,
+        const int size, FSTrunkSpaceInfo *spaces, int *count)
+{
+    return trunk_allocator_reclaim_alloc((FSTrunkAllocator *)arg,
+            blk_hc, size, spaces, count);
+}
+
+/* limit the move speed when the data threads are busy,
+   run at full speed when idle */
+static void reclaim_batch_done(void *arg, const int bytes)
+{
+    TrunkReclaimThreadContext *ctx;
+    int64_t current_time_ms;
+    int64_t expect_time_ms;
+    int64_t elapsed_ms;
+
+    ctx = (TrunkReclaimThreadContext *)arg;
+    if (STORAGE_CFG.reclaim_max_bytes_per_second <= 0) {
+        return;
+    }
+
+    current_time_ms = get_current_time_ms();
+    elapsed_ms = current_time_ms - ctx->throttle.start_time_ms;
+    if (elapsed_ms >= 1000 || data_thread_get_inflight_count() == 0) {
+        ctx->throttle.start_time_ms = current_time_ms;
+        ctx->throttle.bytes = bytes;
+        elapsed_ms = 0;
+    } else {
+        ctx->throttle.bytes += bytes;
+    }
+
+    expect_time_ms = ctx->throttle.bytes * 1000 /
+        STORAGE_CFG.reclaim_max_bytes_per_second;
+    if (expect_time_ms > elapsed_ms) {
+        fc_sleep_ms(expect_time_ms - elapsed_ms);
+    }
+}
+
+static int reclaim_trunk(TrunkReclaimThreadContext *ctx,
+        FSTrunkFileInfo *trunk_info)
+{
+    int64_t start_time_ms;
+    int64_t time_used_ms;
+    int64_t old_bytes;
+    int64_t moved_bytes;
+    int64_t reclaimed_bytes;
+    int result;
+
+    start_time_ms = get_current_time_ms();
+    old_bytes = ctx->move_ctx.stat.bytes;
+    if ((result=trunk_move_slices(&ctx->move_ctx, ctx->allocator,
+                    trunk_info)) == 0)
+    {
+        result = trunk_move_delete_trunk(&ctx->move_ctx,
+                ctx->allocator, trunk_info);
+    }
+
+    if (result != 0) {
+        trunk_allocator_set_trunk_status(ctx->allocator,
+                trunk_info, FS_TRUNK_STATUS_NONE);
+        return result;
+    }
+
+    time_used_ms = get_current_time_ms() - start_time_ms;
+    moved_bytes = ctx->move_ctx.stat.bytes - old_bytes;
+    reclaimed_bytes = trunk_info->size - moved_bytes;
+    ctx->stat.reclaimed_bytes += reclaimed_bytes;
+    ctx->stat.time_used_ms += time_used_ms;
+
+    logInfo("file: "__FILE__", line: %d, "
+            "path: %s, reclaim trunk id: %"PRId64", moved bytes: %"PRId64
+            ", reclaimed bytes: %"PRId64", time used: %"PRId64" ms, "
+            "total reclaimed: %"PRId64" MB, speed: %"PRId64" KB/s",
+            __LINE__, ctx->allocator->path_info->store.path.str,
+            trunk_info->id_info.id, moved_bytes, reclaimed_bytes,
+            time_used_ms, ctx->stat.reclaimed_bytes / (1024 * 1024),
+            ctx->stat.reclaimed_bytes * 1000 / 1024 /
+            (ctx->stat.time_used_ms > 0 ? ctx->stat.time_used_ms : 1));
+    return 0;
+}
+
+static void reclaim_trunks(TrunkReclaimThreadContext *ctx)
+{
+    const FSTrunkInfoPtrArray *trunk_ptr_array;
+    int result;
+    int count;
+    int i;
+
+    trunk_ptr_array = trunk_allocator_avail_space_top_n(
+            ctx->allocator, TRUNK_RECLAIM_SELECT_COUNT);
+    count = trunk_ptr_array->count;
+    if (count == 0) {
+        sleep(5);
+        return;
+    }
+    memcpy(ctx->trunks, trunk_ptr_array->trunks,
+            sizeof(FSTrunkFileInfo *) * count);
+
+    //the trunk with the most garbage first
+    result = 0;
+    for (i=count-1; i>=0; i--) {
+        if (!SF_G_CONTINUE_FLAG || (result=reclaim_trunk(
+                        ctx, ctx->trunks[i])) != 0)
+        {
+            break;
+        }
+    }
+
+    //release the remain trunks for the next selecting
+    for (; i>=0; i--) {
+        trunk_allocator_set_trunk_status(ctx->allocator,
+                ctx->trunks[i], FS_TRUNK_STATUS_NONE);
+    }
+
+    if (result != 0) {  //such as no reclaim space to allocate
+        sleep(5);
+    }
+}
+
+static void *trunk_reclaim_thread_func(void *arg)
+{
+    TrunkReclaimThreadContext *ctx;
+
+    ctx = (TrunkReclaimThreadContext *)arg;
+    while (SF_G_CONTINUE_FLAG) {
+        trunk_move_deal_delay_deletes(&ctx->move_ctx);
+        if (storage_config_calc_path_usage(ctx->allocator->path_info) <=
+                STORAGE_CFG.reclaim_trunks_on_usage)
+        {
+            sleep(1);
+            continue;
+        }
+
+        reclaim_trunks(ctx);
+    }
+
+    return NULL;
+}
+
+int trunk_reclaim_init()
+{
+    int result;
+    int bytes;
+    TrunkReclaimThreadContext *ctx;
+    TrunkReclaimThreadContext *end;
+
+    reclaim_thread_count = g_allocator_mgr->store_path.all.count;
+    if (reclaim_thread_count == 0) {
+        return 0;
+    }
+
+    bytes = sizeof(TrunkReclaimThreadContext) * reclaim_thread_count;
+    reclaim_thread_contexts = (TrunkReclaimThreadContext *)fc_malloc(bytes);
+    if (reclaim_thread_contexts == NULL) {
+        return ENOMEM;
+    }
+    memset(reclaim_thread_contexts, 0, bytes);
+
+    end = reclaim_thread_contexts + reclaim_thread_count;
+    for (ctx=reclaim_thread_contexts; ctx<end; ctx++) {
+        ctx->allocator = g_allocator_mgr->store_path.all.allocators +
+            (ctx - reclaim_thread_contexts);
+        if ((result=trunk_move_init_context(&ctx->move_ctx,
+                        BINLOG_SOURCE_RECLAIM, reclaim_alloc,
+                        ctx->allocator)) != 0)
+        {
+            return result;
+        }
+
+        ctx->move_ctx.batch_done.func = reclaim_batch_done;
+        ctx->move_ctx.batch_done.arg = ctx;
+    }
+
+    return create_work_threads_ex(&reclaim_thread_count,
+            trunk_reclaim_thread_func, reclaim_thread_contexts,
+            sizeof(TrunkReclaimThreadContext), NULL,
+            SF_G_THREAD_STACK_SIZE);
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//trunk_reclaim.h
+
+#ifndef _TRUNK_RECLAIM_H
+#define _TRUNK_RECLAIM_H
+
+#include "../../common/fs_types.h"
+#include "storage_config.h"
+#include "trunk_allocator.h"
+
+//the trunk count to select once
+#define TRUNK_RECLAIM_SELECT_COUNT  4
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    //start one reclaim thread per store path
+    int trunk_reclaim_init();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//compare the memory usage and the lookup latency of the object block index
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "fastcommon/logger.h"
+#include "fastcommon/shared_func.h"
+#include "../../common/fs_func.h"
+#include "../server_global.h"
+#include "../storage/object_block_index.h"
+#include "../storage/object_block_compact.h"
+
+#define SLICE_ALIGN_SIZE   (4 * 1024)
+#define MAX_SLICE_LENGTH   (128 * 1024)
+#define READ_LENGTH        (64 * 1024)
+
+typedef struct {
+    FSBlockSliceKeyInfo bs_key;
+    int64_t trunk_id;
+    int64_t space_offset;
+} BenchSlice;
+
+static FSStorePath store_path;
+static int64_t slice_count = 1000000;
+static int64_t lookup_count = 1000000;
+static int object_count = 10000;
+static int blocks_per_object = 16;
+
+static void usage(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [-n slice count=%"PRId64"] "
+            "[-l lookup count=%"PRId64"] [-o object count=%d] "
+            "[-b blocks per object=%d]\n", argv[0], slice_count,
+            lookup_count, object_count, blocks_per_object);
+}
+
+static int64_t get_rss_bytes()
+{
+    FILE *fp;
+    long pages;
+    long rss;
+
+    if ((fp=fopen("/proc/self/statm", "r")) == NULL) {
+        return 0;
+    }
+    if (fscanf(fp, "%ld %ld", &pages, &rss) != 2) {
+        rss = 0;
+    }
+    fclose(fp);
+    return (int64_t)rss * getpagesize();
+}
+
+static void gen_block_key(FSBlockKey *bkey)
+{
+    bkey->oid = 1 + rand() % object_count;
+    bkey->offset = (int64_t)(rand() % blocks_per_object) *
+        FS_FILE_BLOCK_SIZE;
+    fs_calc_block_hashcode(bkey);
+}
+
+static BenchSlice *gen_slices()
+{
+    BenchSlice *slices;
+    BenchSlice *slice;
+    BenchSlice *end;
+    int64_t space_offset;
+
+    slices = (BenchSlice *)fc_malloc(sizeof(BenchSlice) * slice_count);
+    if (slices == NULL) {
+        return NULL;
+    }
+
+    space_offset = 0;
+    end = slices + slice_count;
+    for (slice=slices; slice<end; slice++) {
+        gen_block_key(&slice->bs_key.block);
+        slice->bs_key.slice.length = SLICE_ALIGN_SIZE * (1 + rand() %
+                (MAX_SLICE_LENGTH / SLICE_ALIGN_SIZE));
+        slice->bs_key.slice.offset = SLICE_ALIGN_SIZE * (rand() %
+                ((FS_FILE_BLOCK_SIZE - slice->bs_key.slice.length) /
+                 SLICE_ALIGN_SIZE + 1));
+        slice->trunk_id = 1 + space_offset / FS_TRUNK_FILE_MAX_SIZE;
+        slice->space_offset = space_offset % FS_TRUNK_FILE_MAX_SIZE;
+        space_offset += slice->bs_key.slice.length;
+    }
+
+    return slices;
+}
+
+static void fill_space(FSTrunkSpaceInfo *space, const BenchSlice *bslice)
+{
+    space->store = &store_path;
+    space->id_info.id = bslice->trunk_id;
+    space->id_info.subdir = bslice->trunk_id % 256;
+    space->offset = bslice->space_offset;
+    space->size = bslice->bs_key.slice.length;
+}
+
+static int load_ob_index(const BenchSlice *slices)
+{
+    const BenchSlice *bslice;
+    const BenchSlice *end;
+    OBSliceEntry *slice;
+    int inc_alloc;
+    int result;
+
+    end = slices + slice_count;
+    for (bslice=slices; bslice<end; bslice++) {
+        slice = ob_index_alloc_slice_ex(&g_ob_hashtable,
+                &bslice->bs_key.block, 0);
+        if (slice == NULL) {
+            return ENOMEM;
+        }
+
+        slice->type = OB_SLICE_TYPE_FILE;
+        slice->read_offset = 0;
+        slice->ssize = bslice->bs_key.slice;
+        fill_space(&slice->space, bslice);
+        if ((result=ob_index_add_slice_ex(&g_ob_hashtable,
+                        slice, NULL, &inc_alloc)) != 0)
+        {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+static int load_obc_index(OBCIndex *index, const BenchSlice *slices)
+{
+    const BenchSlice *bslice;
+    const BenchSlice *end;
+    FSTrunkSpaceInfo space;
+    OBCSlice slice;
+    int result;
+
+    end = slices + slice_count;
+    for (bslice=slices; bslice<end; bslice++) {
+        fill_space(&space, bslice);
+        if ((result=obc_slice_pack(&slice, OB_SLICE_TYPE_FILE,
+                        &bslice->bs_key.slice, 0, &space)) != 0)
+        {
+            return result;
+        }
+        if ((result=obc_index_add_slice(index, &bslice->bs_key.block,
+                        &slice)) != 0)
+        {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+static FSBlockSliceKeyInfo *gen_lookup_keys()
+{
+    FSBlockSliceKeyInfo *keys;
+    FSBlockSliceKeyInfo *key;
+    FSBlockSliceKeyInfo *end;
+
+    keys = (FSBlockSliceKeyInfo *)fc_malloc(
+            sizeof(FSBlockSliceKeyInfo) * lookup_count);
+    if (keys == NULL) {
+        return NULL;
+    }
+
+    end = keys + lookup_count;
+    for (key=keys; key<end; key++) {
+        gen_block_key(&key->block);
+        key->slice.length = READ_LENGTH;
+        key->slice.offset = SLICE_ALIGN_SIZE * (rand() %
+                ((FS_FILE_BLOCK_SIZE - READ_LENGTH) / SLICE_ALIGN_SIZE + 1));
+    }
+
+    return keys;
+}
+
+static int64_t lookup_ob_index(const FSBlockSliceKeyInfo *keys,
+        int64_t *found_slices)
+{
+    const FSBlockSliceKeyInfo *key;
+    const FSBlockSliceKeyInfo *end;
+    OBSlicePtrArray sarray;
+    OBSliceEntry **pp;
+    OBSliceEntry **pend;
+    int64_t start_time;
+
+    ob_index_init_slice_ptr_array(&sarray);
+    *found_slices = 0;
+    start_time = get_current_time_us();
+    end = keys + lookup_count;
+    for (key=keys; key<end; key++) {
+        if (ob_index_get_slices(key, &sarray) == 0) {
+            *found_slices += sarray.count;
+            pend = sarray.slices + sarray.count;
+            for (pp=sarray.slices; pp<pend; pp++) {
+                ob_index_free_slice(*pp);
+            }
+        }
+    }
+
+    start_time = get_current_time_us() - start_time;
+    ob_index_free_slice_ptr_array(&sarray);
+    return start_time;
+}
+
+static int64_t lookup_obc_index(OBCIndex *index,
+        const FSBlockSliceKeyInfo *keys, int64_t *found_slices)
+{
+    const FSBlockSliceKeyInfo *key;
+    const FSBlockSliceKeyInfo *end;
+    OBCSliceArray sarray;
+    int64_t start_time;
+
+    obc_index_init_slice_array(&sarray);
+    *found_slices = 0;
+    start_time = get_current_time_us();
+    end = keys + lookup_count;
+    for (key=keys; key<end; key++) {
+        if (obc_index_get_slices(index, key, &sarray) == 0) {
+            *found_slices += sarray.count;
+        }
+    }
+
+    start_time = get_current_time_us() - start_time;
+    obc_index_free_slice_array(&sarray);
+    return start_time;
+}
+
+static void output(const char *caption, const int64_t memory,
+        const int64_t live_slices, const int64_t time_used_us)
+{
+    printf("%s: memory: %"PRId64" KB, bytes per slice: %.2f, "
+            "lookup time used: %"PRId64" ms, avg lookup latency: %.1f ns\n",
+            caption, memory / 1024, (double)memory / (live_slices > 0 ?
+                live_slices : 1), time_used_us / 1000,
+            (double)time_used_us * 1000 / lookup_count);
+}
+
+int main(int argc, char *argv[])
+{
+    BenchSlice *slices;
+    FSBlockSliceKeyInfo *keys;
+    OBCIndex obc_index;
+    OBCIndexStat stat;
+    int64_t rss;
+    int64_t ob_memory;
+    int64_t obc_memory;
+    int64_t ob_time_used;
+    int64_t obc_time_used;
+    int64_t ob_found;
+    int64_t obc_found;
+    int ch;
+    int result;
+
+    while ((ch=getopt(argc, argv, "hn:l:o:b:")) != -1) {
+        switch (ch) {
+            case 'n':
+                slice_count = strtoll(optarg, NULL, 10);
+                break;
+            case 'l':
+                lookup_count = strtoll(optarg, NULL, 10);
+                break;
+            case 'o':
+                object_count = strtol(optarg, NULL, 10);
+                break;
+            case 'b':
+                blocks_per_object = strtol(optarg, NULL, 10);
+                break;
+            case 'h':
+            default:
+                usage(argv);
+                return ch == 'h' ? 0 : EINVAL;
+        }
+    }
+
+    if (slice_count <= 0 || lookup_count <= 0 || object_count <= 0 ||
+            blocks_per_object <= 0)
+    {
+        usage(argv);
+        return EINVAL;
+    }
+
+    log_init();
+    srand(time(NULL));
+    if ((slices=gen_slices()) == NULL) {
+        return ENOMEM;
+    }
+    if ((keys=gen_lookup_keys()) == NULL) {
+        return ENOMEM;
+    }
+
+    STORAGE_CFG.object_block.shared_locks_count = 163;
+    STORAGE_CFG.object_block.hashtable_capacity =
+        (int64_t)object_count * blocks_per_object;
+
+    rss = get_rss_bytes();
+    if ((result=ob_index_init()) != 0) {
+        return result;
+    }
+    g_ob_hashtable.modify_sallocator = false;
+    g_ob_hashtable.modify_used_space = false;
+    if ((result=load_ob_index(slices)) != 0) {
+        return result;
+    }
+    ob_memory = get_rss_bytes() - rss;
+
+    rss = get_rss_bytes();
+    if ((result=obc_index_init(&obc_index, STORAGE_CFG.object_block.
+                    shared_locks_count, STORAGE_CFG.object_block.
+                    hashtable_capacity)) != 0)
+    {
+        return result;
+    }
+    if ((result=load_obc_index(&obc_index, slices)) != 0) {
+        return result;
+    }
+    obc_memory = get_rss_bytes() - rss;
+    free(slices);
+
+    ob_time_used = lookup_ob_index(keys, &ob_found);
+    obc_time_used = lookup_obc_index(&obc_index, keys, &obc_found);
+    free(keys);
+
+    if (ob_found != obc_found) {
+        fprintf(stderr, "the found slice count of the skiplist index: "
+                "%"PRId64" != the compact index: %"PRId64"\n",
+                ob_found, obc_found);
+        return EINVAL;
+    }
+
+    obc_index_get_stat(&obc_index, &stat);
+    printf("added slices: %"PRId64", live slices: %"PRId64", "
+            "blocks: %"PRId64", lookups: %"PRId64", found slices: "
+            "%"PRId64"\n", slice_count, stat.slice_count,
+            stat.block_count, lookup_count, obc_found);
+    output("skiplist index", ob_memory, stat.slice_count, ob_time_used);
+    output("compact index ", obc_memory, stat.slice_count, obc_time_used);
+    printf("compact index calculated memory: %"PRId64" KB, "
+            "bytes per slice: %.2f\n", stat.memory_bytes / 1024,
+            (double)stat.memory_bytes / (stat.slice_count > 0 ?
+                stat.slice_count : 1));
+
+    obc_index_destroy(&obc_index);
+    return 0;
+}
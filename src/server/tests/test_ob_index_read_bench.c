@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//the scaling of the object block index readers with and without the lock
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "fastcommon/logger.h"
+#include "fastcommon/shared_func.h"
+#include "../../common/fs_func.h"
+#include "../server_global.h"
+#include "../storage/object_block_index.h"
+
+#define SLICE_LENGTH   (64 * 1024)
+#define SLICES_PER_BLOCK  (FS_FILE_BLOCK_SIZE / SLICE_LENGTH)
+
+typedef struct {
+    pthread_t tid;
+    unsigned int seed;
+    int64_t count;
+} BenchThread;
+
+static FSStorePath store_path;
+static int block_count = 16;
+static int max_threads = 64;
+static int seconds = 2;
+static bool with_writer = false;
+static volatile bool continue_flag;
+
+static void usage(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [-b hot block count=%d] "
+            "[-t max reader threads=%d] [-s seconds per round=%d] "
+            "[-w (with a writer thread)]\n", argv[0],
+            block_count, max_threads, seconds);
+}
+
+static void gen_block_key(FSBlockKey *bkey, unsigned int *seed)
+{
+    bkey->oid = 1 + rand_r(seed) % block_count;
+    bkey->offset = 0;
+    fs_calc_block_hashcode(bkey);
+}
+
+static int add_slice(const FSBlockKey *bkey, const int offset,
+        const int length, const int64_t space_offset)
+{
+    OBSliceEntry *slice;
+    int inc_alloc;
+
+    slice = ob_index_alloc_slice_ex(&g_ob_hashtable, bkey, 0);
+    if (slice == NULL) {
+        return ENOMEM;
+    }
+
+    slice->type = OB_SLICE_TYPE_FILE;
+    slice->read_offset = 0;
+    slice->ssize.offset = offset;
+    slice->ssize.length = length;
+    slice->space.store = &store_path;
+    slice->space.id_info.id = 1;
+    slice->space.id_info.subdir = 1;
+    slice->space.offset = space_offset;
+    slice->space.size = length;
+    return ob_index_add_slice_ex(&g_ob_hashtable, slice, NULL, &inc_alloc);
+}
+
+static int load_blocks()
+{
+    FSBlockKey bkey;
+    int64_t space_offset;
+    int i;
+    int k;
+    int result;
+
+    space_offset = 0;
+    for (i=1; i<=block_count; i++) {
+        bkey.oid = i;
+        bkey.offset = 0;
+        fs_calc_block_hashcode(&bkey);
+        for (k=0; k<SLICES_PER_BLOCK; k++) {
+            if ((result=add_slice(&bkey, k * SLICE_LENGTH,
+                            SLICE_LENGTH, space_offset)) != 0)
+            {
+                return result;
+            }
+            space_offset += SLICE_LENGTH;
+        }
+    }
+
+    return 0;
+}
+
+static void *reader_thread(void *arg)
+{
+    BenchThread *thread;
+    FSBlockSliceKeyInfo bs_key;
+    OBSlicePtrArray sarray;
+    OBSliceEntry **pp;
+    OBSliceEntry **end;
+
+    thread = (BenchThread *)arg;
+    ob_index_init_slice_ptr_array(&sarray);
+    while (continue_flag) {
+        gen_block_key(&bs_key.block, &thread->seed);
+        bs_key.slice.offset = (rand_r(&thread->seed) % SLICES_PER_BLOCK) *
+            SLICE_LENGTH + SLICE_LENGTH / 2;
+        bs_key.slice.length = SLICE_LENGTH;
+        if (bs_key.slice.offset + bs_key.slice.length > FS_FILE_BLOCK_SIZE) {
+            bs_key.slice.offset -= SLICE_LENGTH;
+        }
+
+        if (ob_index_get_slices(&bs_key, &sarray) == 0) {
+            end = sarray.slices + sarray.count;
+            for (pp=sarray.slices; pp<end; pp++) {
+                ob_index_free_slice(*pp);
+            }
+        }
+        thread->count++;
+    }
+
+    ob_index_free_slice_ptr_array(&sarray);
+    return NULL;
+}
+
+static void *writer_thread(void *arg)
+{
+    BenchThread *thread;
+    FSBlockKey bkey;
+    int64_t space_offset;
+
+    thread = (BenchThread *)arg;
+    space_offset = 0;
+    while (continue_flag) {
+        gen_block_key(&bkey, &thread->seed);
+        if (add_slice(&bkey, (rand_r(&thread->seed) % SLICES_PER_BLOCK) *
+                    SLICE_LENGTH, SLICE_LENGTH, space_offset) != 0)
+        {
+            break;
+        }
+        space_offset += SLICE_LENGTH;
+        thread->count++;
+        usleep(100);
+    }
+
+    return NULL;
+}
+
+static int run_round(const int thread_count, int64_t *qps)
+{
+    BenchThread *threads;
+    BenchThread writer;
+    int64_t total;
+    int i;
+    int result;
+
+    threads = (BenchThread *)fc_malloc(sizeof(BenchThread) * thread_count);
+    if (threads == NULL) {
+        return ENOMEM;
+    }
+
+    continue_flag = true;
+    memset(&writer, 0, sizeof(writer));
+    if (with_writer) {
+        writer.seed = rand();
+        if ((result=pthread_create(&writer.tid, NULL,
+                        writer_thread, &writer)) != 0)
+        {
+            free(threads);
+            return result;
+        }
+    }
+
+    for (i=0; i<thread_count; i++) {
+        threads[i].seed = rand();
+        threads[i].count = 0;
+        if ((result=pthread_create(&threads[i].tid, NULL,
+                        reader_thread, threads + i)) != 0)
+        {
+            logError("file: "__FILE__", line: %d, "
+                    "create thread fail, errno: %d, error info: %s",
+                    __LINE__, result, STRERROR(result));
+            continue_flag = false;
+            while (--i >= 0) {
+                pthread_join(threads[i].tid, NULL);
+            }
+            if (with_writer) {
+                pthread_join(writer.tid, NULL);
+            }
+            free(threads);
+            return result;
+        }
+    }
+
+    sleep(seconds);
+    continue_flag = false;
+
+    total = 0;
+    for (i=0; i<thread_count; i++) {
+        pthread_join(threads[i].tid, NULL);
+        total += threads[i].count;
+    }
+    if (with_writer) {
+        pthread_join(writer.tid, NULL);
+    }
+
+    *qps = total / seconds;
+    free(threads);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int64_t locked_qps;
+    int64_t lockfree_qps;
+    int thread_count;
+    int ch;
+    int result;
+
+    while ((ch=getopt(argc, argv, "hb:t:s:w")) != -1) {
+        switch (ch) {
+            case 'b':
+                block_count = strtol(optarg, NULL, 10);
+                break;
+            case 't':
+                max_threads = strtol(optarg, NULL, 10);
+                break;
+            case 's':
+                seconds = strtol(optarg, NULL, 10);
+                break;
+            case 'w':
+                with_writer = true;
+                break;
+            case 'h':
+            default:
+                usage(argv);
+                return ch == 'h' ? 0 : EINVAL;
+        }
+    }
+
+    if (block_count <= 0 || max_threads <= 0 || seconds <= 0) {
+        usage(argv);
+        return EINVAL;
+    }
+
+    log_init();
+    srand(time(NULL));
+    STORAGE_CFG.object_block.shared_locks_count = 163;
+    STORAGE_CFG.object_block.hashtable_capacity = 1403641;
+    STORAGE_CFG.object_block.lockfree_read = true;
+    if ((result=ob_index_init()) != 0) {
+        return result;
+    }
+    g_ob_hashtable.modify_sallocator = false;
+    g_ob_hashtable.modify_used_space = false;
+    if ((result=load_blocks()) != 0) {
+        return result;
+    }
+
+    printf("hot blocks: %d, slices per block: %d, seconds per round: %d, "
+            "with writer: %d\n", block_count, SLICES_PER_BLOCK,
+            seconds, with_writer);
+    printf("%8s %16s %16s %10s\n", "threads", "locked ops/s",
+            "lockfree ops/s", "speed up");
+    for (thread_count=1; thread_count<=max_threads; thread_count*=2) {
+        g_ob_hashtable.lockfree_read = false;
+        if ((result=run_round(thread_count, &locked_qps)) != 0) {
+            return result;
+        }
+
+        g_ob_hashtable.lockfree_read = true;
+        if ((result=run_round(thread_count, &lockfree_qps)) != 0) {
+            return result;
+        }
+
+        printf("%8d %16"PRId64" %16"PRId64" %9.2fx\n", thread_count,
+                locked_qps, lockfree_qps, (double)lockfree_qps /
+                (locked_qps > 0 ? locked_qps : 1));
+    }
+
+    return 0;
+}
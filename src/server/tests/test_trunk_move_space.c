@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//check the trunk space of the move dest slices when the source replaced
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "fastcommon/logger.h"
+#include "fastcommon/shared_func.h"
+#include "../../common/fs_func.h"
+#include "../server_global.h"
+#include "../storage/storage_allocator.h"
+#include "../storage/object_block_index.h"
+#include "../storage/trunk_migrate.h"
+
+#define TRUNK_FILE_SIZE  (64 * 1024 * 1024)
+#define SLICE_LENGTH     (16 * 1024)
+#define SLICE_COUNT      8
+
+static FSStoragePathInfo path_info;
+static FSTrunkAllocator allocator;
+static FSTrunkAllocator *allocators[1];
+static FSTrunkFileInfo *trunk_info;
+
+static int init_allocator()
+{
+    FSTrunkIdInfo id_info;
+    int result;
+
+    path_info.store.index = 0;
+    path_info.write_thread_count = 1;
+    STORAGE_CFG.store_path.count = 1;
+    if ((result=trunk_allocator_init(&allocator, &path_info)) != 0) {
+        return result;
+    }
+
+    allocators[0] = &allocator;
+    g_allocator_mgr->allocator_ptr_array.allocators = allocators;
+    g_allocator_mgr->allocator_ptr_array.count = 1;
+    g_allocator_mgr->store_path.avail.allocators = allocators;
+    g_allocator_mgr->store_path.avail.count = 1;
+    g_allocator_mgr->current = &g_allocator_mgr->store_path;
+
+    id_info.id = 1;
+    id_info.subdir = 1;
+    if ((result=trunk_allocator_add(&allocator, &id_info,
+                    TRUNK_FILE_SIZE, &trunk_info)) != 0)
+    {
+        return result;
+    }
+    trunk_allocator_add_to_freelist(&allocator,
+            &allocator.freelists[0].normal, trunk_info);
+    path_info.trunk_stat.total = TRUNK_FILE_SIZE;
+    path_info.trunk_stat.avail = TRUNK_FILE_SIZE;
+    return 0;
+}
+
+static OBSliceEntry *alloc_slice(const FSBlockKey *bkey,
+        const int offset, const int init_refer)
+{
+    FSTrunkSpaceInfo spaces[FS_MAX_SPLIT_COUNT_PER_SPACE_ALLOC];
+    OBSliceEntry *slice;
+    int count;
+
+    if (storage_allocator_normal_alloc(FS_BLOCK_HASH_CODE(*bkey),
+                SLICE_LENGTH, spaces, &count) != 0 || count != 1)
+    {
+        return NULL;
+    }
+    if ((slice=ob_index_alloc_slice_ex(&g_ob_hashtable,
+                    bkey, init_refer)) == NULL)
+    {
+        return NULL;
+    }
+
+    slice->type = OB_SLICE_TYPE_FILE;
+    slice->read_offset = 0;
+    slice->space = spaces[0];
+    slice->ssize.offset = offset;
+    slice->ssize.length = SLICE_LENGTH;
+    return slice;
+}
+
+static int write_slice(const FSBlockKey *bkey, const int offset)
+{
+    OBSliceEntry *slice;
+    int inc_alloc;
+
+    if ((slice=alloc_slice(bkey, offset, 0)) == NULL) {
+        return ENOMEM;
+    }
+    return ob_index_add_slice(slice, NULL, &inc_alloc);
+}
+
+static int check_space(const char *caption, const int64_t avail,
+        const int64_t used, const int64_t free_start)
+{
+    if (path_info.trunk_stat.avail == avail &&
+            path_info.trunk_stat.used == used &&
+            trunk_info->free_start == free_start)
+    {
+        printf("%s: avail: %"PRId64", used: %"PRId64", "
+                "free start: %"PRId64"\n", caption, avail,
+                used, free_start);
+        return 0;
+    }
+
+    fprintf(stderr, "%s: expect avail: %"PRId64", used: %"PRId64", "
+            "free start: %"PRId64", but avail: %"PRId64", used: %"PRId64
+            ", free start: %"PRId64"\n", caption, avail, used, free_start,
+            path_info.trunk_stat.avail, path_info.trunk_stat.used,
+            trunk_info->free_start);
+    return EINVAL;
+}
+
+int main(int argc, char *argv[])
+{
+    FSBlockKey bkey;
+    OBSlicePtrArray sarray;
+    OBSliceEntry *src;
+    OBSliceEntry *dests[1];
+    uint64_t sns[1];
+    int64_t version;
+    int64_t avail;
+    int64_t used;
+    int64_t free_start;
+    int result;
+    int i;
+
+    log_init();
+    STORAGE_CFG.object_block.shared_locks_count = 17;
+    STORAGE_CFG.object_block.hashtable_capacity = 1361;
+    if ((result=init_allocator()) != 0) {
+        return result;
+    }
+    if ((result=ob_index_init()) != 0) {
+        return result;
+    }
+    ob_index_enable_modify_used_space();
+
+    bkey.oid = 1;
+    bkey.offset = 0;
+    fs_calc_block_hashcode(&bkey);
+    for (i=0; i<SLICE_COUNT; i++) {
+        if ((result=write_slice(&bkey, i * SLICE_LENGTH)) != 0) {
+            return result;
+        }
+    }
+
+    //the source slice to move, hold the reference until the replacing
+    ob_index_init_slice_ptr_array(&sarray);
+    if ((result=ob_index_get_block_slices(&bkey, &sarray, &version)) != 0) {
+        return result;
+    }
+    src = sarray.slices[0];
+
+    //the client overwrites the source slice during the moving
+    if ((result=write_slice(&bkey, 0)) != 0) {
+        return result;
+    }
+
+    avail = path_info.trunk_stat.avail;
+    used = path_info.trunk_stat.used;
+    free_start = trunk_info->free_start;
+    if ((dests[0]=alloc_slice(&bkey, src->ssize.offset, 1)) == NULL) {
+        return ENOMEM;
+    }
+
+    result = trunk_move_replace_slice(src, dests, 1, sns);
+    ob_index_free_slice(dests[0]);
+    for (i=0; i<sarray.count; i++) {
+        ob_index_free_slice(sarray.slices[i]);
+    }
+    ob_index_free_slice_ptr_array(&sarray);
+    if (result != ENOENT) {
+        fprintf(stderr, "replace the overwritten source, "
+                "expect result: %d, but %d\n", ENOENT, result);
+        return EINVAL;
+    }
+
+    return check_space("source replaced", avail, used, free_start);
+}
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//compare the loading speed of the text and binary slice binlog
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "fastcommon/logger.h"
+#include "fastcommon/shared_func.h"
+#include "binlog/slice_binlog_bin.h"
+
+#define TEXT_READ_BUFFER_SIZE  (1024 * 1024)
+
+typedef struct {
+    int64_t record_count;
+    int64_t file_size;
+    int64_t time_used_ms;
+    int64_t checksum;  //avoid the parsing optimized away
+} BenchResult;
+
+static void usage(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [-r rounds=3] <text slice binlog filename>\n"
+            "\tthe binary file <filename>%s should be generated by "
+            "fs_slice_binlog_convert\n", argv[0], SLICE_BIN_FILENAME_SUFFIX);
+}
+
+static inline void sum_record(BenchResult *result,
+        const SliceBinlogRecord *record)
+{
+    result->checksum += record->block.oid + record->block.offset +
+        record->slice.offset + record->space.offset;
+}
+
+static int bench_text(const char *filename, BenchResult *bench)
+{
+    SliceBinlogRecord record;
+    string_t line;
+    char *buff;
+    char *line_start;
+    char *line_end;
+    char *buff_end;
+    char error_info[256];
+    int fd;
+    int remain;
+    int read_bytes;
+    int result;
+    int64_t start_time;
+
+    if ((buff=(char *)fc_malloc(TEXT_READ_BUFFER_SIZE)) == NULL) {
+        return ENOMEM;
+    }
+    if ((fd=open(filename, O_RDONLY)) < 0) {
+        result = errno != 0 ? errno : EACCES;
+        logError("file: "__FILE__", line: %d, "
+                "open file \"%s\" fail, "
+                "errno: %d, error info: %s",
+                __LINE__, filename, result, STRERROR(result));
+        free(buff);
+        return result;
+    }
+
+    start_time = get_current_time_ms();
+    result = 0;
+    remain = 0;
+    while ((read_bytes=read(fd, buff + remain,
+                    TEXT_READ_BUFFER_SIZE - remain)) > 0)
+    {
+        bench->file_size += read_bytes;
+        line_start = buff;
+        buff_end = buff + remain + read_bytes;
+        while ((line_end=(char *)memchr(line_start, '\n',
+                        buff_end - line_start)) != NULL)
+        {
+            line.str = line_start;
+            line.len = line_end - line_start;
+            if ((result=slice_bin_parse_text_line(&line,
+                            &record, error_info)) != 0)
+            {
+                logError("file: "__FILE__", line: %d, "
+                        "binlog file: %s, %s", __LINE__,
+                        filename, error_info);
+                break;
+            }
+
+            sum_record(bench, &record);
+            bench->record_count++;
+            line_start = line_end + 1;
+        }
+        if (result != 0) {
+            break;
+        }
+
+        remain = buff_end - line_start;
+        if (remain > 0) {
+            memmove(buff, line_start, remain);
+        }
+    }
+    bench->time_used_ms += get_current_time_ms() - start_time;
+
+    close(fd);
+    free(buff);
+    return result;
+}
+
+static int bench_binary(const char *filename, BenchResult *bench)
+{
+    SliceBinReader reader;
+    SliceBinRecord *records;
+    SliceBinRecord *bin;
+    SliceBinRecord *end;
+    SliceBinlogRecord record;
+    int64_t start_time;
+    int count;
+    int result;
+
+    start_time = get_current_time_ms();
+    if ((result=slice_bin_reader_open(&reader, filename)) != 0) {
+        return result;
+    }
+
+    while ((result=slice_bin_reader_next(&reader,
+                    &records, &count)) == 0)
+    {
+        end = records + count;
+        for (bin=records; bin<end; bin++) {
+            slice_bin_unpack_record(bin, &record);
+            sum_record(bench, &record);
+        }
+        bench->record_count += count;
+    }
+    bench->file_size += reader.offset;
+    bench->time_used_ms += get_current_time_ms() - start_time;
+    slice_bin_reader_close(&reader);
+
+    return result == ENOENT ? 0 : result;
+}
+
+static void output(const char *caption, const BenchResult *bench)
+{
+    int64_t time_used_ms;
+    int64_t record_count;
+
+    time_used_ms = bench->time_used_ms > 0 ? bench->time_used_ms : 1;
+    record_count = bench->record_count > 0 ? bench->record_count : 1;
+    printf("%s: record count: %"PRId64", time used: %"PRId64" ms, "
+            "records per second: %"PRId64", bytes per record: %.2f, "
+            "speed: %.2f MB/s\n", caption, bench->record_count,
+            bench->time_used_ms, bench->record_count * 1000 / time_used_ms,
+            (double)bench->file_size / record_count,
+            (double)bench->file_size * 1000 / time_used_ms /
+            (1024 * 1024));
+}
+
+int main(int argc, char *argv[])
+{
+    const char *filename;
+    char bin_filename[PATH_MAX];
+    BenchResult text;
+    BenchResult binary;
+    char *endptr;
+    int rounds;
+    int ch;
+    int i;
+    int result;
+
+    rounds = 3;
+    while ((ch=getopt(argc, argv, "hr:")) != -1) {
+        switch (ch) {
+            case 'h':
+                usage(argv);
+                return 0;
+            case 'r':
+                rounds = strtol(optarg, &endptr, 10);
+                break;
+            default:
+                usage(argv);
+                return EINVAL;
+        }
+    }
+
+    if (optind >= argc || rounds <= 0) {
+        usage(argv);
+        return EINVAL;
+    }
+
+    log_init();
+    filename = argv[optind];
+    snprintf(bin_filename, sizeof(bin_filename), "%s%s",
+            filename, SLICE_BIN_FILENAME_SUFFIX);
+
+    memset(&text, 0, sizeof(text));
+    memset(&binary, 0, sizeof(binary));
+    for (i=0; i<rounds; i++) {
+        if ((result=bench_text(filename, &text)) != 0) {
+            return result;
+        }
+        if ((result=bench_binary(bin_filename, &binary)) != 0) {
+            return result;
+        }
+    }
+
+    if (text.checksum != binary.checksum ||
+            text.record_count != binary.record_count)
+    {
+        fprintf(stderr, "the records of %s and %s are NOT the same!\n",
+                filename, bin_filename);
+        return EINVAL;
+    }
+
+    printf("rounds: %d\n", rounds);
+    output("text  ", &text);
+    output("binary", &binary);
+    printf("speed up: %.2fx\n", (double)(text.time_used_ms > 0 ?
+                text.time_used_ms : 1) / (binary.time_used_ms > 0 ?
+                    binary.time_used_ms : 1));
+    return 0;
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2020 YuQing <384681@qq.com>
+ *
+ * This program is free software: you can use, redistribute, and/or modify
+ * it under the terms of the GNU Affero General Public License, version 3
+ * or later ("AGPL"), as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "fastcommon/logger.h"
+#include "fastcommon/shared_func.h"
+#include "binlog/slice_binlog_bin.h"
+
+#define TEXT_READ_BUFFER_SIZE  (1024 * 1024)
+
+static void usage(char *argv[])
+{
+    fprintf(stderr, "Usage: %s <slice binlog filename> "
+            "[slice binlog filename ...]\n"
+            "\tconvert the text slice binlog files to the binary files "
+            "named with suffix %s\n"
+            "\tthe binlog files should be converted when the server "
+            "stopped or the files are NOT the current write file\n",
+            argv[0], SLICE_BIN_FILENAME_SUFFIX);
+}
+
+static bool is_ends_with(const char *filename, const char *suffix)
+{
+    int len;
+    int suffix_len;
+
+    len = strlen(filename);
+    suffix_len = strlen(suffix);
+    return (len >= suffix_len && strcmp(filename +
+                len - suffix_len, suffix) == 0);
+}
+
+static int convert_buffer(SliceBinWriter *writer, const char *filename,
+        char *buff, const int length, int64_t *line_count, int *remain)
+{
+    SliceBinlogRecord record;
+    string_t line;
+    char *line_start;
+    char *line_end;
+    char *buff_end;
+    char error_info[256];
+    int result;
+
+    line_start = buff;
+    buff_end = buff + length;
+    while (line_start < buff_end) {
+        line_end = (char *)memchr(line_start, '\n', buff_end - line_start);
+        if (line_end == NULL) {
+            break;
+        }
+
+        ++(*line_count);
+        line.str = line_start;
+        line.len = line_end - line_start;
+        if ((result=slice_bin_parse_text_line(&line,
+                        &record, error_info)) != 0)
+        {
+            logError("file: "__FILE__", line: %d, "
+                    "binlog file: %s, line no: %"PRId64", %s",
+                    __LINE__, filename, *line_count, error_info);
+            return result;
+        }
+
+        if ((result=slice_bin_writer_add(writer, &record)) != 0) {
+            return result;
+        }
+        line_start = line_end + 1;
+    }
+
+    *remain = buff_end - line_start;
+    if (*remain > 0) {
+        memmove(buff, line_start, *remain);
+    }
+    return 0;
+}
+
+static int convert_file(const char *filename, char *buff)
+{
+    SliceBinWriter writer;
+    char bin_filename[PATH_MAX];
+    int64_t source_size;
+    int64_t line_count;
+    int64_t start_time;
+    int fd;
+    int remain;
+    int read_bytes;
+    int result;
+
+    start_time = get_current_time_ms();
+    if ((fd=open(filename, O_RDONLY)) < 0) {
+        result = errno != 0 ? errno : EACCES;
+        logError("file: "__FILE__", line: %d, "
+                "open file \"%s\" fail, "
+                "errno: %d, error info: %s",
+                __LINE__, filename, result, STRERROR(result));
+        return result;
+    }
+
+    snprintf(bin_filename, sizeof(bin_filename), "%s%s",
+            filename, SLICE_BIN_FILENAME_SUFFIX);
+    if ((result=slice_bin_writer_open(&writer, bin_filename)) != 0) {
+        close(fd);
+        return result;
+    }
+
+    source_size = 0;
+    line_count = 0;
+    remain = 0;
+    while (1) {
+        read_bytes = read(fd, buff + remain,
+                TEXT_READ_BUFFER_SIZE - remain);
+        if (read_bytes < 0) {
+            result = errno != 0 ? errno : EIO;
+            logError("file: "__FILE__", line: %d, "
+                    "read file \"%s\" fail, "
+                    "errno: %d, error info: %s",
+                    __LINE__, filename, result, STRERROR(result));
+            break;
+        } else if (read_bytes == 0) {
+            if (remain > 0) {
+                logError("file: "__FILE__", line: %d, "
+                        "binlog file: %s, the last line is incomplete, "
+                        "remain bytes: %d", __LINE__, filename, remain);
+                result = EINVAL;
+            }
+            break;
+        }
+
+        source_size += read_bytes;
+        if ((result=convert_buffer(&writer, filename, buff,
+                        remain + read_bytes, &line_count, &remain)) != 0)
+        {
+            break;
+        }
+
+        if (remain == TEXT_READ_BUFFER_SIZE) {
+            logError("file: "__FILE__", line: %d, "
+                    "binlog file: %s, line no: %"PRId64", "
+                    "line too long", __LINE__, filename, line_count + 1);
+            result = EINVAL;
+            break;
+        }
+    }
+    close(fd);
+
+    if (result != 0) {
+        slice_bin_writer_abort(&writer);
+        return result;
+    }
+
+    if ((result=slice_bin_writer_close(&writer, source_size)) != 0) {
+        return result;
+    }
+
+    printf("%s => %s, record count: %"PRId64", text size: %"PRId64", "
+            "binary size: %"PRId64", time used: %"PRId64" ms\n",
+            filename, bin_filename, line_count, source_size,
+            writer.file_size, get_current_time_ms() - start_time);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char *buff;
+    int result;
+    int i;
+
+    if (argc < 2) {
+        usage(argv);
+        return EINVAL;
+    }
+
+    log_init();
+    buff = (char *)fc_malloc(TEXT_READ_BUFFER_SIZE);
+    if (buff == NULL) {
+        return ENOMEM;
+    }
+
+    result = 0;
+    for (i=1; i<argc; i++) {
+        if (is_ends_with(argv[i], SLICE_BIN_FILENAME_SUFFIX) ||
+                is_ends_with(argv[i], ".tmp"))
+        {
+            continue;
+        }
+
+        if ((result=convert_file(argv[i], buff)) != 0) {
+            break;
+        }
+    }
+
+    free(buff);
+    return result;
+}